@@ -0,0 +1,3497 @@
+﻿// AsciiBench.cpp : Command line benchmarks for the conversion core.
+// Runs headless on any platform, no capture or window required.
+
+#include "AsciiCellDiff.h"
+#include "AsciiCore.h"
+#include "AsciiDelta.h"
+#include "AsciiGlyphs.h"
+#include "AsciiImageIO.h"
+#include "AsciiIntegral.h"
+#include "AsciiKernels.h"
+#include "AsciiMetrics.h"
+#include "AsciiPipeline.h"
+#include "AsciiPyramid.h"
+#include "AsciiQuantizer.h"
+#include "AsciiRecording.h"
+#include "AsciiRegions.h"
+#include "AsciiRender.h"
+#include "AsciiTerminal.h"
+#include "AsciiRuns.h"
+#include "AsciiScheduler.h"
+#include "AsciiServer.h"
+#include "AsciiStabilizer.h"
+#include "AsciiThreadPool.h"
+#include "AsciiTileCache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+//----------------------------------------------------------------
+// Allocation counter. Every operator new of this program goes through
+// here, so the alloc mode can prove that a warmed up frame allocates
+// nothing.
+//----------------------------------------------------------------
+static std::atomic<uint64_t> g_allocations{ 0 };
+
+static void* CountedAlloc(size_t size, size_t alignment)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (size == 0)
+        size = 1;
+#ifdef _MSC_VER
+    void* p = _aligned_malloc(size, alignment);
+#else
+    void* p = nullptr;
+    if (posix_memalign(&p, alignment < sizeof(void*) ? sizeof(void*) : alignment, size) != 0)
+        p = nullptr;
+#endif
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+// For the nothrow forms, which the standard library uses too (e.g. the
+// buffer of std::stable_sort) and whose memory reaches CountedFree
+static void* CountedAllocNoThrow(size_t size, size_t alignment) noexcept
+{
+    try
+    {
+        return CountedAlloc(size, alignment);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return nullptr;
+    }
+}
+
+static void CountedFree(void* p)
+{
+#ifdef _MSC_VER
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+void* operator new(size_t size) { return CountedAlloc(size, alignof(std::max_align_t)); }
+void* operator new[](size_t size) { return CountedAlloc(size, alignof(std::max_align_t)); }
+void* operator new(size_t size, std::align_val_t alignment) { return CountedAlloc(size, static_cast<size_t>(alignment)); }
+void* operator new[](size_t size, std::align_val_t alignment) { return CountedAlloc(size, static_cast<size_t>(alignment)); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return CountedAllocNoThrow(size, alignof(std::max_align_t)); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return CountedAllocNoThrow(size, alignof(std::max_align_t)); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return CountedAllocNoThrow(size, static_cast<size_t>(alignment)); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return CountedAllocNoThrow(size, static_cast<size_t>(alignment)); }
+void operator delete(void* p) noexcept { CountedFree(p); }
+void operator delete[](void* p) noexcept { CountedFree(p); }
+void operator delete(void* p, size_t) noexcept { CountedFree(p); }
+void operator delete[](void* p, size_t) noexcept { CountedFree(p); }
+void operator delete(void* p, std::align_val_t) noexcept { CountedFree(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { CountedFree(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { CountedFree(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { CountedFree(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { CountedFree(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { CountedFree(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { CountedFree(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { CountedFree(p); }
+
+static uint64_t GetAllocationCount()
+{
+    return g_allocations.load(std::memory_order_relaxed);
+}
+
+struct BenchOptions
+{
+    int width = 3840;
+    int height = 2160;
+    int frames = 60;
+    int maxThreads = 0; // 0 = hardware threads
+    double changedPercent = 2.0; // Share of blocks touched per frame in incremental mode
+    AsciiKernel kernel = AsciiKernel::Auto;
+    AsciiGlyphMode glyphMode = AsciiGlyphMode::Intensity;
+    const char* output = nullptr; // Rendered frames in render mode, .ppm or .y4m; "-" shows terminal mode;
+                                  // the recording in record mode, kept
+    AsciiColorMode colorMode = AsciiColorMode::TrueColor;
+    bool quick = false;              // Suite: small matrix for ctest
+    const char* baseline = nullptr;  // Suite: ns/cell per case to compare against
+    double tolerance = 25.0;         // Suite: allowed slowdown in percent
+    bool updateBaseline = false;     // Suite: rewrite the baseline instead of comparing
+};
+
+static bool ParseKernel(const char* name, AsciiKernel& kernel)
+{
+    const AsciiKernel kernels[] = { AsciiKernel::Auto, AsciiKernel::Scalar, AsciiKernel::SSE41, AsciiKernel::AVX2 };
+    for (AsciiKernel k : kernels)
+    {
+        if (!strcmp(name, GetAsciiKernelName(k)))
+        {
+            kernel = k;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool ParseGlyphMode(const char* name, AsciiGlyphMode& mode)
+{
+    if (!strcmp(name, "intensity"))
+        mode = AsciiGlyphMode::Intensity;
+    else if (!strcmp(name, "shape"))
+        mode = AsciiGlyphMode::Shape;
+    else if (!strcmp(name, "edge"))
+        mode = AsciiGlyphMode::Edge;
+    else
+        return false;
+    return true;
+}
+
+static bool ParseColorMode(const char* name, AsciiColorMode& mode)
+{
+    const AsciiColorMode modes[] = { AsciiColorMode::TrueColor, AsciiColorMode::Xterm256,
+        AsciiColorMode::Ansi16, AsciiColorMode::Adaptive };
+    for (AsciiColorMode m : modes)
+    {
+        if (!strcmp(name, GetAsciiColorModeName(m)))
+        {
+            mode = m;
+            return true;
+        }
+    }
+    return false;
+}
+
+static const char* GetGlyphModeName(AsciiGlyphMode mode)
+{
+    return mode == AsciiGlyphMode::Shape ? "shape" : (mode == AsciiGlyphMode::Edge ? "edge" : "intensity");
+}
+
+//----------------------------------------------------------------
+// Synthetic BGRA frame: checkerboard with color gradients, the same
+// pattern GetTestImageData draws
+//----------------------------------------------------------------
+static void GenerateTestFrame(std::vector<uint8_t>& frame, int width, int height)
+{
+    frame.resize(static_cast<size_t>(width) * height * 4);
+    for (int y = 0; y < height; ++y)
+    {
+        uint8_t* pixel = frame.data() + static_cast<size_t>(y) * width * 4;
+        for (int x = 0; x < width; ++x, pixel += 4)
+        {
+            bool blackWhite = ((x / 20) % 2) ^ ((y / 20) % 2); // small squares
+            pixel[0] = static_cast<uint8_t>(y % 255);           // B
+            pixel[1] = static_cast<uint8_t>(x % 255);           // G
+            pixel[2] = blackWhite ? 200 : 50;                   // R
+            pixel[3] = 255;
+        }
+    }
+}
+
+static double NowSeconds()
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+//----------------------------------------------------------------
+// Kernels: random frames at odd sizes and strides, converted by every
+// supported kernel on the unrolled, the generic and clipped block
+// geometries, must give the scalar kernel's cells field for field
+//----------------------------------------------------------------
+static int RunKernels(const BenchOptions&)
+{
+    int failures = 0;
+    const AsciiGlyphMode defaultMode = GetAsciiGlyphMode();
+    const AsciiKernel defaultKernel = GetActiveAsciiKernel();
+
+    struct FrameSize { int width, height, padding; };
+    const FrameSize sizes[] = { { 333, 97, 0 }, { 1001, 257, 12 }, { 67, 41, 4 } };
+    const AsciiGeometry geometries[] = {
+        { 4, 8 }, { 6, 12 }, { 8, 16 }, { 10, 20 },  // Unrolled
+        { 3, 5 }, { 7, 14 }, { 16, 32 }, { 1, 1 },   // Generic
+    };
+    const AsciiKernel kernels[] = { AsciiKernel::SSE41, AsciiKernel::AVX2 };
+    const AsciiGlyphMode modes[] = { AsciiGlyphMode::Intensity, AsciiGlyphMode::Shape };
+
+    uint32_t seed = 1234;
+    std::vector<uint8_t> frame;
+    std::vector<AsciiCell> reference, cells;
+    int compared = 0;
+    for (const FrameSize& size : sizes)
+    {
+        // Random pixels over a smooth background, so the shape matcher
+        // sees structure and the averages are not all mid gray
+        int stride = size.width * 4 + size.padding;
+        frame.resize(static_cast<size_t>(stride) * size.height);
+        for (int y = 0; y < size.height; ++y)
+        {
+            for (int x = 0; x < stride; ++x)
+            {
+                seed = seed * 1664525u + 1013904223u;
+                uint8_t smooth = static_cast<uint8_t>((x * 3 + y * 5) >> 2);
+                frame[static_cast<size_t>(y) * stride + x] = (seed >> 30) ? smooth : static_cast<uint8_t>(seed >> 22);
+            }
+        }
+        AsciiImageView image;
+        image.data = frame.data();
+        image.width = size.width;
+        image.height = size.height;
+        image.stride = stride;
+
+        // The whole frame, then a region starting and ending inside blocks
+        const AsciiRect regions[] = {
+            { 0, 0, size.width, size.height },
+            { 3, 5, size.width - 2, size.height - 7 },
+        };
+        for (AsciiGlyphMode mode : modes)
+        {
+            SetAsciiGlyphMode(mode);
+            for (const AsciiGeometry& geometry : geometries)
+            {
+                for (const AsciiRect& region : regions)
+                {
+                    int cols = 0, rows = 0;
+                    SelectAsciiKernel(AsciiKernel::Scalar);
+                    ConvertRegionToAscii(image, region, geometry, reference, cols, rows);
+                    for (AsciiKernel kernel : kernels)
+                    {
+                        if (!IsAsciiKernelSupported(kernel))
+                            continue;
+                        SelectAsciiKernel(kernel);
+                        ConvertRegionToAscii(image, region, geometry, cells, cols, rows);
+                        size_t mismatch = 0;
+                        while (mismatch < cells.size() && mismatch < reference.size() && cells[mismatch] == reference[mismatch])
+                            ++mismatch;
+                        if (cells.size() != reference.size() || mismatch != reference.size())
+                        {
+                            printf("kernels: %s kernel, %s glyphs, %dx%d frame, %dx%d blocks, region %d,%d-%d,%d differs from "
+                                "the scalar kernel at cell %zu\n", GetAsciiKernelName(kernel), GetGlyphModeName(mode),
+                                size.width, size.height, geometry.blockWidth, geometry.blockHeight,
+                                region.left, region.top, region.right, region.bottom, mismatch);
+                            ++failures;
+                        }
+                        compared += static_cast<int>(cells.size());
+                    }
+                }
+            }
+        }
+    }
+
+    printf("kernels: %d cells compared against the scalar kernel, %d mismatching conversions\n", compared, failures);
+    SelectAsciiKernel(defaultKernel);
+    SetAsciiGlyphMode(defaultMode);
+    return failures ? 1 : 0;
+}
+
+//----------------------------------------------------------------
+// Threads: every thread count must give the single threaded cells,
+// also when the row count does not split evenly and when damage leaves
+// the workers uneven rows to steal; then ConvertRegionToAscii is timed
+// with 1..N threads on the same frame
+//----------------------------------------------------------------
+static int CheckThreadedCells(const BenchOptions& options, const std::vector<uint8_t>& frame)
+{
+    int failures = 0;
+    const int threadCounts[] = { 2, 3, 4, 7 };
+    AsciiGeometry geometry;
+
+    // Full width regions of 1, 2, 3, 5, 7, 13 and all cell rows, the last
+    // row clipped
+    std::vector<AsciiRect> regions;
+    for (int rows : { 1, 2, 3, 5, 7, 13 })
+    {
+        int height = rows * geometry.blockHeight - 5;
+        if (height <= options.height)
+            regions.push_back({ 0, 0, options.width, height });
+    }
+    regions.push_back({ 0, 0, options.width, options.height });
+
+    // Damage on an irregular subset of the rows: a few full rows and many
+    // single cells, so some row tasks cost a hundred times more than others
+    std::vector<uint8_t> changed = frame;
+    std::vector<AsciiRect> damage;
+    int cellRows = (options.height + geometry.blockHeight - 1) / geometry.blockHeight;
+    for (int row = 0; row < cellRows; ++row)
+    {
+        int top = row * geometry.blockHeight;
+        int bottom = top + geometry.blockHeight < options.height ? top + geometry.blockHeight : options.height;
+        if (row % 7 == 1)
+            damage.push_back({ 0, top, options.width, bottom });
+        else if (row % 3 == 0)
+            damage.push_back({ (row * 37) % options.width, top, (row * 37) % options.width + 1, top + 1 });
+    }
+    for (const AsciiRect& rect : damage)
+    {
+        for (int y = rect.top; y < rect.bottom; ++y)
+        {
+            uint8_t* pixel = changed.data() + (static_cast<size_t>(y) * options.width + rect.left) * 4;
+            for (int x = rect.left; x < rect.right && x < options.width; ++x, pixel += 4)
+                pixel[0] = static_cast<uint8_t>(~pixel[0]);
+        }
+    }
+
+    std::vector<std::vector<AsciiCell>> reference(regions.size());
+    AsciiCellGrid referenceGrid;
+    std::vector<int> referenceChanged;
+    AsciiRect fullRegion = { 0, 0, options.width, options.height };
+    std::vector<AsciiCell> cells;
+    AsciiCellGrid grid;
+    std::vector<int> changedCells;
+    int cols = 0, rows = 0;
+
+    SetAsciiThreadCount(1);
+    for (size_t r = 0; r < regions.size(); ++r)
+        ConvertRegionToAscii(frame, options.width, options.height, regions[r], geometry, reference[r], cols, rows);
+    ConvertRegionToAscii(frame, options.width, options.height, fullRegion, geometry, damage, referenceGrid, referenceChanged);
+    ConvertRegionToAscii(changed, options.width, options.height, fullRegion, geometry, damage, referenceGrid, referenceChanged);
+    if (referenceChanged.empty())
+    {
+        printf("threads: the damaged frame changed no cells\n");
+        ++failures;
+    }
+
+    for (int threads : threadCounts)
+    {
+        SetAsciiThreadCount(threads);
+        for (size_t r = 0; r < regions.size(); ++r)
+        {
+            ConvertRegionToAscii(frame, options.width, options.height, regions[r], geometry, cells, cols, rows);
+            if (cells != reference[r])
+            {
+                printf("threads: %d threads, %d cell rows differ from one thread\n", threads, rows);
+                ++failures;
+            }
+        }
+
+        grid = AsciiCellGrid();
+        ConvertRegionToAscii(frame, options.width, options.height, fullRegion, geometry, damage, grid, changedCells);
+        ConvertRegionToAscii(changed, options.width, options.height, fullRegion, geometry, damage, grid, changedCells);
+        if (grid.cells != referenceGrid.cells || changedCells != referenceChanged)
+        {
+            printf("threads: %d threads, damage update differs from one thread\n", threads);
+            ++failures;
+        }
+
+        // Straight on the pool: every task exactly once, with the tasks
+        // of the first share slow enough to be stolen
+        AsciiThreadPool pool(threads);
+        const int taskCount = 1000;
+        std::vector<std::atomic<int>> runs(taskCount);
+        std::atomic<uint32_t> sink{ 0 };
+        pool.ParallelFor(taskCount, [&](int task) {
+            uint32_t spin = task < taskCount / threads ? 20000 : 10;
+            uint32_t value = static_cast<uint32_t>(task);
+            for (uint32_t i = 0; i < spin; ++i)
+                value = value * 1664525u + 1013904223u;
+            sink.fetch_add(value, std::memory_order_relaxed);
+            runs[task].fetch_add(1, std::memory_order_relaxed);
+        });
+        for (int task = 0; task < taskCount; ++task)
+        {
+            if (runs[task].load() != 1)
+            {
+                printf("threads: %d threads, pool task %d ran %d times\n", threads, task, runs[task].load());
+                ++failures;
+                break;
+            }
+        }
+    }
+    SetAsciiThreadCount(1);
+
+    printf("threads: cells of %d regions and a damage update match one thread with 2, 3, 4 and 7 threads\n",
+        static_cast<int>(regions.size()));
+    return failures;
+}
+
+static int RunThreadScaling(const BenchOptions& options)
+{
+    std::vector<uint8_t> frame;
+    GenerateTestFrame(frame, options.width, options.height);
+
+    int failures = CheckThreadedCells(options, frame);
+
+    AsciiRect region = { 0, 0, options.width, options.height };
+    AsciiGeometry geometry;
+    std::vector<AsciiCell> asciiOut;
+    int outCols = 0, outRows = 0;
+
+    int maxThreads = options.maxThreads > 0 ? options.maxThreads : static_cast<int>(std::thread::hardware_concurrency());
+    if (maxThreads <= 0)
+        maxThreads = 1;
+
+    printf("thread scaling: %dx%d, %dx%d blocks, %s kernel, %s glyphs, %d frames\n",
+        options.width, options.height, geometry.blockWidth, geometry.blockHeight,
+        GetAsciiKernelName(GetActiveAsciiKernel()), GetGlyphModeName(options.glyphMode), options.frames);
+    printf("%8s %12s %12s %10s\n", "threads", "ms/frame", "frames/s", "speedup");
+
+    double baseline = 0.0;
+    for (int threads = 1; threads <= maxThreads; ++threads)
+    {
+        SetAsciiThreadCount(threads);
+
+        // Warm up caches and the worker pool
+        ConvertRegionToAscii(frame, options.width, options.height, region, geometry, asciiOut, outCols, outRows);
+
+        double start = NowSeconds();
+        for (int i = 0; i < options.frames; ++i)
+            ConvertRegionToAscii(frame, options.width, options.height, region, geometry, asciiOut, outCols, outRows);
+        double perFrame = (NowSeconds() - start) / options.frames;
+
+        if (threads == 1)
+            baseline = perFrame;
+        printf("%8d %12.3f %12.1f %9.2fx\n", threads, perFrame * 1000.0, 1.0 / perFrame, baseline / perFrame);
+    }
+    SetAsciiThreadCount(1);
+    return failures ? 1 : 0;
+}
+
+//----------------------------------------------------------------
+// Formats: the test frame in every pixel format, converted in place,
+// against expanding the 4:2:0 frame to BGRA first
+//----------------------------------------------------------------
+static void MakeFormatFrame(const std::vector<uint8_t>& bgra, int width, int height, AsciiPixelFormat format,
+    std::vector<uint8_t>& out)
+{
+    out.assign(GetAsciiFrameSize(format, width, height), 0);
+    const int chromaWidth = (width + 1) / 2;
+    const size_t pixels = static_cast<size_t>(width) * height;
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            size_t i = static_cast<size_t>(y) * width + x;
+            int b = bgra[i * 4], g = bgra[i * 4 + 1], r = bgra[i * 4 + 2];
+            // BT.601 limited range, like AsciiY4mWriter
+            uint8_t luma = static_cast<uint8_t>((66 * r + 129 * g + 25 * b + 128 + (16 << 8)) >> 8);
+            uint8_t u = static_cast<uint8_t>((-38 * r - 74 * g + 112 * b + 128 + (128 << 8)) >> 8);
+            uint8_t v = static_cast<uint8_t>((112 * r - 94 * g - 18 * b + 128 + (128 << 8)) >> 8);
+            size_t c = static_cast<size_t>(y / 2) * chromaWidth + x / 2;
+            switch (format)
+            {
+            case AsciiPixelFormat::BGRA8:
+                memcpy(&out[i * 4], &bgra[i * 4], 4);
+                break;
+            case AsciiPixelFormat::RGBA8:
+                out[i * 4] = static_cast<uint8_t>(r);
+                out[i * 4 + 1] = static_cast<uint8_t>(g);
+                out[i * 4 + 2] = static_cast<uint8_t>(b);
+                out[i * 4 + 3] = 255;
+                break;
+            case AsciiPixelFormat::RGB8:
+                out[i * 3] = static_cast<uint8_t>(r);
+                out[i * 3 + 1] = static_cast<uint8_t>(g);
+                out[i * 3 + 2] = static_cast<uint8_t>(b);
+                break;
+            case AsciiPixelFormat::Gray8:
+                out[i] = static_cast<uint8_t>((19595 * r + 38470 * g + 7471 * b) >> 16);
+                break;
+            case AsciiPixelFormat::RGB10A2:
+            {
+                uint32_t packed = (r << 2) | (g << 12) | (static_cast<uint32_t>(b) << 22) | (3u << 30);
+                for (int k = 0; k < 4; ++k)
+                    out[i * 4 + k] = static_cast<uint8_t>(packed >> (k * 8));
+                break;
+            }
+            case AsciiPixelFormat::NV12:
+                out[i] = luma;
+                out[pixels + c * 2] = u;
+                out[pixels + c * 2 + 1] = v;
+                break;
+            case AsciiPixelFormat::I420:
+                out[i] = luma;
+                out[pixels + c] = u;
+                out[pixels + static_cast<size_t>(chromaWidth) * ((height + 1) / 2) + c] = v;
+                break;
+            case AsciiPixelFormat::P010:
+                out[i * 2 + 1] = luma;
+                out[pixels * 2 + c * 4 + 1] = u;
+                out[pixels * 2 + c * 4 + 3] = v;
+                break;
+            }
+        }
+    }
+}
+
+// What a front end without native YUV input does: expand to BGRA
+static void ExpandI420(const uint8_t* planes, int width, int height, std::vector<uint8_t>& bgra)
+{
+    const int chromaWidth = (width + 1) / 2;
+    const size_t pixels = static_cast<size_t>(width) * height;
+    const uint8_t* planeU = planes + pixels;
+    const uint8_t* planeV = planeU + static_cast<size_t>(chromaWidth) * ((height + 1) / 2);
+    bgra.resize(pixels * 4);
+    for (int y = 0; y < height; ++y)
+    {
+        const uint8_t* row = planes + static_cast<size_t>(y) * width;
+        uint8_t* out = bgra.data() + static_cast<size_t>(y) * width * 4;
+        for (int x = 0; x < width; ++x, out += 4)
+        {
+            int c = 298 * (row[x] - 16) + 128;
+            int d = planeU[(y / 2) * chromaWidth + x / 2] - 128;
+            int e = planeV[(y / 2) * chromaWidth + x / 2] - 128;
+            int channels[3] = { (c + 516 * d) >> 8, (c - 100 * d - 208 * e) >> 8, (c + 409 * e) >> 8 };
+            for (int k = 0; k < 3; ++k)
+                out[k] = static_cast<uint8_t>(channels[k] < 0 ? 0 : (channels[k] > 255 ? 255 : channels[k]));
+            out[3] = 255;
+        }
+    }
+}
+
+// Cells of a YUV frame computed block by block: the average Y and the
+// average of the chroma samples the block covers, colored like
+// AsciiYuvToRgb, with the ramp cell of the Y's full range gray. planes is
+// an I420 frame.
+static void ExpectYuvCells(const uint8_t* planes, int width, int height, const AsciiRect& region,
+    const AsciiGeometry& geometry, const std::vector<AsciiCell>& ramp, std::vector<AsciiCell>& cells)
+{
+    const int chromaWidth = (width + 1) / 2;
+    const uint8_t* planeU = planes + static_cast<size_t>(width) * height;
+    const uint8_t* planeV = planeU + static_cast<size_t>(chromaWidth) * ((height + 1) / 2);
+    auto clamp = [](int v) { return static_cast<uint8_t>(v < 0 ? 0 : (v > 255 ? 255 : v)); };
+    cells.clear();
+    for (int y0 = region.top; y0 < region.bottom; y0 += geometry.blockHeight)
+    {
+        for (int x0 = region.left; x0 < region.right; x0 += geometry.blockWidth)
+        {
+            int x1 = x0 + geometry.blockWidth < region.right ? x0 + geometry.blockWidth : region.right;
+            int y1 = y0 + geometry.blockHeight < region.bottom ? y0 + geometry.blockHeight : region.bottom;
+            uint32_t sumY = 0, sumU = 0, sumV = 0, chroma = 0;
+            for (int y = y0; y < y1; ++y)
+            {
+                for (int x = x0; x < x1; ++x)
+                    sumY += planes[static_cast<size_t>(y) * width + x];
+            }
+            for (int cy = y0 / 2; cy < (y1 + 1) / 2; ++cy)
+            {
+                for (int cx = x0 / 2; cx < (x1 + 1) / 2; ++cx, ++chroma)
+                {
+                    sumU += planeU[static_cast<size_t>(cy) * chromaWidth + cx];
+                    sumV += planeV[static_cast<size_t>(cy) * chromaWidth + cx];
+                }
+            }
+            int c = 298 * (static_cast<int>(sumY / ((x1 - x0) * (y1 - y0))) - 16) + 128;
+            int d = static_cast<int>(sumU / chroma) - 128, e = static_cast<int>(sumV / chroma) - 128;
+            AsciiCell cell = ramp[clamp(c >> 8)];
+            cell.bgColor = AsciiRgb(clamp((c + 409 * e) >> 8), clamp((c - 100 * d - 208 * e) >> 8), clamp((c + 516 * d) >> 8));
+            cells.push_back(cell);
+        }
+    }
+}
+
+// RGBA8, RGB8 and RGB10A2 carry the BGRA colors exactly and must give its
+// cells, Gray8 those of the gray BGRA frame, and the YUV formats those of
+// ExpectYuvCells; on odd sizes (odd chroma planes), clipped regions and
+// several block sizes, also in shape mode for the RGB formats
+static int CheckFormats(const BenchOptions& options)
+{
+    int failures = 0;
+    AsciiGlyphMode mode = GetAsciiGlyphMode();
+    std::vector<uint8_t> bgra, gray, frame, i420;
+    std::vector<AsciiCell> reference, grayReference, cells;
+    int cols = 0, rows = 0;
+
+    // Ramp cells by full range luminance, from flat gray blocks
+    SetAsciiGlyphMode(AsciiGlyphMode::Intensity);
+    std::vector<AsciiCell> ramp;
+    for (int level = 0; level < 256; ++level)
+    {
+        std::vector<uint8_t> block(4, static_cast<uint8_t>(level));
+        ConvertRegionToAscii(block, 1, 1, { 0, 0, 1, 1 }, AsciiGeometry(), cells, cols, rows);
+        ramp.push_back(cells[0]);
+    }
+
+    const int sizes[][2] = { { options.width, options.height }, { 37, 23 }, { 6, 5 } };
+    const AsciiGeometry geometries[] = { { 8, 16 }, { 5, 9 }, { 3, 3 } };
+    const AsciiPixelFormat formats[] = {
+        AsciiPixelFormat::RGBA8, AsciiPixelFormat::RGB8, AsciiPixelFormat::RGB10A2, AsciiPixelFormat::Gray8,
+        AsciiPixelFormat::NV12, AsciiPixelFormat::I420, AsciiPixelFormat::P010,
+    };
+    for (const auto& size : sizes)
+    {
+        int width = size[0], height = size[1];
+        GenerateTestFrame(bgra, width, height);
+        uint32_t seed = 12345;
+        for (size_t i = 0; i < bgra.size(); ++i)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            if ((seed >> 28) == 0)
+                bgra[i] = static_cast<uint8_t>(seed >> 20);
+        }
+        MakeFormatFrame(bgra, width, height, AsciiPixelFormat::Gray8, frame);
+        gray.resize(bgra.size());
+        for (size_t i = 0; i < frame.size(); ++i)
+            memset(&gray[i * 4], frame[i], 4);
+        MakeFormatFrame(bgra, width, height, AsciiPixelFormat::I420, i420);
+
+        const AsciiRect regions[] = { { 0, 0, width, height }, { 3, 1, width - 1, height - 2 } };
+        for (AsciiGlyphMode glyphs : { AsciiGlyphMode::Intensity, AsciiGlyphMode::Shape })
+        {
+            SetAsciiGlyphMode(glyphs);
+            for (const AsciiGeometry& geometry : geometries)
+            {
+                for (const AsciiRect& region : regions)
+                {
+                    ConvertRegionToAscii(bgra, width, height, region, geometry, reference, cols, rows);
+                    ConvertRegionToAscii(gray, width, height, region, geometry, grayReference, cols, rows);
+                    for (AsciiPixelFormat format : formats)
+                    {
+                        bool yuv = IsAsciiYuvFormat(format);
+                        if (yuv && glyphs != AsciiGlyphMode::Intensity)
+                            continue;
+                        const std::vector<AsciiCell>* expected = &reference;
+                        if (format == AsciiPixelFormat::Gray8)
+                            expected = &grayReference;
+                        else if (yuv)
+                        {
+                            ExpectYuvCells(i420.data(), width, height, region, geometry, ramp, grayReference);
+                            expected = &grayReference;
+                        }
+                        MakeFormatFrame(bgra, width, height, format, frame);
+                        AsciiImageView view = MakeAsciiImageView(frame.data(), frame.size(), width, height, format);
+                        ConvertRegionToAscii(view, region, geometry, cells, cols, rows);
+                        if (cells != *expected)
+                        {
+                            printf("formats: %s, %s glyphs, %dx%d frame, %dx%d blocks, region %d,%d-%d,%d gives other cells\n",
+                                GetAsciiPixelFormatName(format), GetGlyphModeName(glyphs), width, height,
+                                geometry.blockWidth, geometry.blockHeight, region.left, region.top, region.right,
+                                region.bottom);
+                            ++failures;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    SetAsciiGlyphMode(mode);
+    return failures;
+}
+
+static int RunFormats(const BenchOptions& options)
+{
+    int failures = CheckFormats(options);
+    std::vector<uint8_t> bgra;
+    GenerateTestFrame(bgra, options.width, options.height);
+
+    AsciiRect region = { 0, 0, options.width, options.height };
+    AsciiGeometry geometry;
+    std::vector<AsciiCell> asciiOut;
+    int outCols = 0, outRows = 0;
+
+    printf("formats: %dx%d, %s kernel, %s glyphs, %d frames\n", options.width, options.height,
+        GetAsciiKernelName(GetActiveAsciiKernel()), GetGlyphModeName(options.glyphMode), options.frames);
+    printf("%-18s %12s %12s %12s\n", "format", "MB/frame", "ms/frame", "frames/s");
+
+    const AsciiPixelFormat formats[] = {
+        AsciiPixelFormat::BGRA8, AsciiPixelFormat::RGBA8, AsciiPixelFormat::RGB8, AsciiPixelFormat::Gray8,
+        AsciiPixelFormat::RGB10A2, AsciiPixelFormat::NV12, AsciiPixelFormat::I420, AsciiPixelFormat::P010,
+    };
+    std::vector<uint8_t> frame, expanded;
+    for (AsciiPixelFormat format : formats)
+    {
+        MakeFormatFrame(bgra, options.width, options.height, format, frame);
+        AsciiImageView view = MakeAsciiImageView(frame.data(), frame.size(), options.width, options.height, format);
+        ConvertRegionToAscii(view, region, geometry, asciiOut, outCols, outRows);
+
+        double start = NowSeconds();
+        for (int i = 0; i < options.frames; ++i)
+            ConvertRegionToAscii(view, region, geometry, asciiOut, outCols, outRows);
+        double perFrame = (NowSeconds() - start) / options.frames;
+        printf("%-18s %12.2f %12.3f %12.1f\n", GetAsciiPixelFormatName(format), frame.size() / 1e6,
+            perFrame * 1000.0, 1.0 / perFrame);
+
+        if (format == AsciiPixelFormat::I420)
+        {
+            start = NowSeconds();
+            for (int i = 0; i < options.frames; ++i)
+            {
+                ExpandI420(frame.data(), options.width, options.height, expanded);
+                ConvertRegionToAscii(expanded, options.width, options.height, region, geometry, asciiOut, outCols, outRows);
+            }
+            perFrame = (NowSeconds() - start) / options.frames;
+            printf("%-18s %12.2f %12.3f %12.1f\n", "yuv420p via bgra", (frame.size() + expanded.size() * 2) / 1e6,
+                perFrame * 1000.0, 1.0 / perFrame);
+        }
+    }
+    return failures ? 1 : 0;
+}
+
+//----------------------------------------------------------------
+// Full conversion vs AsciiTileCache on a mostly static frame where a
+// few blocks change every frame, with and without damage rectangles.
+// The damage is as coarse as Desktop Duplication's: a 64x32 pixel
+// area around every touched block.
+//----------------------------------------------------------------
+// A capture region that moves but keeps its size must be converted at its
+// new place by the tile cache (with and without damage) and by the cell
+// grid, even with nothing damaged
+static int CheckMovedRegion(const AsciiImageView& view, const AsciiGeometry& geometry)
+{
+    int failures = 0;
+    int width = view.width / 2, height = view.height / 2;
+    const AsciiRect regions[] = {
+        { 0, 0, width, height },
+        { width, 0, 2 * width, height },                            // A whole region over
+        { width + 3, 5, 2 * width + 3, height + 5 },                // Off the block grid
+    };
+    const std::vector<AsciiRect> noDamage;
+    std::vector<AsciiCell> expected;
+    std::vector<int> changedCells;
+    int cols = 0, rows = 0;
+    const char* names[] = { "tile cache", "cache+damage", "damage" };
+    for (int mode = 0; mode < 3; ++mode)
+    {
+        AsciiTileCache cache;
+        AsciiCellGrid grid;
+        for (const AsciiRect& region : regions)
+        {
+            ConvertRegionToAscii(view, region, geometry, expected, cols, rows);
+            if (mode == 0)
+                cache.Update(view, region, geometry, changedCells);
+            else if (mode == 1)
+                cache.Update(view, region, geometry, noDamage, changedCells);
+            else
+                ConvertRegionToAscii(view, region, geometry, noDamage, grid, changedCells);
+            const std::vector<AsciiCell>& cells = mode < 2 ? cache.GetCells() : grid.cells;
+            if (cells != expected || changedCells.empty())
+            {
+                printf("incremental: %s keeps the cells of the old place after the region moved to %d,%d\n",
+                    names[mode], region.left, region.top);
+                ++failures;
+            }
+        }
+    }
+    return failures;
+}
+
+static int RunIncremental(const BenchOptions& options)
+{
+    std::vector<uint8_t> frame;
+    GenerateTestFrame(frame, options.width, options.height);
+
+    AsciiRect region = { 0, 0, options.width, options.height };
+    AsciiGeometry geometry;
+    int cols = (options.width + geometry.blockWidth - 1) / geometry.blockWidth;
+    int rows = (options.height + geometry.blockHeight - 1) / geometry.blockHeight;
+    int touched = static_cast<int>(static_cast<double>(cols) * rows * options.changedPercent / 100.0);
+
+    // Repaint a different set of blocks every frame, like a blinking cursor
+    // or a ticking clock would. Every pass replays the same sequence.
+    std::vector<AsciiRect> damage;
+    uint32_t seed = 12345;
+    auto touchBlocks = [&](int frameIndex) {
+        damage.clear();
+        for (int i = 0; i < touched; ++i)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            int col = static_cast<int>((seed >> 8) % cols);
+            int row = static_cast<int>((seed >> 20) % rows);
+            int x = col * geometry.blockWidth;
+            int y = row * geometry.blockHeight;
+            if (x < options.width && y < options.height)
+            {
+                frame[(static_cast<size_t>(y) * options.width + x) * 4] ^= static_cast<uint8_t>(frameIndex | 1);
+                damage.push_back({ x & ~63, y & ~31, (x & ~63) + 64, (y & ~31) + 32 });
+            }
+        }
+    };
+
+    printf("incremental: %dx%d, %d of %d blocks touched per frame, %s kernel, %s glyphs, %d frames\n",
+        options.width, options.height, touched, cols * rows,
+        GetAsciiKernelName(GetActiveAsciiKernel()), GetGlyphModeName(options.glyphMode), options.frames);
+
+    AsciiImageView view = MakeAsciiImageView(frame, options.width, options.height);
+    std::vector<uint8_t> initial = frame;
+    std::vector<AsciiCell> asciiOut;
+    int outCols = 0, outRows = 0;
+    double start = NowSeconds();
+    for (int i = 0; i < options.frames; ++i)
+    {
+        touchBlocks(i);
+        ConvertRegionToAscii(view, region, geometry, asciiOut, outCols, outRows);
+    }
+    double fullTime = (NowSeconds() - start) / options.frames;
+
+    // The same frames again from the start for every incremental mode
+    int failures = CheckMovedRegion(view, geometry);
+    struct Mode { const char* name; bool cache; bool useDamage; };
+    const Mode modes[] = {
+        { "tile cache", true, false },
+        { "damage", false, true },
+        { "cache+damage", true, true },
+    };
+    printf("%-14s %12s %14s %14s %14s\n", "mode", "ms/frame", "hashed/frame", "blocks/frame", "changed/frame");
+    printf("%-14s %12.3f %14s %14d %14s\n", "full", fullTime * 1000.0, "-", cols * rows, "-");
+    for (const Mode& mode : modes)
+    {
+        frame = initial;
+        seed = 12345;
+        AsciiTileCache cache;
+        AsciiCellGrid grid;
+        std::vector<int> changedCells;
+        damage.clear();
+        if (mode.cache)
+            cache.Update(view, region, geometry, changedCells);
+        else
+            ConvertRegionToAscii(view, region, geometry, damage, grid, changedCells);
+
+        long long hashed = 0, converted = 0, changed = 0;
+        start = NowSeconds();
+        for (int i = 0; i < options.frames; ++i)
+        {
+            touchBlocks(i);
+            if (!mode.cache)
+            {
+                ConvertRegionToAscii(view, region, geometry, damage, grid, changedCells);
+                changed += static_cast<long long>(changedCells.size());
+                continue;
+            }
+            if (mode.useDamage)
+                cache.Update(view, region, geometry, damage, changedCells);
+            else
+                cache.Update(view, region, geometry, changedCells);
+            hashed += cache.GetLastStats().tilesHashed;
+            converted += cache.GetLastStats().tilesConverted;
+            changed += cache.GetLastStats().cellsChanged;
+        }
+        double perFrame = (NowSeconds() - start) / options.frames;
+
+        // Every mode must end on the cells of the full conversion
+        const std::vector<AsciiCell>& cells = mode.cache ? cache.GetCells() : grid.cells;
+        if (cells != asciiOut)
+        {
+            printf("incremental: %s cells differ from the full conversion\n", mode.name);
+            ++failures;
+        }
+
+        char hashedText[32] = "-", convertedText[32] = "-";
+        if (mode.cache)
+        {
+            snprintf(hashedText, sizeof(hashedText), "%lld", hashed / options.frames);
+            snprintf(convertedText, sizeof(convertedText), "%lld", converted / options.frames);
+        }
+        printf("%-14s %12.3f %14s %14s %14lld   %.2fx\n", mode.name, perFrame * 1000.0, hashedText, convertedText,
+            changed / options.frames, fullTime / perFrame);
+    }
+    return failures ? 1 : 0;
+}
+
+//----------------------------------------------------------------
+// Damage: hand-made damage lists against converting the whole region.
+// The changed pixels sit at the corners and the center of every
+// rectangle, so a rectangle that misses a block leaves a stale cell.
+// The grid must equal the full conversion and changedCells must list
+// exactly the cells that differ from the previous frame.
+//----------------------------------------------------------------
+static int RunDamage(const BenchOptions& options)
+{
+    int failures = 0;
+    const int width = options.width, height = options.height;
+    std::vector<uint8_t> base;
+    GenerateTestFrame(base, width, height);
+
+    auto flipPixel = [&](std::vector<uint8_t>& frame, int x, int y) {
+        if (x < 0 || y < 0 || x >= width || y >= height)
+            return;
+        uint8_t* pixel = frame.data() + (static_cast<size_t>(y) * width + x) * 4;
+        pixel[0] ^= 0xFF;
+        pixel[1] ^= 0xFF;
+        pixel[2] ^= 0xFF;
+    };
+
+    AsciiGeometry geometry;
+    const int bw = geometry.blockWidth, bh = geometry.blockHeight;
+    const AsciiRect regions[] = {
+        { 0, 0, width, height },
+        { 5, 3, width - 9, height - 4 },
+    };
+    std::vector<AsciiCell> previous, expected;
+    std::vector<int> expectedChanged, changedCells;
+    int cols = 0, rows = 0, checks = 0;
+
+    for (int threads : { 1, 3 })
+    {
+        SetAsciiThreadCount(threads);
+        for (const AsciiRect& region : regions)
+        {
+            const int l = region.left, t = region.top, r = region.right, b = region.bottom;
+            struct DamageCase { const char* name; std::vector<AsciiRect> rects; bool changes; };
+            const DamageCase cases[] = {
+                { "block aligned", { { l + 2 * bw, t + bh, l + 4 * bw, t + 3 * bh } }, true },
+                { "across block corners", { { l + 4 * bw - 1, t + 3 * bh - 1, l + 4 * bw + 1, t + 3 * bh + 1 } }, true },
+                { "first and last cell", { { l, t, l + 1, t + 1 }, { r - 1, b - 1, r, b } }, true },
+                { "partly outside", { { l - 20, t - 10, l + bw + 3, t + 5 }, { r - 3, b - 2, r + 50, b + 50 } }, true },
+                { "fully outside", { { r, t, r + 40, t + 30 }, { l - 40, t, l, t + 30 }, { l, b, l + 30, b + 40 } }, false },
+                { "overlapping", { { l + 10, t + 20, l + 60, t + 70 }, { l + 40, t + 50, l + 90, t + 100 },
+                    { l + 10, t + 20, l + 60, t + 70 } }, true },
+                { "empty", { { l + 30, t + 30, l + 30, t + 60 }, { l + 50, t + 30, l + 40, t + 60 } }, false },
+                { "whole region", { { l, t, r, b } }, true },
+            };
+
+            std::vector<uint8_t> frame = base;
+            AsciiCellGrid grid;
+            std::vector<AsciiRect> none;
+            ConvertRegionToAscii(frame, width, height, region, geometry, none, grid, changedCells);
+            ConvertRegionToAscii(frame, width, height, region, geometry, previous, cols, rows);
+            if (grid.cells != previous || changedCells.size() != previous.size())
+            {
+                printf("damage: %d threads, first conversion is not reported in full\n", threads);
+                ++failures;
+            }
+
+            for (const DamageCase& test : cases)
+            {
+                for (const AsciiRect& rect : test.rects)
+                {
+                    if (rect.left >= rect.right || rect.top >= rect.bottom)
+                        continue;
+                    int cx = (rect.left + rect.right) / 2, cy = (rect.top + rect.bottom) / 2;
+                    flipPixel(frame, rect.left, rect.top);
+                    flipPixel(frame, rect.right - 1, rect.top);
+                    flipPixel(frame, rect.left, rect.bottom - 1);
+                    flipPixel(frame, rect.right - 1, rect.bottom - 1);
+                    flipPixel(frame, cx, cy);
+                }
+                ConvertRegionToAscii(frame, width, height, region, geometry, expected, cols, rows);
+                expectedChanged.clear();
+                for (size_t i = 0; i < expected.size(); ++i)
+                {
+                    if (expected[i] != previous[i])
+                        expectedChanged.push_back(static_cast<int>(i));
+                }
+
+                ConvertRegionToAscii(frame, width, height, region, geometry, test.rects, grid, changedCells);
+                if (grid.cells != expected || changedCells != expectedChanged || expectedChanged.empty() == test.changes)
+                {
+                    printf("damage: %s, region %d,%d-%d,%d, %d threads: %zu cells reported, %zu expected%s\n",
+                        test.name, l, t, r, b, threads, changedCells.size(), expectedChanged.size(),
+                        grid.cells != expected ? ", grid differs from a full conversion" : "");
+                    ++failures;
+                }
+                previous.swap(expected);
+                ++checks;
+            }
+
+            // Another geometry can't reuse the grid: every cell is reported
+            AsciiGeometry other = { 4, 8 };
+            ConvertRegionToAscii(frame, width, height, region, other, none, grid, changedCells);
+            ConvertRegionToAscii(frame, width, height, region, other, expected, cols, rows);
+            if (grid.cells != expected || changedCells.size() != expected.size())
+            {
+                printf("damage: %d threads, a geometry change is not reported in full\n", threads);
+                ++failures;
+            }
+        }
+    }
+    SetAsciiThreadCount(1);
+
+    printf("damage: %d damage lists checked against full conversions, %d failures\n", checks, failures);
+    return failures ? 1 : 0;
+}
+
+//----------------------------------------------------------------
+// Draw calls (color runs) per frame for every color mode, and the cost
+// of quantizing and building the runs
+//----------------------------------------------------------------
+static uint32_t ColorDistance(AsciiColor a, AsciiColor b)
+{
+    int dr = AsciiRValue(a) - AsciiRValue(b), dg = AsciiGValue(a) - AsciiGValue(b), db = AsciiBValue(a) - AsciiBValue(b);
+    return static_cast<uint32_t>(dr * dr + dg * dg + db * db);
+}
+
+// The lookup table must give the nearest palette entry at the center of
+// every table cell, median cut at most the asked for number of colors,
+// and the runs must cover every cell of a row once, in order, with the
+// colors of their cells
+static int CheckColorModes(const std::vector<AsciiCell>& cells, int cols, int rows)
+{
+    int failures = 0;
+    AsciiColorQuantizer quantizer;
+    quantizer.SetMode(AsciiColorMode::TrueColor);
+    if (quantizer.MapIndex(AsciiRgb(1, 2, 3)) != -1)
+    {
+        printf("colors: truecolor maps to a palette index\n");
+        ++failures;
+    }
+
+    struct Case { AsciiColorMode mode; int adaptiveColors; };
+    const Case cases[] = { { AsciiColorMode::Ansi16, 16 }, { AsciiColorMode::Xterm256, 16 },
+        { AsciiColorMode::Adaptive, 2 }, { AsciiColorMode::Adaptive, 16 }, { AsciiColorMode::Adaptive, 256 } };
+    std::vector<AsciiCell> quantized;
+    for (const Case& test : cases)
+    {
+        quantizer.SetMode(test.mode, test.adaptiveColors);
+        quantizer.BuildPalette(cells);
+        const std::vector<AsciiColor>& palette = quantizer.GetPalette();
+        if (palette.empty() || (test.mode == AsciiColorMode::Adaptive && static_cast<int>(palette.size()) > test.adaptiveColors))
+        {
+            printf("colors: %s mode with %d colors has a palette of %zu\n", GetAsciiColorModeName(test.mode),
+                test.adaptiveColors, palette.size());
+            ++failures;
+            continue;
+        }
+
+        int wrong = 0;
+        for (int index = 0; index < 32 * 32 * 32; ++index)
+        {
+            AsciiColor center = AsciiRgb(static_cast<uint8_t>(((index >> 10) << 3) | 4),
+                static_cast<uint8_t>((((index >> 5) & 31) << 3) | 4), static_cast<uint8_t>(((index & 31) << 3) | 4));
+            uint32_t nearest = 0xFFFFFFFFu;
+            for (AsciiColor color : palette)
+                nearest = ColorDistance(center, color) < nearest ? ColorDistance(center, color) : nearest;
+            int mapped = quantizer.MapIndex(center);
+            if (mapped < 0 || mapped >= static_cast<int>(palette.size()) || ColorDistance(center, palette[mapped]) != nearest)
+                ++wrong;
+        }
+        if (wrong)
+        {
+            printf("colors: %s mode with %d colors maps %d table cells to a farther entry\n",
+                GetAsciiColorModeName(test.mode), test.adaptiveColors, wrong);
+            ++failures;
+        }
+    }
+
+    std::vector<AsciiRun> runs;
+    for (AsciiColorMode mode : { AsciiColorMode::TrueColor, AsciiColorMode::Ansi16, AsciiColorMode::Adaptive })
+    {
+        quantizer.SetMode(mode);
+        quantizer.Quantize(cells, quantized);
+        BuildAsciiRuns(quantized, cols, rows, runs);
+        int row = 0, col = 0;
+        bool covered = true;
+        for (const AsciiRun& run : runs)
+        {
+            if (col == cols)
+            {
+                ++row;
+                col = 0;
+            }
+            covered = covered && run.row == row && run.col == col && run.length > 0 && col + run.length <= cols;
+            for (int i = 0; covered && i < run.length; ++i)
+            {
+                const AsciiCell& cell = quantized[static_cast<size_t>(row) * cols + col + i];
+                covered = cell.bgColor == run.bgColor && (cell.ch == L' ' || cell.textColor == run.textColor);
+            }
+            col += run.length;
+        }
+        if (!covered || row != rows - 1 || col != cols)
+        {
+            printf("colors: %s runs do not cover the grid with its colors\n", GetAsciiColorModeName(mode));
+            ++failures;
+        }
+    }
+    return failures;
+}
+
+static int RunColorModes(const BenchOptions& options)
+{
+    std::vector<uint8_t> frame;
+    GenerateTestFrame(frame, options.width, options.height);
+
+    AsciiRect region = { 0, 0, options.width, options.height };
+    AsciiGeometry geometry;
+    std::vector<AsciiCell> asciiOut;
+    int outCols = 0, outRows = 0;
+    ConvertRegionToAscii(frame, options.width, options.height, region, geometry, asciiOut, outCols, outRows);
+    int failures = CheckColorModes(asciiOut, outCols, outRows);
+
+    printf("color modes: %dx%d, %d cells, %s glyphs, %d frames\n",
+        options.width, options.height, outCols * outRows, GetGlyphModeName(options.glyphMode), options.frames);
+    printf("%-10s %12s %12s %12s\n", "colors", "runs/frame", "cells/run", "ms/frame");
+
+    const AsciiColorMode modes[] = { AsciiColorMode::TrueColor, AsciiColorMode::Xterm256,
+        AsciiColorMode::Ansi16, AsciiColorMode::Adaptive };
+    AsciiColorQuantizer quantizer;
+    std::vector<AsciiCell> quantized;
+    std::vector<AsciiRun> runs;
+    for (AsciiColorMode colorMode : modes)
+    {
+        quantizer.SetMode(colorMode);
+
+        double start = NowSeconds();
+        for (int i = 0; i < options.frames; ++i)
+        {
+            quantizer.Quantize(asciiOut, quantized);
+            BuildAsciiRuns(quantized, outCols, outRows, runs);
+        }
+        double perFrame = (NowSeconds() - start) / options.frames;
+
+        double cellsPerRun = runs.empty() ? 0.0 : static_cast<double>(outCols) * outRows / runs.size();
+        printf("%-10s %12zu %12.2f %12.3f\n", GetAsciiColorModeName(colorMode), runs.size(), cellsPerRun, perFrame * 1000.0);
+    }
+    return failures ? 1 : 0;
+}
+
+//----------------------------------------------------------------
+// Software rendering of the converted cells back to a full size frame,
+// optionally written to a PPM (last frame) or Y4M (every frame)
+//----------------------------------------------------------------
+
+// Every SIMD blender must write the scalar blender's pixels for odd row
+// lengths, unaligned rows and partial coverage, and nothing past the row
+static int CheckGlyphBlenders()
+{
+    int failures = 0;
+    const AsciiKernel defaultKernel = GetActiveAsciiKernel();
+    const AsciiKernel kernels[] = { AsciiKernel::SSE41, AsciiKernel::AVX2 };
+    uint32_t seed = 4321;
+    auto next = [&seed]() { seed = seed * 1664525u + 1013904223u; return seed >> 8; };
+    std::vector<uint8_t> coverage(80), reference(80 * 4 + 8), pixels(reference.size());
+    for (AsciiKernel kernel : kernels)
+    {
+        if (!IsAsciiKernelSupported(kernel))
+            continue;
+        SelectAsciiKernel(kernel);
+        AsciiGlyphBlender blend = GetAsciiGlyphBlender();
+        int mismatches = 0;
+        for (int row = 0; row < 20000; ++row)
+        {
+            int count = 1 + static_cast<int>(next() % 67);
+            int offset = static_cast<int>(next() % 2) * 4;
+            for (int i = 0; i < count; ++i)
+            {
+                uint32_t r = next();
+                coverage[i] = r % 3 == 0 ? 0 : (r % 3 == 1 ? 255 : static_cast<uint8_t>(r >> 8));
+            }
+            uint32_t fg = next() | (next() << 24), bg = next() | (next() << 24);
+            for (uint8_t& byte : reference)
+                byte = static_cast<uint8_t>(next());
+            pixels = reference;
+            BlendGlyphRowScalar(reference.data() + offset, coverage.data(), count, fg, bg);
+            blend(pixels.data() + offset, coverage.data(), count, fg, bg);
+            mismatches += pixels == reference ? 0 : 1;
+        }
+        if (mismatches)
+        {
+            printf("render: %s blender differs from the scalar blender in %d of 20000 rows\n",
+                GetAsciiKernelName(kernel), mismatches);
+            ++failures;
+        }
+    }
+    SelectAsciiKernel(defaultKernel);
+    return failures;
+}
+
+// Rendering the diff spans over the previous frame must give the full
+// rendering of the next one, with cells clipped to a buffer smaller than
+// the grid and spans outside the grid ignored. The PPM and Y4M writers
+// must give back the rendered pixels.
+static int CheckRender(const std::vector<AsciiCell>& cells, int cols, int rows)
+{
+    int failures = 0;
+    const AsciiKernel defaultKernel = GetActiveAsciiKernel();
+    const AsciiKernel kernels[] = { AsciiKernel::Scalar, AsciiKernel::SSE41, AsciiKernel::AVX2 };
+    const AsciiGeometry geometries[] = { { 8, 16 }, { 5, 9 } };
+
+    // A few changed cells, the last column and row among them
+    std::vector<AsciiCell> changed = cells;
+    for (size_t i = 0; i < changed.size(); i += 37)
+    {
+        changed[i].ch = static_cast<wchar_t>(L'!' + i % 90);
+        changed[i].bgColor ^= 0x00FF00;
+    }
+    changed.back().textColor ^= 0xFF0000;
+    changed[static_cast<size_t>(cols) - 1].ch = L'#';
+
+    std::vector<AsciiCellSpan> spans;
+    DiffAsciiCells(cells.data(), changed.data(), cols, rows, 2, spans);
+    spans.push_back({ -1, 0, 3 });
+    spans.push_back({ rows + 2, 0, cols });
+    spans.push_back({ 0, -4, 6 });
+    spans.push_back({ rows - 1, cols - 2, 10 });
+
+    std::vector<uint8_t> full, updated;
+    for (const AsciiGeometry& geometry : geometries)
+    {
+        AsciiGlyphAtlas atlas;
+        atlas.Reset(geometry.blockWidth, geometry.blockHeight);
+        atlas.AddBuiltinGlyphs();
+
+        // Cuts the last column and row of cells in half; the stride padding
+        // lies outside the buffer and must stay as it is
+        int width = (cols - 1) * geometry.blockWidth - geometry.blockWidth / 2;
+        int height = (rows - 1) * geometry.blockHeight - geometry.blockHeight / 2;
+        int stride = width * 4 + 12;
+        for (AsciiKernel kernel : kernels)
+        {
+            if (!IsAsciiKernelSupported(kernel))
+                continue;
+            SelectAsciiKernel(kernel);
+            full.assign(static_cast<size_t>(stride) * height, 0x5A);
+            updated = full;
+            RenderAsciiCells(changed, cols, rows, atlas, full.data(), width, height, stride);
+            RenderAsciiCells(cells, cols, rows, atlas, updated.data(), width, height, stride);
+            RenderAsciiSpans(changed, cols, rows, spans, atlas, updated.data(), width, height, stride);
+            bool padding = true;
+            for (int y = 0; y < height && padding; ++y)
+            {
+                for (int x = width * 4; x < stride; ++x)
+                    padding = padding && full[static_cast<size_t>(y) * stride + x] == 0x5A;
+            }
+            if (full != updated || !padding)
+            {
+                printf("render: %s kernel, %dx%d cells: %s\n", GetAsciiKernelName(kernel), geometry.blockWidth,
+                    geometry.blockHeight, full != updated ? "spans differ from a full rendering" : "drew outside the buffer");
+                ++failures;
+            }
+        }
+    }
+    SelectAsciiKernel(defaultKernel);
+
+    // The last rendering through the writers and back
+    const AsciiGeometry& last = geometries[sizeof(geometries) / sizeof(geometries[0]) - 1];
+    int width = (cols - 1) * last.blockWidth - last.blockWidth / 2;
+    int height = (rows - 1) * last.blockHeight - last.blockHeight / 2;
+    AsciiImageView view;
+    view.data = full.data();
+    view.width = width;
+    view.height = height;
+    view.stride = width * 4 + 12;
+
+    std::filesystem::path directory = std::filesystem::temp_directory_path();
+    std::string ppmPath = (directory / "asciifilter_bench_render.ppm").string();
+    std::string y4mPath = (directory / "asciifilter_bench_render.y4m").string();
+    AsciiImage image;
+    bool ppm = WriteAsciiPpm(ppmPath.c_str(), view) && ReadAsciiImage(ppmPath.c_str(), image) &&
+        image.width == width && image.height == height;
+    for (int y = 0; ppm && y < height; ++y)
+    {
+        for (int x = 0; ppm && x < width; ++x)
+        {
+            const uint8_t* in = view.data + static_cast<size_t>(y) * view.stride + x * 4;
+            const uint8_t* out = image.pixels.GetData() + (static_cast<size_t>(y) * width + x) * 4;
+            ppm = in[0] == out[0] && in[1] == out[1] && in[2] == out[2];
+        }
+    }
+
+    AsciiY4mWriter writer;
+    AsciiFrameReader reader;
+    bool y4m = writer.Open(y4mPath.c_str(), width, height, 30) && writer.WriteFrame(view) && writer.WriteFrame(view);
+    writer.Close();
+    y4m = y4m && reader.OpenY4m(y4mPath.c_str()) && reader.GetWidth() == width && reader.GetHeight() == height;
+    for (int frame = 0; y4m && frame < 2; ++frame)
+    {
+        y4m = reader.ReadFrame(image) && image.format == AsciiPixelFormat::I420;
+        for (int y = 0; y4m && y < height; ++y)
+        {
+            for (int x = 0; y4m && x < width; ++x)
+            {
+                // BT.601 limited range luma, as the writer computes it
+                const uint8_t* in = view.data + static_cast<size_t>(y) * view.stride + x * 4;
+                int luma = (66 * in[2] + 129 * in[1] + 25 * in[0] + 128 + (16 << 8)) >> 8;
+                y4m = image.pixels.GetData()[static_cast<size_t>(y) * width + x] == luma;
+            }
+        }
+    }
+    y4m = y4m && !reader.ReadFrame(image) && !reader.HasError();
+    reader.Close();
+
+    // The image last held an I420 frame; an image file makes it BGRA again
+    ppm = ppm && ReadAsciiImage(ppmPath.c_str(), image) && image.format == AsciiPixelFormat::BGRA8;
+
+    std::error_code error;
+    std::filesystem::remove(ppmPath, error);
+    std::filesystem::remove(y4mPath, error);
+    if (!ppm || !y4m)
+    {
+        printf("render:%s%s\n", ppm ? "" : " the PPM does not read back", y4m ? "" : " the Y4M does not read back");
+        ++failures;
+    }
+    return failures;
+}
+
+static int RunRender(const BenchOptions& options)
+{
+    std::vector<uint8_t> frame;
+    GenerateTestFrame(frame, options.width, options.height);
+
+    AsciiRect region = { 0, 0, options.width, options.height };
+    AsciiGeometry geometry;
+    std::vector<AsciiCell> asciiOut;
+    int outCols = 0, outRows = 0;
+    ConvertRegionToAscii(frame, options.width, options.height, region, geometry, asciiOut, outCols, outRows);
+    int failures = CheckGlyphBlenders() + CheckRender(asciiOut, outCols, outRows);
+
+    AsciiGlyphAtlas atlas;
+    atlas.Reset(geometry.blockWidth, geometry.blockHeight);
+    atlas.AddBuiltinGlyphs();
+
+    std::vector<uint8_t> rendered(static_cast<size_t>(options.width) * options.height * 4);
+    AsciiImageView view = MakeAsciiImageView(rendered, options.width, options.height);
+
+    bool ppm = false;
+    AsciiY4mWriter y4m;
+    if (options.output)
+    {
+        size_t length = strlen(options.output);
+        ppm = length > 4 && !strcmp(options.output + length - 4, ".ppm");
+        if (!ppm && !y4m.Open(options.output, options.width, options.height, 60))
+        {
+            fprintf(stderr, "cannot open %s\n", options.output);
+            return 1;
+        }
+    }
+
+    printf("render: %dx%d, %d cells, %s kernel, %s glyphs, %d frames\n",
+        options.width, options.height, outCols * outRows,
+        GetAsciiKernelName(GetActiveAsciiKernel()), GetGlyphModeName(options.glyphMode), options.frames);
+
+    double renderTime = 0.0;
+    for (int i = 0; i < options.frames; ++i)
+    {
+        double start = NowSeconds();
+        RenderAsciiCells(asciiOut, outCols, outRows, atlas, rendered.data(), options.width, options.height, options.width * 4);
+        renderTime += NowSeconds() - start;
+
+        if (y4m.IsOpen() && !y4m.WriteFrame(view))
+        {
+            fprintf(stderr, "cannot write %s\n", options.output);
+            return 1;
+        }
+    }
+    if (ppm && !WriteAsciiPpm(options.output, view))
+    {
+        fprintf(stderr, "cannot write %s\n", options.output);
+        return 1;
+    }
+
+    double perFrame = renderTime / options.frames;
+    printf("%12s %12s %14s\n", "ms/frame", "frames/s", "Mpixels/s");
+    printf("%12.3f %12.1f %14.1f\n", perFrame * 1000.0, 1.0 / perFrame,
+        static_cast<double>(options.width) * options.height / perFrame / 1e6);
+    return failures ? 1 : 0;
+}
+
+//----------------------------------------------------------------
+// Cell diff: exact spans and rectangles of a hand-made pair of grids
+// with every comparer, then the cost against the previous frame when a
+// few cells change, and how much of the grid is left to redraw and blit
+//----------------------------------------------------------------
+static int CheckCellDiff()
+{
+    // 37 columns leave a tail after every SIMD group of 4 and 8 cells
+    const int cols = 37, rows = 6;
+    std::vector<AsciiCell> previous(static_cast<size_t>(cols) * rows), next(previous.size());
+
+    // Padding bytes (AsciiCell has them where wchar_t is 16-bit) differ in
+    // every cell and must never count as a change
+    memset(static_cast<void*>(previous.data()), 0xAA, previous.size() * sizeof(AsciiCell));
+    memset(static_cast<void*>(next.data()), 0x55, next.size() * sizeof(AsciiCell));
+    for (size_t i = 0; i < previous.size(); ++i)
+    {
+        AsciiColor color = static_cast<AsciiColor>(i * 0x010203);
+        previous[i].ch = next[i].ch = static_cast<wchar_t>(L'a' + i % 26);
+        previous[i].textColor = next[i].textColor = color;
+        previous[i].bgColor = next[i].bgColor = ~color;
+    }
+
+    // Every field in turn, so none of them is skipped by a comparer
+    auto change = [&](int row, int col) {
+        AsciiCell& cell = next[static_cast<size_t>(row) * cols + col];
+        switch (col % 3)
+        {
+        case 0: cell.ch = static_cast<wchar_t>(cell.ch + 1); break;
+        case 1: cell.textColor ^= 0x800000; break;
+        case 2: cell.bgColor ^= 0x000001; break;
+        }
+    };
+    change(0, 0);                   // First and last cell of a row
+    change(0, cols - 1);
+    change(1, 3);                   // Gap of two: bridged
+    change(1, 6);
+    change(1, 10);                  // Gap of three: a new span
+    for (int col = 8; col < 16; ++col)
+    {
+        change(2, col);             // Same columns in two rows: one rectangle
+        change(3, col);
+    }
+    change(3, 0);
+    for (int col = 0; col < cols; col += 2)
+        change(5, col);             // Every other cell; row 4 is unchanged
+
+    const AsciiCellSpan expectedSpans[] = {
+        { 0, 0, 1 }, { 0, 36, 1 }, { 1, 3, 4 }, { 1, 10, 1 }, { 2, 8, 8 }, { 3, 0, 1 }, { 3, 8, 8 }, { 5, 0, 37 },
+    };
+    const int expectedChanged = 2 + 3 + 8 + 9 + 19;
+
+    // 8x16 blocks on a 291x93 screen: the last column and row are clipped
+    AsciiGeometry geometry;
+    const AsciiRect expectedRects[] = {
+        { 0, 0, 8, 16 }, { 288, 0, 291, 16 }, { 24, 16, 56, 32 }, { 80, 16, 88, 32 },
+        { 64, 32, 128, 64 }, { 0, 48, 8, 64 }, { 0, 80, 291, 93 },
+    };
+
+    int failures = 0;
+    const AsciiKernel defaultKernel = GetActiveAsciiKernel();
+    const AsciiKernel kernels[] = { AsciiKernel::Scalar, AsciiKernel::SSE41, AsciiKernel::AVX2 };
+    std::vector<AsciiCellSpan> spans;
+    std::vector<AsciiRect> rects;
+    int comparers = 0;
+    for (AsciiKernel kernel : kernels)
+    {
+        if (!IsAsciiKernelSupported(kernel))
+            continue;
+        SelectAsciiKernel(kernel);
+        ++comparers;
+
+        spans.clear();
+        int changed = DiffAsciiCells(previous.data(), next.data(), cols, rows, 2, spans);
+        bool spansMatch = changed == expectedChanged && spans.size() == sizeof(expectedSpans) / sizeof(expectedSpans[0]);
+        for (size_t i = 0; spansMatch && i < spans.size(); ++i)
+        {
+            spansMatch = spans[i].row == expectedSpans[i].row && spans[i].col == expectedSpans[i].col &&
+                spans[i].length == expectedSpans[i].length;
+        }
+
+        GetAsciiSpanRects(spans, geometry, cols * geometry.blockWidth - 5, rows * geometry.blockHeight - 3, rects);
+        bool rectsMatch = rects.size() == sizeof(expectedRects) / sizeof(expectedRects[0]);
+        for (size_t i = 0; rectsMatch && i < rects.size(); ++i)
+        {
+            rectsMatch = rects[i].left == expectedRects[i].left && rects[i].top == expectedRects[i].top &&
+                rects[i].right == expectedRects[i].right && rects[i].bottom == expectedRects[i].bottom;
+        }
+
+        // Without a merge gap every changed cell of the last row stands alone
+        spans.clear();
+        DiffAsciiCells(previous.data() + 5 * cols, next.data() + 5 * cols, cols, 1, 0, spans);
+        bool unmerged = spans.size() == 19 && spans.back().col == 36 && spans.back().length == 1;
+
+        // Identical grids, padding aside
+        spans.clear();
+        bool unchanged = DiffAsciiCells(previous.data() + 4 * cols, next.data() + 4 * cols, cols, 1, 2, spans) == 0 &&
+            spans.empty();
+
+        if (!spansMatch || !rectsMatch || !unmerged || !unchanged)
+        {
+            printf("diff: %s comparer:%s%s%s%s\n", GetAsciiKernelName(kernel), spansMatch ? "" : " wrong spans",
+                rectsMatch ? "" : " wrong rectangles", unmerged ? "" : " wrong spans without a merge gap",
+                unchanged ? "" : " changes in identical cells");
+            ++failures;
+        }
+    }
+    SelectAsciiKernel(defaultKernel);
+    printf("diff: spans and rectangles of the hand-made grids checked with %d comparers, %d failures\n",
+        comparers, failures);
+    return failures;
+}
+
+static int RunCellDiff(const BenchOptions& options)
+{
+    int failures = CheckCellDiff();
+
+    std::vector<uint8_t> frame;
+    GenerateTestFrame(frame, options.width, options.height);
+
+    AsciiRect region = { 0, 0, options.width, options.height };
+    AsciiGeometry geometry;
+    std::vector<AsciiCell> previous, next;
+    int cols = 0, rows = 0;
+    ConvertRegionToAscii(frame, options.width, options.height, region, geometry, previous, cols, rows);
+    int touched = static_cast<int>(static_cast<double>(cols) * rows * options.changedPercent / 100.0);
+
+    printf("cell diff: %dx%d cells, %d changed per frame, %s kernel, %d frames\n",
+        cols, rows, touched, GetAsciiKernelName(GetActiveAsciiKernel()), options.frames);
+
+    uint32_t seed = 12345;
+    std::vector<AsciiCellSpan> spans;
+    std::vector<AsciiRect> rects;
+    long long spanCells = 0, rectCount = 0, changed = 0;
+    double diffTime = 0.0;
+    for (int i = 0; i < options.frames; ++i)
+    {
+        next = previous;
+        for (int t = 0; t < touched; ++t)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            next[(seed >> 8) % next.size()].ch ^= 1;
+        }
+
+        spans.clear();
+        double start = NowSeconds();
+        changed += DiffAsciiCells(previous.data(), next.data(), cols, rows, 2, spans);
+        GetAsciiSpanRects(spans, geometry, options.width, options.height, rects);
+        diffTime += NowSeconds() - start;
+
+        for (const AsciiCellSpan& span : spans)
+            spanCells += span.length;
+        rectCount += static_cast<long long>(rects.size());
+        previous.swap(next);
+    }
+
+    printf("%12s %14s %14s %14s\n", "ms/frame", "changed/frame", "redrawn/frame", "rects/frame");
+    printf("%12.3f %14lld %14lld %14lld\n", diffTime / options.frames * 1000.0,
+        changed / options.frames, spanCells / options.frames, rectCount / options.frames);
+    return failures ? 1 : 0;
+}
+
+//----------------------------------------------------------------
+// ANSI terminal encoding of a scrolling test pattern: bytes per frame,
+// and with --output - the frames themselves on stdout
+//----------------------------------------------------------------
+
+// Just enough of a terminal to replay Encode output: CUP, ED 2, the SGR
+// color codes Encode emits and UTF-8 text. Colors are kept the way the
+// encoder writes them, palette indices in the 16 and 256 color modes.
+// Printing past the last column counts as an error, since where the
+// cursor goes from there depends on the terminal.
+struct TerminalReplay
+{
+    static const AsciiColor Unset = 0xFFFFFFFFu;
+
+    int cols = 0, rows = 0;
+    int row = 0, col = 0;
+    AsciiColor textColor = Unset, bgColor = Unset;
+    std::vector<AsciiCell> screen;
+    int errors = 0;
+
+    void Reset(int width, int height)
+    {
+        cols = width;
+        rows = height;
+        row = col = 0;
+        textColor = bgColor = Unset;
+        screen.assign(static_cast<size_t>(cols) * rows, AsciiCell{ L' ', Unset, Unset });
+        errors = 0;
+    }
+
+    void Sgr(const std::vector<int>& params)
+    {
+        for (size_t i = 0; i < params.size(); ++i)
+        {
+            int p = params[i];
+            if (p == 0)
+                textColor = bgColor = Unset;
+            else if ((p == 38 || p == 48) && i + 2 < params.size() && params[i + 1] == 5)
+            {
+                (p == 38 ? textColor : bgColor) = static_cast<AsciiColor>(params[i + 2]);
+                i += 2;
+            }
+            else if ((p == 38 || p == 48) && i + 4 < params.size() && params[i + 1] == 2)
+            {
+                (p == 38 ? textColor : bgColor) = AsciiRgb(static_cast<uint8_t>(params[i + 2]),
+                    static_cast<uint8_t>(params[i + 3]), static_cast<uint8_t>(params[i + 4]));
+                i += 4;
+            }
+            else if (p >= 30 && p <= 37)
+                textColor = static_cast<AsciiColor>(p - 30);
+            else if (p >= 90 && p <= 97)
+                textColor = static_cast<AsciiColor>(p - 90 + 8);
+            else if (p >= 40 && p <= 47)
+                bgColor = static_cast<AsciiColor>(p - 40);
+            else if (p >= 100 && p <= 107)
+                bgColor = static_cast<AsciiColor>(p - 100 + 8);
+            else
+                ++errors;
+        }
+    }
+
+    void Print(uint32_t ch)
+    {
+        if (row < 0 || row >= rows || col < 0 || col >= cols)
+        {
+            ++errors;
+            return;
+        }
+        AsciiCell& cell = screen[static_cast<size_t>(row) * cols + col];
+        cell.ch = static_cast<wchar_t>(ch);
+        cell.textColor = textColor;
+        cell.bgColor = bgColor;
+        ++col;
+    }
+
+    void Feed(const std::string& bytes)
+    {
+        size_t i = 0;
+        while (i < bytes.size())
+        {
+            unsigned char c = static_cast<unsigned char>(bytes[i]);
+            if (c == 0x1b)
+            {
+                if (i + 1 >= bytes.size() || bytes[i + 1] != '[')
+                {
+                    ++errors;
+                    return;
+                }
+                i += 2;
+                bool priv = i < bytes.size() && bytes[i] == '?';
+                i += priv ? 1 : 0;
+                std::vector<int> params(1, 0);
+                while (i < bytes.size() && (isdigit(static_cast<unsigned char>(bytes[i])) || bytes[i] == ';'))
+                {
+                    if (bytes[i] == ';')
+                        params.push_back(0);
+                    else
+                        params.back() = params.back() * 10 + (bytes[i] - '0');
+                    ++i;
+                }
+                if (i >= bytes.size())
+                {
+                    ++errors;
+                    return;
+                }
+                char command = bytes[i++];
+                if (priv && params[0] == 25 && (command == 'l' || command == 'h'))
+                    continue;
+                if (command == 'm')
+                    Sgr(params);
+                else if (command == 'H' && params.size() == 2)
+                {
+                    row = params[0] - 1;
+                    col = params[1] - 1;
+                }
+                else if (command == 'J' && params[0] == 2)
+                    screen.assign(screen.size(), AsciiCell{ L' ', textColor, bgColor });
+                else
+                    ++errors;
+                continue;
+            }
+
+            int extra = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+            uint32_t ch = extra == 3 ? c & 0x07 : extra == 2 ? c & 0x0F : extra == 1 ? c & 0x1F : c;
+            if (i + extra >= bytes.size())
+            {
+                ++errors;
+                return;
+            }
+            for (int k = 1; k <= extra; ++k)
+                ch = (ch << 6) | (static_cast<unsigned char>(bytes[i + k]) & 0x3F);
+            i += 1 + extra;
+            Print(ch);
+        }
+    }
+};
+
+// Replays Encode over scrolled frames in every color mode; the screen
+// must show the quantized grid after every frame, text colors aside in
+// blank cells, and a repeated frame must encode to nothing
+static int CheckTerminal(const std::vector<uint8_t>& frame, int width, int height, int scroll, int frames)
+{
+    int failures = 0;
+    AsciiRect region = { 0, 0, width, height };
+    AsciiGeometry geometry;
+    std::vector<AsciiCell> cells, expected;
+    int cols = 0, rows = 0;
+    TerminalReplay terminal;
+    std::string bytes;
+    const AsciiColorMode modes[] = { AsciiColorMode::TrueColor, AsciiColorMode::Xterm256,
+        AsciiColorMode::Ansi16, AsciiColorMode::Adaptive };
+    for (AsciiColorMode mode : modes)
+    {
+        AsciiTerminalEncoder encoder;
+        encoder.SetColorMode(mode);
+        AsciiColorQuantizer quantizer;
+        quantizer.SetMode(mode);
+        int wrongFrames = 0, errors = 0;
+        bool repeated = true;
+        uint32_t seed = 12345;
+        for (int i = 0; i < frames; ++i)
+        {
+            // Every fourth frame scrolls, the others change a few cells,
+            // blanks and last columns included
+            if (i % 4 == 0)
+            {
+                AsciiImageView view;
+                view.data = frame.data() + static_cast<size_t>(i / 4 * 7 % scroll) * 4;
+                view.width = width;
+                view.height = height;
+                view.stride = (width + scroll) * 4;
+                ConvertRegionToAscii(view, region, geometry, cells, cols, rows);
+            }
+            else
+            {
+                for (int t = 0; t < 8; ++t)
+                {
+                    seed = seed * 1664525u + 1013904223u;
+                    AsciiCell& cell = cells[t == 0 ? static_cast<size_t>(seed >> 8) % rows * cols + cols - 1 : (seed >> 8) % cells.size()];
+                    cell.ch = t % 3 == 0 ? L' ' : static_cast<wchar_t>(L'a' + (seed >> 4) % 26);
+                    cell.textColor ^= seed & 0xFFFFFF;
+                    if (t % 2)
+                        cell.bgColor ^= (seed >> 3) & 0xFFFFFF;
+                }
+            }
+            if (i == 0)
+                terminal.Reset(cols, rows);
+
+            bytes.clear();
+            encoder.Encode(cells, cols, rows, bytes);
+            terminal.Feed(bytes);
+            errors += terminal.errors;
+            terminal.errors = 0;
+
+            if (mode == AsciiColorMode::Ansi16 || mode == AsciiColorMode::Xterm256)
+            {
+                expected.resize(cells.size());
+                for (size_t c = 0; c < cells.size(); ++c)
+                {
+                    expected[c].ch = cells[c].ch;
+                    expected[c].textColor = static_cast<AsciiColor>(quantizer.MapIndex(cells[c].textColor));
+                    expected[c].bgColor = static_cast<AsciiColor>(quantizer.MapIndex(cells[c].bgColor));
+                }
+            }
+            else
+                quantizer.Quantize(cells, expected);
+
+            bool match = true;
+            for (size_t c = 0; match && c < expected.size(); ++c)
+            {
+                const AsciiCell& shown = terminal.screen[c];
+                match = shown.ch == expected[c].ch && shown.bgColor == expected[c].bgColor &&
+                    (expected[c].ch == L' ' || shown.textColor == expected[c].textColor);
+            }
+            wrongFrames += match ? 0 : 1;
+
+            bytes.clear();
+            repeated = repeated && encoder.Encode(cells, cols, rows, bytes) == 0 && bytes.empty();
+        }
+        if (wrongFrames || errors || !repeated)
+        {
+            printf("terminal: %s colors: %d of %d frames replay to other cells, %d unknown or wrapping sequences%s\n",
+                GetAsciiColorModeName(mode), wrongFrames, frames, errors, repeated ? "" : ", a repeated frame is not empty");
+            ++failures;
+        }
+    }
+    return failures;
+}
+
+static int RunTerminal(const BenchOptions& options)
+{
+    // Wider than the view so the pattern can scroll by moving the view
+    const int scroll = 256;
+    std::vector<uint8_t> frame;
+    GenerateTestFrame(frame, options.width + scroll, options.height);
+    int failures = CheckTerminal(frame, options.width, options.height, scroll, options.frames < 20 ? options.frames : 20);
+
+    AsciiRect region = { 0, 0, options.width, options.height };
+    AsciiGeometry geometry;
+    std::vector<AsciiCell> asciiOut;
+    int outCols = 0, outRows = 0;
+
+    AsciiTerminalEncoder encoder;
+    encoder.SetColorMode(options.colorMode);
+    bool show = options.output && !strcmp(options.output, "-");
+
+    std::string bytes;
+    size_t totalBytes = 0, firstBytes = 0, maxBytes = 0;
+    double encodeTime = 0.0;
+    for (int i = 0; i < options.frames; ++i)
+    {
+        AsciiImageView view;
+        view.data = frame.data() + static_cast<size_t>(i % scroll) * 4;
+        view.width = options.width;
+        view.height = options.height;
+        view.stride = (options.width + scroll) * 4;
+        ConvertRegionToAscii(view, region, geometry, asciiOut, outCols, outRows);
+
+        bytes.clear();
+        double start = NowSeconds();
+        size_t frameBytes = encoder.Encode(asciiOut, outCols, outRows, bytes);
+        encodeTime += NowSeconds() - start;
+
+        if (i == 0)
+            firstBytes = frameBytes;
+        else
+            maxBytes = frameBytes > maxBytes ? frameBytes : maxBytes;
+        totalBytes += frameBytes;
+        if (show)
+            WriteAsciiTerminal(1, bytes);
+    }
+    if (show)
+    {
+        bytes = AsciiTerminalEncoder::GetRestoreSequence();
+        bytes += "\x1b[";
+        bytes += std::to_string(outRows + 1);
+        bytes += ";1H\n";
+        WriteAsciiTerminal(1, bytes);
+    }
+
+    double updates = options.frames > 1 ? static_cast<double>(totalBytes - firstBytes) / (options.frames - 1) : 0.0;
+    printf("terminal: %dx%d cells, %s colors, %d frames\n", outCols, outRows,
+        GetAsciiColorModeName(options.colorMode), options.frames);
+    printf("%12s %14s %14s %14s %14s\n", "ms/frame", "first bytes", "bytes/update", "max update", "kbit/s @30");
+    printf("%12.3f %14zu %14.0f %14zu %14.0f\n", encodeTime / options.frames * 1000.0,
+        firstBytes, updates, maxBytes, updates * 8.0 * 30.0 / 1000.0);
+    return failures ? 1 : 0;
+}
+
+//----------------------------------------------------------------
+// Hysteresis: hand-made cells first. A ramp step within the glyph margin
+// is held, a larger one passes, a glyph margin of 0 passes every
+// character, and in Shape and Edge modes a structural character passes
+// at any luminance. Then a static frame with a few levels of noise per
+// pixel, the changed cells and terminal bytes per frame with the
+// stabilizer off and at growing margins.
+//----------------------------------------------------------------
+static int RunStabilizerChecks()
+{
+    int failures = 0;
+    AsciiGlyphMode mode = GetAsciiGlyphMode();
+
+    // Ramp cells the way the converter makes them, from flat gray blocks
+    SetAsciiGlyphMode(AsciiGlyphMode::Intensity);
+    AsciiGeometry geometry;
+    std::vector<AsciiCell> cells;
+    auto flatCell = [&](int gray) {
+        std::vector<uint8_t> block(static_cast<size_t>(geometry.blockWidth) * geometry.blockHeight * 4,
+            static_cast<uint8_t>(gray));
+        AsciiRect rect = { 0, 0, geometry.blockWidth, geometry.blockHeight };
+        int cols = 0, rows = 0;
+        ConvertRegionToAscii(block, geometry.blockWidth, geometry.blockHeight, rect, geometry, cells, cols, rows);
+        return cells[0];
+    };
+    // Two levels apart, on either side of a ramp step
+    int gray = 0;
+    while (gray < 250 && flatCell(gray).ch == flatCell(gray + 2).ch)
+        ++gray;
+    const AsciiCell shown = flatCell(gray), step = flatCell(gray + 2), jump = flatCell(gray + 12);
+    const wchar_t structural = shown.ch != L'|' ? L'|' : L'$';
+    const AsciiCell edge = { structural, shown.textColor, shown.bgColor };
+    const AsciiCell other = { structural == L'|' ? L'$' : L'|', shown.textColor, shown.bgColor };
+
+    // The character of to after from on a 1x1 grid
+    auto check = [&](const char* name, AsciiGlyphMode glyphs, AsciiStabilizerOptions margins, const AsciiCell& from,
+        const AsciiCell& to, bool passes) {
+        SetAsciiGlyphMode(glyphs);
+        AsciiTemporalStabilizer stabilizer;
+        stabilizer.SetOptions(margins);
+        std::vector<AsciiCell> grid = { from };
+        stabilizer.Apply(grid, 1, 1);
+        grid = { to };
+        stabilizer.Apply(grid, 1, 1);
+        wchar_t expected = passes ? to.ch : from.ch;
+        if (grid[0].ch != expected)
+        {
+            printf("hysteresis: %s (%s glyphs, margins %d/%d) showed '%lc', expected '%lc'\n", name,
+                GetGlyphModeName(glyphs), margins.glyphMargin, margins.colorMargin,
+                static_cast<wint_t>(grid[0].ch), static_cast<wint_t>(expected));
+            ++failures;
+        }
+    };
+    const AsciiStabilizerOptions off = { 0, 0 }, on = { 4, 8 };
+    const AsciiGlyphMode allModes[] = { AsciiGlyphMode::Intensity, AsciiGlyphMode::Shape, AsciiGlyphMode::Edge };
+    for (AsciiGlyphMode glyphs : allModes)
+    {
+        check("ramp step within the margin", glyphs, on, shown, step, false);
+        check("ramp step past the margin", glyphs, on, shown, jump, true);
+        check("ramp step with the glyph margin off", glyphs, off, shown, step, true);
+        check("character change at equal luminance, margin off", glyphs, off, edge, other, true);
+    }
+    for (AsciiGlyphMode glyphs : { AsciiGlyphMode::Shape, AsciiGlyphMode::Edge })
+    {
+        check("structural character in", glyphs, on, shown, edge, true);
+        check("structural character out", glyphs, on, edge, shown, true);
+        check("structural character change", glyphs, on, edge, other, true);
+    }
+    check("character change at equal luminance", AsciiGlyphMode::Intensity, on, edge, other, false);
+
+    // The grid form drops held cells from the changed list and puts the
+    // shown cell back
+    SetAsciiGlyphMode(AsciiGlyphMode::Intensity);
+    AsciiTemporalStabilizer stabilizer;
+    stabilizer.SetOptions(on);
+    AsciiCellGrid grid;
+    grid.cols = 2;
+    grid.rows = 1;
+    grid.geometry = geometry;
+    grid.glyphVersion = GetAsciiGlyphVersion();
+    grid.cells = { shown, shown };
+    std::vector<int> changed = { 0, 1 };
+    stabilizer.Apply(grid, changed);
+    grid.cells = { step, jump };
+    int held = stabilizer.Apply(grid, changed);
+    if (held != 1 || changed != std::vector<int>{ 1 } || !(grid.cells[0] == shown) || !(grid.cells[1] == jump))
+    {
+        printf("hysteresis: the grid form held %d cells, left %zu changed\n", held, changed.size());
+        ++failures;
+    }
+
+    SetAsciiGlyphMode(mode);
+    return failures;
+}
+
+static int RunHysteresis(const BenchOptions& options)
+{
+    int failures = RunStabilizerChecks();
+
+    std::vector<uint8_t> base, frame;
+    GenerateTestFrame(base, options.width, options.height);
+    frame.resize(base.size());
+
+    AsciiRect region = { 0, 0, options.width, options.height };
+    AsciiGeometry geometry;
+    std::vector<AsciiCell> asciiOut;
+    int outCols = 0, outRows = 0;
+    const int noise = 4;
+
+    printf("hysteresis: %dx%d, +-%d levels of noise, %s colors, %s glyphs, %d frames\n", options.width, options.height,
+        noise, GetAsciiColorModeName(options.colorMode), GetGlyphModeName(options.glyphMode), options.frames);
+    printf("%6s %6s %14s %14s %14s %12s\n", "glyph", "color", "changed/frame", "held/frame", "bytes/update", "ms/frame");
+
+    const AsciiStabilizerOptions margins[] = { { 0, 0 }, { 2, 4 }, { 4, 8 }, { 8, 16 } };
+    for (const AsciiStabilizerOptions& margin : margins)
+    {
+        AsciiTemporalStabilizer stabilizer;
+        stabilizer.SetOptions(margin);
+        AsciiTerminalEncoder encoder;
+        encoder.SetColorMode(options.colorMode);
+        std::string bytes;
+        size_t updateBytes = 0;
+        double stabilizeTime = 0.0;
+        uint32_t seed = 12345;
+        for (int i = 0; i < options.frames; ++i)
+        {
+            for (size_t p = 0; p < base.size(); ++p)
+            {
+                seed = seed * 1664525u + 1013904223u;
+                int v = base[p] + static_cast<int>((seed >> 24) % (2 * noise + 1)) - noise;
+                frame[p] = static_cast<uint8_t>(v < 0 ? 0 : (v > 255 ? 255 : v));
+            }
+            ConvertRegionToAscii(frame, options.width, options.height, region, geometry, asciiOut, outCols, outRows);
+
+            double start = NowSeconds();
+            stabilizer.Apply(asciiOut, outCols, outRows);
+            stabilizeTime += NowSeconds() - start;
+
+            bytes.clear();
+            size_t frameBytes = encoder.Encode(asciiOut, outCols, outRows, bytes);
+            if (i > 0)
+                updateBytes += frameBytes;
+        }
+
+        // The first frame passes in full, count updates only
+        const AsciiStabilizerStats& stats = stabilizer.GetStats();
+        double updates = options.frames > 1 ? options.frames - 1.0 : 1.0;
+        double changed = static_cast<double>(stats.changed - static_cast<uint64_t>(outCols) * outRows) / updates;
+        printf("%6d %6d %14.1f %14.1f %14.0f %12.3f\n", margin.glyphMargin, margin.colorMargin, changed,
+            stats.suppressed / updates, updateBytes / updates, stabilizeTime / options.frames * 1000.0);
+    }
+    return failures ? 1 : 0;
+}
+
+//----------------------------------------------------------------
+// Pyramid: several block sizes from one pass over the pixels, against
+// one ConvertRegionToAscii per size. Every level must match the separate
+// conversion on every kernel, on fixed and generic geometries, and on a
+// region whose edge blocks are clipped.
+//----------------------------------------------------------------
+static int RunPyramid(const BenchOptions& options)
+{
+    std::vector<uint8_t> frame;
+    GenerateTestFrame(frame, options.width, options.height);
+    AsciiImageView image = MakeAsciiImageView(frame, options.width, options.height);
+    const int levelCount = 4;
+
+    std::vector<AsciiPyramidLevel> levels;
+    std::vector<AsciiCell> separate;
+    int cols = 0, rows = 0;
+    int failures = 0;
+
+    const AsciiKernel kernels[] = { AsciiKernel::Scalar, AsciiKernel::SSE41, AsciiKernel::AVX2 };
+    const AsciiGeometry geometries[] = { { 8, 16 }, { 5, 9 } };
+    const AsciiRect regions[] = {
+        { 0, 0, options.width, options.height },
+        { 3, 5, options.width - 7, options.height - 11 },
+    };
+    for (AsciiKernel kernel : kernels)
+    {
+        if (!IsAsciiKernelSupported(kernel))
+            continue;
+        SelectAsciiKernel(kernel);
+        for (int threads = 1; threads <= 2; ++threads)
+        {
+            SetAsciiThreadCount(threads);
+            for (const AsciiGeometry& geometry : geometries)
+            {
+                for (const AsciiRect& region : regions)
+                {
+                    ConvertRegionToAsciiPyramid(image, region, geometry, levelCount, levels);
+                    for (const AsciiPyramidLevel& level : levels)
+                    {
+                        ConvertRegionToAscii(image, region, level.geometry, separate, cols, rows);
+                        if (level.cols != cols || level.rows != rows || level.cells != separate)
+                        {
+                            printf("pyramid: %s kernel, %dx%d blocks, region %d,%d-%d,%d differs from the separate conversion\n",
+                                GetAsciiKernelName(kernel), level.geometry.blockWidth, level.geometry.blockHeight,
+                                region.left, region.top, region.right, region.bottom);
+                            ++failures;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    SetAsciiThreadCount(1);
+    SelectAsciiKernel(options.kernel);
+
+    AsciiRect region = { 0, 0, options.width, options.height };
+    AsciiGeometry geometry;
+    printf("pyramid: %dx%d, %dx%d blocks, %s kernel, %s glyphs, %d frames\n", options.width, options.height,
+        geometry.blockWidth, geometry.blockHeight, GetAsciiKernelName(GetActiveAsciiKernel()),
+        GetGlyphModeName(options.glyphMode), options.frames);
+    printf("%8s %14s %14s %10s\n", "levels", "separate ms", "pyramid ms", "speedup");
+    for (int count = 1; count <= levelCount; ++count)
+    {
+        ConvertRegionToAsciiPyramid(image, region, geometry, count, levels);
+        double start = NowSeconds();
+        for (int i = 0; i < options.frames; ++i)
+        {
+            for (int level = 0; level < count; ++level)
+                ConvertRegionToAscii(image, region, levels[level].geometry, levels[level].cells, cols, rows);
+        }
+        double separateTime = (NowSeconds() - start) / options.frames;
+
+        start = NowSeconds();
+        for (int i = 0; i < options.frames; ++i)
+            ConvertRegionToAsciiPyramid(image, region, geometry, count, levels);
+        double pyramidTime = (NowSeconds() - start) / options.frames;
+
+        printf("%8d %14.3f %14.3f %9.2fx\n", count, separateTime * 1000.0, pyramidTime * 1000.0, separateTime / pyramidTime);
+    }
+    return failures ? 1 : 0;
+}
+
+//----------------------------------------------------------------
+// Integral: cells read from a summed-area table against
+// ConvertRegionToAscii. Integer block sizes must match cell for cell in
+// intensity and shape modes, and edge mode must give the intensity cells.
+// Fractional zoom is checked on what is known without a reference: the
+// cell counts, the integer overload at whole sizes, and every cell of a
+// flat frame. Then build plus conversion against the plain conversion.
+//----------------------------------------------------------------
+static int RunIntegral(const BenchOptions& options)
+{
+    std::vector<uint8_t> frame;
+    GenerateTestFrame(frame, options.width, options.height);
+    AsciiIntegralImage integral;
+    integral.Build(frame, options.width, options.height);
+    std::vector<AsciiCell> reference, cells;
+    int refCols = 0, refRows = 0, cols = 0, rows = 0;
+    int failures = 0;
+
+    AsciiGlyphMode mode = GetAsciiGlyphMode();
+    const AsciiGlyphMode allModes[] = { AsciiGlyphMode::Intensity, AsciiGlyphMode::Shape, AsciiGlyphMode::Edge };
+    const AsciiGeometry geometries[] = { { 8, 16 }, { 5, 9 }, { 3, 5 } };
+    const AsciiRect regions[] = {
+        { 0, 0, options.width, options.height },
+        { 3, 5, options.width - 7, options.height - 11 },
+    };
+    for (AsciiGlyphMode glyphs : allModes)
+    {
+        for (const AsciiGeometry& geometry : geometries)
+        {
+            for (const AsciiRect& region : regions)
+            {
+                // Edge directions need the pixels, the table only has sums
+                SetAsciiGlyphMode(glyphs == AsciiGlyphMode::Edge ? AsciiGlyphMode::Intensity : glyphs);
+                ConvertRegionToAscii(frame, options.width, options.height, region, geometry, reference, refCols, refRows);
+                SetAsciiGlyphMode(glyphs);
+                ConvertIntegralToAscii(integral, region, geometry, cells, cols, rows);
+                if (cols != refCols || rows != refRows || cells != reference)
+                {
+                    printf("integral: %s glyphs, %dx%d blocks, region %d,%d-%d,%d differs from ConvertRegionToAscii\n",
+                        GetGlyphModeName(glyphs), geometry.blockWidth, geometry.blockHeight,
+                        region.left, region.top, region.right, region.bottom);
+                    ++failures;
+                }
+            }
+        }
+    }
+    SetAsciiGlyphMode(AsciiGlyphMode::Intensity);
+
+    // Fractional sizes, zoomed in past one pixel per cell included
+    const double zooms[][2] = { { 7.5, 15.25 }, { 2.75, 3.5 }, { 0.5, 0.75 } };
+    AsciiRect region = regions[1];
+    int regionW = region.right - region.left, regionH = region.bottom - region.top;
+    for (const auto& zoom : zooms)
+    {
+        ConvertIntegralToAscii(integral, region, zoom[0], zoom[1], cells, cols, rows);
+        if (cols != static_cast<int>(std::ceil(regionW / zoom[0])) || rows != static_cast<int>(std::ceil(regionH / zoom[1])) ||
+            cells.size() != static_cast<size_t>(cols) * rows)
+        {
+            printf("integral: %gx%g blocks gave %dx%d cells\n", zoom[0], zoom[1], cols, rows);
+            ++failures;
+        }
+    }
+    ConvertIntegralToAscii(integral, region, 8.0, 16.0, cells, cols, rows);
+    ConvertRegionToAscii(frame, options.width, options.height, region, AsciiGeometry(), reference, refCols, refRows);
+    if (cells != reference)
+    {
+        printf("integral: 8.0x16.0 blocks differ from the integer geometry\n");
+        ++failures;
+    }
+    std::vector<uint8_t> flat(frame.size());
+    for (size_t i = 0; i < flat.size(); i += 4)
+    {
+        flat[i + 0] = 40;
+        flat[i + 1] = 120;
+        flat[i + 2] = 200;
+        flat[i + 3] = 255;
+    }
+    AsciiIntegralImage flatIntegral;
+    flatIntegral.Build(flat, options.width, options.height);
+    ConvertRegionToAscii(flat, options.width, options.height, region, AsciiGeometry(), reference, refCols, refRows);
+    for (const auto& zoom : zooms)
+    {
+        ConvertIntegralToAscii(flatIntegral, region, zoom[0], zoom[1], cells, cols, rows);
+        for (const AsciiCell& cell : cells)
+        {
+            if (!(cell == reference[0]))
+            {
+                printf("integral: %gx%g blocks of a flat frame differ from its cells\n", zoom[0], zoom[1]);
+                ++failures;
+                break;
+            }
+        }
+    }
+    SetAsciiGlyphMode(mode);
+
+    region = regions[0];
+    AsciiGeometry geometry;
+    printf("integral: %dx%d, %dx%d blocks, %s kernel, %s glyphs, %d frames\n", options.width, options.height,
+        geometry.blockWidth, geometry.blockHeight, GetAsciiKernelName(GetActiveAsciiKernel()),
+        GetGlyphModeName(options.glyphMode), options.frames);
+    double start = NowSeconds();
+    for (int i = 0; i < options.frames; ++i)
+        ConvertRegionToAscii(frame, options.width, options.height, region, geometry, reference, refCols, refRows);
+    double plainTime = (NowSeconds() - start) / options.frames;
+    start = NowSeconds();
+    for (int i = 0; i < options.frames; ++i)
+        integral.Build(frame, options.width, options.height);
+    double buildTime = (NowSeconds() - start) / options.frames;
+    start = NowSeconds();
+    for (int i = 0; i < options.frames; ++i)
+        ConvertIntegralToAscii(integral, region, geometry, cells, cols, rows);
+    double lookupTime = (NowSeconds() - start) / options.frames;
+    printf("%14s %14s %14s\n", "plain ms", "build ms", "lookup ms");
+    printf("%14.3f %14.3f %14.3f\n", plainTime * 1000.0, buildTime * 1000.0, lookupTime * 1000.0);
+    return failures ? 1 : 0;
+}
+
+//----------------------------------------------------------------
+// Regions: several capture regions with their own block sizes and
+// palettes, converted from one frame as one batch against one
+// ConvertRegionToAscii per region. Colors must match the separate
+// conversions, and characters must come from each region's palette.
+//----------------------------------------------------------------
+static int RunRegions(const BenchOptions& options)
+{
+    std::vector<uint8_t> frame;
+    GenerateTestFrame(frame, options.width, options.height);
+    AsciiImageView image = MakeAsciiImageView(frame, options.width, options.height);
+    int w = options.width, h = options.height;
+
+    static wchar_t blocks[256], digits[256];
+    BuildAsciiPalette(L" .:-=+*#%@", blocks);
+    BuildAsciiPalette(L" 123456789", digits);
+
+    // A log pane, a chart, a thumbnail, one hanging off the frame and one outside it
+    std::vector<AsciiCaptureRegion> regions(5);
+    regions[0].region = { 0, 0, w / 2, h };
+    regions[1].region = { w / 2, 0, w, h / 2 };
+    regions[1].geometry = { 4, 8 };
+    regions[1].palette = blocks;
+    regions[2].region = { w / 2, h / 2, w * 3 / 4, h };
+    regions[2].geometry = { 5, 9 };
+    regions[2].palette = digits;
+    regions[3].region = { w - 100, h - 50, w + 100, h + 50 };
+    regions[3].geometry = { 16, 32 };
+    regions[4].region = { w + 10, 0, w + 20, 10 };
+
+    std::vector<AsciiCellGrid> grids;
+    std::vector<AsciiCell> separate;
+    int cols = 0, rows = 0;
+    int failures = 0;
+
+    int maxThreads = options.maxThreads > 0 ? options.maxThreads : static_cast<int>(std::thread::hardware_concurrency());
+    maxThreads = maxThreads > 0 ? maxThreads : 1;
+    for (int threads : { 1, maxThreads })
+    {
+        SetAsciiThreadCount(threads);
+        ConvertRegionsToAscii(image, regions, grids);
+        for (size_t i = 0; i < regions.size(); ++i)
+        {
+            const AsciiCaptureRegion& request = regions[i];
+            const AsciiCellGrid& grid = grids[i];
+            ConvertRegionToAscii(image, request.region, request.geometry, separate, cols, rows);
+            bool same = grid.cols == cols && grid.rows == rows && grid.cells.size() == separate.size();
+            for (size_t c = 0; same && c < separate.size(); ++c)
+            {
+                const AsciiCell& cell = grid.cells[c];
+                AsciiColor bg = cell.bgColor;
+                uint32_t luminance = (19595 * AsciiRValue(bg) + 38470 * AsciiGValue(bg) + 7471 * AsciiBValue(bg)) >> 16;
+                wchar_t expected = request.palette && options.glyphMode == AsciiGlyphMode::Intensity ?
+                    request.palette[luminance] : separate[c].ch;
+                same = cell.ch == expected && cell.textColor == separate[c].textColor && bg == separate[c].bgColor;
+            }
+            if (!same)
+            {
+                printf("regions: region %zu differs from its separate conversion with %d threads\n", i, threads);
+                ++failures;
+            }
+        }
+    }
+
+    printf("regions: %dx%d, %zu regions, %s kernel, %s glyphs, %d threads, %d frames\n", w, h, regions.size(),
+        GetAsciiKernelName(GetActiveAsciiKernel()), GetGlyphModeName(options.glyphMode), maxThreads, options.frames);
+    printf("%14s %14s %10s\n", "separate ms", "batched ms", "speedup");
+    double start = NowSeconds();
+    for (int i = 0; i < options.frames; ++i)
+    {
+        for (const AsciiCaptureRegion& request : regions)
+            ConvertRegionToAscii(image, request.region, request.geometry, separate, cols, rows);
+    }
+    double separateTime = (NowSeconds() - start) / options.frames;
+
+    start = NowSeconds();
+    for (int i = 0; i < options.frames; ++i)
+        ConvertRegionsToAscii(image, regions, grids);
+    double batchedTime = (NowSeconds() - start) / options.frames;
+    printf("%14.3f %14.3f %9.2fx\n", separateTime * 1000.0, batchedTime * 1000.0, separateTime / batchedTime);
+
+    SetAsciiThreadCount(1);
+    return failures ? 1 : 0;
+}
+
+//----------------------------------------------------------------
+// Edges: thin lines drawn into single 8x16 blocks must get their
+// directional glyph while flat and noisy blocks keep the intensity one,
+// every kernel must give the scalar kernel's cells, and the cost over
+// plain conversion is measured.
+//----------------------------------------------------------------
+static int RunEdges(const BenchOptions& options)
+{
+    int failures = 0;
+    const AsciiGlyphMode defaultMode = GetAsciiGlyphMode();
+
+    // One pattern per 8x16 block, white on dark gray
+    struct EdgeCase { const char* name; wchar_t expected; };
+    const EdgeCase cases[] = {
+        { "vertical", L'|' }, { "horizontal", L'-' }, { "underline", L'_' }, { "step", L'|' },
+        { "cell diagonal", L'\\' }, { "cell antidiagonal", L'/' }, { "45 degrees", L'\\' },
+        { "flat", 0 }, { "noise", 0 },
+    };
+    const int caseCount = static_cast<int>(sizeof(cases) / sizeof(cases[0]));
+    const int blockW = 8, blockH = 16;
+    std::vector<uint8_t> pattern(static_cast<size_t>(caseCount) * blockW * blockH * 4);
+    uint32_t seed = 99;
+    for (int c = 0; c < caseCount; ++c)
+    {
+        for (int y = 0; y < blockH; ++y)
+        {
+            for (int x = 0; x < blockW; ++x)
+            {
+                bool ink = false;
+                switch (c)
+                {
+                case 0: ink = x == 3; break;
+                case 1: ink = y == 7; break;
+                case 2: ink = y == 14; break;
+                case 3: ink = x >= 4; break;
+                case 4: ink = x == y / 2; break;
+                case 5: ink = x == 7 - y / 2; break;
+                case 6: ink = x == y - 4; break;
+                }
+                uint8_t v = ink ? 230 : 30;
+                if (c == 8)
+                {
+                    seed = seed * 1664525u + 1013904223u;
+                    v = static_cast<uint8_t>(seed >> 24);
+                }
+                uint8_t* pixel = pattern.data() + (static_cast<size_t>(y) * caseCount * blockW + c * blockW + x) * 4;
+                pixel[0] = pixel[1] = pixel[2] = v;
+                pixel[3] = 255;
+            }
+        }
+    }
+
+    AsciiRect patternRegion = { 0, 0, caseCount * blockW, blockH };
+    AsciiGeometry patternGeometry = { blockW, blockH };
+    std::vector<AsciiCell> intensityCells, edgeCells;
+    int cols = 0, rows = 0;
+    SetAsciiGlyphMode(AsciiGlyphMode::Intensity);
+    ConvertRegionToAscii(pattern, caseCount * blockW, blockH, patternRegion, patternGeometry, intensityCells, cols, rows);
+    SetAsciiGlyphMode(AsciiGlyphMode::Edge);
+    ConvertRegionToAscii(pattern, caseCount * blockW, blockH, patternRegion, patternGeometry, edgeCells, cols, rows);
+    for (int c = 0; c < caseCount; ++c)
+    {
+        wchar_t expected = cases[c].expected ? cases[c].expected : intensityCells[c].ch;
+        if (edgeCells[c].ch != expected || edgeCells[c].bgColor != intensityCells[c].bgColor)
+        {
+            printf("edges: %s block got '%lc', expected '%lc'\n", cases[c].name, static_cast<wint_t>(edgeCells[c].ch),
+                static_cast<wint_t>(expected));
+            ++failures;
+        }
+    }
+
+    // Every kernel on the unrolled sizes, generic ones (the tall one past
+    // the strips' 16-bit channel sums) and clipped blocks
+    std::vector<uint8_t> frame;
+    GenerateTestFrame(frame, options.width, options.height);
+    for (size_t i = 0; i < frame.size(); ++i)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        if ((seed >> 28) == 0)
+            frame[i] = static_cast<uint8_t>(seed >> 20);
+    }
+    const AsciiGeometry geometries[] = { { 4, 8 }, { 6, 12 }, { 8, 16 }, { 10, 20 }, { 7, 14 }, { 13, 150 } };
+    const AsciiRect regions[] = {
+        { 0, 0, options.width, options.height },
+        { 3, 5, options.width - 7, options.height - 11 },
+    };
+    const AsciiKernel kernels[] = { AsciiKernel::SSE41, AsciiKernel::AVX2 };
+    std::vector<AsciiCell> reference, cells;
+    int edgeCount = 0;
+    for (const AsciiGeometry& geometry : geometries)
+    {
+        for (const AsciiRect& region : regions)
+        {
+            SelectAsciiKernel(AsciiKernel::Scalar);
+            ConvertRegionToAscii(frame, options.width, options.height, region, geometry, reference, cols, rows);
+            for (const AsciiCell& cell : reference)
+                edgeCount += wcschr(L"|/-\\_", cell.ch) ? 1 : 0;
+            for (AsciiKernel kernel : kernels)
+            {
+                if (!IsAsciiKernelSupported(kernel))
+                    continue;
+                SelectAsciiKernel(kernel);
+                ConvertRegionToAscii(frame, options.width, options.height, region, geometry, cells, cols, rows);
+                if (cells != reference)
+                {
+                    printf("edges: %s kernel, %dx%d blocks, region %d,%d-%d,%d differs from the scalar kernel\n",
+                        GetAsciiKernelName(kernel), geometry.blockWidth, geometry.blockHeight,
+                        region.left, region.top, region.right, region.bottom);
+                    ++failures;
+                }
+            }
+        }
+    }
+    SelectAsciiKernel(options.kernel);
+
+    AsciiRect region = { 0, 0, options.width, options.height };
+    AsciiGeometry geometry;
+    printf("edges: %dx%d, %dx%d blocks, %s kernel, %d frames, %d directional cells in the kernel check\n",
+        options.width, options.height, geometry.blockWidth, geometry.blockHeight,
+        GetAsciiKernelName(GetActiveAsciiKernel()), options.frames, edgeCount);
+    printf("%10s %12s\n", "glyphs", "ms/frame");
+    double intensityTime = 0.0;
+    for (AsciiGlyphMode mode : { AsciiGlyphMode::Intensity, AsciiGlyphMode::Edge })
+    {
+        SetAsciiGlyphMode(mode);
+        ConvertRegionToAscii(frame, options.width, options.height, region, geometry, cells, cols, rows);
+        double start = NowSeconds();
+        for (int i = 0; i < options.frames; ++i)
+            ConvertRegionToAscii(frame, options.width, options.height, region, geometry, cells, cols, rows);
+        double perFrame = (NowSeconds() - start) / options.frames;
+        if (mode == AsciiGlyphMode::Intensity)
+            intensityTime = perFrame;
+        printf("%10s %12.3f", GetGlyphModeName(mode), perFrame * 1000.0);
+        if (mode == AsciiGlyphMode::Edge)
+            printf("  (+%.0f%%)", (perFrame / intensityTime - 1.0) * 100.0);
+        printf("\n");
+    }
+    SetAsciiGlyphMode(defaultMode);
+    return failures ? 1 : 0;
+}
+
+//----------------------------------------------------------------
+// Serve: one converted stream fanned out over localhost to plain TCP and
+// WebSocket viewers that keep up, to one that reads slowly and to two that
+// hang up mid-stream. The fast viewers must end on exactly the published
+// grid; the slow one must skip ahead to keyframes without ever failing to
+// decode, and the server must let go of the ones that left.
+//----------------------------------------------------------------
+struct ServeViewer
+{
+    const char* kind;
+    bool websocket;
+    int delayMs;        // Pause after every packet
+    uint64_t dropAfter; // Packets before it disconnects, 0 = never
+    std::thread thread;
+    AsciiDeltaDecoder decoder;
+    std::atomic<uint32_t> frame{ 0 }; // Last frame decoded, for the publisher to wait on
+    uint64_t packets = 0;
+    uint64_t skipped = 0; // Frames jumped over by a keyframe
+    uint64_t errors = 0;
+    bool connected = false;
+};
+
+// A keyframe header claiming more cells than its body can hold must be
+// refused before the decoder allocates the grid; the densest legal run
+// length keyframe must still decode
+static int CheckPacketBounds()
+{
+    int failures = 0;
+    AsciiDeltaEncoder encoder;
+    AsciiDeltaDecoder decoder;
+    std::vector<AsciiCell> flat(static_cast<size_t>(129) * 64, AsciiCell{ L' ', AsciiRgb(1, 2, 3), AsciiRgb(4, 5, 6) });
+    for (bool runLength : { false, true })
+    {
+        std::string packet;
+        encoder.Reset();
+        encoder.SetRunLength(runLength);
+        encoder.Encode(flat, 129, 64, true, packet);
+        bool dense = decoder.Decode(reinterpret_cast<const uint8_t*>(packet.data()), packet.size()) &&
+            decoder.GetCells() == flat;
+
+        // 65535 x 65535 cells on the same body
+        packet[8] = packet[9] = packet[10] = packet[11] = static_cast<char>(0xFF);
+        bool refused = false;
+        try
+        {
+            refused = !decoder.Decode(reinterpret_cast<const uint8_t*>(packet.data()), packet.size()) && !decoder.IsValid();
+        }
+        catch (const std::bad_alloc&)
+        {
+        }
+        if (!dense || !refused)
+        {
+            printf("serve: %s keyframe:%s%s\n", runLength ? "run length" : "plain", dense ? "" : " does not decode",
+                refused ? "" : " an oversized header is not refused");
+            ++failures;
+        }
+    }
+    return failures;
+}
+
+static int RunServe(const BenchOptions& options)
+{
+    int failures = CheckPacketBounds();
+    std::vector<uint8_t> base, frame;
+    GenerateTestFrame(base, options.width, options.height);
+    frame = base;
+
+    AsciiServerOptions serverOptions;
+    serverOptions.port = 0;
+    serverOptions.keyframeInterval = 60;
+    serverOptions.maxBacklogBytes = 0;     // Two keyframes
+    serverOptions.sendBufferBytes = 64 << 10;
+    AsciiFanoutServer server;
+    if (!server.Start(serverOptions))
+    {
+        fprintf(stderr, "serve: %s\n", server.GetError().c_str());
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<ServeViewer>> viewers;
+    const struct { const char* kind; bool websocket; int delayMs; uint64_t dropAfter; } kinds[] = {
+        { "tcp", false, 0, 0 }, { "tcp", false, 0, 0 }, { "tcp", false, 0, 0 },
+        { "websocket", true, 0, 0 }, { "websocket", true, 0, 0 }, { "tcp slow", false, 25, 0 },
+        { "tcp drop", false, 0, 20 }, { "ws drop", true, 0, 40 },
+    };
+    std::atomic<int> ready{ 0 };
+    std::atomic<bool> done{ false };
+    for (const auto& kind : kinds)
+    {
+        viewers.emplace_back(new ServeViewer());
+        ServeViewer* viewer = viewers.back().get();
+        viewer->kind = kind.kind;
+        viewer->websocket = kind.websocket;
+        viewer->delayMs = kind.delayMs;
+        viewer->dropAfter = kind.dropAfter;
+        viewer->thread = std::thread([&, viewer]() {
+            AsciiStreamClient client;
+            if (viewer->delayMs > 0)
+                client.SetReceiveBuffer(4096);
+            viewer->connected = client.Connect("127.0.0.1", server.GetPort(), viewer->websocket);
+            ++ready;
+            std::string packet;
+            while (viewer->connected && !done && client.ReadPacket(packet))
+            {
+                ++viewer->packets;
+                uint32_t previous = viewer->decoder.GetFrame();
+                if (!viewer->decoder.Decode(reinterpret_cast<const uint8_t*>(packet.data()), packet.size()))
+                    ++viewer->errors;
+                if (previous != 0 && viewer->decoder.GetFrame() > previous + 1)
+                    viewer->skipped += viewer->decoder.GetFrame() - previous - 1;
+                viewer->frame = viewer->decoder.GetFrame();
+                if (viewer->delayMs > 0)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(viewer->delayMs));
+                if (viewer->dropAfter && viewer->packets == viewer->dropAfter)
+                    break;
+            }
+            client.Close();
+        });
+    }
+    while (ready < static_cast<int>(viewers.size()))
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    while (server.GetStats().clients < static_cast<int>(viewers.size()))
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    // A window of moving video on a static desktop, 60 frames a second
+    AsciiRect region = { 0, 0, options.width, options.height };
+    AsciiGeometry geometry;
+    std::vector<AsciiCell> asciiOut;
+    int outCols = 0, outRows = 0;
+    int boxWidth = options.width / 3, boxHeight = options.height / 3;
+    std::vector<AsciiClientStats> clients;
+    std::map<uint64_t, uint32_t> maxLag;
+    double next = NowSeconds();
+    for (int i = 0; i < options.frames; ++i)
+    {
+        for (int y = boxHeight; y < 2 * boxHeight; ++y)
+        {
+            uint8_t* row = frame.data() + static_cast<size_t>(y) * options.width * 4;
+            const uint8_t* source = base.data() + static_cast<size_t>((y + i * 3) % options.height) * options.width * 4;
+            for (int x = boxWidth; x < 2 * boxWidth; ++x)
+                memcpy(row + x * 4, source + ((x + i * 5) % options.width) * 4, 4);
+        }
+        ConvertRegionToAscii(frame, options.width, options.height, region, geometry, asciiOut, outCols, outRows);
+        server.Publish(asciiOut, outCols, outRows);
+
+        server.GetClientStats(clients);
+        for (const AsciiClientStats& client : clients)
+            maxLag[client.id] = std::max(maxLag[client.id], client.lagFrames);
+
+        next += 1.0 / 60.0;
+        double wait = next - NowSeconds();
+        if (wait > 0.0)
+            std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+    }
+
+    // The picture stays still while the fast viewers catch up, as a static
+    // desktop would; one that skipped at the end gets its keyframe this
+    // way. The slow one is cut off.
+    double deadline = NowSeconds() + 5.0;
+    uint32_t lastFrame = static_cast<uint32_t>(server.GetStats().frames);
+    for (;;)
+    {
+        bool behind = false;
+        for (const std::unique_ptr<ServeViewer>& viewer : viewers)
+            behind |= viewer->delayMs == 0 && !viewer->dropAfter && viewer->frame != lastFrame;
+        if (!behind || NowSeconds() > deadline)
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(16));
+        server.Publish(asciiOut, outCols, outRows);
+        lastFrame = static_cast<uint32_t>(server.GetStats().frames);
+    }
+    server.GetClientStats(clients);
+    AsciiServerStats stats = server.GetStats();
+    done = true;
+    server.Stop();
+    for (const std::unique_ptr<ServeViewer>& viewer : viewers)
+        viewer->thread.join();
+
+    printf("serve: %dx%d cells, %d frames at 60 fps (%u with the catch-up), %zu viewers, keyframe every %d frames\n",
+        outCols, outRows, options.frames, lastFrame, viewers.size(), serverOptions.keyframeInterval);
+    double frames = static_cast<double>(stats.frames);
+    printf("%14s %14s %14s %14s %14s %14s\n", "encode ms", "max encode ms", "keyframes", "key bytes", "delta bytes", "sent MB");
+    printf("%14.3f %14.3f %14llu %14.0f %14.0f %14.2f\n", stats.encodeTime / frames / 1e6, stats.maxEncodeTime / 1e6,
+        static_cast<unsigned long long>(stats.keyframes),
+        stats.keyframes ? static_cast<double>(stats.keyframeBytes) / stats.keyframes : 0.0,
+        stats.deltas ? static_cast<double>(stats.deltaBytes) / stats.deltas : 0.0, stats.bytesSent / 1e6);
+
+    // As the server saw them, in the order they connected
+    printf("%6s %-10s %9s %9s %9s %9s %9s\n", "client", "protocol", "frames", "skipped", "max lag", "lag ms", "sent MB");
+    for (const AsciiClientStats& client : clients)
+    {
+        printf("%6llu %-10s %9llu %9llu %9u %9.1f %9.2f\n", static_cast<unsigned long long>(client.id),
+            client.websocket ? "websocket" : "tcp", static_cast<unsigned long long>(client.frames),
+            static_cast<unsigned long long>(client.skipped), maxLag[client.id], client.lagSeconds * 1000.0,
+            client.bytesSent / 1e6);
+    }
+
+    printf("%-10s %9s %9s %9s %8s\n", "viewer", "packets", "skipped", "frame", "result");
+    for (const std::unique_ptr<ServeViewer>& viewer : viewers)
+    {
+        bool ok = viewer->connected && viewer->errors == 0;
+        if (viewer->dropAfter)
+            ok = ok && viewer->packets == viewer->dropAfter;
+        else if (viewer->delayMs == 0)
+            ok = ok && viewer->decoder.IsValid() && viewer->frame == lastFrame && viewer->decoder.GetCells() == asciiOut;
+        else
+            ok = ok && viewer->skipped > 0;
+        failures += ok ? 0 : 1;
+        printf("%-10s %9llu %9llu %9u %8s\n", viewer->kind, static_cast<unsigned long long>(viewer->packets),
+            static_cast<unsigned long long>(viewer->skipped), static_cast<uint32_t>(viewer->frame), ok ? "ok" : "FAILED");
+    }
+
+    // Everyone but the viewers that hung up was still connected at the end
+    int staying = 0;
+    for (const std::unique_ptr<ServeViewer>& viewer : viewers)
+        staying += viewer->dropAfter ? 0 : 1;
+    if (stats.clients != staying)
+    {
+        printf("serve: %d viewers connected at the end, %d expected\n", stats.clients, staying);
+        ++failures;
+    }
+    return failures ? 1 : 0;
+}
+
+//----------------------------------------------------------------
+// Record: a synthetic session written to a recording, then opened by
+// the player for random seeks and sequential playback. Every frame read
+// back must match what was written, also from a copy whose index was
+// cut off (the recorder died) and has to be rebuilt.
+//----------------------------------------------------------------
+static uint64_t HashCells(const std::vector<AsciiCell>& cells)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (const AsciiCell& cell : cells)
+    {
+        uint64_t values[3] = { static_cast<uint64_t>(cell.ch), cell.textColor, cell.bgColor };
+        for (uint64_t value : values)
+            hash = (hash ^ value) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Seeks and plays back path; returns the number of frames that differ
+// from hashes
+static int CheckPlayback(const char* label, const char* path, const std::vector<uint64_t>& hashes, size_t expectedFrames)
+{
+    double start = NowSeconds();
+    AsciiRecordingReader reader;
+    if (!reader.Open(path))
+    {
+        printf("%-10s cannot open %s  FAILED\n", label, path);
+        return 1;
+    }
+    double openTime = NowSeconds() - start;
+    int failures = reader.GetFrameCount() == expectedFrames ? 0 : 1;
+
+    const int seeks = 1000;
+    uint32_t seed = 12345;
+    double seekTime = 0.0, maxSeek = 0.0;
+    for (int i = 0; i < seeks && reader.GetFrameCount() > 0; ++i)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        uint64_t time = reader.GetDuration() * (seed >> 8) / (1u << 24);
+        double seekStart = NowSeconds();
+        size_t frame = reader.FindFrame(time);
+        bool ok = reader.ReadFrame(frame);
+        double seconds = NowSeconds() - seekStart;
+        seekTime += seconds;
+        maxSeek = seconds > maxSeek ? seconds : maxSeek;
+        ok = ok && reader.GetTimestamp(frame) <= time &&
+            (frame + 1 == reader.GetFrameCount() || reader.GetTimestamp(frame + 1) > time);
+        failures += ok && HashCells(reader.GetCells()) == hashes[frame] ? 0 : 1;
+    }
+
+    start = NowSeconds();
+    for (size_t frame = 0; frame < reader.GetFrameCount(); ++frame)
+        failures += reader.ReadFrame(frame) && HashCells(reader.GetCells()) == hashes[frame] ? 0 : 1;
+    double playTime = NowSeconds() - start;
+
+    printf("%-10s %8s %10.3f %10.1f %10.1f %12.0f %8s\n", label, reader.HasIndex() ? "trailer" : "rebuilt",
+        openTime * 1000.0, seekTime / seeks * 1e6, maxSeek * 1e6,
+        reader.GetFrameCount() / (playTime > 0.0 ? playTime : 1e-9), failures ? "FAILED" : "ok");
+    return failures;
+}
+
+static int RunRecord(const BenchOptions& options)
+{
+    std::vector<uint8_t> base, frame;
+    GenerateTestFrame(base, options.width, options.height);
+    frame = base;
+
+    std::string path = options.output ? options.output :
+        (std::filesystem::temp_directory_path() / "asciifilter_bench.rec").string();
+    AsciiRecordingOptions recordingOptions;
+    recordingOptions.keyframeInterval = 300;
+    AsciiRecordingWriter writer;
+    if (!writer.Open(path.c_str(), recordingOptions))
+    {
+        fprintf(stderr, "record: cannot write %s\n", path.c_str());
+        return 1;
+    }
+
+    // The moving window of the serve mode, recorded at 60 fps
+    AsciiRect region = { 0, 0, options.width, options.height };
+    AsciiGeometry geometry;
+    std::vector<AsciiCell> asciiOut;
+    int outCols = 0, outRows = 0;
+    int boxWidth = options.width / 3, boxHeight = options.height / 3;
+    std::vector<uint64_t> hashes;
+    for (int i = 0; i < options.frames; ++i)
+    {
+        for (int y = boxHeight; y < 2 * boxHeight; ++y)
+        {
+            uint8_t* row = frame.data() + static_cast<size_t>(y) * options.width * 4;
+            const uint8_t* source = base.data() + static_cast<size_t>((y + i * 3) % options.height) * options.width * 4;
+            for (int x = boxWidth; x < 2 * boxWidth; ++x)
+                memcpy(row + x * 4, source + ((x + i * 5) % options.width) * 4, 4);
+        }
+        ConvertRegionToAscii(frame, options.width, options.height, region, geometry, asciiOut, outCols, outRows);
+        writer.WriteFrame(asciiOut, outCols, outRows, static_cast<uint64_t>(i) * 1000000000ull / 60);
+        hashes.push_back(HashCells(asciiOut));
+    }
+    uint64_t indexStart = writer.GetStats().bytes;
+    double closeStart = NowSeconds();
+    bool written = writer.Close();
+    double closeTime = NowSeconds() - closeStart;
+    const AsciiRecordingStats& stats = writer.GetStats();
+
+    double writeSeconds = stats.encodeTime / 1e9 + closeTime;
+    double seconds = options.frames / 60.0;
+    printf("record: %dx%d cells, %d frames at 60 fps, keyframe every %d frames, %s\n", outCols, outRows,
+        options.frames, recordingOptions.keyframeInterval, path.c_str());
+    printf("%12s %12s %12s %12s %12s %12s\n", "ms/frame", "MB/s", "MB", "bytes/frame", "keyframes", "GB/hour");
+    printf("%12.3f %12.1f %12.2f %12.0f %12llu %12.2f\n", writeSeconds / options.frames * 1000.0,
+        stats.bytes / 1e6 / (writeSeconds > 0.0 ? writeSeconds : 1e-9), stats.bytes / 1e6,
+        static_cast<double>(stats.bytes) / options.frames, static_cast<unsigned long long>(stats.keyframes),
+        stats.bytes / seconds * 3600.0 / 1e9);
+
+    // Copies of the file cut to size bytes, with an edit applied
+    std::vector<char> bytes;
+    if (FILE* in = fopen(path.c_str(), "rb"))
+    {
+        bytes.resize(static_cast<size_t>(stats.bytes));
+        if (fread(bytes.data(), 1, bytes.size(), in) != bytes.size())
+            bytes.clear();
+        fclose(in);
+    }
+    auto writeCopy = [&](const std::string& copy, size_t size, const std::function<void(std::vector<char>&)>& edit) {
+        if (bytes.size() < size)
+            return false;
+        std::vector<char> data(bytes.begin(), bytes.begin() + size);
+        edit(data);
+        FILE* out = fopen(copy.c_str(), "wb");
+        bool ok = out && fwrite(data.data(), 1, data.size(), out) == data.size();
+        if (out)
+            fclose(out);
+        return ok;
+    };
+
+    // Cut the index off and tear the last record, as a crash would
+    std::string partial = path + ".partial";
+    bool copied = writeCopy(partial, static_cast<size_t>(indexStart - 5), [](std::vector<char>&) {});
+
+    printf("%-10s %8s %10s %10s %10s %12s %8s\n", "file", "index", "open ms", "seek us", "max us", "play fps", "result");
+    int failures = written ? 0 : 1;
+    failures += CheckPlayback("closed", path.c_str(), hashes, hashes.size());
+    failures += copied ? CheckPlayback("crashed", partial.c_str(), hashes, hashes.size() - 1) : 1;
+
+    // A header with a few bytes after it is shorter than the trailer and
+    // opens as an empty recording
+    std::string stub = path + ".stub";
+    AsciiRecordingReader reader;
+    if (!writeCopy(stub, ASCII_RECORDING_HEADER_SIZE + 5, [](std::vector<char>&) {}) ||
+        !reader.Open(stub.c_str()) || reader.GetFrameCount() != 0 || reader.ReadFrame(0))
+    {
+        printf("record: a file shorter than the trailer is not read as empty\n");
+        ++failures;
+    }
+
+    // An index entry whose keyframe lies after its frame must be rejected
+    // instead of returning the cells of another frame
+    std::string damaged = path + ".damaged";
+    size_t victim = hashes.size() / 2;
+    bool edited = writeCopy(damaged, bytes.size(), [&](std::vector<char>& data) {
+        size_t field = static_cast<size_t>(indexStart) + victim * ASCII_RECORDING_ENTRY_SIZE + 16;
+        uint32_t keyframe = static_cast<uint32_t>(victim + 1);
+        for (int i = 0; i < 4; ++i)
+            data[field + i] = static_cast<char>(keyframe >> (i * 8));
+    });
+    if (!edited || !reader.Open(damaged.c_str()) || !reader.HasIndex() || !reader.ReadFrame(victim - 1) ||
+        reader.ReadFrame(victim) || !reader.ReadFrame(victim + 1) || HashCells(reader.GetCells()) != hashes[victim + 1])
+    {
+        printf("record: an index entry with a later keyframe is not rejected\n");
+        ++failures;
+    }
+    reader.Close();
+
+    std::error_code error;
+    std::filesystem::remove(partial, error);
+    std::filesystem::remove(stub, error);
+    std::filesystem::remove(damaged, error);
+    if (!options.output)
+        std::filesystem::remove(path, error);
+    return failures ? 1 : 0;
+}
+
+//----------------------------------------------------------------
+// Suite: conversion and rendering over a matrix of resolutions, block
+// sizes and palettes, optionally checked against a stored baseline
+//----------------------------------------------------------------
+struct SuiteResult
+{
+    std::string name;
+    double nsPerCell;
+};
+
+// Best of three timed runs, each repeating the work for at least
+// minSeconds, so one descheduled run does not fail the baseline
+template <typename Work>
+static double MeasureSeconds(double minSeconds, const Work& work)
+{
+    work(); // Warm up
+    double best = 0.0;
+    for (int run = 0; run < 3; ++run)
+    {
+        int iterations = 0;
+        double start = NowSeconds(), elapsed = 0.0;
+        do
+        {
+            work();
+            ++iterations;
+            elapsed = NowSeconds() - start;
+        } while (elapsed < minSeconds);
+        double perIteration = elapsed / iterations;
+        best = run == 0 || perIteration < best ? perIteration : best;
+    }
+    return best;
+}
+
+static bool ReadBaseline(const char* path, std::map<std::string, double>& baseline)
+{
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return false;
+    char name[256];
+    double value = 0.0;
+    while (fscanf(file, "%255s %lf", name, &value) == 2)
+        baseline[name] = value;
+    fclose(file);
+    return true;
+}
+
+static bool WriteBaseline(const char* path, const std::vector<SuiteResult>& results)
+{
+    FILE* file = fopen(path, "w");
+    if (!file)
+        return false;
+    for (const SuiteResult& result : results)
+        fprintf(file, "%s %.4f\n", result.name.c_str(), result.nsPerCell);
+    return fclose(file) == 0;
+}
+
+static void MeasureSuite(const BenchOptions& options, std::vector<SuiteResult>& results)
+{
+    struct Resolution { const char* name; int width; int height; };
+    const Resolution allResolutions[] = {
+        { "720p", 1280, 720 }, { "1080p", 1920, 1080 }, { "1440p", 2560, 1440 },
+        { "4k", 3840, 2160 }, { "8k", 7680, 4320 } };
+    // The unrolled sizes plus one that takes the generic kernel
+    const AsciiGeometry allBlocks[] = { { 4, 8 }, { 8, 16 }, { 10, 20 }, { 7, 14 } };
+    struct Palette { const char* name; const char* chars; };
+    const Palette allPalettes[] = { { "full", nullptr }, { "ramp10", " .:-=+*#%@" } };
+    const AsciiGlyphMode glyphModes[] = { AsciiGlyphMode::Intensity, AsciiGlyphMode::Shape };
+
+    const int resolutionCount = options.quick ? 2 : 5;
+    const int blockCount = options.quick ? 2 : 4;
+    const int paletteCount = options.quick ? 1 : 2;
+    const double minSeconds = options.quick ? 0.05 : 0.2;
+
+    const AsciiGlyphSet defaultGlyphs = GetAsciiGlyphSet();
+    const AsciiGlyphMode defaultMode = GetAsciiGlyphMode();
+
+    printf("%-36s %10s %10s %10s\n", "case", "ns/cell", "GB/s", "frames/s");
+
+    results.clear();
+    std::vector<uint8_t> frame, rendered;
+    std::vector<AsciiCell> asciiOut;
+    for (int r = 0; r < resolutionCount; ++r)
+    {
+        const Resolution& res = allResolutions[r];
+        GenerateTestFrame(frame, res.width, res.height);
+        AsciiRect region = { 0, 0, res.width, res.height };
+        const double frameBytes = static_cast<double>(res.width) * res.height * 4;
+
+        for (int b = 0; b < blockCount; ++b)
+        {
+            // Quick runs keep the two most common sizes, 8x16 and 4x8
+            const AsciiGeometry& geometry = allBlocks[options.quick ? 1 - b : b];
+            int cols = 0, rows = 0;
+            char name[128];
+            auto report = [&](double seconds) {
+                double nsPerCell = seconds * 1e9 / (static_cast<double>(cols) * rows);
+                printf("%-36s %10.2f %10.2f %10.1f\n", name, nsPerCell, frameBytes / seconds / 1e9, 1.0 / seconds);
+                results.push_back({ name, nsPerCell });
+            };
+
+            for (int p = 0; p < paletteCount; ++p)
+            {
+                AsciiGlyphSet glyphs;
+                if (allPalettes[p].chars)
+                    glyphs.AddBuiltinGlyphs(allPalettes[p].chars);
+                SetAsciiGlyphSet(allPalettes[p].chars ? glyphs : defaultGlyphs);
+
+                for (AsciiGlyphMode glyphMode : glyphModes)
+                {
+                    SetAsciiGlyphMode(glyphMode);
+                    double seconds = MeasureSeconds(minSeconds, [&]() {
+                        ConvertRegionToAscii(frame, res.width, res.height, region, geometry, asciiOut, cols, rows);
+                    });
+                    snprintf(name, sizeof(name), "convert/%s/%dx%d/%s/%s", res.name, geometry.blockWidth,
+                        geometry.blockHeight, allPalettes[p].name, GetGlyphModeName(glyphMode));
+                    report(seconds);
+                }
+            }
+            SetAsciiGlyphSet(defaultGlyphs);
+            SetAsciiGlyphMode(defaultMode);
+
+            // Rendering the cells back to a full frame
+            ConvertRegionToAscii(frame, res.width, res.height, region, geometry, asciiOut, cols, rows);
+            AsciiGlyphAtlas atlas;
+            atlas.Reset(geometry.blockWidth, geometry.blockHeight);
+            atlas.AddBuiltinGlyphs();
+            rendered.resize(frame.size());
+            double seconds = MeasureSeconds(minSeconds, [&]() {
+                RenderAsciiCells(asciiOut, cols, rows, atlas, rendered.data(), res.width, res.height, res.width * 4);
+            });
+            snprintf(name, sizeof(name), "render/%s/%dx%d", res.name, geometry.blockWidth, geometry.blockHeight);
+            report(seconds);
+        }
+    }
+
+}
+
+static int CountRegressions(const BenchOptions& options, const std::vector<SuiteResult>& results,
+    const std::map<std::string, double>& baseline, bool print)
+{
+    int regressions = 0;
+    for (const SuiteResult& result : results)
+    {
+        auto it = baseline.find(result.name);
+        if (it == baseline.end())
+            continue;
+        double change = (result.nsPerCell / it->second - 1.0) * 100.0;
+        if (change > options.tolerance)
+        {
+            if (print)
+            {
+                printf("REGRESSION %s: %.2f ns/cell, baseline %.2f (+%.1f%%)\n",
+                    result.name.c_str(), result.nsPerCell, it->second, change);
+            }
+            ++regressions;
+        }
+    }
+    return regressions;
+}
+
+static int RunSuite(const BenchOptions& options)
+{
+    printf("suite: %s kernel, %d thread(s)%s\n", GetAsciiKernelName(GetActiveAsciiKernel()),
+        GetAsciiThreadCount(), options.quick ? ", quick" : "");
+
+    std::vector<SuiteResult> results;
+    MeasureSuite(options, results);
+    if (!options.baseline)
+        return 0;
+
+    std::map<std::string, double> baseline;
+    if (options.updateBaseline || !ReadBaseline(options.baseline, baseline))
+    {
+        // No baseline yet: this run becomes it
+        if (!WriteBaseline(options.baseline, results))
+        {
+            fprintf(stderr, "cannot write baseline %s\n", options.baseline);
+            return 1;
+        }
+        printf("baseline written to %s\n", options.baseline);
+        return 0;
+    }
+
+    // A slow case has to be slow twice: measure once more and keep the
+    // faster result, so a noisy neighbour does not fail the check
+    if (CountRegressions(options, results, baseline, false))
+    {
+        printf("re-measuring\n");
+        std::vector<SuiteResult> again;
+        MeasureSuite(options, again);
+        for (size_t i = 0; i < results.size() && i < again.size(); ++i)
+            results[i].nsPerCell = again[i].nsPerCell < results[i].nsPerCell ? again[i].nsPerCell : results[i].nsPerCell;
+    }
+
+    int regressions = CountRegressions(options, results, baseline, true);
+    int compared = 0;
+    for (const SuiteResult& result : results)
+        compared += baseline.count(result.name) ? 1 : 0;
+    printf("%d of %d cases within %.0f%% of %s\n", compared - regressions, compared, options.tolerance, options.baseline);
+    return regressions ? 1 : 0;
+}
+
+//----------------------------------------------------------------
+// Metrics: histogram buckets and percentiles of known values, counters
+// that start over with every snapshot, and the CSV and JSON lines files
+//----------------------------------------------------------------
+
+// Just enough JSON to check the metrics lines: objects, strings without
+// escapes and numbers
+static bool SkipJsonValue(const char*& p)
+{
+    if (*p == '{')
+    {
+        ++p;
+        if (*p == '}')
+            return ++p, true;
+        for (;;)
+        {
+            if (*p != '"' || !SkipJsonValue(p) || *p++ != ':' || !SkipJsonValue(p))
+                return false;
+            if (*p == '}')
+                return ++p, true;
+            if (*p++ != ',')
+                return false;
+        }
+    }
+    if (*p == '"')
+    {
+        const char* end = strchr(p + 1, '"');
+        if (!end || end == p + 1)
+            return false;
+        p = end + 1;
+        return true;
+    }
+    char* end = nullptr;
+    strtod(p, &end);
+    if (end == p)
+        return false;
+    p = end;
+    return true;
+}
+
+static bool IsJsonObject(const std::string& line)
+{
+    const char* p = line.c_str();
+    return *p == '{' && SkipJsonValue(p) && *p == '\0';
+}
+
+static int RunMetrics(const BenchOptions&)
+{
+    int failures = 0;
+    auto check = [&](const char* what, bool ok) {
+        if (!ok)
+        {
+            printf("metrics: %s\n", what);
+            ++failures;
+        }
+    };
+
+    // Every value lands in a bucket whose middle is within half a bucket,
+    // 1/32 of it (exact below 16), and buckets grow with the values
+    bool bucketsOk = true;
+    int previous = -1;
+    uint64_t checked = 0;
+    for (uint64_t value = 0; value < (uint64_t(1) << 62); value = value < 4096 ? value + 1 : value + value / 61 + 1, ++checked)
+    {
+        int bucket = AsciiHistogram::GetBucket(value);
+        uint64_t middle = AsciiHistogram::GetBucketValue(bucket);
+        uint64_t error = middle > value ? middle - value : value - middle;
+        bucketsOk = bucketsOk && bucket >= previous && bucket < AsciiHistogram::BUCKET_COUNT &&
+            (value < AsciiHistogram::SUB_BUCKETS ? error == 0 : error <= value / 32);
+        previous = bucket;
+    }
+    int last = AsciiHistogram::GetBucket(~uint64_t(0));
+    check("a bucket is out of order, out of range or too far from its values",
+        bucketsOk && last >= previous && last < AsciiHistogram::BUCKET_COUNT);
+
+    // 1..1000 microseconds once each
+    AsciiHistogram histogram;
+    for (uint64_t us = 1; us <= 1000; ++us)
+        histogram.Record(us * 1000);
+    AsciiHistogram::Summary summary = histogram.Drain();
+    auto near = [](uint64_t value, uint64_t expected) {
+        return (value > expected ? value - expected : expected - value) <= expected / 16;
+    };
+    check("percentiles of 1..1000 us are off", summary.count == 1000 && summary.max == 1000000 &&
+        summary.mean == 500500.0 && near(summary.p50, 500000) && near(summary.p95, 950000) && near(summary.p99, 990000) &&
+        summary.p50 <= summary.p95 && summary.p95 <= summary.p99 && summary.p99 <= summary.max);
+    summary = histogram.Drain();
+    check("a second drain is not empty", summary.count == 0 && summary.max == 0 && summary.p99 == 0);
+    histogram.Record(7);
+    summary = histogram.Drain();
+    check("a drained histogram does not start over", summary.count == 1 && summary.p50 == 7 && summary.p99 == 7 &&
+        summary.max == 7 && summary.mean == 7.0);
+
+    // 10 frames within a 10 ms budget, 5 over it, 7 dropped
+    AsciiMetrics metrics;
+    int convert = metrics.AddStage("convert");
+    int draw = metrics.AddStage("draw");
+    metrics.SetFrameBudget(0.010);
+    for (int i = 0; i < 15; ++i)
+    {
+        metrics.Record(convert, 3000000);
+        metrics.Record(draw, 1000000);
+        metrics.EndFrame(i < 10 ? 5000000 : 20000000);
+    }
+    metrics.AddDropped(3);
+    metrics.AddDropped(4);
+    AsciiMetricsSnapshot snapshot;
+    metrics.Snapshot(snapshot);
+    check("frame, late or dropped counts do not add up", snapshot.frames == 15 && snapshot.late == 5 &&
+        snapshot.dropped == 7 && snapshot.frameTime.count == 15 && snapshot.frameTime.max == 20000000 &&
+        snapshot.stages.size() == 2 && snapshot.stages[0].name == "convert" && snapshot.stages[0].time.count == 15 &&
+        snapshot.stages[1].time.max == 1000000);
+    AsciiMetricsSnapshot first = snapshot;
+    metrics.Snapshot(snapshot);
+    check("a second snapshot does not start over", snapshot.frames == 0 && snapshot.late == 0 &&
+        snapshot.dropped == 0 && snapshot.frameTime.count == 0 && snapshot.stages.size() == 2 &&
+        snapshot.stages[0].time.count == 0);
+
+    // Two snapshots into a new file of each kind
+    std::filesystem::path directory = std::filesystem::temp_directory_path();
+    std::string csvPath = (directory / "asciifilter_bench_metrics.csv").string();
+    std::string jsonPath = (directory / "asciifilter_bench_metrics.jsonl").string();
+    std::error_code error;
+    std::filesystem::remove(csvPath, error);
+    std::filesystem::remove(jsonPath, error);
+    bool written = AppendAsciiMetricsFile(csvPath.c_str(), first) && AppendAsciiMetricsFile(csvPath.c_str(), snapshot) &&
+        AppendAsciiMetricsFile(jsonPath.c_str(), first) && AppendAsciiMetricsFile(jsonPath.c_str(), snapshot);
+    check("cannot write the metrics files", written);
+
+    auto readLines = [](const std::string& path, std::vector<std::string>& lines) {
+        lines.clear();
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file)
+            return;
+        char line[4096];
+        while (fgets(line, sizeof(line), file))
+        {
+            size_t length = strlen(line);
+            if (length && line[length - 1] == '\n')
+                line[--length] = '\0';
+            lines.push_back(line);
+        }
+        fclose(file);
+    };
+    std::vector<std::string> lines;
+    readLines(csvPath, lines);
+    int headers = 0;
+    bool rowsOk = lines.size() == 1 + 2 * 3;
+    for (size_t i = 0; i < lines.size(); ++i)
+    {
+        bool header = lines[i].compare(0, 5, "time,") == 0;
+        headers += header ? 1 : 0;
+        rowsOk = rowsOk && header == (i == 0) && std::count(lines[i].begin(), lines[i].end(), ',') == 11;
+    }
+    check("the CSV file is not one header and a row per stage and frame", written && headers == 1 && rowsOk);
+
+    readLines(jsonPath, lines);
+    bool jsonOk = lines.size() == 2;
+    for (const std::string& line : lines)
+        jsonOk = jsonOk && IsJsonObject(line) && line.find("\"stages\":{\"convert\":{") != std::string::npos;
+    check("the JSON lines file is not one well-formed object per snapshot", written && jsonOk);
+    std::filesystem::remove(csvPath, error);
+    std::filesystem::remove(jsonPath, error);
+
+    printf("metrics: %llu bucket values, percentiles, counters and files checked, %d failures\n",
+        static_cast<unsigned long long>(checked), failures);
+    return failures ? 1 : 0;
+}
+
+//----------------------------------------------------------------
+// Scheduler: frame pacing on a simulated clock, deterministic on any
+// machine. Fails when a scenario does not pace as expected.
+//----------------------------------------------------------------
+struct SchedulerScenario
+{
+    const char* name;
+    double seconds;
+    double workMs;        // Time each frame takes
+    int changedFrames;    // Frames that show something new, then the source goes static
+};
+
+static AsciiSchedulerStats SimulateScheduler(const SchedulerScenario& scenario, uint64_t& lastGap)
+{
+    AsciiManualClock clock;
+    AsciiFrameScheduler scheduler(clock);
+    const uint64_t end = static_cast<uint64_t>(scenario.seconds * 1e9);
+    const uint64_t work = static_cast<uint64_t>(scenario.workMs * 1e6);
+    uint64_t lastStart = 0;
+    lastGap = 0;
+    for (;;)
+    {
+        clock.Advance(scheduler.GetWaitTime()); // Sleeping until the deadline
+        if (clock.Now() >= end)
+            break;
+        lastGap = clock.Now() - lastStart;
+        lastStart = clock.Now();
+        scheduler.BeginFrame();
+        clock.Advance(work);
+        scheduler.EndFrame(scheduler.GetStats().frames <= static_cast<uint64_t>(scenario.changedFrames));
+    }
+    return scheduler.GetStats();
+}
+
+static int RunScheduler(const BenchOptions&)
+{
+    printf("scheduler: 60 fps target, simulated clock\n");
+    printf("%-14s %8s %8s %8s %12s %s\n", "scenario", "frames", "dropped", "idle", "last gap ms", "result");
+
+    int failures = 0;
+    auto check = [&](const SchedulerScenario& scenario, bool ok, const AsciiSchedulerStats& stats, uint64_t gap) {
+        printf("%-14s %8llu %8llu %8llu %12.1f %s\n", scenario.name, static_cast<unsigned long long>(stats.frames),
+            static_cast<unsigned long long>(stats.dropped), static_cast<unsigned long long>(stats.idleFrames),
+            gap / 1e6, ok ? "ok" : "FAILED");
+        failures += ok ? 0 : 1;
+    };
+
+    // Cheap frames on a changing source: exactly the target rate
+    SchedulerScenario steady = { "steady", 1.0, 5.0, 1 << 30 };
+    uint64_t gap = 0;
+    AsciiSchedulerStats stats = SimulateScheduler(steady, gap);
+    check(steady, stats.frames == 60 && stats.dropped == 0 && stats.idleFrames == 0, stats, gap);
+
+    // Frames slower than the budget: they run back to back at the rate the
+    // work allows and the deadlines they miss are dropped, not made up for
+    // by a burst of catch-up frames
+    SchedulerScenario slow = { "overloaded", 1.0, 40.0, 1 << 30 };
+    stats = SimulateScheduler(slow, gap);
+    check(slow, stats.frames == 25 && stats.frames + stats.dropped >= 58 && gap == 40000000ull, stats, gap);
+
+    // A static source backs off to the idle interval
+    SchedulerScenario idle = { "idle", 10.0, 2.0, 10 };
+    stats = SimulateScheduler(idle, gap);
+    check(idle, stats.frames < 600 / 8 && stats.dropped == 0 && gap == 500000000ull, stats, gap);
+
+    // Wake during the backoff: the next frame is due at once, then the
+    // target rate holds again
+    {
+        AsciiManualClock clock;
+        AsciiFrameScheduler scheduler(clock);
+        for (int i = 0; i < 100; ++i)
+        {
+            clock.Advance(scheduler.GetWaitTime());
+            scheduler.BeginFrame();
+            scheduler.EndFrame(false);
+        }
+        bool wasIdle = scheduler.IsIdle();
+        clock.Advance(1000000);
+        scheduler.Wake();
+        bool due = scheduler.IsFrameDue();
+        scheduler.BeginFrame();
+        scheduler.EndFrame(true);
+        SchedulerScenario wake = { "wake", 0.0, 0.0, 0 };
+        check(wake, wasIdle && due && !scheduler.IsIdle() && scheduler.GetWaitTime() == 16666667ull,
+            scheduler.GetStats(), scheduler.GetWaitTime());
+    }
+    return failures ? 1 : 0;
+}
+
+//----------------------------------------------------------------
+// Alloc: heap allocations per frame of every per-frame path once warmed
+// up, single and multi threaded. Fails unless all of them are zero.
+//----------------------------------------------------------------
+static int RunAllocations(const BenchOptions& options)
+{
+    std::vector<uint8_t> frame;
+    GenerateTestFrame(frame, options.width, options.height);
+    AsciiImageView view = MakeAsciiImageView(frame, options.width, options.height);
+    AsciiRect region = { 0, 0, options.width, options.height };
+    AsciiGeometry geometry;
+
+    std::vector<AsciiCell> asciiOut, quantized;
+    int cols = 0, rows = 0;
+    AsciiCellGrid grid;
+    std::vector<int> changedCells;
+    std::vector<AsciiRect> damage;
+    AsciiTileCache cache, damageCache;
+    AsciiColorQuantizer quantizer;
+    std::vector<AsciiRun> runs;
+    AsciiBufferHistory history;
+    std::vector<AsciiCellSpan> redraw, damageSpans;
+    std::vector<AsciiRect> rects;
+    AsciiGlyphAtlas atlas;
+    atlas.Reset(geometry.blockWidth, geometry.blockHeight);
+    atlas.AddBuiltinGlyphs();
+    std::vector<uint8_t> rendered(frame.size());
+    AsciiTerminalEncoder encoder;
+    std::string terminal;
+    history.Reset(3);
+
+    // Stages of one frame, in the order the front ends run them
+    struct Stage { const char* name; std::function<void(int)> run; };
+    const Stage stages[] = {
+        { "convert", [&](int) { ConvertRegionToAscii(view, region, geometry, asciiOut, cols, rows); } },
+        { "damage", [&](int i) {
+            // A few blocks change, like a blinking cursor
+            int x = (i * 97) % (options.width - 64), y = (i * 53) % (options.height - 64);
+            frame[(static_cast<size_t>(y) * options.width + x) * 4] ^= 0x55;
+            damage.assign(1, { x, y, x + 64, y + 64 });
+            ConvertRegionToAscii(view, region, geometry, damage, grid, changedCells);
+        } },
+        { "tile cache", [&](int) { cache.Update(view, region, geometry, changedCells); } },
+        { "cache+damage", [&](int) { damageCache.Update(view, region, geometry, damage, changedCells); } },
+        { "quantize", [&](int) { quantizer.Quantize(grid.cells, quantized); } },
+        { "runs", [&](int) { BuildAsciiRuns(quantized, grid.cols, grid.rows, runs); } },
+        { "history", [&](int i) {
+            redraw.clear();
+            damageSpans.clear();
+            history.Present(i % 3, quantized, grid.cols, grid.rows, 2, redraw, damageSpans);
+            GetAsciiSpanRects(damageSpans, geometry, options.width, options.height, rects);
+        } },
+        { "render", [&](int) {
+            RenderAsciiSpans(quantized, grid.cols, grid.rows, redraw, atlas, rendered.data(),
+                options.width, options.height, options.width * 4);
+        } },
+        { "terminal", [&](int) {
+            terminal.clear();
+            encoder.Encode(quantized, grid.cols, grid.rows, terminal);
+        } },
+    };
+
+    int maxThreads = options.maxThreads > 0 ? options.maxThreads : 4;
+    const int warmup = 5;
+    int failures = 0;
+    printf("alloc: %dx%d, %s colors, %d frames after %d warm-up frames\n", options.width, options.height,
+        GetAsciiColorModeName(options.colorMode), options.frames, warmup);
+    printf("%-12s %8s %14s\n", "stage", "threads", "allocs/frame");
+    for (int threads : { 1, maxThreads })
+    {
+        SetAsciiThreadCount(threads);
+        quantizer.SetMode(options.colorMode);
+        std::vector<uint64_t> counts(sizeof(stages) / sizeof(stages[0]), 0);
+        for (int i = 0; i < warmup + options.frames; ++i)
+        {
+            for (size_t s = 0; s < counts.size(); ++s)
+            {
+                uint64_t before = GetAllocationCount();
+                stages[s].run(i);
+                if (i >= warmup)
+                    counts[s] += GetAllocationCount() - before;
+            }
+        }
+        for (size_t s = 0; s < counts.size(); ++s)
+        {
+            printf("%-12s %8d %14.2f%s\n", stages[s].name, threads,
+                static_cast<double>(counts[s]) / options.frames, counts[s] ? "  FAILED" : "");
+            failures += counts[s] ? 1 : 0;
+        }
+    }
+    SetAsciiThreadCount(1);
+
+    // The streaming pipeline, counted between two frames of a running
+    // stream so that only its steady state shows
+    for (int workers : { 1, 2 })
+    {
+        AsciiPipelineOptions pipeline;
+        pipeline.convertWorkers = workers;
+        int produced = 0;
+        uint64_t first = 0, last = 0;
+        auto source = [&](AsciiStreamFrame& streamFrame) {
+            if (produced++ >= warmup * 4 + options.frames)
+                return false;
+            streamFrame.image.pixels.Resize(frame.size());
+            memcpy(streamFrame.image.pixels.GetData(), frame.data(), frame.size());
+            streamFrame.image.width = options.width;
+            streamFrame.image.height = options.height;
+            return true;
+        };
+        auto sink = [&](const AsciiStreamFrame& streamFrame) {
+            // Every pooled frame has been through once after warmup * 4
+            if (streamFrame.index == static_cast<uint64_t>(warmup * 4))
+                first = GetAllocationCount();
+            last = GetAllocationCount();
+            return true;
+        };
+        AsciiPipelineStats stats;
+        RunAsciiPipeline(pipeline, source, sink, stats);
+        uint64_t count = last - first;
+        printf("%-12s %8d %14.2f%s\n", workers > 1 ? "pipeline x2" : "pipeline", workers,
+            static_cast<double>(count) / options.frames, count ? "  FAILED" : "");
+        failures += count ? 1 : 0;
+    }
+    return failures ? 1 : 0;
+}
+
+static void PrintUsage()
+{
+    printf("usage: asciifilter_bench [threads|kernels|incremental|damage|colors|render|diff|terminal|suite|scheduler|metrics|alloc|formats|hysteresis|pyramid|integral|regions|edges|serve|record] [--width N] [--height N] [--frames N]\n"
+        "                         [--max-threads N] [--changed PERCENT]\n"
+        "                         [--kernel auto|scalar|sse4.1|avx2] [--glyphs intensity|shape|edge]\n"
+        "                         [--output FILE.ppm|FILE.y4m|FILE.rec|-] [--colors truecolor|256|16|adaptive]\n"
+        "                         [--quick] [--baseline FILE] [--tolerance PERCENT] [--update-baseline]\n");
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    const char* mode = "threads";
+    int first = 1;
+    if (argc > 1 && argv[1][0] != '-')
+    {
+        mode = argv[1];
+        first = 2;
+    }
+
+    for (int i = first; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+        if (!strcmp(arg, "--width") && value)            { options.width = atoi(value); ++i; }
+        else if (!strcmp(arg, "--height") && value)      { options.height = atoi(value); ++i; }
+        else if (!strcmp(arg, "--frames") && value)      { options.frames = atoi(value); ++i; }
+        else if (!strcmp(arg, "--max-threads") && value) { options.maxThreads = atoi(value); ++i; }
+        else if (!strcmp(arg, "--changed") && value)     { options.changedPercent = atof(value); ++i; }
+        else if (!strcmp(arg, "--kernel") && value && ParseKernel(value, options.kernel)) { ++i; }
+        else if (!strcmp(arg, "--glyphs") && value && ParseGlyphMode(value, options.glyphMode)) { ++i; }
+        else if (!strcmp(arg, "--output") && value)      { options.output = value; ++i; }
+        else if (!strcmp(arg, "--colors") && value && ParseColorMode(value, options.colorMode)) { ++i; }
+        else if (!strcmp(arg, "--quick"))                { options.quick = true; }
+        else if (!strcmp(arg, "--baseline") && value)    { options.baseline = value; ++i; }
+        else if (!strcmp(arg, "--tolerance") && value)   { options.tolerance = atof(value); ++i; }
+        else if (!strcmp(arg, "--update-baseline"))      { options.updateBaseline = true; }
+        else
+        {
+            PrintUsage();
+            return 1;
+        }
+    }
+    if (options.width <= 0 || options.height <= 0 || options.frames <= 0)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    SelectAsciiKernel(options.kernel);
+    SetAsciiGlyphMode(options.glyphMode);
+
+    if (!strcmp(mode, "threads"))
+        return RunThreadScaling(options);
+    else if (!strcmp(mode, "kernels"))
+        return RunKernels(options);
+    else if (!strcmp(mode, "incremental"))
+        return RunIncremental(options);
+    else if (!strcmp(mode, "damage"))
+        return RunDamage(options);
+    else if (!strcmp(mode, "colors"))
+        return RunColorModes(options);
+    else if (!strcmp(mode, "render"))
+        return RunRender(options);
+    else if (!strcmp(mode, "diff"))
+        return RunCellDiff(options);
+    else if (!strcmp(mode, "terminal"))
+        return RunTerminal(options);
+    else if (!strcmp(mode, "suite"))
+        return RunSuite(options);
+    else if (!strcmp(mode, "scheduler"))
+        return RunScheduler(options);
+    else if (!strcmp(mode, "metrics"))
+        return RunMetrics(options);
+    else if (!strcmp(mode, "alloc"))
+        return RunAllocations(options);
+    else if (!strcmp(mode, "formats"))
+        return RunFormats(options);
+    else if (!strcmp(mode, "hysteresis"))
+        return RunHysteresis(options);
+    else if (!strcmp(mode, "pyramid"))
+        return RunPyramid(options);
+    else if (!strcmp(mode, "integral"))
+        return RunIntegral(options);
+    else if (!strcmp(mode, "regions"))
+        return RunRegions(options);
+    else if (!strcmp(mode, "edges"))
+        return RunEdges(options);
+    else if (!strcmp(mode, "serve"))
+        return RunServe(options);
+    else if (!strcmp(mode, "record"))
+        return RunRecord(options);
+    else
+    {
+        PrintUsage();
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,164 @@
+﻿#include "AsciiBuffer.h"
+
+#include <atomic>
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+static std::atomic<size_t> g_hugePageThreshold{ ASCII_HUGE_PAGE_THRESHOLD };
+
+void AsciiPixelBuffer::SetHugePageThreshold(size_t bytes)
+{
+	g_hugePageThreshold.store(bytes, std::memory_order_relaxed);
+}
+
+size_t AsciiPixelBuffer::GetHugePageThreshold()
+{
+	return g_hugePageThreshold.load(std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------
+// Mapped blocks. The capacity is rounded up to the huge page size so the
+// whole block can be backed by huge pages.
+//------------------------------------------------------------
+#ifdef _WIN32
+static uint8_t* MapBlock(size_t& capacity)
+{
+	// Large pages need SeLockMemoryPrivilege, which few processes hold;
+	// without it this fails and the block gets normal pages
+	size_t largePage = GetLargePageMinimum();
+	if (largePage > 0) {
+		size_t size = (capacity + largePage - 1) / largePage * largePage;
+		void* p = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if (p) {
+			capacity = size;
+			return static_cast<uint8_t*>(p);
+		}
+	}
+	// 64 KB aligned
+	return static_cast<uint8_t*>(VirtualAlloc(nullptr, capacity, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+}
+
+static void UnmapBlock(uint8_t* data, size_t)
+{
+	VirtualFree(data, 0, MEM_RELEASE);
+}
+#else
+static const size_t ASCII_HUGE_PAGE_SIZE = 2u << 20;
+
+static uint8_t* MapBlock(size_t& capacity)
+{
+	// Map one huge page more and trim both ends, so the block starts on a
+	// huge page boundary
+	size_t size = (capacity + ASCII_HUGE_PAGE_SIZE - 1) / ASCII_HUGE_PAGE_SIZE * ASCII_HUGE_PAGE_SIZE;
+	void* p = mmap(nullptr, size + ASCII_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return nullptr;
+	uintptr_t start = reinterpret_cast<uintptr_t>(p);
+	uintptr_t aligned = (start + ASCII_HUGE_PAGE_SIZE - 1) & ~(static_cast<uintptr_t>(ASCII_HUGE_PAGE_SIZE) - 1);
+	if (aligned > start)
+		munmap(p, aligned - start);
+	size_t tail = ASCII_HUGE_PAGE_SIZE - (aligned - start);
+	if (tail > 0)
+		munmap(reinterpret_cast<void*>(aligned + size), tail);
+#ifdef MADV_HUGEPAGE
+	// Only a hint: without transparent huge pages this is a normal mapping
+	madvise(reinterpret_cast<void*>(aligned), size, MADV_HUGEPAGE);
+#endif
+	capacity = size;
+	return reinterpret_cast<uint8_t*>(aligned);
+}
+
+static void UnmapBlock(uint8_t* data, size_t capacity)
+{
+	munmap(data, capacity);
+}
+#endif
+
+//------------------------------------------------------------
+// Buffer
+//------------------------------------------------------------
+AsciiPixelBuffer::AsciiPixelBuffer(const AsciiPixelBuffer& other)
+{
+	*this = other;
+}
+
+AsciiPixelBuffer::AsciiPixelBuffer(AsciiPixelBuffer&& other) noexcept
+{
+	*this = std::move(other);
+}
+
+AsciiPixelBuffer& AsciiPixelBuffer::operator=(const AsciiPixelBuffer& other)
+{
+	if (this != &other) {
+		Resize(other.m_size);
+		if (m_size > 0)
+			memcpy(m_data, other.m_data, m_size);
+	}
+	return *this;
+}
+
+AsciiPixelBuffer& AsciiPixelBuffer::operator=(AsciiPixelBuffer&& other) noexcept
+{
+	if (this != &other) {
+		Release();
+		m_data = other.m_data;
+		m_size = other.m_size;
+		m_capacity = other.m_capacity;
+		m_mapped = other.m_mapped;
+		other.m_data = nullptr;
+		other.m_size = other.m_capacity = 0;
+		other.m_mapped = false;
+	}
+	return *this;
+}
+
+void AsciiPixelBuffer::Resize(size_t size)
+{
+	if (size <= m_capacity) {
+		m_size = size;
+		return;
+	}
+
+	size_t capacity = (size + ASCII_BUFFER_ALIGNMENT - 1) / ASCII_BUFFER_ALIGNMENT * ASCII_BUFFER_ALIGNMENT;
+	size_t threshold = GetHugePageThreshold();
+	uint8_t* data = nullptr;
+	bool mapped = false;
+	if (threshold > 0 && size >= threshold) {
+		data = MapBlock(capacity);
+		mapped = data != nullptr;
+	}
+	if (!data) {
+		capacity = (size + ASCII_BUFFER_ALIGNMENT - 1) / ASCII_BUFFER_ALIGNMENT * ASCII_BUFFER_ALIGNMENT;
+		data = static_cast<uint8_t*>(::operator new(capacity, std::align_val_t(ASCII_BUFFER_ALIGNMENT)));
+	}
+
+	if (m_size > 0)
+		memcpy(data, m_data, m_size);
+	Release();
+	m_data = data;
+	m_size = size;
+	m_capacity = capacity;
+	m_mapped = mapped;
+}
+
+void AsciiPixelBuffer::Release()
+{
+	if (m_data) {
+		if (m_mapped)
+			UnmapBlock(m_data, m_capacity);
+		else
+			::operator delete(m_data, std::align_val_t(ASCII_BUFFER_ALIGNMENT));
+	}
+	m_data = nullptr;
+	m_size = m_capacity = 0;
+	m_mapped = false;
+}
@@ -0,0 +1,68 @@
+﻿// AsciiBuffer.h : Reusable, aligned storage for frames.
+//
+// A frame buffer is sized by capacity: it only ever grows, so a stream of
+// frames (or a window that is resized back and forth) reuses one block
+// instead of freeing and allocating a few megabytes per frame. Blocks are
+// 64-byte aligned for the SIMD kernels. Big ones are mapped straight from
+// the OS and asked for huge pages (transparent huge pages on Linux, large
+// pages on Windows when the process holds SeLockMemoryPrivilege), which
+// saves TLB misses when a 4K frame is streamed through the converter.
+
+#pragma once
+#include "AsciiCore.h"
+
+// Alignment of every block
+const size_t ASCII_BUFFER_ALIGNMENT = 64;
+
+// Default size from which blocks are mapped: a 1080p BGRA frame and up
+const size_t ASCII_HUGE_PAGE_THRESHOLD = 8u << 20;
+
+class AsciiPixelBuffer
+{
+public:
+    AsciiPixelBuffer() = default;
+    AsciiPixelBuffer(const AsciiPixelBuffer& other);
+    AsciiPixelBuffer(AsciiPixelBuffer&& other) noexcept;
+    ~AsciiPixelBuffer() { Release(); }
+
+    AsciiPixelBuffer& operator=(const AsciiPixelBuffer& other);
+    AsciiPixelBuffer& operator=(AsciiPixelBuffer&& other) noexcept;
+
+    // Sets the size in bytes, keeping the first min(old, new) bytes.
+    // Allocates only when size exceeds the capacity; throws std::bad_alloc
+    // like std::vector when that fails.
+    void Resize(size_t size);
+    void Clear() { m_size = 0; }
+
+    // Frees the block, e.g. when a stream ends
+    void Release();
+
+    uint8_t* GetData() { return m_data; }
+    const uint8_t* GetData() const { return m_data; }
+    size_t GetSize() const { return m_size; }
+    size_t GetCapacity() const { return m_capacity; }
+    bool IsEmpty() const { return m_size == 0; }
+
+    // True when the block was mapped with huge pages requested
+    bool IsMapped() const { return m_mapped; }
+
+    // Blocks of at least this many bytes are mapped from the OS and backed
+    // by huge pages where possible; 0 turns that off. Applies to blocks
+    // allocated afterwards. The default is ASCII_HUGE_PAGE_THRESHOLD.
+    static void SetHugePageThreshold(size_t bytes);
+    static size_t GetHugePageThreshold();
+
+private:
+    uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_capacity = 0;
+    bool m_mapped = false;
+};
+
+// View of a tightly packed frame in the buffer; empty when the buffer is
+// too small
+inline AsciiImageView MakeAsciiImageView(const AsciiPixelBuffer& frameData, int width, int height,
+    AsciiPixelFormat format = AsciiPixelFormat::BGRA8)
+{
+    return MakeAsciiImageView(frameData.GetData(), frameData.GetSize(), width, height, format);
+}
@@ -0,0 +1,157 @@
+﻿#include "AsciiCellDiff.h"
+#include "AsciiKernels.h"
+
+//------------------------------------------------------------
+// Reference cell comparison
+//------------------------------------------------------------
+int CompareCellsScalar(const AsciiCell* previous, const AsciiCell* next, int count, uint8_t* changed)
+{
+	int total = 0;
+	for (int i = 0; i < count; ++i) {
+		changed[i] = previous[i] != next[i];
+		total += changed[i];
+	}
+	return total;
+}
+
+//------------------------------------------------------------
+// Spans
+//------------------------------------------------------------
+int DiffAsciiCells(const AsciiCell* previous, const AsciiCell* next, int cols, int rows,
+	int mergeGap, std::vector<AsciiCellSpan>& spans)
+{
+	if (cols <= 0 || rows <= 0)
+		return 0;
+
+	AsciiCellComparer compare = GetAsciiCellComparer();
+	thread_local std::vector<uint8_t> changed;
+	changed.resize(cols);
+	spans.reserve(spans.size() + GetAsciiMaxSpanCount(cols, rows));
+
+	int total = 0;
+	for (int row = 0; row < rows; ++row) {
+		size_t offset = static_cast<size_t>(row) * cols;
+		int rowChanged = compare(previous + offset, next + offset, cols, changed.data());
+		if (rowChanged == 0)
+			continue;
+		total += rowChanged;
+
+		AsciiCellSpan span = { row, 0, 0 };
+		int lastChanged = -1;
+		for (int col = 0; col < cols; ++col) {
+			if (!changed[col])
+				continue;
+			if (lastChanged >= 0 && col - lastChanged - 1 <= mergeGap) {
+				span.length = col - span.col + 1;
+			}
+			else {
+				if (lastChanged >= 0)
+					spans.push_back(span);
+				span.col = col;
+				span.length = 1;
+			}
+			lastChanged = col;
+		}
+		spans.push_back(span);
+	}
+	return total;
+}
+
+void GetAsciiSpanRects(const std::vector<AsciiCellSpan>& spans, const AsciiGeometry& geometry,
+	int clipWidth, int clipHeight, std::vector<AsciiRect>& rects)
+{
+	rects.clear();
+	// Every span adds at most one rectangle. Sizing by the capacity of
+	// spans keeps the buffers from growing again once it stopped growing.
+	rects.reserve(spans.capacity());
+
+	// Spans come row by row; a span extends a rectangle that reached the
+	// previous row when it covers the same columns
+	thread_local std::vector<size_t> open, reached;
+	open.clear();
+	reached.clear();
+	open.reserve(spans.capacity());
+	reached.reserve(spans.capacity());
+	int currentRow = -1;
+	for (const AsciiCellSpan& span : spans) {
+		if (span.row != currentRow) {
+			open.swap(reached);
+			reached.clear();
+			if (span.row != currentRow + 1)
+				open.clear();
+			currentRow = span.row;
+		}
+
+		int left = span.col * geometry.blockWidth;
+		int right = (span.col + span.length) * geometry.blockWidth;
+		size_t index = rects.size();
+		for (size_t i : open) {
+			if (rects[i].left == left && rects[i].right == right) {
+				index = i;
+				break;
+			}
+		}
+		if (index == rects.size())
+			rects.push_back({ left, span.row * geometry.blockHeight, right, 0 });
+		rects[index].bottom = (span.row + 1) * geometry.blockHeight;
+		reached.push_back(index);
+	}
+
+	size_t kept = 0;
+	for (AsciiRect& rect : rects) {
+		rect.right = rect.right < clipWidth ? rect.right : clipWidth;
+		rect.bottom = rect.bottom < clipHeight ? rect.bottom : clipHeight;
+		if (rect.left < rect.right && rect.top < rect.bottom)
+			rects[kept++] = rect;
+	}
+	rects.resize(kept);
+}
+
+//------------------------------------------------------------
+// Back buffer history
+//------------------------------------------------------------
+void AsciiBufferHistory::Reset(int bufferCount)
+{
+	m_buffers.assign(bufferCount > 0 ? bufferCount : 0, Buffer());
+	m_lastBuffer = -1;
+}
+
+bool AsciiBufferHistory::Present(int buffer, const std::vector<AsciiCell>& cells, int cols, int rows, int mergeGap,
+	std::vector<AsciiCellSpan>& redraw, std::vector<AsciiCellSpan>& damage)
+{
+	redraw.clear();
+	damage.clear();
+	if (buffer < 0 || buffer >= static_cast<int>(m_buffers.size()) || cols <= 0 || rows <= 0 ||
+		cells.size() < static_cast<size_t>(cols) * rows)
+		return false;
+
+	redraw.reserve(GetAsciiMaxSpanCount(cols, rows));
+	damage.reserve(GetAsciiMaxSpanCount(cols, rows));
+
+	auto matches = [&](const Buffer& b) { return b.valid && b.cols == cols && b.rows == rows; };
+	auto wholeGrid = [&](std::vector<AsciiCellSpan>& spans) {
+		for (int row = 0; row < rows; ++row)
+			spans.push_back({ row, 0, cols });
+	};
+
+	// Against the screen first: when there is a single buffer it is also
+	// the one about to be overwritten
+	bool known = m_lastBuffer >= 0 && matches(m_buffers[m_lastBuffer]);
+	if (known)
+		DiffAsciiCells(m_buffers[m_lastBuffer].cells.data(), cells.data(), cols, rows, mergeGap, damage);
+	else
+		wholeGrid(damage);
+
+	Buffer& target = m_buffers[buffer];
+	if (matches(target))
+		DiffAsciiCells(target.cells.data(), cells.data(), cols, rows, mergeGap, redraw);
+	else
+		wholeGrid(redraw);
+
+	target.cells.assign(cells.begin(), cells.begin() + static_cast<size_t>(cols) * rows);
+	target.cols = cols;
+	target.rows = rows;
+	target.valid = true;
+	m_lastBuffer = buffer;
+	return known;
+}
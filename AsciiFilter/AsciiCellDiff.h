@@ -0,0 +1,68 @@
+﻿// AsciiCellDiff.h : Finds the cells that changed between two grids.
+//
+// A front end that keeps the cells it drew can redraw just the changed
+// spans instead of the whole grid, and copy just the damaged rectangles
+// to the screen. Cells are compared with the active SIMD kernel, which
+// skips a run of unchanged cells in a few instructions.
+
+#pragma once
+#include "AsciiCore.h"
+
+// Cells [col, col + length) of one row
+struct AsciiCellSpan
+{
+    int row;
+    int col;
+    int length;
+};
+
+// Appends the spans of cells that differ between two cols x rows grids.
+// Up to mergeGap unchanged cells between two changes are included in the
+// span, since redrawing a few cells is cheaper than another draw call.
+// Returns the number of changed cells.
+int DiffAsciiCells(const AsciiCell* previous, const AsciiCell* next, int cols, int rows,
+    int mergeGap, std::vector<AsciiCellSpan>& spans);
+
+// Most spans one diff of a cols x rows grid can produce: every other
+// cell changed. DiffAsciiCells reserves this much up front, so span
+// buffers that are reused across frames stop allocating after the first.
+inline size_t GetAsciiMaxSpanCount(int cols, int rows)
+{
+    return cols > 0 && rows > 0 ? static_cast<size_t>(rows) * ((cols + 1) / 2) : 0;
+}
+
+// Replaces rects with pixel rectangles covering spans, clipped to
+// clipWidth x clipHeight. Spans with the same columns in consecutive rows
+// share one rectangle.
+void GetAsciiSpanRects(const std::vector<AsciiCellSpan>& spans, const AsciiGeometry& geometry,
+    int clipWidth, int clipHeight, std::vector<AsciiRect>& rects);
+
+// Remembers the grid last presented into each of a set of back buffers
+// (e.g. triple buffering) and works out what each new frame has to draw.
+class AsciiBufferHistory
+{
+public:
+    // Forgets every buffer, e.g. after they were recreated
+    void Reset(int bufferCount);
+
+    // Records cells as the contents of buffer and fills
+    //  - redraw with the spans that must be drawn into buffer, which is
+    //    the whole grid when the buffer has no history of that size;
+    //  - damage with the spans that differ from the previously presented
+    //    buffer, i.e. what must be copied to the screen.
+    // Returns false when nothing is known (damage then covers the grid).
+    bool Present(int buffer, const std::vector<AsciiCell>& cells, int cols, int rows, int mergeGap,
+        std::vector<AsciiCellSpan>& redraw, std::vector<AsciiCellSpan>& damage);
+
+private:
+    struct Buffer
+    {
+        std::vector<AsciiCell> cells;
+        int cols = 0;
+        int rows = 0;
+        bool valid = false;
+    };
+
+    std::vector<Buffer> m_buffers;
+    int m_lastBuffer = -1;
+};
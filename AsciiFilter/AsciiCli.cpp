@@ -0,0 +1,793 @@
+﻿// AsciiCli.cpp : Batch converter from image files to text or ANSI art.
+// Headless and portable; converts whole directories across all cores.
+//
+// Small images are spread over file workers, one image per thread. Images
+// of ASCII_CLI_LARGE_PIXELS and up are converted one after another with
+// the conversion itself split over the thread pool instead, so a single
+// huge file does not leave the other cores idle.
+//
+// A Y4M or raw video input (a .y4m file, "-" for stdin, or --raw) is
+// streamed through the pipelined decode -> convert -> encode chain of
+// AsciiPipeline.h instead, e.g.
+//   ffmpeg -i in.mp4 -f yuv4mpegpipe - | asciifilter_cli --format ansi -
+//
+// With --serve the stream goes to network viewers (AsciiServer.h) at the
+// video's frame rate; --connect is such a viewer for the terminal.
+// --record keeps the cells in a seekable recording (AsciiRecording.h)
+// that --play shows again from any point.
+
+#include "AsciiCore.h"
+#include "AsciiDelta.h"
+#include "AsciiImageIO.h"
+#include "AsciiPipeline.h"
+#include "AsciiQuantizer.h"
+#include "AsciiRecording.h"
+#include "AsciiRender.h"
+#include "AsciiServer.h"
+#include "AsciiStabilizer.h"
+#include "AsciiTerminal.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static const int64_t ASCII_CLI_LARGE_PIXELS = 4 * 1024 * 1024;
+
+enum class CliFormat { Text, Ansi, Y4m };
+
+struct CliOptions
+{
+    std::vector<std::string> inputs;
+    const char* outputDir = nullptr; // Null writes to stdout; the output file when streaming
+    bool recursive = false;
+    bool quiet = false;
+    CliFormat format = CliFormat::Text;
+    AsciiColorMode colorMode = AsciiColorMode::TrueColor;
+    AsciiGeometry geometry;
+    AsciiKernel kernel = AsciiKernel::Auto;
+    AsciiGlyphMode glyphMode = AsciiGlyphMode::Intensity;
+    int threads = 0; // 0 = hardware threads
+    // Streaming only
+    bool rawInput = false;
+    AsciiPixelFormat rawFormat = AsciiPixelFormat::BGRA8;
+    int rawWidth = 0;
+    int rawHeight = 0;
+    int frameParallel = 1; // Convert workers, ordered output
+    int queueDepth = 4;
+    const char* metricsPath = nullptr; // Per-stage histograms, JSON lines or CSV
+    bool hysteresis = false;
+    AsciiStabilizerOptions stabilizer;
+    bool serve = false;
+    AsciiServerOptions server;
+    // Viewer of another instance's --serve stream instead of any input
+    std::string connectHost;
+    int connectPort = 0;
+    const char* recordPath = nullptr;
+    // Playback of a recording instead of any input
+    const char* playPath = nullptr;
+    double seekSeconds = 0.0;
+};
+
+struct CliJob
+{
+    fs::path input;
+    fs::path name;          // input relative to the directory it was found under
+    fs::path output = {};
+    int64_t pixels = 0;
+    bool ok = false;
+};
+
+static bool ParseKernel(const char* name, AsciiKernel& kernel)
+{
+    const AsciiKernel kernels[] = { AsciiKernel::Auto, AsciiKernel::Scalar, AsciiKernel::SSE41, AsciiKernel::AVX2 };
+    for (AsciiKernel k : kernels)
+    {
+        if (!strcmp(name, GetAsciiKernelName(k)))
+        {
+            kernel = k;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool ParseColorMode(const char* name, AsciiColorMode& mode)
+{
+    const AsciiColorMode modes[] = { AsciiColorMode::TrueColor, AsciiColorMode::Xterm256,
+        AsciiColorMode::Ansi16, AsciiColorMode::Adaptive };
+    for (AsciiColorMode m : modes)
+    {
+        if (!strcmp(name, GetAsciiColorModeName(m)))
+        {
+            mode = m;
+            return true;
+        }
+    }
+    return false;
+}
+
+// GLYPH,COLOR margins of the temporal stabilizer
+static bool ParseMargins(const char* value, AsciiStabilizerOptions& margins)
+{
+    int glyph = 0, color = 0;
+    if (sscanf(value, "%d,%d", &glyph, &color) != 2 || glyph < 0 || color < 0)
+        return false;
+    margins.glyphMargin = glyph;
+    margins.colorMargin = color;
+    return true;
+}
+
+// [HOST:]PORT; host stays unchanged when omitted
+static bool ParseAddress(const char* value, std::string& host, int& port)
+{
+    const char* colon = strrchr(value, ':');
+    int parsed = atoi(colon ? colon + 1 : value);
+    if (parsed <= 0 || parsed > 65535)
+        return false;
+    if (colon)
+        host.assign(value, colon);
+    port = parsed;
+    return true;
+}
+
+static bool ParseSize(const char* value, int& width, int& height)
+{
+    int w = 0, h = 0;
+    if (sscanf(value, "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0)
+        return false;
+    width = w;
+    height = h;
+    return true;
+}
+
+// ffmpeg -pix_fmt names
+static bool ParseRawFormat(const char* name, AsciiPixelFormat& format)
+{
+    const AsciiPixelFormat formats[] = {
+        AsciiPixelFormat::BGRA8, AsciiPixelFormat::RGBA8, AsciiPixelFormat::RGB8, AsciiPixelFormat::Gray8,
+        AsciiPixelFormat::RGB10A2, AsciiPixelFormat::NV12, AsciiPixelFormat::I420, AsciiPixelFormat::P010,
+    };
+    for (AsciiPixelFormat candidate : formats) {
+        if (!strcmp(name, GetAsciiPixelFormatName(candidate))) {
+            format = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+static double NowSeconds()
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+//----------------------------------------------------------------
+// Input collection
+//----------------------------------------------------------------
+static bool IsImageExtension(const fs::path& path)
+{
+    std::string ext = path.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return static_cast<char>(tolower(c)); });
+    return ext == ".ppm" || ext == ".pgm" || ext == ".pnm" || ext == ".pam" || ext == ".bmp";
+}
+
+static void CollectInputs(const CliOptions& options, std::vector<CliJob>& jobs)
+{
+    for (const std::string& input : options.inputs)
+    {
+        std::error_code error;
+        fs::path path(input);
+        if (fs::is_directory(path, error))
+        {
+            std::vector<fs::path> files;
+            auto add = [&](const fs::directory_entry& entry) {
+                if (entry.is_regular_file(error) && IsImageExtension(entry.path()))
+                    files.push_back(entry.path());
+            };
+            if (options.recursive)
+            {
+                for (const auto& entry : fs::recursive_directory_iterator(path, error))
+                    add(entry);
+            }
+            else
+            {
+                for (const auto& entry : fs::directory_iterator(path, error))
+                    add(entry);
+            }
+            // Directory order is unspecified, keep runs reproducible
+            std::sort(files.begin(), files.end());
+            for (const fs::path& file : files)
+                jobs.push_back({ file, file.lexically_relative(path) });
+        }
+        else
+        {
+            // Explicit files are taken whatever their extension
+            jobs.push_back({ path, path.filename() });
+        }
+    }
+}
+
+//----------------------------------------------------------------
+// Conversion of one file
+//----------------------------------------------------------------
+struct CliWorker
+{
+    AsciiImage image;
+    std::vector<AsciiCell> cells;
+    AsciiColorQuantizer quantizer;
+    std::vector<AsciiCell> quantized;
+    AsciiTerminalEncoder encoder;
+    std::string text;
+};
+
+static bool WriteFileData(const fs::path& path, const std::string& data)
+{
+    FILE* file = fopen(path.string().c_str(), "wb");
+    if (!file)
+        return false;
+    bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+    return fclose(file) == 0 && ok;
+}
+
+static bool ConvertFile(const CliOptions& options, CliJob& job, CliWorker& worker)
+{
+    if (!ReadAsciiImage(job.input.string().c_str(), worker.image))
+    {
+        fprintf(stderr, "asciifilter_cli: cannot read %s\n", job.input.string().c_str());
+        return false;
+    }
+    job.pixels = static_cast<int64_t>(worker.image.width) * worker.image.height;
+
+    AsciiRect region = { 0, 0, worker.image.width, worker.image.height };
+    int cols = 0, rows = 0;
+    ConvertRegionToAscii(worker.image.View(), region, options.geometry, worker.cells, cols, rows);
+
+    worker.text.clear();
+    if (options.format == CliFormat::Ansi)
+    {
+        worker.encoder.SetColorMode(options.colorMode);
+        worker.encoder.EncodeLines(worker.cells, cols, rows, worker.text);
+    }
+    else
+    {
+        EncodeAsciiText(worker.cells, cols, rows, worker.text);
+    }
+
+    bool written = job.output.empty() ? WriteAsciiTerminal(1, worker.text) : WriteFileData(job.output, worker.text);
+    if (!written)
+    {
+        fprintf(stderr, "asciifilter_cli: cannot write %s\n", job.output.empty() ? "stdout" : job.output.string().c_str());
+        return false;
+    }
+    return true;
+}
+
+//----------------------------------------------------------------
+// Streaming
+//----------------------------------------------------------------
+static bool IsStreamInput(const CliOptions& options)
+{
+    if (options.rawInput)
+        return true;
+    if (options.inputs.size() != 1)
+        return false;
+    fs::path path(options.inputs[0]);
+    std::string ext = path.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return static_cast<char>(tolower(c)); });
+    return options.inputs[0] == "-" || ext == ".y4m";
+}
+
+static void PrintPipelineStats(const AsciiPipelineStats& stats)
+{
+    double seconds = stats.seconds > 0.0 ? stats.seconds : 1e-9;
+    fprintf(stderr, "%llu frames in %.3f s: %.1f fps\n",
+        static_cast<unsigned long long>(stats.frames), seconds, stats.frames / seconds);
+    fprintf(stderr, "%-12s %8s %10s %12s %12s\n", "stage", "frames", "busy ms", "in stall ms", "out stall ms");
+    for (const AsciiStageStats& stage : stats.stages)
+    {
+        fprintf(stderr, "%-12s %8llu %10.1f %12.1f %12.1f\n", stage.name.c_str(),
+            static_cast<unsigned long long>(stage.frames), stage.busySeconds * 1000.0,
+            stage.inputStallSeconds * 1000.0, stage.outputStallSeconds * 1000.0);
+    }
+    fprintf(stderr, "%-12s %8s %10s %12s\n", "queue", "capacity", "max depth", "avg depth");
+    for (const AsciiQueueStats& queue : stats.queues)
+        fprintf(stderr, "%-12s %8d %10d %12.2f\n", queue.name.c_str(), queue.capacity, queue.maxDepth, queue.averageDepth);
+}
+
+static int RunStream(const CliOptions& options, int threads)
+{
+    const char* input = options.inputs[0].c_str();
+    AsciiFrameReader reader;
+    bool opened = options.rawInput ?
+        reader.OpenRaw(input, options.rawFormat, options.rawWidth, options.rawHeight) :
+        reader.OpenY4m(input);
+    if (!opened)
+    {
+        fprintf(stderr, "asciifilter_cli: cannot open %s as %s video\n", input, options.rawInput ? "raw" : "Y4M");
+        return 1;
+    }
+
+    const char* output = options.outputDir ? options.outputDir : "-";
+    FILE* file = nullptr;
+    AsciiY4mWriter y4m;
+    AsciiGlyphAtlas atlas;
+    std::vector<uint8_t> rendered;
+    if (options.format == CliFormat::Y4m)
+    {
+        int fps = reader.GetFrameRate() > 0.0 ? static_cast<int>(reader.GetFrameRate() + 0.5) : 30;
+        if (!y4m.Open(output, reader.GetWidth(), reader.GetHeight(), fps))
+        {
+            fprintf(stderr, "asciifilter_cli: cannot write %s\n", output);
+            return 1;
+        }
+        atlas.Reset(options.geometry.blockWidth, options.geometry.blockHeight);
+        atlas.AddBuiltinGlyphs();
+        rendered.resize(static_cast<size_t>(reader.GetWidth()) * reader.GetHeight() * 4);
+    }
+    else if (strcmp(output, "-") != 0)
+    {
+        file = fopen(output, "wb");
+        if (!file)
+        {
+            fprintf(stderr, "asciifilter_cli: cannot write %s\n", output);
+            return 1;
+        }
+    }
+
+    // ANSI output redraws only what changed since the previous frame;
+    // text frames are separated by form feeds
+    AsciiTerminalEncoder encoder;
+    encoder.SetColorMode(options.colorMode);
+    std::string data;
+
+    // The stabilizer sees the frames in order on the sink thread
+    AsciiTemporalStabilizer stabilizer;
+    stabilizer.SetOptions(options.stabilizer);
+    std::vector<AsciiCell> stable;
+
+    // Viewers get the frames at the video's rate; the files and stdout
+    // only when --output asks for them
+    AsciiFanoutServer server;
+    if (options.serve)
+    {
+        if (!server.Start(options.server))
+        {
+            fprintf(stderr, "asciifilter_cli: %s\n", server.GetError().c_str());
+            return 1;
+        }
+        fprintf(stderr, "serving on %s:%d\n", options.server.bindAddress.c_str(), server.GetPort());
+    }
+    bool writeOutput = !options.serve || options.outputDir;
+
+    // Recorded on the video's clock, not the wall clock
+    AsciiRecordingWriter recording;
+    if (options.recordPath && !recording.Open(options.recordPath))
+    {
+        fprintf(stderr, "asciifilter_cli: cannot write %s\n", options.recordPath);
+        return 1;
+    }
+    auto frameInterval = std::chrono::duration<double>(reader.GetFrameRate() > 0.0 ? 1.0 / reader.GetFrameRate() : 0.0);
+    std::chrono::steady_clock::time_point streamStart;
+
+    auto source = [&](AsciiStreamFrame& frame) { return reader.ReadFrame(frame.image); };
+    auto sink = [&](const AsciiStreamFrame& frame) {
+        const std::vector<AsciiCell>* cells = &frame.cells;
+        if (options.hysteresis)
+        {
+            stable = frame.cells;
+            stabilizer.Apply(stable, frame.cols, frame.rows);
+            cells = &stable;
+        }
+        if (recording.IsOpen() &&
+            !recording.WriteFrame(*cells, frame.cols, frame.rows, static_cast<uint64_t>(frameInterval.count() * frame.index * 1e9)))
+            return false;
+        if (options.serve)
+        {
+            if (frame.index == 0)
+                streamStart = std::chrono::steady_clock::now();
+            std::this_thread::sleep_until(streamStart + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                frameInterval * static_cast<double>(frame.index)));
+            server.Publish(*cells, frame.cols, frame.rows);
+            if (!writeOutput)
+                return true;
+        }
+        if (options.format == CliFormat::Y4m)
+        {
+            const AsciiImage& image = frame.image;
+            RenderAsciiCells(*cells, frame.cols, frame.rows, atlas, rendered.data(), image.width, image.height, image.width * 4);
+            return y4m.WriteFrame(MakeAsciiImageView(rendered, image.width, image.height));
+        }
+        data.clear();
+        if (options.format == CliFormat::Ansi)
+        {
+            encoder.Encode(*cells, frame.cols, frame.rows, data);
+        }
+        else
+        {
+            if (frame.index > 0)
+                data += '\f';
+            EncodeAsciiText(*cells, frame.cols, frame.rows, data);
+        }
+        return file ? fwrite(data.data(), 1, data.size(), file) == data.size() : WriteAsciiTerminal(1, data);
+    };
+
+    // Histograms go to the metrics file every second and once at the end
+    AsciiMetrics metrics;
+    AsciiMetricsSnapshot snapshot;
+    if (reader.GetFrameRate() > 0.0)
+        metrics.SetFrameBudget(1.0 / reader.GetFrameRate());
+    uint64_t lastDump = AsciiMetrics::Now();
+    auto dumpMetrics = [&]() {
+        metrics.Snapshot(snapshot);
+        if (!AppendAsciiMetricsFile(options.metricsPath, snapshot))
+            fprintf(stderr, "asciifilter_cli: cannot write %s\n", options.metricsPath);
+        lastDump = AsciiMetrics::Now();
+    };
+    auto timedSink = [&](const AsciiStreamFrame& frame) {
+        bool ok = sink(frame);
+        if (AsciiMetrics::Now() - lastDump >= 1000000000ull)
+            dumpMetrics();
+        return ok;
+    };
+
+    AsciiPipelineOptions pipeline;
+    pipeline.geometry = options.geometry;
+    pipeline.queueDepth = options.queueDepth;
+    pipeline.convertWorkers = options.frameParallel;
+    pipeline.metrics = options.metricsPath ? &metrics : nullptr;
+    SetAsciiThreadCount(options.frameParallel > 1 ? 1 : threads);
+    AsciiPipelineStats stats;
+    bool finished = options.metricsPath ?
+        RunAsciiPipeline(pipeline, source, timedSink, stats) :
+        RunAsciiPipeline(pipeline, source, sink, stats);
+    SetAsciiThreadCount(1);
+    if (options.metricsPath)
+        dumpMetrics();
+
+    AsciiServerStats served = server.GetStats();
+    server.Stop();
+    if (recording.IsOpen() && !recording.Close())
+    {
+        fprintf(stderr, "asciifilter_cli: cannot write %s\n", options.recordPath);
+        finished = false;
+    }
+
+    if (options.format == CliFormat::Ansi && !file && writeOutput)
+        WriteAsciiTerminal(1, AsciiTerminalEncoder::GetRestoreSequence());
+    if (file && fclose(file) != 0)
+        finished = false;
+    y4m.Close();
+
+    if (!options.quiet)
+    {
+        PrintPipelineStats(stats);
+        if (options.hysteresis)
+        {
+            const AsciiStabilizerStats& held = stabilizer.GetStats();
+            fprintf(stderr, "hysteresis: %llu cell changes passed, %llu held\n",
+                static_cast<unsigned long long>(held.changed), static_cast<unsigned long long>(held.suppressed));
+        }
+        if (options.recordPath)
+        {
+            const AsciiRecordingStats& recorded = recording.GetStats();
+            fprintf(stderr, "record: %llu frames, %llu keyframes, %.2f MB, %.3f ms per frame\n",
+                static_cast<unsigned long long>(recorded.frames), static_cast<unsigned long long>(recorded.keyframes),
+                recorded.bytes / 1e6, recorded.frames ? recorded.encodeTime / 1e6 / recorded.frames : 0.0);
+        }
+        if (options.serve)
+        {
+            double frames = served.frames ? static_cast<double>(served.frames) : 1.0;
+            fprintf(stderr, "serve: %llu viewers, %llu keyframes of %.0f bytes, deltas of %.0f bytes, "
+                "encode %.3f ms avg %.3f ms max, %.2f MB sent, %llu frames skipped\n",
+                static_cast<unsigned long long>(served.connections), static_cast<unsigned long long>(served.keyframes),
+                served.keyframes ? static_cast<double>(served.keyframeBytes) / served.keyframes : 0.0,
+                served.deltas ? static_cast<double>(served.deltaBytes) / served.deltas : 0.0,
+                served.encodeTime / frames / 1e6, served.maxEncodeTime / 1e6, served.bytesSent / 1e6,
+                static_cast<unsigned long long>(served.skipped));
+        }
+    }
+    if (!finished)
+        fprintf(stderr, "asciifilter_cli: cannot write %s\n", output);
+    if (reader.HasError())
+        fprintf(stderr, "asciifilter_cli: %s ends in a truncated frame\n", input);
+    return finished && !reader.HasError() ? 0 : 1;
+}
+
+// Writes one frame of a live view (--connect, --play) to stdout
+static bool ShowFrame(const CliOptions& options, AsciiTerminalEncoder& encoder, const std::vector<AsciiCell>& cells,
+    int cols, int rows, uint64_t index, std::string& data)
+{
+    data.clear();
+    if (options.format == CliFormat::Ansi)
+    {
+        encoder.Encode(cells, cols, rows, data);
+    }
+    else
+    {
+        if (index > 0)
+            data += '\f';
+        EncodeAsciiText(cells, cols, rows, data);
+    }
+    return WriteAsciiTerminal(1, data);
+}
+
+// Plays a recording from --seek at its recorded pace
+static int RunPlay(const CliOptions& options)
+{
+    AsciiRecordingReader reader;
+    if (!reader.Open(options.playPath))
+    {
+        fprintf(stderr, "asciifilter_cli: cannot read %s as a recording\n", options.playPath);
+        return 1;
+    }
+
+    AsciiTerminalEncoder encoder;
+    encoder.SetColorMode(options.colorMode);
+    std::string data;
+    size_t first = reader.FindFrame(static_cast<uint64_t>(options.seekSeconds * 1e9));
+    auto start = std::chrono::steady_clock::now();
+    bool ok = true;
+    for (size_t frame = first; ok && frame < reader.GetFrameCount(); ++frame)
+    {
+        std::this_thread::sleep_until(start + std::chrono::nanoseconds(reader.GetTimestamp(frame) - reader.GetTimestamp(first)));
+        ok = reader.ReadFrame(frame) &&
+            ShowFrame(options, encoder, reader.GetCells(), reader.GetCols(), reader.GetRows(), frame - first, data);
+    }
+    if (options.format == CliFormat::Ansi)
+        WriteAsciiTerminal(1, AsciiTerminalEncoder::GetRestoreSequence());
+    if (!options.quiet)
+    {
+        fprintf(stderr, "%zu of %zu frames shown, %.1f s recorded%s\n", reader.GetFrameCount() - first,
+            reader.GetFrameCount(), reader.GetDuration() / 1e9, reader.HasIndex() ? "" : ", index rebuilt");
+    }
+    return ok ? 0 : 1;
+}
+
+// Shows another instance's --serve stream until it ends
+static int RunConnect(const CliOptions& options)
+{
+    AsciiStreamClient client;
+    if (!client.Connect(options.connectHost.c_str(), options.connectPort, false))
+    {
+        fprintf(stderr, "asciifilter_cli: cannot connect to %s:%d\n", options.connectHost.c_str(), options.connectPort);
+        return 1;
+    }
+
+    AsciiDeltaDecoder decoder;
+    AsciiTerminalEncoder encoder;
+    encoder.SetColorMode(options.colorMode);
+    std::string packet, data;
+    uint64_t frames = 0;
+    bool ok = true;
+    while (ok && client.ReadPacket(packet))
+    {
+        // Until a keyframe arrives there is nothing to show
+        if (!decoder.Decode(reinterpret_cast<const uint8_t*>(packet.data()), packet.size()))
+            continue;
+        ok = ShowFrame(options, encoder, decoder.GetCells(), decoder.GetCols(), decoder.GetRows(), frames++, data);
+    }
+    if (options.format == CliFormat::Ansi)
+        WriteAsciiTerminal(1, AsciiTerminalEncoder::GetRestoreSequence());
+    if (!options.quiet)
+        fprintf(stderr, "%llu frames shown\n", static_cast<unsigned long long>(frames));
+    return ok ? 0 : 1;
+}
+
+static void PrintUsage()
+{
+    printf("usage: asciifilter_cli [options] INPUT...\n"
+        "  INPUT                   image file (PPM/PGM/PAM/BMP) or directory of them\n"
+        "  --output DIR            write DIR/<name>.txt or .ans, stdout when omitted\n"
+        "                          (<name>: the input's file name, or its path under\n"
+        "                          an input directory; streaming: the output file)\n"
+        "  --recursive             descend into subdirectories\n"
+        "  --format text|ansi|y4m  plain UTF-8 text, ANSI colored text or, streaming\n"
+        "                          only, rendered glyphs as Y4M video (default text)\n"
+        "  --colors truecolor|256|16|adaptive   ANSI color mode\n"
+        "  --block WxH             pixels per character cell (default 8x16)\n"
+        "  --glyphs intensity|shape|edge\n"
+        "  --kernel auto|scalar|sse4.1|avx2\n"
+        "  --threads N             worker threads, 0 = hardware threads (default)\n"
+        "  --quiet                 no per-file lines, only the summary\n"
+        "streaming (INPUT is a .y4m file, - for stdin, or raw video with --raw):\n"
+        "  --raw FMT               headless raw video, needs --size; FMT is an ffmpeg\n"
+        "                          pix_fmt: bgra, rgba, rgb24, gray, x2bgr10le, nv12,\n"
+        "                          yuv420p or p010le\n"
+        "  --size WxH              raw video frame size\n"
+        "  --frame-parallel N      convert N frames at a time, output stays in order\n"
+        "  --queue-depth N         frames between two stages (default 4)\n"
+        "  --hysteresis G,C        hold a cell's character until its luminance moved\n"
+        "                          more than G levels and its colors until a channel\n"
+        "                          moved more than C (e.g. 4,8)\n"
+        "  --metrics FILE          per-stage p50/p95/p99/max every second, JSON lines\n"
+        "                          for .json/.jsonl, CSV otherwise\n"
+        "  --serve [ADDR:]PORT     stream to TCP and WebSocket viewers at the video's\n"
+        "                          frame rate (ADDR defaults to 127.0.0.1); writes\n"
+        "                          output only when --output is given\n"
+        "  --keyframes N           frames between keyframes for all viewers (default 300)\n"
+        "  --record FILE           also keep the cells in a seekable recording\n"
+        "viewing (no INPUT):\n"
+        "  --connect HOST:PORT     show a --serve stream as text or ANSI\n"
+        "  --play FILE             play a recording at its recorded pace\n"
+        "  --seek SECONDS          start playing at this time\n");
+}
+
+int main(int argc, char** argv)
+{
+    CliOptions options;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+        if (!strcmp(arg, "--output") && value)           { options.outputDir = value; ++i; }
+        else if (!strcmp(arg, "--recursive"))            { options.recursive = true; }
+        else if (!strcmp(arg, "--quiet"))                { options.quiet = true; }
+        else if (!strcmp(arg, "--threads") && value)     { options.threads = atoi(value); ++i; }
+        else if (!strcmp(arg, "--format") && value && !strcmp(value, "text")) { options.format = CliFormat::Text; ++i; }
+        else if (!strcmp(arg, "--format") && value && !strcmp(value, "ansi")) { options.format = CliFormat::Ansi; ++i; }
+        else if (!strcmp(arg, "--colors") && value && ParseColorMode(value, options.colorMode)) { ++i; }
+        else if (!strcmp(arg, "--format") && value && !strcmp(value, "y4m"))  { options.format = CliFormat::Y4m; ++i; }
+        else if (!strcmp(arg, "--block") && value &&
+            ParseSize(value, options.geometry.blockWidth, options.geometry.blockHeight)) { ++i; }
+        else if (!strcmp(arg, "--raw") && value && ParseRawFormat(value, options.rawFormat)) { options.rawInput = true; ++i; }
+        else if (!strcmp(arg, "--size") && value && ParseSize(value, options.rawWidth, options.rawHeight)) { ++i; }
+        else if (!strcmp(arg, "--frame-parallel") && value) { options.frameParallel = atoi(value); ++i; }
+        else if (!strcmp(arg, "--queue-depth") && value)    { options.queueDepth = atoi(value); ++i; }
+        else if (!strcmp(arg, "--metrics") && value)        { options.metricsPath = value; ++i; }
+        else if (!strcmp(arg, "--hysteresis") && value && ParseMargins(value, options.stabilizer)) { options.hysteresis = true; ++i; }
+        else if (!strcmp(arg, "--serve") && value &&
+            ParseAddress(value, options.server.bindAddress, options.server.port)) { options.serve = true; ++i; }
+        else if (!strcmp(arg, "--keyframes") && value)      { options.server.keyframeInterval = atoi(value); ++i; }
+        else if (!strcmp(arg, "--connect") && value && strchr(value, ':') &&
+            ParseAddress(value, options.connectHost, options.connectPort)) { ++i; }
+        else if (!strcmp(arg, "--record") && value)         { options.recordPath = value; ++i; }
+        else if (!strcmp(arg, "--play") && value)           { options.playPath = value; ++i; }
+        else if (!strcmp(arg, "--seek") && value)           { options.seekSeconds = atof(value); ++i; }
+        else if (!strcmp(arg, "--kernel") && value && ParseKernel(value, options.kernel)) { ++i; }
+        else if (!strcmp(arg, "--glyphs") && value && !strcmp(value, "intensity")) { options.glyphMode = AsciiGlyphMode::Intensity; ++i; }
+        else if (!strcmp(arg, "--glyphs") && value && !strcmp(value, "shape"))     { options.glyphMode = AsciiGlyphMode::Shape; ++i; }
+        else if (!strcmp(arg, "--glyphs") && value && !strcmp(value, "edge"))      { options.glyphMode = AsciiGlyphMode::Edge; ++i; }
+        else if (arg[0] == '-' && arg[1] != '\0')
+        {
+            PrintUsage();
+            return 1;
+        }
+        else
+        {
+            options.inputs.push_back(arg);
+        }
+    }
+    if (options.connectPort > 0 && options.inputs.empty())
+        return RunConnect(options);
+    if (options.playPath && options.inputs.empty())
+        return RunPlay(options);
+    if (options.inputs.empty() || options.threads < 0 || options.frameParallel < 1 || options.queueDepth < 1)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    int threads = options.threads > 0 ? options.threads : static_cast<int>(std::thread::hardware_concurrency());
+    if (threads <= 0)
+        threads = 1;
+
+    SelectAsciiKernel(options.kernel);
+    SetAsciiGlyphMode(options.glyphMode);
+    PrepareAsciiConversion();
+
+    if (IsStreamInput(options))
+        return RunStream(options, threads);
+    if (options.format == CliFormat::Y4m)
+    {
+        fprintf(stderr, "asciifilter_cli: y4m output needs a video input\n");
+        return 1;
+    }
+    if (options.serve || options.recordPath)
+    {
+        fprintf(stderr, "asciifilter_cli: --serve and --record need a video input\n");
+        return 1;
+    }
+
+    std::vector<CliJob> jobs;
+    CollectInputs(options, jobs);
+    if (jobs.empty())
+    {
+        fprintf(stderr, "asciifilter_cli: no input images\n");
+        return 1;
+    }
+    if (!options.outputDir && jobs.size() > 1)
+    {
+        fprintf(stderr, "asciifilter_cli: %zu inputs need --output DIR\n", jobs.size());
+        return 1;
+    }
+    if (options.outputDir)
+    {
+        std::error_code error;
+        fs::create_directories(options.outputDir, error);
+        // The tree under each input directory is mirrored, and the source
+        // extension kept, so x.ppm and x.bmp or a/x.ppm and b/x.ppm do not
+        // meet. Explicit files from different directories still can.
+        const char* extension = options.format == CliFormat::Ansi ? ".ans" : ".txt";
+        std::map<fs::path, const CliJob*> outputs;
+        for (CliJob& job : jobs)
+        {
+            job.output = (fs::path(options.outputDir) / job.name).lexically_normal();
+            job.output += extension;
+            auto inserted = outputs.emplace(job.output, &job);
+            if (!inserted.second)
+            {
+                fprintf(stderr, "asciifilter_cli: %s and %s both write %s\n", inserted.first->second->input.string().c_str(),
+                    job.input.string().c_str(), job.output.string().c_str());
+                return 1;
+            }
+            fs::create_directories(job.output.parent_path(), error);
+        }
+    }
+
+    // Split by size from the headers alone; unreadable files go with the
+    // small ones and report their error there
+    std::vector<CliJob*> small, large;
+    for (CliJob& job : jobs)
+    {
+        int w = 0, h = 0;
+        bool sized = ReadAsciiImageSize(job.input.string().c_str(), w, h);
+        (sized && static_cast<int64_t>(w) * h >= ASCII_CLI_LARGE_PIXELS ? large : small).push_back(&job);
+    }
+
+    double start = NowSeconds();
+
+    // Small images: one file per worker, each conversion single threaded
+    SetAsciiThreadCount(1);
+    std::atomic<size_t> next(0);
+    auto runSmall = [&]() {
+        CliWorker worker;
+        for (size_t i = next++; i < small.size(); i = next++)
+            small[i]->ok = ConvertFile(options, *small[i], worker);
+    };
+    int fileWorkers = static_cast<int>(std::min<size_t>(static_cast<size_t>(threads), small.size()));
+    std::vector<std::thread> workers;
+    for (int i = 1; i < fileWorkers; ++i)
+        workers.emplace_back(runSmall);
+    if (fileWorkers > 0)
+        runSmall();
+    for (std::thread& worker : workers)
+        worker.join();
+
+    // Large images: one at a time, the conversion split over the pool
+    SetAsciiThreadCount(threads);
+    CliWorker worker;
+    for (CliJob* job : large)
+        job->ok = ConvertFile(options, *job, worker);
+    SetAsciiThreadCount(1);
+
+    double seconds = NowSeconds() - start;
+
+    int converted = 0;
+    int64_t pixels = 0;
+    for (const CliJob& job : jobs)
+    {
+        if (!job.ok)
+            continue;
+        ++converted;
+        pixels += job.pixels;
+        if (!options.quiet && options.outputDir)
+            fprintf(stderr, "%s -> %s\n", job.input.string().c_str(), job.output.string().c_str());
+    }
+    if (seconds <= 0.0)
+        seconds = 1e-9;
+    fprintf(stderr, "%d/%zu images (%zu large) on %d threads in %.3f s: %.1f images/s, %.1f MP/s\n",
+        converted, jobs.size(), large.size(), threads, seconds, converted / seconds, pixels / seconds / 1e6);
+    return converted == static_cast<int>(jobs.size()) ? 0 : 1;
+}
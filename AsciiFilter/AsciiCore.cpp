@@ -0,0 +1,672 @@
+﻿#include "AsciiCore.h"
+#include "AsciiKernels.h"
+#include "AsciiThreadPool.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+#if defined(ASCII_HAVE_X86_KERNELS) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+//Constants
+static const char* ASCII_GRAYSCALE = " !\"#$ % &\\'()*+,-./0123456789:;<=>?@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_`abcdefghijklmnopqrstuvwxyz{|}~"; // ASCII palette
+static const int ASCII_CELL_ASPECT = 2; // Cell height relative to its width
+
+// For precomputing the ASCII-grayscale palette
+static wchar_t intensityToAscii[256];
+static bool initialized = false;
+
+// Glyphs for shape matching and the palette ramp, built-in font by default
+static AsciiGlyphSet g_glyphSet;
+static bool g_glyphSetReady = false;
+static AsciiGlyphMode g_glyphMode = AsciiGlyphMode::Intensity;
+static uint32_t g_glyphVersion = 1;
+
+// Kernel used by ConvertRegionToAscii, resolved on first use
+static AsciiKernel g_activeKernel = AsciiKernel::Auto;
+
+// Workers for the conversion, null when running single threaded
+static std::unique_ptr<AsciiThreadPool> g_threadPool;
+
+void InitializeAsciiGrayscalePalette() {
+	// Order the glyphs from least to most ink so the ramp is monotonic
+	const AsciiGlyphSet& glyphs = GetAsciiGlyphSet();
+	std::vector<int> order(glyphs.GetGlyphCount());
+	for (size_t i = 0; i < order.size(); ++i)
+		order[i] = static_cast<int>(i);
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+		return glyphs.GetCoverage(a) < glyphs.GetCoverage(b);
+	});
+
+	for (int i = 0; i < 256; ++i) {
+		if (order.empty()) {
+			intensityToAscii[i] = L' ';
+			continue;
+		}
+		long asciiIndex = static_cast<long>(i * (order.size() - 1) / 255.0f);
+		intensityToAscii[i] = glyphs.GetGlyph(order[asciiIndex]);
+	}
+	initialized = true;
+}
+
+void SetAsciiGlyphSet(const AsciiGlyphSet& glyphs)
+{
+	g_glyphSet = glyphs;
+	g_glyphSetReady = true;
+	++g_glyphVersion;
+	InitializeAsciiGrayscalePalette();
+}
+
+const AsciiGlyphSet& GetAsciiGlyphSet()
+{
+	if (!g_glyphSetReady) {
+		g_glyphSet.AddBuiltinGlyphs(ASCII_GRAYSCALE);
+		g_glyphSetReady = true;
+	}
+	return g_glyphSet;
+}
+
+void SetAsciiGlyphMode(AsciiGlyphMode mode)
+{
+	if (mode != g_glyphMode) {
+		g_glyphMode = mode;
+		++g_glyphVersion;
+	}
+}
+
+AsciiGlyphMode GetAsciiGlyphMode()
+{
+	return g_glyphMode;
+}
+
+uint32_t GetAsciiGlyphVersion()
+{
+	return g_glyphVersion;
+}
+
+const wchar_t* GetAsciiPalette()
+{
+	if (!initialized)
+		InitializeAsciiGrayscalePalette();
+	return intensityToAscii;
+}
+
+void PrepareAsciiConversion()
+{
+	GetAsciiPalette();
+	GetAsciiGlyphSet();
+	GetActiveAsciiKernel();
+}
+
+//------------------------------------------------------------
+// CPU feature detection
+//------------------------------------------------------------
+#ifdef ASCII_HAVE_X86_KERNELS
+static bool CpuHasSSE41()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 19)) != 0;
+#else
+	return __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+static bool CpuHasAVX2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx)
+		return false;
+	// The OS has to save the YMM registers on context switch
+	if ((_xgetbv(0) & 0x6) != 0x6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+bool IsAsciiKernelSupported(AsciiKernel kernel)
+{
+	switch (kernel) {
+	case AsciiKernel::Auto:
+	case AsciiKernel::Scalar:
+		return true;
+#ifdef ASCII_HAVE_X86_KERNELS
+	case AsciiKernel::SSE41:
+		return CpuHasSSE41();
+	case AsciiKernel::AVX2:
+		return CpuHasAVX2();
+#endif
+	default:
+		return false;
+	}
+}
+
+const char* GetAsciiKernelName(AsciiKernel kernel)
+{
+	switch (kernel) {
+	case AsciiKernel::Auto:   return "auto";
+	case AsciiKernel::Scalar: return "scalar";
+	case AsciiKernel::SSE41:  return "sse4.1";
+	case AsciiKernel::AVX2:   return "avx2";
+	}
+	return "unknown";
+}
+
+AsciiKernel SelectAsciiKernel(AsciiKernel kernel)
+{
+	if (kernel == AsciiKernel::Auto) {
+		if (IsAsciiKernelSupported(AsciiKernel::AVX2))
+			kernel = AsciiKernel::AVX2;
+		else if (IsAsciiKernelSupported(AsciiKernel::SSE41))
+			kernel = AsciiKernel::SSE41;
+		else
+			kernel = AsciiKernel::Scalar;
+	}
+	else if (!IsAsciiKernelSupported(kernel)) {
+		kernel = AsciiKernel::Scalar;
+	}
+
+	g_activeKernel = kernel;
+	return kernel;
+}
+
+AsciiKernel GetActiveAsciiKernel()
+{
+	if (g_activeKernel == AsciiKernel::Auto)
+		SelectAsciiKernel(AsciiKernel::Auto);
+	return g_activeKernel;
+}
+
+void SetAsciiThreadCount(int threadCount)
+{
+	if (threadCount <= 0)
+		threadCount = static_cast<int>(std::thread::hardware_concurrency());
+	if (threadCount == GetAsciiThreadCount())
+		return;
+
+	g_threadPool.reset();
+	if (threadCount > 1)
+		g_threadPool.reset(new AsciiThreadPool(threadCount));
+}
+
+int GetAsciiThreadCount()
+{
+	return g_threadPool ? g_threadPool->GetThreadCount() : 1;
+}
+
+AsciiThreadPool* GetAsciiThreadPool()
+{
+	return g_threadPool.get();
+}
+
+bool IsAsciiGeometrySpecialized(const AsciiGeometry& geometry)
+{
+#define X(W, H) if (geometry.blockWidth == W && geometry.blockHeight == H) return true;
+	ASCII_FOR_EACH_FIXED_GEOMETRY(X)
+#undef X
+	return false;
+}
+
+// Row kernel for the active instruction set, glyph mode, block geometry
+// and pixel format
+AsciiRowKernel GetAsciiRowKernel(const AsciiGeometry& geometry, AsciiPixelFormat format)
+{
+	if (format != AsciiPixelFormat::BGRA8)
+		return GetFormatRowKernel(format, g_glyphMode);
+	if (g_glyphMode == AsciiGlyphMode::Shape)
+		return GetShapeRowKernel(geometry.blockWidth, geometry.blockHeight);
+	if (g_glyphMode == AsciiGlyphMode::Edge) {
+		switch (GetActiveAsciiKernel()) {
+#ifdef ASCII_HAVE_X86_KERNELS
+		case AsciiKernel::SSE41: return GetEdgeRowKernelSSE41(geometry.blockWidth, geometry.blockHeight);
+		case AsciiKernel::AVX2:  return GetEdgeRowKernelAVX2(geometry.blockWidth, geometry.blockHeight);
+#endif
+		default:                 return GetEdgeRowKernelScalar(geometry.blockWidth, geometry.blockHeight);
+		}
+	}
+
+	switch (GetActiveAsciiKernel()) {
+#ifdef ASCII_HAVE_X86_KERNELS
+	case AsciiKernel::SSE41: return GetRowKernelSSE41(geometry.blockWidth, geometry.blockHeight);
+	case AsciiKernel::AVX2:  return GetRowKernelAVX2(geometry.blockWidth, geometry.blockHeight);
+#endif
+	default:                 return GetRowKernelScalar(geometry.blockWidth, geometry.blockHeight);
+	}
+}
+
+AsciiSumKernel GetAsciiSumKernel(const AsciiGeometry& geometry)
+{
+	switch (GetActiveAsciiKernel()) {
+#ifdef ASCII_HAVE_X86_KERNELS
+	case AsciiKernel::SSE41: return GetSumKernelSSE41(geometry.blockWidth, geometry.blockHeight);
+	case AsciiKernel::AVX2:  return GetSumKernelAVX2(geometry.blockWidth, geometry.blockHeight);
+#endif
+	default:                 return GetSumKernelScalar(geometry.blockWidth, geometry.blockHeight);
+	}
+}
+
+AsciiBlockHasher GetAsciiBlockHasher()
+{
+	switch (GetActiveAsciiKernel()) {
+#ifdef ASCII_HAVE_X86_KERNELS
+	case AsciiKernel::SSE41: return HashBlockSSE41;
+	case AsciiKernel::AVX2:  return HashBlockAVX2;
+#endif
+	default:                 return HashBlockScalar;
+	}
+}
+
+AsciiGlyphSearch GetAsciiGlyphSearch()
+{
+	switch (GetActiveAsciiKernel()) {
+#ifdef ASCII_HAVE_X86_KERNELS
+	case AsciiKernel::SSE41: return SearchGlyphsSSE41;
+	case AsciiKernel::AVX2:  return SearchGlyphsAVX2;
+#endif
+	default:                 return SearchGlyphsScalar;
+	}
+}
+
+AsciiGlyphBlender GetAsciiGlyphBlender()
+{
+	switch (GetActiveAsciiKernel()) {
+#ifdef ASCII_HAVE_X86_KERNELS
+	case AsciiKernel::SSE41: return BlendGlyphRowSSE41;
+	case AsciiKernel::AVX2:  return BlendGlyphRowAVX2;
+#endif
+	default:                 return BlendGlyphRowScalar;
+	}
+}
+
+AsciiCellComparer GetAsciiCellComparer()
+{
+	switch (GetActiveAsciiKernel()) {
+#ifdef ASCII_HAVE_X86_KERNELS
+	case AsciiKernel::SSE41: return CompareCellsSSE41;
+	case AsciiKernel::AVX2:  return CompareCellsAVX2;
+#endif
+	default:                 return CompareCellsScalar;
+	}
+}
+
+//------------------------------------------------------------
+// Reference block hash
+//------------------------------------------------------------
+uint64_t HashBlockScalar(const uint8_t* pixel, int rowPitch, int width, int height)
+{
+	uint64_t acc[4] = { 0, 0, 0, 0 };
+	uint64_t key[4] = { ASCII_HASH_KEYS[0], ASCII_HASH_KEYS[1], ASCII_HASH_KEYS[2], ASCII_HASH_KEYS[3] };
+	size_t bytes = static_cast<size_t>(width) * 4;
+
+	for (int y = 0; y < height; ++y) {
+		const uint8_t* row = pixel + static_cast<size_t>(y) * rowPitch;
+		for (size_t i = 0; i < bytes; i += 32) {
+			uint64_t words[4] = { 0, 0, 0, 0 };
+			memcpy(words, row + i, bytes - i < 32 ? bytes - i : 32);
+			for (int lane = 0; lane < 4; ++lane) {
+				key[lane] += ASCII_HASH_KEY_STEP;
+				uint64_t x = words[lane] ^ key[lane];
+				acc[lane] += words[lane] + (x & 0xFFFFFFFFull) * (x >> 32);
+			}
+		}
+	}
+	return FinishBlockHash(acc, width, height);
+}
+
+//------------------------------------------------------------
+// Reference kernel: one byte at a time
+//------------------------------------------------------------
+template<typename Out>
+static void ConvertRowScalar(const AsciiBlockJob& job, int row, Out* outRow)
+{
+	for (int col = 0; col < job.outCols; ++col) {
+		// Pixel block region
+		int startX, startY, endX, endY;
+		GetBlockBounds(job, row, col, startX, startY, endX, endY);
+
+		// Accumulate color
+		uint32_t sumR = 0, sumG = 0, sumB = 0;
+		uint32_t count = static_cast<uint32_t>((endX - startX) * (endY - startY));
+		const uint8_t* pixel = job.frame + static_cast<size_t>(startY) * job.rowPitch + startX * 4;
+		SumBlockScalar(pixel, job.rowPitch, endX - startX, endY - startY, sumR, sumG, sumB);
+
+		if (count > 0)
+			AsciiStoreBlock(outRow[col], sumR, sumG, sumB, count, job.palette);
+	}
+}
+
+// Full blocks take the unrolled path, clipped edge blocks the generic one
+template<int W, int H, typename Out>
+static void ConvertRowScalarFixed(const AsciiBlockJob& job, int row, Out* outRow)
+{
+	for (int col = 0; col < job.outCols; ++col) {
+		int startX, startY, endX, endY;
+		GetBlockBounds(job, row, col, startX, startY, endX, endY);
+
+		uint32_t sumR = 0, sumG = 0, sumB = 0;
+		const uint8_t* pixel = job.frame + static_cast<size_t>(startY) * job.rowPitch + startX * 4;
+		if (endX - startX == W && endY - startY == H) {
+			AsciiUnroll<H>([&](int y) {
+				const uint8_t* p = pixel + static_cast<size_t>(y) * job.rowPitch;
+				AsciiUnroll<W>([&](int x) {
+					sumB += p[x * 4 + 0];
+					sumG += p[x * 4 + 1];
+					sumR += p[x * 4 + 2];
+				});
+			});
+			AsciiStoreBlock(outRow[col], sumR, sumG, sumB, W * H, job.palette);
+		}
+		else {
+			uint32_t count = static_cast<uint32_t>((endX - startX) * (endY - startY));
+			SumBlockScalar(pixel, job.rowPitch, endX - startX, endY - startY, sumR, sumG, sumB);
+			if (count > 0)
+				AsciiStoreBlock(outRow[col], sumR, sumG, sumB, count, job.palette);
+		}
+	}
+}
+
+//------------------------------------------------------------
+// Reference edge kernel
+//------------------------------------------------------------
+static void ConvertRowEdgeScalar(const AsciiBlockJob& job, int row, AsciiCell* outRow)
+{
+	for (int col = 0; col < job.outCols; ++col) {
+		int startX, startY, endX, endY;
+		GetBlockBounds(job, row, col, startX, startY, endX, endY);
+
+		uint32_t sumR = 0, sumG = 0, sumB = 0;
+		uint32_t count = static_cast<uint32_t>((endX - startX) * (endY - startY));
+		const uint8_t* pixel = job.frame + static_cast<size_t>(startY) * job.rowPitch + startX * 4;
+		SumBlockScalar(pixel, job.rowPitch, endX - startX, endY - startY, sumR, sumG, sumB);
+		AsciiEdgeSums edges;
+		SumEdgesScalar(pixel, job.rowPitch, endX - startX, endY - startY, edges);
+		AsciiEdgeWeights weights;
+		GetAsciiEdgeWeights(endX - startX, endY - startY, weights);
+
+		if (count > 0)
+			outRow[col] = MakeAsciiEdgeCell(sumR, sumG, sumB, count, edges, weights, job.palette);
+	}
+}
+
+AsciiRowKernel GetEdgeRowKernelScalar(int, int)
+{
+	return ConvertRowEdgeScalar;
+}
+
+AsciiRowKernel GetRowKernelScalar(int blockWidth, int blockHeight)
+{
+#define X(W, H) if (blockWidth == W && blockHeight == H) return ConvertRowScalarFixed<W, H, AsciiCell>;
+	ASCII_FOR_EACH_FIXED_GEOMETRY(X)
+#undef X
+	return ConvertRowScalar<AsciiCell>;
+}
+
+AsciiSumKernel GetSumKernelScalar(int blockWidth, int blockHeight)
+{
+#define X(W, H) if (blockWidth == W && blockHeight == H) return ConvertRowScalarFixed<W, H, AsciiBlockSums>;
+	ASCII_FOR_EACH_FIXED_GEOMETRY(X)
+#undef X
+	return ConvertRowScalar<AsciiBlockSums>;
+}
+
+void ConvertDirtyCells(const AsciiBlockJob& job, AsciiRowKernel rowKernel, int row,
+	uint8_t* flags, AsciiCell* cells, bool forceChanged)
+{
+	// Runs are converted in chunks on the stack: a thread_local buffer
+	// would allocate on whichever worker first gets a row after warm-up
+	const int chunkCells = 64;
+	AsciiCell scratch[chunkCells];
+
+	for (int col = 0; col < job.outCols;) {
+		if (flags[col] == ASCII_CELL_CLEAN) {
+			++col;
+			continue;
+		}
+		int runEnd = col + 1;
+		while (runEnd < job.outCols && runEnd - col < chunkCells && flags[runEnd] != ASCII_CELL_CLEAN)
+			++runEnd;
+
+		// Kernels place cell c at region.left + c * blockWidth, so moving
+		// the left edge makes the run start at cell 0
+		AsciiBlockJob run = job;
+		run.region.left = job.region.left + col * job.blockWidth;
+		run.outCols = runEnd - col;
+		rowKernel(run, row, scratch);
+
+		for (int c = col; c < runEnd; ++c) {
+			const AsciiCell& cell = scratch[c - col];
+			if (forceChanged || cell != cells[c]) {
+				cells[c] = cell;
+				flags[c] = ASCII_CELL_CHANGED;
+			}
+			else {
+				flags[c] = ASCII_CELL_CONVERTED;
+			}
+		}
+		col = runEnd;
+	}
+}
+
+void MarkAsciiDamage(const AsciiBlockJob& job, int rows, const std::vector<AsciiRect>& damage,
+	uint8_t* flags, uint8_t mark)
+{
+	const AsciiRect& clipped = job.region;
+	for (const AsciiRect& rect : damage) {
+		int left = rect.left > clipped.left ? rect.left : clipped.left;
+		int top = rect.top > clipped.top ? rect.top : clipped.top;
+		int right = rect.right < clipped.right ? rect.right : clipped.right;
+		int bottom = rect.bottom < clipped.bottom ? rect.bottom : clipped.bottom;
+		if (left >= right || top >= bottom)
+			continue;
+
+		int colBegin = (left - clipped.left) / job.blockWidth;
+		int colEnd = (right - clipped.left + job.blockWidth - 1) / job.blockWidth;
+		int rowBegin = (top - clipped.top) / job.blockHeight;
+		int rowEnd = (bottom - clipped.top + job.blockHeight - 1) / job.blockHeight;
+		rowEnd = rowEnd < rows ? rowEnd : rows;
+		for (int row = rowBegin; row < rowEnd; ++row) {
+			uint8_t* rowFlags = flags + static_cast<size_t>(row) * job.outCols;
+			for (int col = colBegin; col < colEnd; ++col)
+				rowFlags[col] = mark;
+		}
+	}
+}
+
+bool PrepareAsciiBlockJob(const AsciiImageView& image,
+	const AsciiRect& region, const AsciiGeometry& geometry,
+	AsciiBlockJob& job, int& outCols, int& outRows)
+{
+	int blockWidth = geometry.blockWidth;
+	int blockHeight = geometry.blockHeight;
+
+	// Clamp the region to the frame so the kernels never read out of bounds
+	AsciiRect clipped = region;
+	clipped.left = clipped.left < 0 ? 0 : clipped.left;
+	clipped.top = clipped.top < 0 ? 0 : clipped.top;
+	clipped.right = clipped.right > image.width ? image.width : clipped.right;
+	clipped.bottom = clipped.bottom > image.height ? image.height : clipped.bottom;
+
+	// Compute region size
+	int regionW = clipped.right - clipped.left;
+	int regionH = clipped.bottom - clipped.top;
+	bool missingChroma = IsAsciiYuvFormat(image.format) &&
+		(!image.chroma[0] || (image.format == AsciiPixelFormat::I420 && !image.chroma[1]));
+	if (!image.data || missingChroma || blockWidth <= 0 || blockHeight <= 0 || regionW <= 0 || regionH <= 0) {
+		outCols = 0;
+		outRows = 0;
+		return false;
+	}
+
+	// Calculate number of blocks
+	outCols = (regionW + blockWidth - 1) / blockWidth;
+	outRows = (regionH + blockHeight - 1) / blockHeight;
+
+	job.frame = image.data;
+	job.rowPitch = image.stride;
+	job.format = image.format;
+	job.chroma[0] = image.chroma[0];
+	job.chroma[1] = image.chroma[1];
+	job.chromaPitch = image.chromaStride;
+	job.region = clipped;
+	job.blockWidth = blockWidth;
+	job.blockHeight = blockHeight;
+	job.outCols = outCols;
+	job.palette = GetAsciiPalette();
+	job.glyphs = g_glyphMode == AsciiGlyphMode::Shape ? &GetAsciiGlyphSet() : nullptr;
+	return true;
+}
+
+//------------------------------------------------------------
+// Convert the region portion of the frameData to ASCII
+// with block sampling of size blockWidth x blockHeight
+//------------------------------------------------------------
+void ConvertRegionToAscii(const AsciiImageView& image,
+	const AsciiRect& region, const AsciiGeometry& geometry,
+	std::vector<AsciiCell>& asciiOut,
+	int& outCols, int& outRows)
+{
+	AsciiBlockJob job;
+	if (!PrepareAsciiBlockJob(image, region, geometry, job, outCols, outRows)) {
+		asciiOut.clear();
+		return;
+	}
+
+	asciiOut.resize(static_cast<size_t>(outCols) * outRows);
+
+	// Every cell row is one task; rows write disjoint parts of asciiOut
+	AsciiRowKernel rowKernel = GetAsciiRowKernel(geometry, image.format);
+	AsciiCell* cells = asciiOut.data();
+	if (g_threadPool) {
+		g_threadPool->ParallelFor(outRows, [&](int row) {
+			rowKernel(job, row, cells + static_cast<size_t>(row) * outCols);
+		});
+		return;
+	}
+	for (int row = 0; row < outRows; ++row) {
+		rowKernel(job, row, cells + static_cast<size_t>(row) * outCols);
+	}
+}
+
+//------------------------------------------------------------
+// Re-convert only the cells touched by the damage rectangles
+//------------------------------------------------------------
+void ConvertRegionToAscii(const AsciiImageView& image,
+	const AsciiRect& region, const AsciiGeometry& geometry,
+	const std::vector<AsciiRect>& damage,
+	AsciiCellGrid& grid, std::vector<int>& changedCells)
+{
+	changedCells.clear();
+
+	AsciiBlockJob job;
+	int cols = 0, rows = 0;
+	if (!PrepareAsciiBlockJob(image, region, geometry, job, cols, rows)) {
+		grid.cells.clear();
+		grid.cols = 0;
+		grid.rows = 0;
+		return;
+	}
+
+	const AsciiRect& clipped = job.region;
+	bool fullUpdate = cols != grid.cols || rows != grid.rows ||
+		grid.cells.size() != static_cast<size_t>(cols) * rows ||
+		clipped.left != grid.region.left || clipped.top != grid.region.top ||
+		clipped.right != grid.region.right || clipped.bottom != grid.region.bottom ||
+		geometry.blockWidth != grid.geometry.blockWidth || geometry.blockHeight != grid.geometry.blockHeight ||
+		image.format != grid.format || grid.glyphVersion != g_glyphVersion;
+
+	grid.cells.resize(static_cast<size_t>(cols) * rows);
+	grid.cols = cols;
+	grid.rows = rows;
+	grid.region = clipped;
+	grid.geometry = geometry;
+	grid.format = image.format;
+	grid.glyphVersion = g_glyphVersion;
+
+	// Mark the cells under each damage rectangle
+	static thread_local std::vector<uint8_t> flags;
+	flags.assign(grid.cells.size(), fullUpdate ? ASCII_CELL_CONVERTED : ASCII_CELL_CLEAN);
+	if (!fullUpdate)
+		MarkAsciiDamage(job, rows, damage, flags.data(), ASCII_CELL_CONVERTED);
+
+	// Only rows with damage become tasks
+	static thread_local std::vector<int> dirtyRows;
+	dirtyRows.clear();
+	for (int row = 0; row < rows; ++row) {
+		const uint8_t* rowFlags = flags.data() + static_cast<size_t>(row) * cols;
+		for (int col = 0; col < cols; ++col) {
+			if (rowFlags[col] != ASCII_CELL_CLEAN) {
+				dirtyRows.push_back(row);
+				break;
+			}
+		}
+	}
+
+	AsciiRowKernel rowKernel = GetAsciiRowKernel(geometry, image.format);
+	// Workers have their own thread_local buffers, hand them ours
+	uint8_t* flagData = flags.data();
+	const int* dirtyRowData = dirtyRows.data();
+	AsciiCell* cells = grid.cells.data();
+	auto convertRow = [&](int index) {
+		int row = dirtyRowData[index];
+		size_t offset = static_cast<size_t>(row) * cols;
+		ConvertDirtyCells(job, rowKernel, row, flagData + offset, cells + offset, fullUpdate);
+	};
+	if (g_threadPool) {
+		g_threadPool->ParallelFor(static_cast<int>(dirtyRows.size()), convertRow);
+	}
+	else {
+		for (int i = 0; i < static_cast<int>(dirtyRows.size()); ++i)
+			convertRow(i);
+	}
+
+	for (int row : dirtyRows) {
+		size_t offset = static_cast<size_t>(row) * cols;
+		for (int col = 0; col < cols; ++col) {
+			if (flags[offset + col] == ASCII_CELL_CHANGED)
+				changedCells.push_back(static_cast<int>(offset + col));
+		}
+	}
+}
+
+void ConvertRegionToAscii(const std::vector<uint8_t>& frameData,
+	int desktopWidth, int desktopHeight,
+	const AsciiRect& region, const AsciiGeometry& geometry,
+	std::vector<AsciiCell>& asciiOut,
+	int& outCols, int& outRows)
+{
+	ConvertRegionToAscii(MakeAsciiImageView(frameData, desktopWidth, desktopHeight),
+		region, geometry, asciiOut, outCols, outRows);
+}
+
+void ConvertRegionToAscii(const std::vector<uint8_t>& frameData,
+	int desktopWidth, int desktopHeight,
+	const AsciiRect& region, const AsciiGeometry& geometry,
+	const std::vector<AsciiRect>& damage,
+	AsciiCellGrid& grid, std::vector<int>& changedCells)
+{
+	ConvertRegionToAscii(MakeAsciiImageView(frameData, desktopWidth, desktopHeight),
+		region, geometry, damage, grid, changedCells);
+}
+
+void ConvertRegionToAscii(const std::vector<uint8_t>& frameData,
+	int desktopWidth, int desktopHeight,
+	const AsciiRect& region, int blockSize,
+	std::vector<AsciiCell>& asciiOut,
+	int& outCols, int& outRows)
+{
+	AsciiGeometry geometry;
+	geometry.blockWidth = blockSize;
+	geometry.blockHeight = blockSize * ASCII_CELL_ASPECT;
+	ConvertRegionToAscii(frameData, desktopWidth, desktopHeight, region, geometry, asciiOut, outCols, outRows);
+}
@@ -0,0 +1,212 @@
+﻿// AsciiCore.h : Platform independent part of the ASCII filter.
+// Everything in here builds without <windows.h> so the conversion
+// code can be compiled and exercised on any platform.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Colors use the same 0x00BBGGRR layout as a Win32 COLORREF, so they
+// can be handed to SetTextColor/SetBkColor without conversion.
+typedef uint32_t AsciiColor;
+
+inline constexpr AsciiColor AsciiRgb(uint8_t r, uint8_t g, uint8_t b)
+{
+    return static_cast<AsciiColor>(r) | (static_cast<AsciiColor>(g) << 8) | (static_cast<AsciiColor>(b) << 16);
+}
+
+inline constexpr uint8_t AsciiRValue(AsciiColor c) { return static_cast<uint8_t>(c); }
+inline constexpr uint8_t AsciiGValue(AsciiColor c) { return static_cast<uint8_t>(c >> 8); }
+inline constexpr uint8_t AsciiBValue(AsciiColor c) { return static_cast<uint8_t>(c >> 16); }
+
+// A small struct to hold block-based ASCII info
+struct AsciiCell
+{
+    wchar_t ch;
+    AsciiColor textColor;
+    AsciiColor bgColor;   // Background color
+};
+
+// Compare field by field; AsciiCell has padding where wchar_t is 16-bit
+inline bool operator==(const AsciiCell& a, const AsciiCell& b)
+{
+    return a.ch == b.ch && a.textColor == b.textColor && a.bgColor == b.bgColor;
+}
+
+inline bool operator!=(const AsciiCell& a, const AsciiCell& b)
+{
+    return !(a == b);
+}
+
+// Same meaning as a Win32 RECT: right/bottom are exclusive
+struct AsciiRect
+{
+    int left;
+    int top;
+    int right;
+    int bottom;
+};
+
+// Size of the pixel block sampled for one character cell
+struct AsciiGeometry
+{
+    int blockWidth = 8;
+    int blockHeight = 16;
+};
+
+// Layout of the pixels behind an AsciiImageView. The YUV formats are
+// BT.601 limited range with chroma at half resolution in both directions
+// (rounded up), like decoded video and Y4M files.
+enum class AsciiPixelFormat
+{
+    BGRA8,   // 4 bytes per pixel: B, G, R, A (Desktop Duplication, DIB sections)
+    RGBA8,   // 4 bytes per pixel: R, G, B, A
+    RGB8,    // 3 bytes per pixel: R, G, B
+    Gray8,   // 1 byte per pixel, full range
+    RGB10A2, // 32 bits per pixel: R in bits 0-9, G in 10-19, B in 20-29 (HDR desktops)
+    NV12,    // Y plane, then one plane of interleaved U, V pairs (hardware decoders)
+    I420,    // Y plane, then a U and a V plane (yuv420p, Y4M)
+    P010,    // NV12 with 16-bit little endian samples, 10 bits in the high bits
+};
+
+const char* GetAsciiPixelFormatName(AsciiPixelFormat format);
+
+inline constexpr bool IsAsciiYuvFormat(AsciiPixelFormat format)
+{
+    return format == AsciiPixelFormat::NV12 || format == AsciiPixelFormat::I420 || format == AsciiPixelFormat::P010;
+}
+
+// Bytes of a tightly packed width x height frame, planes back to back
+size_t GetAsciiFrameSize(AsciiPixelFormat format, int width, int height);
+
+// Non-owning, strided view of an image. The conversion reads straight from
+// it, so a mapped texture or a sub-rectangle of a bigger buffer can be
+// converted without copying. stride is in bytes and may exceed width times
+// the pixel size. For the YUV formats data and stride describe the Y plane.
+struct AsciiImageView
+{
+    const uint8_t* data = nullptr;
+    int width = 0;
+    int height = 0;
+    int stride = 0;
+    AsciiPixelFormat format = AsciiPixelFormat::BGRA8;
+
+    // Chroma of the YUV formats: the U/V plane of NV12 and P010, or the U
+    // and V planes of I420, which share chromaStride
+    const uint8_t* chroma[2] = { nullptr, nullptr };
+    int chromaStride = 0;
+};
+
+// View of a tightly packed frame of size bytes in any format (see
+// GetAsciiFrameSize); empty when the buffer is too small
+AsciiImageView MakeAsciiImageView(const uint8_t* data, size_t size, int width, int height, AsciiPixelFormat format);
+
+// View of a tightly packed BGRA buffer; empty when the buffer is too small
+inline AsciiImageView MakeAsciiImageView(const std::vector<uint8_t>& frameData, int width, int height)
+{
+    AsciiImageView view;
+    if (width > 0 && height > 0 && frameData.size() >= static_cast<size_t>(width) * height * 4) {
+        view.data = frameData.data();
+        view.width = width;
+        view.height = height;
+        view.stride = width * 4;
+    }
+    return view;
+}
+
+// Cell grid kept across frames for damage based updates
+struct AsciiCellGrid
+{
+    std::vector<AsciiCell> cells;
+    int cols = 0;
+    int rows = 0;
+    AsciiRect region = { 0, 0, 0, 0 };  // Clamped region the cells belong to
+    AsciiGeometry geometry;
+    AsciiPixelFormat format = AsciiPixelFormat::BGRA8;
+    uint32_t glyphVersion = 0;          // GetAsciiGlyphVersion() when converted
+};
+
+// Block averaging kernels. Auto picks the fastest one the CPU supports.
+enum class AsciiKernel { Auto, Scalar, SSE41, AVX2 };
+
+// Precompute the intensity -> character lookup table
+void InitializeAsciiGrayscalePalette();
+
+// Builds every lazily initialized table (palette, glyph set, kernel
+// choice). They are not thread safe, so call this once before converting
+// from several threads at a time.
+void PrepareAsciiConversion();
+
+// How the character of a cell is chosen
+enum class AsciiGlyphMode
+{
+    Intensity,  // By average luminance, from a ramp sorted by ink coverage
+    Shape,      // By matching 4x8 sub-cell structure against glyph masks (AsciiGlyphs.h)
+    Edge,       // By intensity, except | / - \ _ in blocks crossed by one strong edge (BGRA8 only)
+};
+
+void SetAsciiGlyphMode(AsciiGlyphMode mode);
+AsciiGlyphMode GetAsciiGlyphMode();
+
+// Bumped whenever the glyph mode or glyph set changes, so cached cells
+// (AsciiCellGrid, AsciiTileCache) know they have to be converted again
+uint32_t GetAsciiGlyphVersion();
+
+// Selects the kernel used by ConvertRegionToAscii. Returns the kernel that
+// is actually active, which falls back to Scalar when the requested one is
+// not supported by this CPU or build.
+AsciiKernel SelectAsciiKernel(AsciiKernel kernel);
+AsciiKernel GetActiveAsciiKernel();
+bool IsAsciiKernelSupported(AsciiKernel kernel);
+const char* GetAsciiKernelName(AsciiKernel kernel);
+
+// Number of threads used by the conversion, counting the calling thread.
+// 1 (the default) converts on the calling thread only, 0 uses every
+// hardware thread. Workers persist until the count changes again.
+void SetAsciiThreadCount(int threadCount);
+int GetAsciiThreadCount();
+
+// True when the geometry has a kernel with fully unrolled block loops
+// (4x8, 6x12, 8x16 and 10x20). Other sizes use the generic kernel.
+bool IsAsciiGeometrySpecialized(const AsciiGeometry& geometry);
+
+// Convert the region portion of an image to ASCII with block sampling.
+// The region is in image coordinates and clamped to the image. BGRA8 runs
+// on the SIMD kernels; every other format is read in place by its own
+// kernel, and for YUV the luminance comes straight from the Y plane.
+void ConvertRegionToAscii(const AsciiImageView& image,
+    const AsciiRect& region, const AsciiGeometry& geometry,
+    std::vector<AsciiCell>& asciiOut,
+    int& outCols, int& outRows);
+
+// Same for a tightly packed BGRA frame, i.e. rowPitch = desktopWidth * 4
+void ConvertRegionToAscii(const std::vector<uint8_t>& frameData,
+    int desktopWidth, int desktopHeight,
+    const AsciiRect& region, const AsciiGeometry& geometry,
+    std::vector<AsciiCell>& asciiOut,
+    int& outCols, int& outRows);
+
+// Damage based update of a persistent grid. Only cells overlapping one of
+// the damage rectangles (frame coordinates, e.g. Desktop Duplication dirty
+// and move rects) are converted again. changedCells receives the
+// row * cols + col index of every cell whose output changed. A grid built
+// for another region, geometry or glyph version is converted (and
+// reported) in full.
+void ConvertRegionToAscii(const AsciiImageView& image,
+    const AsciiRect& region, const AsciiGeometry& geometry,
+    const std::vector<AsciiRect>& damage,
+    AsciiCellGrid& grid, std::vector<int>& changedCells);
+
+void ConvertRegionToAscii(const std::vector<uint8_t>& frameData,
+    int desktopWidth, int desktopHeight,
+    const AsciiRect& region, const AsciiGeometry& geometry,
+    const std::vector<AsciiRect>& damage,
+    AsciiCellGrid& grid, std::vector<int>& changedCells);
+
+// Same as above with blockSize x (blockSize * 2) blocks
+void ConvertRegionToAscii(const std::vector<uint8_t>& frameData,
+    int desktopWidth, int desktopHeight,
+    const AsciiRect& region, int blockSize,
+    std::vector<AsciiCell>& asciiOut,
+    int& outCols, int& outRows);
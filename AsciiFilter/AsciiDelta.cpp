@@ -0,0 +1,287 @@
+﻿#include "AsciiDelta.h"
+
+#include <algorithm>
+#include <cstring>
+
+//------------------------------------------------------------
+// Little endian fields
+//------------------------------------------------------------
+static inline uint8_t* PutU16(uint8_t* p, uint32_t value)
+{
+	p[0] = static_cast<uint8_t>(value);
+	p[1] = static_cast<uint8_t>(value >> 8);
+	return p + 2;
+}
+
+static inline uint8_t* PutU32(uint8_t* p, uint32_t value)
+{
+	p = PutU16(p, value & 0xFFFF);
+	return PutU16(p, value >> 16);
+}
+
+static inline uint32_t GetU16(const uint8_t* p)
+{
+	return p[0] | (static_cast<uint32_t>(p[1]) << 8);
+}
+
+static inline uint32_t GetU32(const uint8_t* p)
+{
+	return GetU16(p) | (GetU16(p + 2) << 16);
+}
+
+static inline uint8_t* PutCell(uint8_t* p, const AsciiCell& cell)
+{
+	p = PutU16(p, static_cast<uint16_t>(cell.ch));
+	p[0] = AsciiRValue(cell.textColor);
+	p[1] = AsciiGValue(cell.textColor);
+	p[2] = AsciiBValue(cell.textColor);
+	p[3] = AsciiRValue(cell.bgColor);
+	p[4] = AsciiGValue(cell.bgColor);
+	p[5] = AsciiBValue(cell.bgColor);
+	return p + 6;
+}
+
+static inline const uint8_t* GetCell(const uint8_t* p, AsciiCell& cell)
+{
+	cell.ch = static_cast<wchar_t>(GetU16(p));
+	cell.textColor = AsciiRgb(p[2], p[3], p[4]);
+	cell.bgColor = AsciiRgb(p[5], p[6], p[7]);
+	return p + ASCII_PACKET_CELL_SIZE;
+}
+
+//------------------------------------------------------------
+// Cell lists, plain or as runs
+//------------------------------------------------------------
+// Most bytes count cells can take: a control byte per 128 literal cells,
+// and one more for a literal run cut short by a repeat, which saves more
+// than that byte
+static inline size_t GetMaxCellBytes(size_t count, bool runLength)
+{
+	return count * ASCII_PACKET_CELL_SIZE + (runLength ? count / 128 + 1 : 0);
+}
+
+static uint8_t* WriteCells(uint8_t* p, const AsciiCell* cells, size_t count, bool runLength)
+{
+	if (!runLength) {
+		for (size_t i = 0; i < count; ++i)
+			p = PutCell(p, cells[i]);
+		return p;
+	}
+
+	size_t i = 0;
+	while (i < count) {
+		size_t repeat = 1;
+		while (i + repeat < count && repeat < 129 && cells[i + repeat] == cells[i])
+			++repeat;
+		if (repeat >= 2) {
+			*p++ = static_cast<uint8_t>(126 + repeat);
+			p = PutCell(p, cells[i]);
+			i += repeat;
+			continue;
+		}
+
+		// Literal cells up to the next repeat
+		uint8_t* control = p++;
+		size_t literal = 0;
+		do {
+			p = PutCell(p, cells[i++]);
+			++literal;
+		} while (i < count && literal < 128 && !(i + 1 < count && cells[i + 1] == cells[i]));
+		*control = static_cast<uint8_t>(literal - 1);
+	}
+	return p;
+}
+
+// Reads count cells; nullptr when the data ends early or runs overflow
+static const uint8_t* ReadCells(const uint8_t* p, const uint8_t* end, AsciiCell* cells, size_t count, bool runLength)
+{
+	if (!runLength) {
+		if (static_cast<size_t>(end - p) < count * ASCII_PACKET_CELL_SIZE)
+			return nullptr;
+		for (size_t i = 0; i < count; ++i)
+			p = GetCell(p, cells[i]);
+		return p;
+	}
+
+	size_t i = 0;
+	while (i < count) {
+		if (p == end)
+			return nullptr;
+		uint8_t control = *p++;
+		bool repeat = control >= 128;
+		size_t n = repeat ? control - 126u : control + 1u;
+		size_t bytes = (repeat ? 1 : n) * ASCII_PACKET_CELL_SIZE;
+		if (n > count - i || static_cast<size_t>(end - p) < bytes)
+			return nullptr;
+		if (repeat) {
+			p = GetCell(p, cells[i]);
+			std::fill(cells + i + 1, cells + i + n, cells[i]);
+		}
+		else {
+			for (size_t j = 0; j < n; ++j)
+				p = GetCell(p, cells[i + j]);
+		}
+		i += n;
+	}
+	return p;
+}
+
+//------------------------------------------------------------
+// Packets
+//------------------------------------------------------------
+// Appends a header with room for up to maxBody bytes behind it and
+// returns where the body starts; FinishPacket trims it to the end
+static uint8_t* AppendPacket(std::string& out, size_t& start, AsciiPacketType type, bool runLength,
+	uint32_t frame, int cols, int rows, size_t maxBody)
+{
+	start = out.size();
+	out.resize(start + ASCII_PACKET_HEADER_SIZE + maxBody);
+	uint8_t* p = reinterpret_cast<uint8_t*>(&out[start]);
+	p[0] = 'A';
+	p[1] = 'F';
+	p[2] = ASCII_PACKET_VERSION;
+	p[3] = static_cast<uint8_t>(type) | (runLength ? ASCII_PACKET_RUN_LENGTH : 0);
+	p = PutU32(p + 4, frame);
+	p = PutU16(p, cols);
+	p = PutU16(p, rows);
+	return p + 4;
+}
+
+static void FinishPacket(std::string& out, size_t start, const uint8_t* end)
+{
+	const uint8_t* header = reinterpret_cast<const uint8_t*>(&out[start]);
+	size_t size = end - header;
+	PutU32(reinterpret_cast<uint8_t*>(&out[start + 12]), static_cast<uint32_t>(size - ASCII_PACKET_HEADER_SIZE));
+	out.resize(start + size);
+}
+
+static void AppendKeyframe(std::string& out, uint32_t frame, const std::vector<AsciiCell>& cells, int cols, int rows, bool runLength)
+{
+	size_t count = static_cast<size_t>(cols) * rows;
+	size_t start = 0;
+	uint8_t* p = AppendPacket(out, start, AsciiPacketType::Keyframe, runLength, frame, cols, rows,
+		GetMaxCellBytes(count, runLength));
+	FinishPacket(out, start, WriteCells(p, cells.data(), count, runLength));
+}
+
+//------------------------------------------------------------
+// Encoder
+//------------------------------------------------------------
+void AsciiDeltaEncoder::Reset()
+{
+	m_valid = false;
+}
+
+AsciiPacketType AsciiDeltaEncoder::Encode(const std::vector<AsciiCell>& cells, int cols, int rows, bool keyframe, std::string& out)
+{
+	size_t count = static_cast<size_t>(cols) * rows;
+	++m_frame;
+
+	// A span header costs less than one cell, so unchanged cells between
+	// two changes are never worth merging into a span
+	bool delta = !keyframe && m_valid && cols == m_cols && rows == m_rows;
+	int changed = 0;
+	if (delta) {
+		m_spans.clear();
+		changed = DiffAsciiCells(m_previous.data(), cells.data(), cols, rows, 0, m_spans);
+		size_t deltaBody = 4 + m_spans.size() * ASCII_PACKET_SPAN_SIZE + static_cast<size_t>(changed) * ASCII_PACKET_CELL_SIZE;
+		delta = deltaBody < count * ASCII_PACKET_CELL_SIZE;
+	}
+
+	m_previous.assign(cells.begin(), cells.begin() + count);
+	m_cols = cols;
+	m_rows = rows;
+	m_valid = true;
+	if (!delta) {
+		AppendKeyframe(out, m_frame, m_previous, cols, rows, m_runLength);
+		return AsciiPacketType::Keyframe;
+	}
+
+	size_t maxBody = 4 + m_spans.size() * (ASCII_PACKET_SPAN_SIZE + GetMaxCellBytes(0, m_runLength)) +
+		GetMaxCellBytes(changed, m_runLength);
+	size_t start = 0;
+	uint8_t* p = AppendPacket(out, start, AsciiPacketType::Delta, m_runLength, m_frame, cols, rows, maxBody);
+	p = PutU32(p, static_cast<uint32_t>(m_spans.size()));
+	for (const AsciiCellSpan& span : m_spans) {
+		p = PutU16(p, span.row);
+		p = PutU16(p, span.col);
+		p = PutU16(p, span.length);
+		p = WriteCells(p, &m_previous[static_cast<size_t>(span.row) * cols + span.col], span.length, m_runLength);
+	}
+	FinishPacket(out, start, p);
+	return AsciiPacketType::Delta;
+}
+
+void AsciiDeltaEncoder::EncodeKeyframe(std::string& out) const
+{
+	if (m_valid)
+		AppendKeyframe(out, m_frame, m_previous, m_cols, m_rows, m_runLength);
+}
+
+//------------------------------------------------------------
+// Decoder
+//------------------------------------------------------------
+size_t AsciiDeltaDecoder::GetPacketSize(const uint8_t* data, size_t size)
+{
+	if (size < ASCII_PACKET_HEADER_SIZE || data[0] != 'A' || data[1] != 'F' || data[2] != ASCII_PACKET_VERSION)
+		return 0;
+	return ASCII_PACKET_HEADER_SIZE + GetU32(data + 12);
+}
+
+bool AsciiDeltaDecoder::Decode(const uint8_t* data, size_t size)
+{
+	bool ok = GetPacketSize(data, size) == size;
+	if (ok) {
+		AsciiPacketType type = static_cast<AsciiPacketType>(data[3] & ~ASCII_PACKET_RUN_LENGTH);
+		bool runLength = (data[3] & ASCII_PACKET_RUN_LENGTH) != 0;
+		uint32_t frame = GetU32(data + 4);
+		int cols = static_cast<int>(GetU16(data + 8));
+		int rows = static_cast<int>(GetU16(data + 10));
+		size_t count = static_cast<size_t>(cols) * rows;
+		const uint8_t* p = data + ASCII_PACKET_HEADER_SIZE;
+		const uint8_t* end = data + size;
+
+		if (type == AsciiPacketType::Keyframe) {
+			// The header alone must not make the grid allocate more cells
+			// than the body can hold: 129 per 9 bytes at best with runs
+			size_t body = size - ASCII_PACKET_HEADER_SIZE;
+			size_t maxCount = runLength ? body / (1 + ASCII_PACKET_CELL_SIZE) * 129 : body / ASCII_PACKET_CELL_SIZE;
+			ok = count <= maxCount;
+			if (ok) {
+				m_cells.resize(count);
+				p = ReadCells(p, end, m_cells.data(), count, runLength);
+				ok = p == end;
+			}
+		}
+		else if (type == AsciiPacketType::Delta) {
+			ok = m_valid && frame == m_frame + 1 && cols == m_cols && rows == m_rows && end - p >= 4;
+			uint32_t spans = ok ? GetU32(p) : 0;
+			p += ok ? 4 : 0;
+			for (uint32_t i = 0; ok && i < spans; ++i) {
+				ok = static_cast<size_t>(end - p) >= ASCII_PACKET_SPAN_SIZE;
+				if (!ok)
+					break;
+				int row = static_cast<int>(GetU16(p));
+				int col = static_cast<int>(GetU16(p + 2));
+				int length = static_cast<int>(GetU16(p + 4));
+				p += ASCII_PACKET_SPAN_SIZE;
+				ok = row < rows && col + length <= cols;
+				if (ok)
+					p = ReadCells(p, end, &m_cells[static_cast<size_t>(row) * cols + col], length, runLength);
+				ok = ok && p != nullptr;
+			}
+			ok = ok && p == end;
+		}
+		else {
+			ok = false;
+		}
+
+		if (ok) {
+			m_cols = cols;
+			m_rows = rows;
+			m_frame = frame;
+		}
+	}
+	m_valid = ok;
+	return ok;
+}
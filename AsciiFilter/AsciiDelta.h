@@ -0,0 +1,107 @@
+﻿// AsciiDelta.h : Keyframe / delta packets for streaming cell grids.
+//
+// A keyframe carries the whole grid, a delta only the spans of cells that
+// changed since the frame before it (found with DiffAsciiCells). Packets
+// are self delimiting, so a TCP stream is just packets back to back, and
+// a WebSocket message holds exactly one packet. All integers are little
+// endian.
+//
+//    0  'A' 'F'      magic
+//    2  u8  version  ASCII_PACKET_VERSION
+//    3  u8  type     AsciiPacketType, | ASCII_PACKET_RUN_LENGTH
+//    4  u32 frame    frame number; a delta applies to frame - 1
+//    8  u16 cols
+//   10  u16 rows
+//   12  u32 size     bytes after the header
+//
+// A cell is 8 bytes: the character as a UTF-16 code unit, then text and
+// background color as R, G, B. A keyframe body is cols * rows cells row by
+// row; a delta body is a u32 span count followed by, for every span, u16
+// row, u16 col, u16 length and length cells.
+//
+// With ASCII_PACKET_RUN_LENGTH set, every list of cells is stored as runs
+// instead: a byte n < 128 followed by n + 1 cells, or a byte n >= 128
+// followed by one cell that repeats n - 126 times. Flat areas (a terminal
+// background, a dark desktop) then cost 9 bytes per up to 129 cells.
+
+#pragma once
+#include "AsciiCellDiff.h"
+#include "AsciiCore.h"
+
+#include <string>
+
+const uint8_t ASCII_PACKET_VERSION = 1;
+const size_t ASCII_PACKET_HEADER_SIZE = 16;
+const size_t ASCII_PACKET_CELL_SIZE = 8;
+const size_t ASCII_PACKET_SPAN_SIZE = 6;
+const uint8_t ASCII_PACKET_RUN_LENGTH = 0x80;
+// Largest packet a header can describe, header included
+const uint64_t ASCII_PACKET_MAX_SIZE = ASCII_PACKET_HEADER_SIZE + 0xFFFFFFFFull;
+
+enum class AsciiPacketType : uint8_t
+{
+    Keyframe = 1,
+    Delta = 2,
+};
+
+class AsciiDeltaEncoder
+{
+public:
+    // Forgets the previous frame; the next packet is a keyframe
+    void Reset();
+
+    // Run-length codes the cells of the following packets; off by default
+    void SetRunLength(bool runLength) { m_runLength = runLength; }
+    bool GetRunLength() const { return m_runLength; }
+
+    // Appends cells (cols x rows) as the next frame to out: a delta
+    // against the previous frame, or a keyframe when asked for, when the
+    // size changed or when the delta would not be smaller. Returns the
+    // type of the appended packet.
+    AsciiPacketType Encode(const std::vector<AsciiCell>& cells, int cols, int rows, bool keyframe, std::string& out);
+
+    // Appends the frame last passed to Encode as a keyframe with the same
+    // frame number, for viewers that join or fall behind while everyone
+    // else gets the delta. Does nothing before the first frame.
+    void EncodeKeyframe(std::string& out) const;
+
+    uint32_t GetFrame() const { return m_frame; }
+
+private:
+    std::vector<AsciiCell> m_previous;
+    std::vector<AsciiCellSpan> m_spans;
+    int m_cols = 0;
+    int m_rows = 0;
+    uint32_t m_frame = 0;
+    bool m_valid = false;
+    bool m_runLength = false;
+};
+
+class AsciiDeltaDecoder
+{
+public:
+    // Size of the packet starting at data from its header, 0 when fewer
+    // than ASCII_PACKET_HEADER_SIZE bytes are given or the header is not
+    // a packet header
+    static size_t GetPacketSize(const uint8_t* data, size_t size);
+
+    // Applies one whole packet. Returns false, and waits for the next
+    // keyframe, on a malformed packet or a delta that does not follow the
+    // frame it applies to.
+    bool Decode(const uint8_t* data, size_t size);
+
+    void Reset() { m_valid = false; }
+
+    bool IsValid() const { return m_valid; }
+    const std::vector<AsciiCell>& GetCells() const { return m_cells; }
+    int GetCols() const { return m_cols; }
+    int GetRows() const { return m_rows; }
+    uint32_t GetFrame() const { return m_frame; }
+
+private:
+    std::vector<AsciiCell> m_cells;
+    int m_cols = 0;
+    int m_rows = 0;
+    uint32_t m_frame = 0;
+    bool m_valid = false;
+};
@@ -13,39 +13,95 @@ AppGlobals g_App = {
    false,
    false,
    { 0, 0 },{ 0, 0, 0, 0 },
-   AppGlobals::HitZone::None,
-   std::chrono::high_resolution_clock::now(),
-   0,
-   0.0
+   AppGlobals::HitZone::None
 };
 
 //Constants
-static const char* ASCII_GRAYSCALE = " !\"#$ % &\\'()*+,-./0123456789:;<=>?@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_`abcdefghijklmnopqrstuvwxyz{|}~"; // ASCII palette
 const int borderThickness = 4; // Adjust this to match the actual border thickness
 const wchar_t* ASCII_FONT = L"Consolas";
 //Constants for Aspect Ratio
-const int ASCII_BLOCK_SIZE = 8; // Block size for sampling in  pixels; width of a character block
-const int blockWidth = ASCII_BLOCK_SIZE;
-float ASCII_CHAR_ASPECT_RATIO = 2.0f; // Example: character width-to-height ratio
-const int blockHeight = static_cast<int>(ASCII_BLOCK_SIZE * ASCII_CHAR_ASPECT_RATIO); // Height adjusted for character aspect ratio
+const int ASCII_BLOCK_SIZE = 8; // Default block size for sampling in pixels; width of a character block
+float ASCII_CHAR_ASPECT_RATIO = 2.0f; // Character height-to-width ratio, measured from the font
+
+// Block geometry used for sampling and drawing, set by SetAsciiBlockGeometry
+AsciiGeometry g_geometry = { ASCII_BLOCK_SIZE, static_cast<int>(ASCII_BLOCK_SIZE * ASCII_CHAR_ASPECT_RATIO) };
+HFONT g_asciiFont = nullptr; // Output font matching g_geometry
 
 //for triple buffer
 HBITMAP g_buffers[3] = { nullptr, nullptr, nullptr }; // Triple buffers
 HBITMAP g_currentBuffer = nullptr;                    // Current buffer to render to
 int g_bufferIndex = 0;                                // Current buffer index
 HDC g_memoryDC = nullptr;                             // Memory DC for rendering
-
-// A small struct to hold block-based ASCII info
-struct AsciiCell
-{
-	wchar_t ch;
-	COLORREF textColor;
-	COLORREF bgColor;   // Background color
-};
-
-// For precomputing the ASCII-grayscale palette
-static wchar_t intensityToAscii[256];
-static bool initialized = false;
+void* g_bufferBits[3] = { nullptr, nullptr, nullptr }; // Top-down BGRA pixels of each buffer
+int g_bufferWidth = 0;
+int g_bufferHeight = 0;
+
+// Glyphs of the output font for the software renderer, which blends cells
+// straight into the buffer bits instead of going through TextOut
+AsciiGlyphAtlas g_glyphAtlas;
+bool g_softwareRender = true;
+
+// Cells last drawn into each buffer: a frame only redraws the spans that
+// differ from its buffer and only blits the rectangles that differ from the
+// screen. g_presentFull asks for a whole-window blit instead.
+AsciiBufferHistory g_bufferHistory;
+std::vector<AsciiCellSpan> g_redrawSpans;
+std::vector<AsciiCellSpan> g_damageSpans;
+std::vector<AsciiRect> g_damageRects;
+bool g_presentFull = true;
+bool g_frameRequested = false;
+const int ASCII_SPAN_MERGE_GAP = 2;     // Unchanged cells a span may bridge
+const int ASCII_MAX_DAMAGE_RECTS = 64;  // Beyond this one full blit is cheaper
+
+// Region-sized staging texture, reused while the capture rectangle keeps its size.
+// It stays mapped from CaptureFrame until UnmapCapturedFrame so the conversion
+// reads the pixels in place.
+ID3D11Texture2D* g_stagingTexture = nullptr;
+D3D11_TEXTURE2D_DESC g_stagingDesc = {};
+bool g_stagingMapped = false;
+RECT g_capturedRect = { 0, 0, 0, 0 }; // Desktop area held by the staging texture
+
+// Cells of the last frame; only cells under damaged areas are converted again
+AsciiCellGrid g_cellGrid;
+std::vector<AsciiRect> g_damage;
+std::vector<int> g_changedCells;
+
+// H toggles temporal hysteresis: cells whose luminance or colors only
+// jitter keep what was drawn, so noisy video needs fewer redraws
+AsciiTemporalStabilizer g_stabilizer;
+bool g_stabilize = false;
+int g_heldCells = 0;
+
+// Setting ASCIIFILTER_SERVE to [address:]port streams the cells of every
+// frame to TCP and WebSocket viewers, encoded once for all of them
+AsciiFanoutServer g_server;
+
+// Setting ASCIIFILTER_RECORD to a file path records the session there;
+// asciifilter_cli --play shows it again
+AsciiRecordingWriter g_recording;
+
+// Colors are quantized before drawing so neighbouring cells share colors and
+// each row needs fewer TextOut calls; g_drawCalls counts them for the title
+AsciiColorQuantizer g_quantizer;
+std::vector<AsciiCell> g_drawCells;
+std::vector<AsciiRun> g_runs;
+std::vector<wchar_t> g_runText;
+int g_drawCalls = 0;
+
+// Frame times per stage. The title shows them once a second; setting
+// ASCIIFILTER_METRICS to a .json or .csv path also appends them there.
+AsciiMetrics g_metrics;
+const int STAGE_CAPTURE = g_metrics.AddStage("capture"); // Acquire the desktop frame, queue the GPU copy
+const int STAGE_COPY = g_metrics.AddStage("copy");       // Wait for the staging texture to map
+const int STAGE_CONVERT = g_metrics.AddStage("convert"); // Cells, quantizing and the redraw diff
+const int STAGE_DRAW = g_metrics.AddStage("draw");
+const int STAGE_PRESENT = g_metrics.AddStage("present");
+const double ASCII_FRAME_BUDGET = 1.0 / 60.0;
+
+// Paces the frames: 60 Hz while the desktop changes, backing off to a
+// few frames per second while it does not
+AsciiSteadyClock g_clock;
+AsciiFrameScheduler g_scheduler(g_clock);
 
 // Global variable to store the high-resolution timer frequency
 static LARGE_INTEGER g_PerfFrequency = { 0 };
@@ -54,25 +110,24 @@ static LARGE_INTEGER g_PerfFrequency = { 0 };
 LRESULT CALLBACK WndProcOutputFrame(HWND, UINT, WPARAM, LPARAM);
 LRESULT CALLBACK WndProcInputFrame(HWND, UINT, WPARAM, LPARAM);
 
-void InitializeAsciiGrayscalePalette();
 void InitializeHighResolutionTimer();
+void SetAsciiBlockGeometry(int blockWidth, int blockHeight = 0);
+void LoadAsciiGlyphMasks(HFONT font, int cellWidth, int cellHeight);
 void RunMessageLoop();
-void UpdateWindowTitleWithFPS(HWND hwnd, double fps);
+void UpdateWindowTitle(HWND hwnd, const AsciiMetricsSnapshot& metrics);
 bool InitDesktopDuplication();
 double GetElapsedTime(LARGE_INTEGER start, LARGE_INTEGER end);
 void ReleaseDesktopDuplication();
-void CaptureFrame(std::vector<BYTE>& frameData, int& fullWidth, int& fullHeight);
+bool CaptureFrame(const RECT& captureRect, AsciiImageView& view, std::vector<AsciiRect>* damage = nullptr);
+void UnmapCapturedFrame();
 void DrawBorderWithUpdateLayered(HWND hWnd);
 void HandleMouseDown(HWND hWnd, LPARAM lParam);
 void HandleMouseMove(HWND hWnd, LPARAM lParam);
 void HandleMouseUp(HWND hWnd);
 RECT GetBorderWindowRect();
-void DrawAsciiOutput(HWND hWnd);
-void ConvertRegionToAscii(const std::vector<BYTE>& frameData,
-	int desktopWidth, int desktopHeight,
-	const RECT& region, int blockSize,
-	std::vector<AsciiCell>& asciiOut,
-	int& outCols, int& outRows);
+bool DrawAsciiOutput(HWND hWnd);
+void RequestOutputFrame(HWND hWnd);
+void RenderOutputFrame(HWND hWnd);
 
 // Utility: returns which "zone" the mouse is in, for resizing
 AppGlobals::HitZone DetectHitZone(RECT rc, POINT pt);
@@ -121,6 +176,9 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE, PWSTR, int)
 		return 0;
 	}
 
+	// Create the output font; the block height follows its real metrics
+	SetAsciiBlockGeometry(ASCII_BLOCK_SIZE);
+
 	// Adjust extended style
 	LONG exStyle = GetWindowLong(g_App.hwndInput, GWL_EXSTYLE);
 	exStyle &= ~WS_EX_TRANSPARENT;
@@ -142,10 +200,10 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE, PWSTR, int)
 	int extendedHeight = inputHeight + (2 * borderThickness);
 
 	// Calculate the dimensions for the output window's client area
-	int outCols = (extendedWidth + blockWidth - 1) / blockWidth;
-	int outRows = (extendedHeight + blockHeight - 1) / blockHeight;
-	int clientWidth = outCols * blockWidth;
-	int clientHeight = outRows * blockHeight;
+	int outCols = (extendedWidth + g_geometry.blockWidth - 1) / g_geometry.blockWidth;
+	int outRows = (extendedHeight + g_geometry.blockHeight - 1) / g_geometry.blockHeight;
+	int clientWidth = outCols * g_geometry.blockWidth;
+	int clientHeight = outRows * g_geometry.blockHeight;
 
 	// Adjust the total window size to match the desired client area
 	RECT desiredClientRect = { 0, 0, clientWidth, clientHeight };
@@ -183,26 +241,51 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE, PWSTR, int)
 	// 5) Initialize high-performance timer
 	InitializeHighResolutionTimer();
 
-	// 6) Precompute ASCII-grayscale pallette
+	// 6) Precompute ASCII-grayscale pallette and pick the block kernel
 	InitializeAsciiGrayscalePalette();
+	OutputDebugString(L"ASCII-grayscale Palette has been initialized\n");
+	AsciiKernel kernel = SelectAsciiKernel(AsciiKernel::Auto);
+	wchar_t kernelMsg[64];
+	swprintf_s(kernelMsg, _countof(kernelMsg), L"Block kernel: %hs\n", GetAsciiKernelName(kernel));
+	OutputDebugString(kernelMsg);
+
+	// Convert on every core; drawing stays on this thread since GDI DCs are not thread safe
+	SetAsciiThreadCount(0);
+
+	char serve[64] = {};
+	if (GetEnvironmentVariableA("ASCIIFILTER_SERVE", serve, _countof(serve))) {
+		AsciiServerOptions serverOptions;
+		const char* colon = strrchr(serve, ':');
+		if (colon)
+			serverOptions.bindAddress.assign(serve, colon);
+		serverOptions.port = atoi(colon ? colon + 1 : serve);
+		wchar_t serveMsg[128];
+		if (g_server.Start(serverOptions))
+			swprintf_s(serveMsg, _countof(serveMsg), L"Serving on port %d\n", g_server.GetPort());
+		else
+			swprintf_s(serveMsg, _countof(serveMsg), L"ASCIIFILTER_SERVE: %hs\n", g_server.GetError().c_str());
+		OutputDebugString(serveMsg);
+	}
+
+	char recordPath[MAX_PATH] = {};
+	if (GetEnvironmentVariableA("ASCIIFILTER_RECORD", recordPath, MAX_PATH) && !g_recording.Open(recordPath))
+		OutputDebugString(L"ASCIIFILTER_RECORD: cannot write the recording\n");
 
 	// 7) Run message loop
 	RunMessageLoop();
 
 	// Cleanup
+	g_server.Stop();
+	g_recording.Close();
 	ReleaseDesktopDuplication();
+	if (g_asciiFont) {
+		DeleteObject(g_asciiFont);
+		g_asciiFont = nullptr;
+	}
 	
 	return 0;
 }
 
-void InitializeAsciiGrayscalePalette() {
-	for (int i = 0; i < 256; ++i) {
-		long asciiIndex = static_cast<long>(i * (strlen(ASCII_GRAYSCALE) - 1) / 255.0f);
-		intensityToAscii[i] = static_cast<wchar_t>(ASCII_GRAYSCALE[asciiIndex]);
-	}
-	initialized = true;
-	OutputDebugString(L"ASCII-grayscale Palette has been initialized\n");
-}
 
 void InitializeHighResolutionTimer()
 {
@@ -213,6 +296,111 @@ void InitializeHighResolutionTimer()
     OutputDebugString(L"High-resolution timer initialized.\n");
 }
 
+//------------------------------------------------------------
+// Set the sampling block size and recreate the output font to match.
+// With blockHeight <= 0 the height is derived from the font's aspect
+// ratio, so glyph cells and sampled blocks always line up.
+//------------------------------------------------------------
+void SetAsciiBlockGeometry(int blockWidth, int blockHeight)
+{
+	if (blockWidth <= 0)
+		return;
+
+	int fontHeight = blockHeight > 0 ? blockHeight : static_cast<int>(blockWidth * ASCII_CHAR_ASPECT_RATIO);
+	HFONT hFont = CreateFont(
+		fontHeight, blockWidth, 0, 0, FW_NORMAL, FALSE, FALSE, FALSE, OEM_CHARSET,
+		OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS, DEFAULT_QUALITY,
+		FIXED_PITCH | FF_MODERN, ASCII_FONT
+	);
+	if (!hFont) {
+		OutputDebugString(L"SetAsciiBlockGeometry: CreateFont failed\n");
+		return;
+	}
+
+	// Measure the font that was actually selected
+	TEXTMETRIC tm;
+	HDC hdc = GetDC(nullptr);
+	HFONT oldFont = (HFONT)SelectObject(hdc, hFont);
+	GetTextMetrics(hdc, &tm);
+	SelectObject(hdc, oldFont);
+	ReleaseDC(nullptr, hdc);
+
+	if (tm.tmAveCharWidth > 0)
+		ASCII_CHAR_ASPECT_RATIO = (float)tm.tmHeight / (float)tm.tmAveCharWidth;
+
+	if (g_asciiFont)
+		DeleteObject(g_asciiFont);
+	g_asciiFont = hFont;
+
+	g_geometry.blockWidth = blockWidth;
+	g_geometry.blockHeight = blockHeight > 0 ? blockHeight : static_cast<int>(blockWidth * ASCII_CHAR_ASPECT_RATIO + 0.5f);
+
+	// Shape matching compares against the glyphs as they are actually drawn
+	LoadAsciiGlyphMasks(hFont, g_geometry.blockWidth, g_geometry.blockHeight);
+	g_bufferHistory.Reset(3);
+
+	wchar_t debugMsg[128];
+	swprintf_s(debugMsg, _countof(debugMsg), L"Block geometry: %dx%d (%hs kernel)\n", g_geometry.blockWidth, g_geometry.blockHeight,
+		IsAsciiGeometrySpecialized(g_geometry) ? "unrolled" : "generic");
+	OutputDebugString(debugMsg);
+}
+
+//------------------------------------------------------------
+// Rasterize the printable ASCII glyphs of the output font into
+// a cell-sized DIB and hand their coverage to the shape matcher
+// and the software renderer
+//------------------------------------------------------------
+void LoadAsciiGlyphMasks(HFONT font, int cellWidth, int cellHeight)
+{
+	BITMAPINFO bmi = {};
+	bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+	bmi.bmiHeader.biWidth = cellWidth;
+	bmi.bmiHeader.biHeight = -cellHeight; // Top-down
+	bmi.bmiHeader.biPlanes = 1;
+	bmi.bmiHeader.biBitCount = 32;
+	bmi.bmiHeader.biCompression = BI_RGB;
+
+	HDC hdc = CreateCompatibleDC(nullptr);
+	void* bits = nullptr;
+	HBITMAP dib = CreateDIBSection(hdc, &bmi, DIB_RGB_COLORS, &bits, nullptr, 0);
+	if (!hdc || !dib) {
+		OutputDebugString(L"LoadAsciiGlyphMasks: CreateDIBSection failed\n");
+		if (dib)
+			DeleteObject(dib);
+		if (hdc)
+			DeleteDC(hdc);
+		return;
+	}
+
+	HBITMAP oldBitmap = (HBITMAP)SelectObject(hdc, dib);
+	HFONT oldFont = (HFONT)SelectObject(hdc, font);
+	SetTextColor(hdc, RGB(255, 255, 255));
+	SetBkColor(hdc, RGB(0, 0, 0));
+	SetBkMode(hdc, OPAQUE);
+
+	// White on black, so any channel is the coverage
+	AsciiGlyphSet glyphs;
+	g_glyphAtlas.Reset(cellWidth, cellHeight);
+	std::vector<uint8_t> coverage(static_cast<size_t>(cellWidth) * cellHeight);
+	RECT cell = { 0, 0, cellWidth, cellHeight };
+	for (wchar_t ch = 32; ch < 127; ++ch) {
+		ExtTextOut(hdc, 0, 0, ETO_OPAQUE, &cell, &ch, 1, nullptr);
+		GdiFlush();
+		const uint8_t* pixel = static_cast<const uint8_t*>(bits);
+		for (size_t i = 0; i < coverage.size(); ++i)
+			coverage[i] = pixel[i * 4 + 1];
+		glyphs.AddGlyph(ch, coverage.data(), cellWidth, cellHeight, cellWidth);
+		g_glyphAtlas.AddGlyph(ch, coverage.data(), cellWidth, cellHeight, cellWidth);
+	}
+
+	SelectObject(hdc, oldFont);
+	SelectObject(hdc, oldBitmap);
+	DeleteObject(dib);
+	DeleteDC(hdc);
+
+	SetAsciiGlyphSet(glyphs);
+}
+
 void InitializeTripleBuffers(HWND hWnd)
 {
 	// Get the client dimensions of the output window
@@ -254,22 +442,31 @@ void InitializeTripleBuffers(HWND hWnd)
 			OutputDebugString(debugOutput);
 		}
 
-		void* bits = nullptr;
-		g_buffers[i] = CreateDIBSection(screenDC, &bmi, DIB_RGB_COLORS, &bits, nullptr, 0);
+		g_bufferBits[i] = nullptr;
+		g_buffers[i] = CreateDIBSection(screenDC, &bmi, DIB_RGB_COLORS, &g_bufferBits[i], nullptr, 0);
 
 		if (!g_buffers[i] && g_buffers[i] != nullptr) {
 			OutputDebugString(L"InitializeTripleBuffers: Failed to create DIB buffer\n");
 		}
 	}
 
+	g_bufferWidth = width;
+	g_bufferHeight = height;
+	g_bufferHistory.Reset(3);
+	g_presentFull = true;
+
 	// Release the screen DC
 	ReleaseDC(hWnd, screenDC);
 }
 
-void UpdateWindowTitleWithFPS(HWND hwnd, double fps)
+void UpdateWindowTitle(HWND hwnd, const AsciiMetricsSnapshot& metrics)
 {
+	double fps = metrics.intervalSeconds > 0.0 ? metrics.frames / metrics.intervalSeconds : 0.0;
 	wchar_t title[256];
-	swprintf_s(title, _countof(title), L"ASCII Output - FPS: %.2f", fps);
+	swprintf_s(title, _countof(title),
+		L"ASCII Output - FPS: %.2f - Frame p50/p99: %.2f/%.2f ms - Dropped: %llu - Draw calls: %d - Colors: %hs - Held: %d",
+		fps, metrics.frameTime.p50 / 1e6, metrics.frameTime.p99 / 1e6, static_cast<unsigned long long>(metrics.dropped),
+		g_drawCalls, GetAsciiColorModeName(g_quantizer.GetMode()), g_heldCells);
 	SetWindowText(hwnd, title);
 }
 
@@ -279,48 +476,76 @@ double GetElapsedTime(LARGE_INTEGER start, LARGE_INTEGER end)
 	return static_cast<double>(end.QuadPart - start.QuadPart) / g_PerfFrequency.QuadPart;
 }
 
-// Example usage of the timer for frame timing
+// Sleeps until the next frame is due or a message arrives, so a static
+// desktop costs next to no CPU. g_scheduler is the only source of frames.
 void RunMessageLoop()
 {
 	MSG msg;
-	LARGE_INTEGER timerStart, timerEnd, fpsStart;
-	int frameCount = 0;
+	LARGE_INTEGER now, metricsStart;
+	QueryPerformanceCounter(&metricsStart);
 
-	QueryPerformanceCounter(&timerStart);
-	QueryPerformanceCounter(&fpsStart);
+	char metricsPath[MAX_PATH] = {};
+	if (!GetEnvironmentVariableA("ASCIIFILTER_METRICS", metricsPath, MAX_PATH))
+		metricsPath[0] = '\0';
+	g_metrics.SetFrameBudget(ASCII_FRAME_BUDGET);
+	AsciiMetricsSnapshot snapshot;
 
-	while (GetMessage(&msg, nullptr, 0, 0))
-	{
-		TranslateMessage(&msg);
-		DispatchMessage(&msg);
+	// 1 ms timer resolution instead of ~15.6 ms, or the waits cannot hold 60 Hz
+	timeBeginPeriod(1);
 
-		// Calculate elapsed time
-		QueryPerformanceCounter(&timerEnd);
-		double elapsed = GetElapsedTime(timerStart, timerEnd);
-
-		if (elapsed >= 1.0 / 60.0) // Target 60 FPS
+	for (;;)
+	{
+		// While a requested frame waits for its WM_PAINT there is nothing to
+		// time; the paint message itself ends the wait. Wake at least once a
+		// second for the metrics.
+		uint64_t wait = g_frameRequested ? 1000000000ull : g_scheduler.GetWaitTime();
+		DWORD timeout = static_cast<DWORD>(std::min<uint64_t>((wait + 999999) / 1000000, 1000));
+		if (timeout)
+			MsgWaitForMultipleObjectsEx(0, nullptr, timeout, QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+
+		bool quit = false;
+		while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
 		{
-			// Update and redraw logic
-			InvalidateRect(g_App.hwndOutput, nullptr, FALSE);
-			frameCount++;
-			timerStart = timerEnd; // Reset start time
+			if (msg.message == WM_QUIT) {
+				quit = true;
+				break;
+			}
+			// Keys and clicks change the output, dragging moves the capture area
+			bool input = (msg.message >= WM_KEYFIRST && msg.message <= WM_KEYLAST) ||
+				(msg.message >= WM_LBUTTONDOWN && msg.message <= WM_MOUSELAST) ||
+				(msg.message == WM_MOUSEMOVE && (g_App.dragging || g_App.resizing));
+			if (input)
+				g_scheduler.Wake();
+
+			TranslateMessage(&msg);
+			DispatchMessage(&msg);
 		}
+		if (quit)
+			break;
 
-		// Calculate FPS over 1 second intervals
-		LARGE_INTEGER currentTime;
-		QueryPerformanceCounter(&currentTime);
-		double fpsElapsed = GetElapsedTime(fpsStart, currentTime);
-
-		if (fpsElapsed >= 1.0)
+		// A frame that is still pending is not queued behind another one
+		if (!g_frameRequested && g_scheduler.IsFrameDue())
 		{
-			double fps = frameCount / fpsElapsed;
-			UpdateWindowTitleWithFPS(g_App.hwndOutput, fps);
+			int dropped = g_scheduler.BeginFrame();
+			if (dropped)
+				g_metrics.AddDropped(dropped);
+			RequestOutputFrame(g_App.hwndOutput);
+		}
 
-			// Reset for the next interval
-			frameCount = 0;
-			fpsStart = currentTime;
+		// Report the frame times of the last second; frames are counted
+		// when drawn, not when requested
+		QueryPerformanceCounter(&now);
+		if (GetElapsedTime(metricsStart, now) >= 1.0)
+		{
+			g_metrics.Snapshot(snapshot);
+			UpdateWindowTitle(g_App.hwndOutput, snapshot);
+			if (metricsPath[0])
+				AppendAsciiMetricsFile(metricsPath, snapshot);
+			metricsStart = now;
 		}
 	}
+
+	timeEndPeriod(1);
 }
 
 //
@@ -334,48 +559,63 @@ LRESULT CALLBACK WndProcOutputFrame(HWND hWnd, UINT msg, WPARAM wParam, LPARAM l
 		InitializeTripleBuffers(hWnd);
 		return 0;
 
-	case WM_TIMER:
-		if (wParam == 1) {
-			{
-				// Scope to avoid issues with auto declarations
-				g_App.frameCounter++;
-
-				// Calculate time elapsed
-				auto currentTime = std::chrono::high_resolution_clock::now();
-				auto elapsed = std::chrono::duration_cast<std::chrono::duration<double>>(currentTime - g_App.lastTime);
-
-				if (elapsed.count() >= 1.0) {
-					// Update FPS
-					g_App.fps.store(static_cast<double>(g_App.frameCounter) / elapsed.count());
-					g_App.frameCounter = 0;
-					g_App.lastTime = currentTime;
-
-					// Update the window title
-					wchar_t title[256];
-					double fpsValue = g_App.fps.load();
-					swprintf_s(title, sizeof(title) / sizeof(title[0]), L"ASCII Output - FPS: %.2f", fpsValue);
-					SetWindowText(g_App.hwndOutput, title);
-				}
-
-				// Trigger a redraw
-				InvalidateRect(hWnd, nullptr, FALSE);
-			}
-		}
-		return 0;
-
 	case WM_PAINT:
 	{
 		PAINTSTRUCT ps;
-		BeginPaint(hWnd, &ps);
+		HDC hdc = BeginPaint(hWnd, &ps);
 
-		// Render to the back buffer and present it
-		DrawAsciiOutput(hWnd);
-		PresentBuffer(hWnd);
+		if (g_frameRequested) {
+			g_frameRequested = false;
+			RenderOutputFrame(hWnd);
+		}
 
+		// RequestOutputFrame invalidates a single pixel; anything larger was
+		// uncovered, and the damage blit alone would not repaint it
+		bool exposed = ps.rcPaint.left != 0 || ps.rcPaint.top != 0 || ps.rcPaint.right > 1 || ps.rcPaint.bottom > 1;
+		int lastBuffer = (g_bufferIndex + 2) % 3;
+		if (exposed && g_memoryDC && g_buffers[lastBuffer]) {
+			HBITMAP oldBitmap = (HBITMAP)SelectObject(g_memoryDC, g_buffers[lastBuffer]);
+			BitBlt(hdc, ps.rcPaint.left, ps.rcPaint.top, ps.rcPaint.right - ps.rcPaint.left, ps.rcPaint.bottom - ps.rcPaint.top,
+				g_memoryDC, ps.rcPaint.left, ps.rcPaint.top, SRCCOPY);
+			SelectObject(g_memoryDC, oldBitmap);
+		}
 		EndPaint(hWnd, &ps);
 		return 0;
 	}
 
+	case WM_KEYDOWN:
+		// G cycles through intensity, shape and edge-direction glyphs
+		if (wParam == 'G') {
+			AsciiGlyphMode mode = GetAsciiGlyphMode();
+			SetAsciiGlyphMode(mode == AsciiGlyphMode::Intensity ? AsciiGlyphMode::Shape
+				: mode == AsciiGlyphMode::Shape ? AsciiGlyphMode::Edge : AsciiGlyphMode::Intensity);
+			g_scheduler.Wake();
+			return 0;
+		}
+		// R switches between the software renderer and GDI TextOut
+		if (wParam == 'R') {
+			g_softwareRender = !g_softwareRender;
+			g_bufferHistory.Reset(3); // The buffers hold the other renderer's pixels
+			g_scheduler.Wake();
+			return 0;
+		}
+		// C cycles the color modes: true color, 16, 256, adaptive
+		if (wParam == 'C') {
+			int mode = (static_cast<int>(g_quantizer.GetMode()) + 1) % 4;
+			g_quantizer.SetMode(static_cast<AsciiColorMode>(mode));
+			g_scheduler.Wake();
+			return 0;
+		}
+		// H toggles temporal hysteresis
+		if (wParam == 'H') {
+			g_stabilize = !g_stabilize;
+			g_stabilizer.Reset();
+			g_heldCells = 0;
+			g_scheduler.Wake();
+			return 0;
+		}
+		break;
+
 	case WM_DESTROY:
 		CleanupTripleBuffers();
 		PostQuitMessage(0);
@@ -518,6 +758,11 @@ bool InitDesktopDuplication()
 //------------------------------------------------------------
 void ReleaseDesktopDuplication()
 {
+	UnmapCapturedFrame();
+	if (g_stagingTexture) {
+		g_stagingTexture->Release();
+		g_stagingTexture = nullptr;
+	}
 	if (g_App.pDuplication) {
 		g_App.pDuplication->Release();
 		g_App.pDuplication = nullptr;
@@ -532,29 +777,86 @@ void ReleaseDesktopDuplication()
 	}
 }
 
+//------------------------------------------------------------
+// Collect the dirty and moved areas of the acquired frame.
+// Falls back to the whole desktop when the metadata is unavailable.
+//------------------------------------------------------------
+void GetFrameDamage(const DXGI_OUTDUPL_FRAME_INFO& frameInfo, int fullWidth, int fullHeight,
+	std::vector<AsciiRect>& damage)
+{
+	damage.clear();
+	if (frameInfo.TotalMetadataBufferSize == 0) {
+		// Only the mouse pointer changed (LastPresentTime == 0) or nothing at all
+		if (frameInfo.LastPresentTime.QuadPart != 0)
+			damage.push_back({ 0, 0, fullWidth, fullHeight });
+		return;
+	}
+
+	static std::vector<BYTE> metadata;
+	metadata.resize(frameInfo.TotalMetadataBufferSize);
+
+	// Move rects first, dirty rects in the remaining space
+	UINT moveBytes = 0;
+	HRESULT hr = g_App.pDuplication->GetFrameMoveRects(static_cast<UINT>(metadata.size()),
+		reinterpret_cast<DXGI_OUTDUPL_MOVE_RECT*>(metadata.data()), &moveBytes);
+	UINT dirtyBytes = 0;
+	if (SUCCEEDED(hr)) {
+		hr = g_App.pDuplication->GetFrameDirtyRects(static_cast<UINT>(metadata.size()) - moveBytes,
+			reinterpret_cast<RECT*>(metadata.data() + moveBytes), &dirtyBytes);
+	}
+	if (FAILED(hr)) {
+		damage.push_back({ 0, 0, fullWidth, fullHeight });
+		return;
+	}
+
+	// A move only damages its destination; whatever uncovers the source
+	// shows up as a dirty rect
+	const DXGI_OUTDUPL_MOVE_RECT* moves = reinterpret_cast<const DXGI_OUTDUPL_MOVE_RECT*>(metadata.data());
+	for (UINT i = 0; i < moveBytes / sizeof(DXGI_OUTDUPL_MOVE_RECT); ++i) {
+		const RECT& rc = moves[i].DestinationRect;
+		damage.push_back({ rc.left, rc.top, rc.right, rc.bottom });
+	}
+	const RECT* dirty = reinterpret_cast<const RECT*>(metadata.data() + moveBytes);
+	for (UINT i = 0; i < dirtyBytes / sizeof(RECT); ++i)
+		damage.push_back({ dirty[i].left, dirty[i].top, dirty[i].right, dirty[i].bottom });
+}
+
 //------------------------------------------------------------
 // Capture one frame via Desktop Duplication
-// Returns raw BGRA (or RGBA) in frameData
+// Only the part of the desktop under captureRect is copied to the CPU.
+// On success view points into the mapped staging texture (BGRA, RowPitch
+// stride) until UnmapCapturedFrame, and damage, if requested, receives
+// the changed areas in view coordinates. A frame that was acquired but
+// can't be handed out takes its damage with it, so g_capturedRect is
+// cleared and the next capture reports the whole view as damaged.
 //------------------------------------------------------------
-void CaptureFrame(std::vector<BYTE>& frameData, int& fullWidth, int& fullHeight)
+bool CaptureFrame(const RECT& captureRect, AsciiImageView& view, std::vector<AsciiRect>* damage)
 {
 	if (!g_App.pDuplication)
-		return;
+		return false;
+
+	UnmapCapturedFrame();
 
 	// Acquire frame
 	IDXGIResource* desktopResource = nullptr;
 	DXGI_OUTDUPL_FRAME_INFO frameInfo = {};
+	uint64_t captureStart = AsciiMetrics::Now();
 	HRESULT hr = g_App.pDuplication->AcquireNextFrame(0, &frameInfo, &desktopResource);
 	if (hr == DXGI_ERROR_WAIT_TIMEOUT) {
 		// no new frame => just skip
-		return;
+		return false;
 	}
 	if (FAILED(hr)) {
 		// Attempt to release, re-init?
 		g_App.pDuplication->ReleaseFrame();
-		return;
+		SetRectEmpty(&g_capturedRect);
+		return false;
 	}
 
+	// Desktop updates the duplication coalesced into this one were never shown
+	if (frameInfo.AccumulatedFrames > 1)
+		g_metrics.AddDropped(frameInfo.AccumulatedFrames - 1);
+
 	// Query for ID3D11Texture2D
 	ID3D11Texture2D* tex = nullptr;
 	if (desktopResource) {
@@ -564,42 +866,112 @@ void CaptureFrame(std::vector<BYTE>& frameData, int& fullWidth, int& fullHeight)
 
 	if (!tex) {
 		g_App.pDuplication->ReleaseFrame();
-		return;
+		SetRectEmpty(&g_capturedRect);
+		return false;
 	}
 
 	// Get desc
 	D3D11_TEXTURE2D_DESC desc;
 	tex->GetDesc(&desc);
-	fullWidth = desc.Width;
-	fullHeight = desc.Height;
-
-	// Create a staging texture to copy into CPU-accessible memory
-	desc.Usage = D3D11_USAGE_STAGING;
-	desc.BindFlags = 0;
-	desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
-	desc.MiscFlags = 0;
-
-	ID3D11Texture2D* stagingTex = nullptr;
-	hr = g_App.pDevice->CreateTexture2D(&desc, nullptr, &stagingTex);
-	if (SUCCEEDED(hr) && stagingTex) {
-		// Copy
-		g_App.pContext->CopyResource(stagingTex, tex);
-
-		// Map
-		D3D11_MAPPED_SUBRESOURCE map;
-		hr = g_App.pContext->Map(stagingTex, 0, D3D11_MAP_READ, 0, &map);
-		if (SUCCEEDED(hr)) {
-			// copy out
-			int rowPitch = map.RowPitch;
-			frameData.resize(desc.Height * rowPitch);
-			memcpy(frameData.data(), map.pData, desc.Height * rowPitch);
-			g_App.pContext->Unmap(stagingTex, 0);
+	int fullWidth = desc.Width;
+	int fullHeight = desc.Height;
+
+	// Clamp the region to desktop size
+	RECT capRect = captureRect;
+	capRect.left = std::max(0L, capRect.left);
+	capRect.top = std::max(0L, capRect.top);
+	capRect.right = std::min((LONG)fullWidth, capRect.right);
+	capRect.bottom = std::min((LONG)fullHeight, capRect.bottom);
+	if (capRect.right <= capRect.left || capRect.bottom <= capRect.top) {
+		tex->Release();
+		g_App.pDuplication->ReleaseFrame();
+		SetRectEmpty(&g_capturedRect);
+		return false;
+	}
+	UINT width = capRect.right - capRect.left;
+	UINT height = capRect.bottom - capRect.top;
+
+	if (damage) {
+		GetFrameDamage(frameInfo, fullWidth, fullHeight, *damage);
+
+		// Other desktop pixels behind the view: everything changed
+		if (!EqualRect(&capRect, &g_capturedRect)) {
+			damage->clear();
+			damage->push_back({ 0, 0, (int)width, (int)height });
+		}
+		else {
+			for (AsciiRect& rect : *damage) {
+				rect.left -= capRect.left;
+				rect.right -= capRect.left;
+				rect.top -= capRect.top;
+				rect.bottom -= capRect.top;
+			}
 		}
-		stagingTex->Release();
 	}
 
+	// (Re)create the staging texture when the region size or format changes
+	if (!g_stagingTexture || g_stagingDesc.Width != width || g_stagingDesc.Height != height ||
+		g_stagingDesc.Format != desc.Format) {
+		if (g_stagingTexture) {
+			g_stagingTexture->Release();
+			g_stagingTexture = nullptr;
+		}
+		desc.Width = width;
+		desc.Height = height;
+		desc.MipLevels = 1;
+		desc.ArraySize = 1;
+		desc.Usage = D3D11_USAGE_STAGING;
+		desc.BindFlags = 0;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		desc.MiscFlags = 0;
+		hr = g_App.pDevice->CreateTexture2D(&desc, nullptr, &g_stagingTexture);
+		if (FAILED(hr)) {
+			g_stagingTexture = nullptr;
+			tex->Release();
+			g_App.pDuplication->ReleaseFrame();
+			SetRectEmpty(&g_capturedRect);
+			return false;
+		}
+		g_stagingDesc = desc;
+	}
+
+	// Copy just the capture rectangle
+	D3D11_BOX box = { (UINT)capRect.left, (UINT)capRect.top, 0, (UINT)capRect.right, (UINT)capRect.bottom, 1 };
+	g_App.pContext->CopySubresourceRegion(g_stagingTexture, 0, 0, 0, 0, tex, 0, &box);
+	uint64_t copyStart = AsciiMetrics::Now();
+	g_metrics.Record(STAGE_CAPTURE, copyStart - captureStart);
+
+	// Map; waits for the copy, after which the desktop frame can go back
+	D3D11_MAPPED_SUBRESOURCE map;
+	hr = g_App.pContext->Map(g_stagingTexture, 0, D3D11_MAP_READ, 0, &map);
 	tex->Release();
 	g_App.pDuplication->ReleaseFrame();
+	g_metrics.Record(STAGE_COPY, AsciiMetrics::Now() - copyStart);
+	if (FAILED(hr)) {
+		SetRectEmpty(&g_capturedRect);
+		return false;
+	}
+
+	g_stagingMapped = true;
+	g_capturedRect = capRect;
+
+	view.data = static_cast<const uint8_t*>(map.pData);
+	view.width = width;
+	view.height = height;
+	view.stride = map.RowPitch;
+	view.format = AsciiPixelFormat::BGRA8;
+	return true;
+}
+
+//------------------------------------------------------------
+// Hand the staging texture back to the GPU after conversion
+//------------------------------------------------------------
+void UnmapCapturedFrame()
+{
+	if (g_stagingMapped) {
+		g_App.pContext->Unmap(g_stagingTexture, 0);
+		g_stagingMapped = false;
+	}
 }
 
 //------------------------------------------------------------
@@ -805,10 +1177,10 @@ void HandleMouseMove(HWND hWnd, LPARAM lParam)
 		int extendedHeight = inputHeight + (2 * borderThickness);
 
 		// Calculate new dimensions for the output window's client area
-		int outCols = (extendedWidth + blockWidth - 1) / blockWidth;
-		int outRows = (extendedHeight + blockHeight - 1) / blockHeight;
-		int clientWidth = outCols * blockWidth;
-		int clientHeight = outRows * blockHeight;
+		int outCols = (extendedWidth + g_geometry.blockWidth - 1) / g_geometry.blockWidth;
+		int outRows = (extendedHeight + g_geometry.blockHeight - 1) / g_geometry.blockHeight;
+		int clientWidth = outCols * g_geometry.blockWidth;
+		int clientHeight = outRows * g_geometry.blockHeight;
 
 		// Adjust total window size to ensure client area matches desired dimensions
 		RECT desiredClientRect = { 0, 0, clientWidth, clientHeight };
@@ -919,27 +1291,15 @@ RECT GetBorderWindowRect()
 // 3) Convert to ASCII with block sampling (e.g. 8x8).
 // 4) Draw each character with SetTextColor.
 //------------------------------------------------------------
-void DrawAsciiOutput(HWND hWnd)
+bool DrawAsciiOutput(HWND hWnd)
 {
-	// Capture frame data
-	std::vector<BYTE> frameData;
-	int desktopWidth = 0, desktopHeight = 0;
-	CaptureFrame(frameData, desktopWidth, desktopHeight);
-
-	// If no frame data, skip
-	if (frameData.empty() || desktopWidth == 0 || desktopHeight == 0) {
+	// Capture the input region, including borders
+	AsciiImageView frame;
+	if (!CaptureFrame(GetBorderWindowRect(), frame, &g_damage)) {
 		OutputDebugString(L"DrawAsciiOutput: No frame data captured\n");
-		return;
+		return false;
 	}
 
-	// Get the input region, including borders
-	RECT capRect = GetBorderWindowRect();
-	// Clamp the region to desktop size
-	capRect.left = std::max(0L, capRect.left);
-	capRect.top = std::max(0L, capRect.top);
-	capRect.right = std::min((LONG)desktopWidth, capRect.right);
-	capRect.bottom = std::min((LONG)desktopHeight, capRect.bottom);
-
 	// Select the current buffer into the memory DC
 	HBITMAP oldBitmap = (HBITMAP)SelectObject(g_memoryDC, g_buffers[g_bufferIndex]);
 
@@ -959,70 +1319,111 @@ void DrawAsciiOutput(HWND hWnd)
 		DeleteObject(diffRegion);
 
 		previousRect = clientRect; // Update the previous rect
+		g_bufferHistory.Reset(3);
 	}
 
 	SetBkMode(g_memoryDC, OPAQUE); // Allow background color rendering
 
-	// Convert the captured region to ASCII
-	std::vector<AsciiCell> asciiOut;
-	int outCols = 0, outRows = 0;
-	ConvertRegionToAscii(frameData, desktopWidth, desktopHeight, capRect, ASCII_BLOCK_SIZE, asciiOut, outCols, outRows);
-
-	// Prepare font
-	HFONT hFont = CreateFont(
-		16, 8, 0, 0, FW_NORMAL, FALSE, FALSE, FALSE, OEM_CHARSET,
-		OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS, DEFAULT_QUALITY,
-		FIXED_PITCH | FF_MODERN, ASCII_FONT
-	);
-	HFONT oldFont = (HFONT)SelectObject(g_memoryDC, hFont);
-	
-	TEXTMETRIC tm;
-	HDC hdc = GetDC(nullptr); // Or your window's DC
-	GetTextMetrics(hdc, &tm);
-	ASCII_CHAR_ASPECT_RATIO = (float)tm.tmHeight / (float)tm.tmAveCharWidth;
-
-	// Draw each row
-	for (int row = 0; row < outRows; ++row) {
-		std::wstring rowBuffer;
-		COLORREF lastTextColor = RGB(255, 255, 255);
-		COLORREF lastBgColor = RGB(0, 0, 0);
-
-		for (int col = 0; col < outCols; ++col) {
-			const AsciiCell& cell = asciiOut[row * outCols + col];
-
-			if (rowBuffer.empty()) {
-				// Start the buffer with the initial colors
-				lastTextColor = cell.textColor;
-				lastBgColor = cell.bgColor;
+	// Convert the captured region to ASCII, only where the desktop changed
+	uint64_t convertStart = AsciiMetrics::Now();
+	AsciiRect region = { 0, 0, frame.width, frame.height };
+	ConvertRegionToAscii(frame, region, g_geometry, g_damage, g_cellGrid, g_changedCells);
+	UnmapCapturedFrame();
+	if (g_stabilize)
+		g_heldCells = g_stabilizer.Apply(g_cellGrid, g_changedCells);
+	if (g_server.IsRunning())
+		g_server.Publish(g_cellGrid.cells, g_cellGrid.cols, g_cellGrid.rows);
+	if (g_recording.IsOpen())
+		g_recording.WriteFrame(g_cellGrid.cells, g_cellGrid.cols, g_cellGrid.rows, AsciiMetrics::Now());
+
+	// Select the font created by SetAsciiBlockGeometry
+	HFONT oldFont = (HFONT)SelectObject(g_memoryDC, g_asciiFont);
+	const int blockWidth = g_geometry.blockWidth;
+	const int blockHeight = g_geometry.blockHeight;
+
+	g_quantizer.Quantize(g_cellGrid.cells, g_drawCells);
+	g_drawCalls = 0;
+
+	// Only the cells that differ from what this buffer already shows
+	bool screenKnown = g_bufferHistory.Present(g_bufferIndex, g_drawCells, g_cellGrid.cols, g_cellGrid.rows,
+		ASCII_SPAN_MERGE_GAP, g_redrawSpans, g_damageSpans);
+	GetAsciiSpanRects(g_damageSpans, g_geometry, g_bufferWidth, g_bufferHeight, g_damageRects);
+	g_presentFull = !screenKnown || static_cast<int>(g_damageRects.size()) > ASCII_MAX_DAMAGE_RECTS;
+	uint64_t drawStart = AsciiMetrics::Now();
+	g_metrics.Record(STAGE_CONVERT, drawStart - convertStart);
+
+	if (g_softwareRender && g_bufferBits[g_bufferIndex]) {
+		// Blend the glyphs straight into the DIB, no GDI calls at all
+		GdiFlush();
+		RenderAsciiSpans(g_drawCells, g_cellGrid.cols, g_cellGrid.rows, g_redrawSpans, g_glyphAtlas,
+			static_cast<uint8_t*>(g_bufferBits[g_bufferIndex]), g_bufferWidth, g_bufferHeight, g_bufferWidth * 4);
+	}
+	else {
+		// Draw every run of equal colors with one TextOut
+		BuildAsciiRuns(g_drawCells, g_cellGrid.cols, g_cellGrid.rows, g_redrawSpans, g_runs);
+
+		COLORREF textColor = GetTextColor(g_memoryDC);
+		COLORREF bgColor = GetBkColor(g_memoryDC);
+		for (const AsciiRun& run : g_runs) {
+			if (run.textColor != textColor) {
+				textColor = run.textColor;
+				SetTextColor(g_memoryDC, textColor);
 			}
-			else if (cell.textColor != lastTextColor || cell.bgColor != lastBgColor) {
-				// Flush the current buffer when colors change
-				SetTextColor(g_memoryDC, lastTextColor);
-				SetBkColor(g_memoryDC, lastBgColor);
-				TextOut(g_memoryDC, col * blockWidth - static_cast<int>(rowBuffer.length()) * blockWidth, row * blockHeight, rowBuffer.c_str(), rowBuffer.length());
-				rowBuffer.clear();
-				lastTextColor = cell.textColor;
-				lastBgColor = cell.bgColor;
+			if (run.bgColor != bgColor) {
+				bgColor = run.bgColor;
+				SetBkColor(g_memoryDC, bgColor);
 			}
-			// Add character to buffer
-			rowBuffer += cell.ch;
-		}
 
-		// Flush the remaining characters in the buffer
-		if (!rowBuffer.empty()) {
-			SetTextColor(g_memoryDC, lastTextColor);
-			SetBkColor(g_memoryDC, lastBgColor);
-			TextOut(g_memoryDC, 0, row * blockHeight, rowBuffer.c_str(), rowBuffer.length());
+			const AsciiCell* cells = g_drawCells.data() + run.row * g_cellGrid.cols + run.col;
+			g_runText.resize(run.length);
+			for (int i = 0; i < run.length; ++i)
+				g_runText[i] = cells[i].ch;
+			TextOut(g_memoryDC, run.col * blockWidth, run.row * blockHeight, g_runText.data(), run.length);
+			g_drawCalls++;
 		}
 	}
 
 	// Restore and bitmap
 	SelectObject(g_memoryDC, oldFont);
-	DeleteObject(hFont); 
 	SelectObject(g_memoryDC, oldBitmap);
+	g_metrics.Record(STAGE_DRAW, AsciiMetrics::Now() - drawStart);
+	return true;
 }
 
-void PresentBuffer(HWND hWnd)
+//------------------------------------------------------------
+// Frames are drawn from WM_PAINT. Invalidating one pixel instead of
+// the client area lets the paint handler tell a frame tick from an
+// exposed window, which must not get away with a partial blit.
+//------------------------------------------------------------
+void RequestOutputFrame(HWND hWnd)
+{
+	static const RECT pixel = { 0, 0, 1, 1 };
+	g_frameRequested = true;
+	InvalidateRect(hWnd, &pixel, FALSE);
+}
+
+// Draw the next frame into the current buffer and present the parts
+// of it that changed
+void RenderOutputFrame(HWND hWnd)
+{
+	uint64_t frameStart = AsciiMetrics::Now();
+	bool changed = false;
+	if (DrawAsciiOutput(hWnd)) {
+		uint64_t presentStart = AsciiMetrics::Now();
+		PresentBuffer(hWnd, g_presentFull ? nullptr : &g_damageRects);
+		uint64_t frameEnd = AsciiMetrics::Now();
+		g_metrics.Record(STAGE_PRESENT, frameEnd - presentStart);
+		g_metrics.EndFrame(frameEnd - frameStart);
+
+		// The other buffers catch up on a change over the next frames, which
+		// keeps the scheduler at full rate until all of them show it
+		changed = g_presentFull || !g_redrawSpans.empty();
+	}
+	// No new desktop frame or nothing redrawn: one step closer to idle
+	g_scheduler.EndFrame(changed);
+}
+
+void PresentBuffer(HWND hWnd, const std::vector<AsciiRect>* damage)
 {
 	HDC screenDC = GetDC(hWnd);
 	RECT clientRect;
@@ -1031,9 +1432,16 @@ void PresentBuffer(HWND hWnd)
 	int height = clientRect.bottom - clientRect.top;
 
 	if (g_memoryDC && g_buffers[g_bufferIndex]) {
-		// Copy the current buffer to the screen
+		// Copy the current buffer, or just its damaged rectangles, to the screen
 		HBITMAP oldBitmap = (HBITMAP)SelectObject(g_memoryDC, g_buffers[g_bufferIndex]);
-		BitBlt(screenDC, 0, 0, width, height, g_memoryDC, 0, 0, SRCCOPY);
+		if (damage) {
+			for (const AsciiRect& rect : *damage)
+				BitBlt(screenDC, rect.left, rect.top, rect.right - rect.left, rect.bottom - rect.top,
+					g_memoryDC, rect.left, rect.top, SRCCOPY);
+		}
+		else {
+			BitBlt(screenDC, 0, 0, width, height, g_memoryDC, 0, 0, SRCCOPY);
+		}
 		SelectObject(g_memoryDC, oldBitmap);
 	}
 	else {
@@ -1054,6 +1462,7 @@ void CleanupTripleBuffers()
 		if (g_buffers[i]) {
 			DeleteObject(g_buffers[i]);
 			g_buffers[i] = nullptr;
+			g_bufferBits[i] = nullptr;
 		}
 	}
 
@@ -1061,78 +1470,4 @@ void CleanupTripleBuffers()
 		DeleteDC(g_memoryDC);
 		g_memoryDC = nullptr;
 	}
-}
-
-//------------------------------------------------------------
-// Convert the (capRect) portion of the frameData to ASCII
-// with block sampling of size blockSize x blockSize
-//------------------------------------------------------------
-void ConvertRegionToAscii(const std::vector<BYTE>& frameData,
-	int desktopWidth, int desktopHeight,
-	const RECT& region, int blockSize,
-	std::vector<AsciiCell>& asciiOut,
-	int& outCols, int& outRows)
-{
-	// Precompute ASCII mapping
-	if (!initialized) {
-		
-	}
-
-	int rowPitch = desktopWidth * 4;
-
-	// Compute region size
-	int regionW = region.right - region.left;
-	int regionH = region.bottom - region.top;
-
-	// Calculate number of blocks
-	outCols = (regionW + blockSize - 1) / blockSize;
-	outRows = (regionH + blockHeight - 1) / blockHeight;
-
-	asciiOut.resize(outCols * outRows);
-
-	// Loop through each block
-	for (int row = 0; row < outRows; ++row) {
-		for (int col = 0; col < outCols; ++col) {
-			// Pixel block region
-			int startX = region.left + col * blockWidth;
-			int startY = region.top + row * blockHeight;
-			int endX = std::min((long) startX + blockWidth, region.right);
-			int endY = std::min((long) startY + blockHeight, region.bottom);
-
-			// Accumulate color
-			unsigned int sumR = 0, sumG = 0, sumB = 0, count = 0;
-			for (int y = startY; y < endY; ++y) {
-				const BYTE* pixel = frameData.data() + y * rowPitch + startX * 4;
-				for (int x = startX; x < endX; ++x) {
-					sumB += pixel[0];
-					sumG += pixel[1];
-					sumR += pixel[2];
-					pixel += 4;
-					count++;
-				}
-			}
-
-			// Calculate average color
-			if (count > 0) {
-				BYTE avgR = sumR / count;
-				BYTE avgG = sumG / count;
-				BYTE avgB = sumB / count;
-
-				// Calculate intensity and luminance
-				BYTE intensity = static_cast<BYTE>(0.299f * avgR + 0.587f * avgG + 0.114f * avgB);
-				BYTE luminance = static_cast<BYTE>((0.299 * avgR + 0.587 * avgG + 0.114 * avgB));
-
-				// Text color as a dynamic grayscale based on luminance
-				BYTE textGray = (luminance > 128) ? luminance - 80 : luminance + 80; // Ensure contrast
-				COLORREF textColor = RGB(textGray, textGray, textGray);
-
-				// Populate AsciiCell with text and background colors
-				asciiOut[row * outCols + col] = {
-					intensityToAscii[intensity], // Character
-					textColor,                   // Dynamic grayscale text color
-					RGB(avgR, avgG, avgB)        // Background color
-				};
-			}
-		}
-	}
 }
\ No newline at end of file
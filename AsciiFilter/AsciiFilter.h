@@ -14,9 +14,23 @@
 #include <cmath>
 #include <dxgi1_2.h>
 #include <d3d11.h>
+#include <timeapi.h>
+
+#include "AsciiCellDiff.h"
+#include "AsciiCore.h"
+#include "AsciiGlyphs.h"
+#include "AsciiMetrics.h"
+#include "AsciiQuantizer.h"
+#include "AsciiRecording.h"
+#include "AsciiRender.h"
+#include "AsciiRuns.h"
+#include "AsciiScheduler.h"
+#include "AsciiServer.h"
+#include "AsciiStabilizer.h"
 
 #pragma comment(lib, "d3d11.lib")
 #pragma comment(lib, "dxgi.lib")
+#pragma comment(lib, "winmm.lib")
 
 LRESULT CALLBACK WndProcMain(HWND, UINT, WPARAM, LPARAM);
 LRESULT CALLBACK WndProcInput(HWND, UINT, WPARAM, LPARAM);
@@ -38,9 +52,6 @@ struct AppGlobals
     // Keep track which edge/corner is grabbed
     enum class HitZone { None, Left, Right, Top, Bottom, TopLeft, TopRight, BottomLeft, BottomRight };
     HitZone hitZone = HitZone::None;
-    std::chrono::high_resolution_clock::time_point lastTime = std::chrono::high_resolution_clock::now();
-    std::atomic<int> frameCounter = 0;
-    std::atomic<double> fps = 0.0;
 };
 
 extern AppGlobals g_App;
@@ -67,5 +78,7 @@ void ConvertToASCII(const std::vector<COLORREF>& pixels, int width, int height,
 // TODO: Reference additional headers your program requires here. //
 int WINAPI WinMain(HINSTANCE hInst, HINSTANCE, LPSTR, int);
 
-void PresentBuffer(HWND hWnd);
+// Copies the current buffer to the window (only the damage rectangles
+// when given) and moves on to the next buffer
+void PresentBuffer(HWND hWnd, const std::vector<AsciiRect>* damage = nullptr);
 void CleanupTripleBuffers();
\ No newline at end of file
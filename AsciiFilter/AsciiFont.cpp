@@ -0,0 +1,109 @@
+﻿#include "AsciiFont.h"
+
+static const wchar_t ASCII_FONT_FIRST = 32;
+static const wchar_t ASCII_FONT_LAST = 126;
+
+static const uint8_t ASCII_FONT_DATA[ASCII_FONT_LAST - ASCII_FONT_FIRST + 1][ASCII_FONT_HEIGHT] = {
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // space
+	{ 0x00, 0x00, 0x00, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x00, 0x10, 0x10, 0x00, 0x00, 0x00, 0x00 }, // !
+	{ 0x00, 0x00, 0x00, 0x28, 0x28, 0x28, 0x28, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // "
+	{ 0x00, 0x00, 0x12, 0x12, 0x16, 0x7F, 0x24, 0x24, 0xFE, 0x28, 0x48, 0x48, 0x00, 0x00, 0x00, 0x00 }, // #
+	{ 0x00, 0x00, 0x00, 0x08, 0x3E, 0x49, 0x48, 0x38, 0x0E, 0x09, 0x49, 0x3E, 0x08, 0x08, 0x00, 0x00 }, // $
+	{ 0x00, 0x00, 0x00, 0x60, 0x90, 0x90, 0x62, 0x1C, 0x66, 0x09, 0x09, 0x06, 0x00, 0x00, 0x00, 0x00 }, // %
+	{ 0x00, 0x00, 0x00, 0x1C, 0x20, 0x20, 0x30, 0x49, 0x4D, 0x45, 0x62, 0x3D, 0x00, 0x00, 0x00, 0x00 }, // &
+	{ 0x00, 0x00, 0x00, 0x10, 0x10, 0x10, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '
+	{ 0x00, 0x0C, 0x08, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x08, 0x08, 0x04, 0x00, 0x00, 0x00 }, // (
+	{ 0x00, 0x30, 0x10, 0x10, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x10, 0x10, 0x30, 0x00, 0x00, 0x00 }, // )
+	{ 0x00, 0x00, 0x00, 0x08, 0x49, 0x3E, 0x1C, 0x6B, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // *
+	{ 0x00, 0x00, 0x00, 0x00, 0x10, 0x10, 0x10, 0xFE, 0x10, 0x10, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00 }, // +
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x10, 0x20, 0x00, 0x00 }, // ,
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x38, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // -
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00 }, // .
+	{ 0x00, 0x00, 0x00, 0x02, 0x04, 0x04, 0x08, 0x08, 0x18, 0x10, 0x10, 0x20, 0x20, 0x40, 0x00, 0x00 }, // /
+	{ 0x00, 0x00, 0x00, 0x1C, 0x22, 0x41, 0x41, 0x49, 0x41, 0x41, 0x22, 0x1C, 0x00, 0x00, 0x00, 0x00 }, // 0
+	{ 0x00, 0x00, 0x00, 0x38, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x3E, 0x00, 0x00, 0x00, 0x00 }, // 1
+	{ 0x00, 0x00, 0x00, 0x3E, 0x43, 0x01, 0x01, 0x02, 0x0C, 0x18, 0x20, 0x7F, 0x00, 0x00, 0x00, 0x00 }, // 2
+	{ 0x00, 0x00, 0x00, 0x3E, 0x41, 0x01, 0x03, 0x1C, 0x03, 0x01, 0x43, 0x3E, 0x00, 0x00, 0x00, 0x00 }, // 3
+	{ 0x00, 0x00, 0x00, 0x06, 0x0A, 0x1A, 0x12, 0x22, 0x42, 0x7F, 0x02, 0x02, 0x00, 0x00, 0x00, 0x00 }, // 4
+	{ 0x00, 0x00, 0x00, 0x7E, 0x40, 0x40, 0x7C, 0x03, 0x01, 0x01, 0x43, 0x3C, 0x00, 0x00, 0x00, 0x00 }, // 5
+	{ 0x00, 0x00, 0x00, 0x1E, 0x21, 0x40, 0x5E, 0x63, 0x41, 0x41, 0x23, 0x1E, 0x00, 0x00, 0x00, 0x00 }, // 6
+	{ 0x00, 0x00, 0x00, 0x7F, 0x02, 0x02, 0x04, 0x04, 0x08, 0x18, 0x10, 0x20, 0x00, 0x00, 0x00, 0x00 }, // 7
+	{ 0x00, 0x00, 0x00, 0x3E, 0x41, 0x41, 0x41, 0x3E, 0x63, 0x41, 0x61, 0x3E, 0x00, 0x00, 0x00, 0x00 }, // 8
+	{ 0x00, 0x00, 0x00, 0x3C, 0x62, 0x41, 0x41, 0x63, 0x3D, 0x01, 0x42, 0x3C, 0x00, 0x00, 0x00, 0x00 }, // 9
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00 }, // :
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00, 0x18, 0x18, 0x10, 0x20, 0x00, 0x00 }, // ;
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x0E, 0x70, 0x70, 0x0E, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00 }, // <
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x7F, 0x00, 0x00, 0x7F, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // =
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0x38, 0x07, 0x07, 0x38, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00 }, // >
+	{ 0x00, 0x00, 0x00, 0x38, 0x44, 0x04, 0x08, 0x10, 0x10, 0x00, 0x10, 0x10, 0x00, 0x00, 0x00, 0x00 }, // ?
+	{ 0x00, 0x00, 0x00, 0x1E, 0x33, 0x21, 0x47, 0x49, 0x49, 0x49, 0x47, 0x20, 0x30, 0x1E, 0x00, 0x00 }, // @
+	{ 0x00, 0x00, 0x00, 0x08, 0x14, 0x14, 0x14, 0x22, 0x22, 0x3E, 0x63, 0x41, 0x00, 0x00, 0x00, 0x00 }, // A
+	{ 0x00, 0x00, 0x00, 0x7E, 0x41, 0x41, 0x41, 0x7E, 0x41, 0x41, 0x41, 0x7E, 0x00, 0x00, 0x00, 0x00 }, // B
+	{ 0x00, 0x00, 0x00, 0x1E, 0x21, 0x40, 0x40, 0x40, 0x40, 0x40, 0x21, 0x1E, 0x00, 0x00, 0x00, 0x00 }, // C
+	{ 0x00, 0x00, 0x00, 0x7C, 0x42, 0x41, 0x41, 0x41, 0x41, 0x41, 0x42, 0x7C, 0x00, 0x00, 0x00, 0x00 }, // D
+	{ 0x00, 0x00, 0x00, 0x7F, 0x40, 0x40, 0x40, 0x7F, 0x40, 0x40, 0x40, 0x7F, 0x00, 0x00, 0x00, 0x00 }, // E
+	{ 0x00, 0x00, 0x00, 0x7F, 0x40, 0x40, 0x40, 0x7F, 0x40, 0x40, 0x40, 0x40, 0x00, 0x00, 0x00, 0x00 }, // F
+	{ 0x00, 0x00, 0x00, 0x1E, 0x21, 0x40, 0x40, 0x43, 0x41, 0x41, 0x21, 0x1E, 0x00, 0x00, 0x00, 0x00 }, // G
+	{ 0x00, 0x00, 0x00, 0x41, 0x41, 0x41, 0x41, 0x7F, 0x41, 0x41, 0x41, 0x41, 0x00, 0x00, 0x00, 0x00 }, // H
+	{ 0x00, 0x00, 0x00, 0x7C, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x7C, 0x00, 0x00, 0x00, 0x00 }, // I
+	{ 0x00, 0x00, 0x00, 0x1C, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x44, 0x38, 0x00, 0x00, 0x00, 0x00 }, // J
+	{ 0x00, 0x00, 0x00, 0x42, 0x44, 0x48, 0x50, 0x70, 0x48, 0x44, 0x44, 0x42, 0x00, 0x00, 0x00, 0x00 }, // K
+	{ 0x00, 0x00, 0x00, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x7F, 0x00, 0x00, 0x00, 0x00 }, // L
+	{ 0x00, 0x00, 0x00, 0x63, 0x63, 0x55, 0x55, 0x55, 0x49, 0x41, 0x41, 0x41, 0x00, 0x00, 0x00, 0x00 }, // M
+	{ 0x00, 0x00, 0x00, 0x61, 0x61, 0x51, 0x51, 0x49, 0x45, 0x45, 0x43, 0x43, 0x00, 0x00, 0x00, 0x00 }, // N
+	{ 0x00, 0x00, 0x00, 0x1C, 0x22, 0x41, 0x41, 0x41, 0x41, 0x41, 0x22, 0x1C, 0x00, 0x00, 0x00, 0x00 }, // O
+	{ 0x00, 0x00, 0x00, 0x7E, 0x43, 0x41, 0x41, 0x43, 0x7E, 0x40, 0x40, 0x40, 0x00, 0x00, 0x00, 0x00 }, // P
+	{ 0x00, 0x00, 0x00, 0x1C, 0x22, 0x41, 0x41, 0x41, 0x41, 0x41, 0x23, 0x1E, 0x06, 0x02, 0x00, 0x00 }, // Q
+	{ 0x00, 0x00, 0x00, 0xFC, 0x86, 0x82, 0x82, 0xFC, 0x84, 0x82, 0x82, 0x81, 0x00, 0x00, 0x00, 0x00 }, // R
+	{ 0x00, 0x00, 0x00, 0x3E, 0x61, 0x40, 0x60, 0x3E, 0x03, 0x01, 0x43, 0x3E, 0x00, 0x00, 0x00, 0x00 }, // S
+	{ 0x00, 0x00, 0x00, 0xFE, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x00, 0x00, 0x00, 0x00 }, // T
+	{ 0x00, 0x00, 0x00, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x3E, 0x00, 0x00, 0x00, 0x00 }, // U
+	{ 0x00, 0x00, 0x00, 0x41, 0x63, 0x22, 0x22, 0x22, 0x14, 0x14, 0x14, 0x08, 0x00, 0x00, 0x00, 0x00 }, // V
+	{ 0x00, 0x00, 0x00, 0x81, 0x81, 0x81, 0x5A, 0x5A, 0x5A, 0x66, 0x66, 0x66, 0x00, 0x00, 0x00, 0x00 }, // W
+	{ 0x00, 0x00, 0x00, 0x63, 0x22, 0x14, 0x1C, 0x08, 0x14, 0x36, 0x22, 0x41, 0x00, 0x00, 0x00, 0x00 }, // X
+	{ 0x00, 0x00, 0x00, 0x82, 0x44, 0x28, 0x28, 0x10, 0x10, 0x10, 0x10, 0x10, 0x00, 0x00, 0x00, 0x00 }, // Y
+	{ 0x00, 0x00, 0x00, 0x7F, 0x03, 0x06, 0x04, 0x08, 0x10, 0x30, 0x60, 0x7F, 0x00, 0x00, 0x00, 0x00 }, // Z
+	{ 0x00, 0x1C, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1C, 0x00, 0x00, 0x00 }, // [
+	{ 0x00, 0x00, 0x00, 0x40, 0x20, 0x20, 0x10, 0x10, 0x18, 0x08, 0x08, 0x04, 0x04, 0x02, 0x00, 0x00 }, // backslash
+	{ 0x00, 0x38, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x38, 0x00, 0x00, 0x00 }, // ]
+	{ 0x00, 0x00, 0x00, 0x10, 0x28, 0x44, 0xC6, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // ^
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0x00 }, // _
+	{ 0x00, 0x00, 0x10, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // `
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x1C, 0x22, 0x02, 0x3E, 0x42, 0x46, 0x3A, 0x00, 0x00, 0x00, 0x00 }, // a
+	{ 0x00, 0x40, 0x40, 0x40, 0x40, 0x7C, 0x66, 0x42, 0x42, 0x42, 0x66, 0x7C, 0x00, 0x00, 0x00, 0x00 }, // b
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x1C, 0x22, 0x40, 0x40, 0x40, 0x22, 0x1C, 0x00, 0x00, 0x00, 0x00 }, // c
+	{ 0x00, 0x02, 0x02, 0x02, 0x02, 0x3E, 0x66, 0x42, 0x42, 0x42, 0x66, 0x3E, 0x00, 0x00, 0x00, 0x00 }, // d
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x3C, 0x66, 0x42, 0x7E, 0x40, 0x62, 0x3C, 0x00, 0x00, 0x00, 0x00 }, // e
+	{ 0x00, 0x0C, 0x10, 0x10, 0x10, 0x7C, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x00, 0x00, 0x00, 0x00 }, // f
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x3E, 0x66, 0x42, 0x42, 0x42, 0x66, 0x3A, 0x02, 0x22, 0x1C, 0x00 }, // g
+	{ 0x00, 0x40, 0x40, 0x40, 0x40, 0x5C, 0x62, 0x42, 0x42, 0x42, 0x42, 0x42, 0x00, 0x00, 0x00, 0x00 }, // h
+	{ 0x00, 0x10, 0x00, 0x00, 0x00, 0x70, 0x10, 0x10, 0x10, 0x10, 0x10, 0x7C, 0x00, 0x00, 0x00, 0x00 }, // i
+	{ 0x00, 0x08, 0x00, 0x00, 0x00, 0x38, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x70, 0x00 }, // j
+	{ 0x00, 0x40, 0x40, 0x40, 0x40, 0x44, 0x48, 0x50, 0x70, 0x48, 0x44, 0x42, 0x00, 0x00, 0x00, 0x00 }, // k
+	{ 0x00, 0x70, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x0E, 0x00, 0x00, 0x00, 0x00 }, // l
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x7F, 0x49, 0x49, 0x49, 0x49, 0x49, 0x49, 0x00, 0x00, 0x00, 0x00 }, // m
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x5C, 0x62, 0x42, 0x42, 0x42, 0x42, 0x42, 0x00, 0x00, 0x00, 0x00 }, // n
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x3C, 0x66, 0x42, 0x42, 0x42, 0x66, 0x3C, 0x00, 0x00, 0x00, 0x00 }, // o
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x7C, 0x66, 0x42, 0x42, 0x42, 0x66, 0x7C, 0x40, 0x40, 0x40, 0x00 }, // p
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x3E, 0x66, 0x42, 0x42, 0x42, 0x66, 0x3A, 0x02, 0x02, 0x02, 0x00 }, // q
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x3C, 0x32, 0x20, 0x20, 0x20, 0x20, 0x20, 0x00, 0x00, 0x00, 0x00 }, // r
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x3C, 0x42, 0x40, 0x3C, 0x02, 0x42, 0x3C, 0x00, 0x00, 0x00, 0x00 }, // s
+	{ 0x00, 0x00, 0x00, 0x10, 0x10, 0x7E, 0x10, 0x10, 0x10, 0x10, 0x10, 0x0E, 0x00, 0x00, 0x00, 0x00 }, // t
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x42, 0x42, 0x42, 0x42, 0x42, 0x46, 0x3A, 0x00, 0x00, 0x00, 0x00 }, // u
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x42, 0x66, 0x24, 0x24, 0x3C, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00 }, // v
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x81, 0x81, 0x5A, 0x5A, 0x5A, 0x24, 0x24, 0x00, 0x00, 0x00, 0x00 }, // w
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x66, 0x24, 0x18, 0x18, 0x18, 0x24, 0x66, 0x00, 0x00, 0x00, 0x00 }, // x
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x42, 0x22, 0x24, 0x24, 0x14, 0x18, 0x08, 0x08, 0x10, 0x30, 0x00 }, // y
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x7E, 0x02, 0x04, 0x18, 0x20, 0x40, 0x7E, 0x00, 0x00, 0x00, 0x00 }, // z
+	{ 0x00, 0x1C, 0x10, 0x10, 0x10, 0x10, 0x60, 0x10, 0x10, 0x10, 0x10, 0x10, 0x0C, 0x00, 0x00, 0x00 }, // {
+	{ 0x00, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x00, 0x00 }, // |
+	{ 0x00, 0x70, 0x10, 0x10, 0x10, 0x10, 0x0C, 0x10, 0x10, 0x10, 0x10, 0x10, 0x60, 0x00, 0x00, 0x00 }, // }
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x39, 0x46, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // ~
+};
+
+const uint8_t* GetAsciiFontGlyph(wchar_t ch)
+{
+	if (ch < ASCII_FONT_FIRST || ch > ASCII_FONT_LAST)
+		return nullptr;
+	return ASCII_FONT_DATA[ch - ASCII_FONT_FIRST];
+}
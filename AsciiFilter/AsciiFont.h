@@ -0,0 +1,15 @@
+﻿// AsciiFont.h : Built-in 8x16 bitmap font for printable ASCII.
+//
+// Lets the core rasterize glyphs without a platform font API, e.g. to
+// build glyph masks or to render cells headless. Rasterized from
+// DejaVu Sans Mono (Bitstream Vera license), one byte per row, most
+// significant bit leftmost, baseline on row 12.
+
+#pragma once
+#include <cstdint>
+
+const int ASCII_FONT_WIDTH = 8;
+const int ASCII_FONT_HEIGHT = 16;
+
+// The ASCII_FONT_HEIGHT row bytes of ch, or null when ch is not in 32..126
+const uint8_t* GetAsciiFontGlyph(wchar_t ch);
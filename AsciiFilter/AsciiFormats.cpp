@@ -0,0 +1,352 @@
+﻿#include "AsciiKernels.h"
+
+#include <cstring>
+
+// Conversion kernels for the pixel formats other than BGRA8. They read the
+// source in its own layout, so a decoded video frame or an RGB buffer is
+// converted without first being expanded to BGRA. YUV blocks take their
+// luminance from the Y samples and average the chroma samples they cover
+// at chroma resolution. Block sums and cells follow the BGRA kernels, so a
+// format carrying the same colors gives the same cells.
+
+const char* GetAsciiPixelFormatName(AsciiPixelFormat format)
+{
+	switch (format) {
+	case AsciiPixelFormat::BGRA8:   return "bgra";
+	case AsciiPixelFormat::RGBA8:   return "rgba";
+	case AsciiPixelFormat::RGB8:    return "rgb24";
+	case AsciiPixelFormat::Gray8:   return "gray";
+	case AsciiPixelFormat::RGB10A2: return "x2bgr10le";
+	case AsciiPixelFormat::NV12:    return "nv12";
+	case AsciiPixelFormat::I420:    return "yuv420p";
+	case AsciiPixelFormat::P010:    return "p010le";
+	}
+	return "unknown";
+}
+
+// Bytes per pixel of the packed formats and per Y sample of the YUV ones
+static inline constexpr int GetSampleBytes(AsciiPixelFormat format)
+{
+	switch (format) {
+	case AsciiPixelFormat::RGB8:  return 3;
+	case AsciiPixelFormat::Gray8:
+	case AsciiPixelFormat::NV12:
+	case AsciiPixelFormat::I420:  return 1;
+	case AsciiPixelFormat::P010:  return 2;
+	default:                      return 4;
+	}
+}
+
+size_t GetAsciiFrameSize(AsciiPixelFormat format, int width, int height)
+{
+	if (width <= 0 || height <= 0)
+		return 0;
+	size_t luma = static_cast<size_t>(width) * height * GetSampleBytes(format);
+	if (!IsAsciiYuvFormat(format))
+		return luma;
+	// Two chroma samples per chroma position in every YUV format
+	size_t chroma = static_cast<size_t>((width + 1) / 2) * ((height + 1) / 2) * 2 * GetSampleBytes(format);
+	return luma + chroma;
+}
+
+AsciiImageView MakeAsciiImageView(const uint8_t* data, size_t size, int width, int height, AsciiPixelFormat format)
+{
+	AsciiImageView view;
+	if (!data || width <= 0 || height <= 0 || size < GetAsciiFrameSize(format, width, height))
+		return view;
+
+	int sampleBytes = GetSampleBytes(format);
+	view.data = data;
+	view.width = width;
+	view.height = height;
+	view.stride = width * sampleBytes;
+	view.format = format;
+	if (IsAsciiYuvFormat(format)) {
+		const uint8_t* chroma = data + static_cast<size_t>(view.stride) * height;
+		int chromaWidth = (width + 1) / 2;
+		if (format == AsciiPixelFormat::I420) {
+			view.chromaStride = chromaWidth;
+			view.chroma[0] = chroma;
+			view.chroma[1] = chroma + static_cast<size_t>(chromaWidth) * ((height + 1) / 2);
+		}
+		else {
+			view.chromaStride = chromaWidth * 2 * sampleBytes;
+			view.chroma[0] = chroma;
+		}
+	}
+	return view;
+}
+
+//------------------------------------------------------------
+// Samples
+//------------------------------------------------------------
+template<AsciiPixelFormat F>
+static inline void LoadPixel(const uint8_t* p, uint32_t& r, uint32_t& g, uint32_t& b)
+{
+	if constexpr (F == AsciiPixelFormat::RGBA8 || F == AsciiPixelFormat::RGB8) {
+		r = p[0];
+		g = p[1];
+		b = p[2];
+	}
+	else if constexpr (F == AsciiPixelFormat::Gray8) {
+		r = g = b = p[0];
+	}
+	else if constexpr (F == AsciiPixelFormat::RGB10A2) {
+		// Little endian whatever the host, top 8 of every 10 bits
+		uint32_t v = p[0] | (static_cast<uint32_t>(p[1]) << 8) | (static_cast<uint32_t>(p[2]) << 16) |
+			(static_cast<uint32_t>(p[3]) << 24);
+		r = (v >> 2) & 0xFF;
+		g = (v >> 12) & 0xFF;
+		b = (v >> 22) & 0xFF;
+	}
+	else {
+		// BGRA8, which normally takes the SIMD kernels
+		b = p[0];
+		g = p[1];
+		r = p[2];
+	}
+}
+
+// Y, U or V sample; P010 keeps all 10 bits
+template<AsciiPixelFormat F>
+static inline uint32_t LoadSample(const uint8_t* p)
+{
+	if constexpr (F == AsciiPixelFormat::P010)
+		return (p[0] | (static_cast<uint32_t>(p[1]) << 8)) >> 6;
+	else
+		return p[0];
+}
+
+// Significant bits of a YUV sample above 8
+template<AsciiPixelFormat F>
+static inline constexpr int ExtraSampleBits()
+{
+	return F == AsciiPixelFormat::P010 ? 2 : 0;
+}
+
+// Sum of the Y samples of a block
+template<AsciiPixelFormat F>
+static inline uint32_t SumLuma(const AsciiBlockJob& job, int startX, int startY, int endX, int endY)
+{
+	const int step = GetSampleBytes(F);
+	uint32_t sum = 0;
+	for (int y = startY; y < endY; ++y) {
+		const uint8_t* p = job.frame + static_cast<size_t>(y) * job.rowPitch + static_cast<size_t>(startX) * step;
+		for (int x = startX; x < endX; ++x, p += step)
+			sum += LoadSample<F>(p);
+	}
+	return sum;
+}
+
+// Sums of the chroma samples under a block, at chroma resolution
+template<AsciiPixelFormat F>
+static inline void SumChroma(const AsciiBlockJob& job, int startX, int startY, int endX, int endY,
+	uint32_t& sumU, uint32_t& sumV, uint32_t& count)
+{
+	int cx0 = startX / 2, cx1 = (endX + 1) / 2;
+	int cy0 = startY / 2, cy1 = (endY + 1) / 2;
+	sumU = sumV = 0;
+	count = static_cast<uint32_t>((cx1 - cx0) * (cy1 - cy0));
+	for (int cy = cy0; cy < cy1; ++cy) {
+		size_t offset = static_cast<size_t>(cy) * job.chromaPitch;
+		if constexpr (F == AsciiPixelFormat::I420) {
+			const uint8_t* u = job.chroma[0] + offset;
+			const uint8_t* v = job.chroma[1] + offset;
+			for (int cx = cx0; cx < cx1; ++cx) {
+				sumU += u[cx];
+				sumV += v[cx];
+			}
+		}
+		else {
+			const int step = 2 * GetSampleBytes(F);
+			const uint8_t* uv = job.chroma[0] + offset + static_cast<size_t>(cx0) * step;
+			for (int cx = cx0; cx < cx1; ++cx, uv += step) {
+				sumU += LoadSample<F>(uv);
+				sumV += LoadSample<F>(uv + step / 2);
+			}
+		}
+	}
+}
+
+template<AsciiPixelFormat F>
+static inline AsciiCell MakeYuvCell(const AsciiBlockJob& job, int startX, int startY, int endX, int endY)
+{
+	uint32_t count = static_cast<uint32_t>((endX - startX) * (endY - startY)) << ExtraSampleBits<F>();
+	uint32_t sumY = SumLuma<F>(job, startX, startY, endX, endY);
+	uint32_t sumU, sumV, chromaCount;
+	SumChroma<F>(job, startX, startY, endX, endY, sumU, sumV, chromaCount);
+	chromaCount <<= ExtraSampleBits<F>();
+	return MakeAsciiYuvCell(sumY / count, sumU / chromaCount, sumV / chromaCount, job.palette);
+}
+
+//------------------------------------------------------------
+// Intensity row kernels
+//------------------------------------------------------------
+template<AsciiPixelFormat F>
+static void ConvertRowPacked(const AsciiBlockJob& job, int row, AsciiCell* outRow)
+{
+	const int step = GetSampleBytes(F);
+	for (int col = 0; col < job.outCols; ++col) {
+		int startX, startY, endX, endY;
+		GetBlockBounds(job, row, col, startX, startY, endX, endY);
+
+		uint32_t sumR = 0, sumG = 0, sumB = 0;
+		for (int y = startY; y < endY; ++y) {
+			const uint8_t* p = job.frame + static_cast<size_t>(y) * job.rowPitch + static_cast<size_t>(startX) * step;
+			for (int x = startX; x < endX; ++x, p += step) {
+				uint32_t r, g, b;
+				LoadPixel<F>(p, r, g, b);
+				sumR += r;
+				sumG += g;
+				sumB += b;
+			}
+		}
+		uint32_t count = static_cast<uint32_t>((endX - startX) * (endY - startY));
+		if (count > 0)
+			outRow[col] = MakeAsciiCell(sumR, sumG, sumB, count, job.palette);
+	}
+}
+
+template<AsciiPixelFormat F>
+static void ConvertRowYuv(const AsciiBlockJob& job, int row, AsciiCell* outRow)
+{
+	for (int col = 0; col < job.outCols; ++col) {
+		int startX, startY, endX, endY;
+		GetBlockBounds(job, row, col, startX, startY, endX, endY);
+		if (endX > startX && endY > startY)
+			outRow[col] = MakeYuvCell<F>(job, startX, startY, endX, endY);
+	}
+}
+
+//------------------------------------------------------------
+// Shape row kernels. Sub-cells are laid out like SumSubCells in
+// AsciiGlyphs.cpp; YUV sub-cells sum the full range luminance into all
+// three channels, which MakeAsciiShapeCell weighs back to the same value.
+//------------------------------------------------------------
+template<AsciiPixelFormat F>
+static inline void SumSubCellsFormat(const AsciiBlockJob& job, int startX, int startY, int width, int height,
+	AsciiSubCellSums& sums)
+{
+	const int step = GetSampleBytes(F);
+	for (int sy = 0; sy < ASCII_GLYPH_MASK_ROWS; ++sy) {
+		int y0 = startY + sy * height / ASCII_GLYPH_MASK_ROWS;
+		int y1 = startY + (sy + 1) * height / ASCII_GLYPH_MASK_ROWS;
+		for (int sx = 0; sx < ASCII_GLYPH_MASK_COLS; ++sx) {
+			int x0 = startX + sx * width / ASCII_GLYPH_MASK_COLS;
+			int x1 = startX + (sx + 1) * width / ASCII_GLYPH_MASK_COLS;
+
+			uint32_t sumR = 0, sumG = 0, sumB = 0;
+			for (int y = y0; y < y1; ++y) {
+				const uint8_t* p = job.frame + static_cast<size_t>(y) * job.rowPitch + static_cast<size_t>(x0) * step;
+				for (int x = x0; x < x1; ++x, p += step) {
+					if constexpr (IsAsciiYuvFormat(F)) {
+						uint32_t luma = AsciiYToLuminance(static_cast<int>(LoadSample<F>(p) >> ExtraSampleBits<F>()));
+						sumR += luma;
+						sumG += luma;
+						sumB += luma;
+					}
+					else {
+						uint32_t r, g, b;
+						LoadPixel<F>(p, r, g, b);
+						sumR += r;
+						sumG += g;
+						sumB += b;
+					}
+				}
+			}
+
+			int i = sy * ASCII_GLYPH_MASK_COLS + sx;
+			sums.r[i] = sumR;
+			sums.g[i] = sumG;
+			sums.b[i] = sumB;
+			sums.count[i] = static_cast<uint32_t>((x1 - x0) * (y1 - y0));
+			sums.scale[i] = AsciiSubCellScale(sums.count[i]);
+		}
+	}
+}
+
+template<AsciiPixelFormat F>
+static void ConvertRowShapeFormat(const AsciiBlockJob& job, int row, AsciiCell* outRow)
+{
+	AsciiSubCellSums sums;
+	for (int col = 0; col < job.outCols; ++col) {
+		int startX, startY, endX, endY;
+		GetBlockBounds(job, row, col, startX, startY, endX, endY);
+		if (endX <= startX || endY <= startY)
+			continue;
+
+		SumSubCellsFormat<F>(job, startX, startY, endX - startX, endY - startY, sums);
+		AsciiCell cell = MakeAsciiShapeCell(sums, *job.glyphs, job.palette);
+		if constexpr (IsAsciiYuvFormat(F)) {
+			// The sums above are gray, the colors come from the chroma
+			wchar_t ch = cell.ch;
+			cell = MakeYuvCell<F>(job, startX, startY, endX, endY);
+			cell.ch = ch;
+		}
+		outRow[col] = cell;
+	}
+}
+
+AsciiRowKernel GetFormatRowKernel(AsciiPixelFormat format, AsciiGlyphMode mode)
+{
+	bool shape = mode == AsciiGlyphMode::Shape;
+	switch (format) {
+#define X(F, Kernel) case AsciiPixelFormat::F: \
+		return shape ? ConvertRowShapeFormat<AsciiPixelFormat::F> : Kernel<AsciiPixelFormat::F>;
+	X(BGRA8, ConvertRowPacked)
+	X(RGBA8, ConvertRowPacked)
+	X(RGB8, ConvertRowPacked)
+	X(Gray8, ConvertRowPacked)
+	X(RGB10A2, ConvertRowPacked)
+	X(NV12, ConvertRowYuv)
+	X(I420, ConvertRowYuv)
+	X(P010, ConvertRowYuv)
+#undef X
+	}
+	return ConvertRowPacked<AsciiPixelFormat::BGRA8>;
+}
+
+//------------------------------------------------------------
+// Block hash over the bytes of every plane, mixed like HashBlockScalar
+//------------------------------------------------------------
+static void HashRows(const uint8_t* data, int pitch, size_t bytes, int rows, uint64_t acc[4], uint64_t key[4])
+{
+	for (int y = 0; y < rows; ++y) {
+		const uint8_t* row = data + static_cast<size_t>(y) * pitch;
+		for (size_t i = 0; i < bytes; i += 32) {
+			uint64_t words[4] = { 0, 0, 0, 0 };
+			memcpy(words, row + i, bytes - i < 32 ? bytes - i : 32);
+			for (int lane = 0; lane < 4; ++lane) {
+				key[lane] += ASCII_HASH_KEY_STEP;
+				uint64_t x = words[lane] ^ key[lane];
+				acc[lane] += words[lane] + (x & 0xFFFFFFFFull) * (x >> 32);
+			}
+		}
+	}
+}
+
+uint64_t HashFormatBlock(const AsciiBlockJob& job, int startX, int startY, int endX, int endY)
+{
+	uint64_t acc[4] = { 0, 0, 0, 0 };
+	uint64_t key[4] = { ASCII_HASH_KEYS[0], ASCII_HASH_KEYS[1], ASCII_HASH_KEYS[2], ASCII_HASH_KEYS[3] };
+	int sampleBytes = GetSampleBytes(job.format);
+	HashRows(job.frame + static_cast<size_t>(startY) * job.rowPitch + static_cast<size_t>(startX) * sampleBytes,
+		job.rowPitch, static_cast<size_t>(endX - startX) * sampleBytes, endY - startY, acc, key);
+
+	if (IsAsciiYuvFormat(job.format)) {
+		int cx0 = startX / 2, cx1 = (endX + 1) / 2;
+		int cy0 = startY / 2, cy1 = (endY + 1) / 2;
+		if (job.format == AsciiPixelFormat::I420) {
+			for (int plane = 0; plane < 2; ++plane) {
+				HashRows(job.chroma[plane] + static_cast<size_t>(cy0) * job.chromaPitch + cx0, job.chromaPitch,
+					static_cast<size_t>(cx1 - cx0), cy1 - cy0, acc, key);
+			}
+		}
+		else {
+			size_t step = 2 * static_cast<size_t>(sampleBytes);
+			HashRows(job.chroma[0] + static_cast<size_t>(cy0) * job.chromaPitch + cx0 * step, job.chromaPitch,
+				(cx1 - cx0) * step, cy1 - cy0, acc, key);
+		}
+	}
+	return FinishBlockHash(acc, endX - startX, endY - startY);
+}
@@ -0,0 +1,191 @@
+﻿#include "AsciiGlyphs.h"
+#include "AsciiFont.h"
+#include "AsciiKernels.h"
+
+//------------------------------------------------------------
+// Glyph masks
+//------------------------------------------------------------
+void AsciiGlyphSet::Clear()
+{
+	m_chars.clear();
+	m_masks.clear();
+	m_coverage.clear();
+}
+
+bool AsciiGlyphSet::AddGlyph(wchar_t ch, const uint8_t* coverage, int width, int height, int pitch)
+{
+	if (!coverage || width <= 0 || height <= 0 || GetGlyphCount() >= ASCII_GLYPH_MAX_COUNT)
+		return false;
+	for (wchar_t existing : m_chars) {
+		if (existing == ch)
+			return false;
+	}
+
+	// Box filter the raster down to the mask; rasters smaller than the
+	// mask repeat their pixels
+	uint8_t mask[ASCII_GLYPH_MASK_SIZE];
+	int total = 0;
+	for (int sy = 0; sy < ASCII_GLYPH_MASK_ROWS; ++sy) {
+		int y0 = sy * height / ASCII_GLYPH_MASK_ROWS;
+		int y1 = (sy + 1) * height / ASCII_GLYPH_MASK_ROWS;
+		y1 = y1 > y0 ? y1 : y0 + 1;
+		for (int sx = 0; sx < ASCII_GLYPH_MASK_COLS; ++sx) {
+			int x0 = sx * width / ASCII_GLYPH_MASK_COLS;
+			int x1 = (sx + 1) * width / ASCII_GLYPH_MASK_COLS;
+			x1 = x1 > x0 ? x1 : x0 + 1;
+
+			uint32_t sum = 0;
+			for (int y = y0; y < y1; ++y) {
+				const uint8_t* p = coverage + static_cast<size_t>(y) * pitch;
+				for (int x = x0; x < x1; ++x)
+					sum += p[x];
+			}
+			uint32_t count = static_cast<uint32_t>((x1 - x0) * (y1 - y0));
+			mask[sy * ASCII_GLYPH_MASK_COLS + sx] = static_cast<uint8_t>((sum + count / 2) / count);
+			total += mask[sy * ASCII_GLYPH_MASK_COLS + sx];
+		}
+	}
+
+	m_chars.push_back(ch);
+	m_masks.insert(m_masks.end(), mask, mask + ASCII_GLYPH_MASK_SIZE);
+	m_coverage.push_back(total);
+	return true;
+}
+
+int AsciiGlyphSet::AddBuiltinGlyphs(const char* chars)
+{
+	int added = 0;
+	for (const char* c = chars; *c; ++c) {
+		const uint8_t* rows = GetAsciiFontGlyph(static_cast<wchar_t>(*c));
+		if (!rows)
+			continue;
+
+		uint8_t raster[ASCII_FONT_WIDTH * ASCII_FONT_HEIGHT];
+		for (int y = 0; y < ASCII_FONT_HEIGHT; ++y) {
+			for (int x = 0; x < ASCII_FONT_WIDTH; ++x)
+				raster[y * ASCII_FONT_WIDTH + x] = (rows[y] & (0x80 >> x)) ? 255 : 0;
+		}
+		if (AddGlyph(static_cast<wchar_t>(*c), raster, ASCII_FONT_WIDTH, ASCII_FONT_HEIGHT, ASCII_FONT_WIDTH))
+			++added;
+	}
+	return added;
+}
+
+wchar_t AsciiGlyphSet::Match(const uint8_t* target) const
+{
+	if (m_chars.empty())
+		return L' ';
+	int index = GetAsciiGlyphSearch()(m_masks.data(), static_cast<int>(m_chars.size()), target);
+	return m_chars[index];
+}
+
+//------------------------------------------------------------
+// Reference glyph search
+//------------------------------------------------------------
+int SearchGlyphsScalar(const uint8_t* masks, int glyphCount, const uint8_t* target)
+{
+	int best = 0;
+	uint32_t bestDistance = 0xFFFFFFFFu;
+	for (int i = 0; i < glyphCount; ++i, masks += ASCII_GLYPH_MASK_SIZE) {
+		uint32_t distance = 0;
+		for (int j = 0; j < ASCII_GLYPH_MASK_SIZE; ++j)
+			distance += masks[j] > target[j] ? masks[j] - target[j] : target[j] - masks[j];
+		if (distance < bestDistance) {
+			bestDistance = distance;
+			best = i;
+		}
+	}
+	return best;
+}
+
+//------------------------------------------------------------
+// Shape row kernels: sub-cell sums, then the glyph search
+//------------------------------------------------------------
+static inline void SumSubCells(const uint8_t* pixel, int rowPitch, int width, int height,
+	AsciiSubCellSums& sums)
+{
+	for (int sy = 0; sy < ASCII_GLYPH_MASK_ROWS; ++sy) {
+		int y0 = sy * height / ASCII_GLYPH_MASK_ROWS;
+		int y1 = (sy + 1) * height / ASCII_GLYPH_MASK_ROWS;
+		for (int sx = 0; sx < ASCII_GLYPH_MASK_COLS; ++sx) {
+			int x0 = sx * width / ASCII_GLYPH_MASK_COLS;
+			int x1 = (sx + 1) * width / ASCII_GLYPH_MASK_COLS;
+
+			int i = sy * ASCII_GLYPH_MASK_COLS + sx;
+			sums.r[i] = sums.g[i] = sums.b[i] = 0;
+			sums.count[i] = static_cast<uint32_t>((x1 - x0) * (y1 - y0));
+			sums.scale[i] = (i > 0 && sums.count[i] == sums.count[i - 1]) ? sums.scale[i - 1] : AsciiSubCellScale(sums.count[i]);
+			SumBlockScalar(pixel + static_cast<size_t>(y0) * rowPitch + x0 * 4, rowPitch,
+				x1 - x0, y1 - y0, sums.r[i], sums.g[i], sums.b[i]);
+		}
+	}
+}
+
+static void ConvertRowShape(const AsciiBlockJob& job, int row, AsciiCell* outRow)
+{
+	AsciiSubCellSums sums;
+	for (int col = 0; col < job.outCols; ++col) {
+		int startX, startY, endX, endY;
+		GetBlockBounds(job, row, col, startX, startY, endX, endY);
+
+		const uint8_t* pixel = job.frame + static_cast<size_t>(startY) * job.rowPitch + startX * 4;
+		SumSubCells(pixel, job.rowPitch, endX - startX, endY - startY, sums);
+		outRow[col] = MakeAsciiShapeCell(sums, *job.glyphs, job.palette);
+	}
+}
+
+// Same sub-cell edges as SumSubCells, but known at compile time, so the
+// loops unroll and every sub-cell sums into registers
+template<int W, int H>
+static inline void SumSubCellsFixed(const uint8_t* pixel, int rowPitch, AsciiSubCellSums& sums)
+{
+	AsciiUnroll<ASCII_GLYPH_MASK_ROWS>([&](int sy) {
+		const int y0 = sy * H / ASCII_GLYPH_MASK_ROWS;
+		const int y1 = (sy + 1) * H / ASCII_GLYPH_MASK_ROWS;
+		AsciiUnroll<ASCII_GLYPH_MASK_COLS>([&](int sx) {
+			const int x0 = sx * W / ASCII_GLYPH_MASK_COLS;
+			const int x1 = (sx + 1) * W / ASCII_GLYPH_MASK_COLS;
+			uint32_t r = 0, g = 0, b = 0;
+			for (int y = y0; y < y1; ++y) {
+				const uint8_t* p = pixel + static_cast<size_t>(y) * rowPitch;
+				for (int x = x0; x < x1; ++x) {
+					b += p[x * 4 + 0];
+					g += p[x * 4 + 1];
+					r += p[x * 4 + 2];
+				}
+			}
+			const int i = sy * ASCII_GLYPH_MASK_COLS + sx;
+			sums.r[i] = r;
+			sums.g[i] = g;
+			sums.b[i] = b;
+			sums.count[i] = static_cast<uint32_t>((x1 - x0) * (y1 - y0));
+			sums.scale[i] = AsciiSubCellScale(sums.count[i]);
+		});
+	});
+}
+
+// Full blocks take the unrolled path, clipped edge blocks the generic one
+template<int W, int H>
+static void ConvertRowShapeFixed(const AsciiBlockJob& job, int row, AsciiCell* outRow)
+{
+	AsciiSubCellSums sums;
+	for (int col = 0; col < job.outCols; ++col) {
+		int startX, startY, endX, endY;
+		GetBlockBounds(job, row, col, startX, startY, endX, endY);
+
+		const uint8_t* pixel = job.frame + static_cast<size_t>(startY) * job.rowPitch + startX * 4;
+		if (endX - startX == W && endY - startY == H)
+			SumSubCellsFixed<W, H>(pixel, job.rowPitch, sums);
+		else
+			SumSubCells(pixel, job.rowPitch, endX - startX, endY - startY, sums);
+		outRow[col] = MakeAsciiShapeCell(sums, *job.glyphs, job.palette);
+	}
+}
+
+AsciiRowKernel GetShapeRowKernel(int blockWidth, int blockHeight)
+{
+#define X(W, H) if (blockWidth == W && blockHeight == H) return ConvertRowShapeFixed<W, H>;
+	ASCII_FOR_EACH_FIXED_GEOMETRY(X)
+#undef X
+	return ConvertRowShape;
+}
@@ -0,0 +1,56 @@
+﻿// AsciiGlyphs.h : Shape-aware glyph selection.
+//
+// Every glyph is reduced once to a 4x8 mask of ink coverage. In
+// AsciiGlyphMode::Shape each block is sampled at the same 4x8 resolution
+// and the glyph whose mask is closest (sum of absolute differences) to the
+// block's ink pattern is picked, so edges and lines come out as '/', '|',
+// '_' ... instead of whatever character has the right brightness. The
+// search runs on the active SIMD kernel, one PSADBW per glyph.
+
+#pragma once
+#include "AsciiCore.h"
+
+const int ASCII_GLYPH_MASK_COLS = 4;
+const int ASCII_GLYPH_MASK_ROWS = 8;
+const int ASCII_GLYPH_MASK_SIZE = ASCII_GLYPH_MASK_COLS * ASCII_GLYPH_MASK_ROWS;
+
+// The SIMD searches pack glyph indices into 16 bits
+const int ASCII_GLYPH_MAX_COUNT = 0x10000;
+
+class AsciiGlyphSet
+{
+public:
+    // Add a glyph from an 8-bit coverage raster (0 = background, 255 =
+    // ink) of any size; pitch is in bytes. Returns false for a character
+    // that is already in the set, an empty raster or a full set.
+    bool AddGlyph(wchar_t ch, const uint8_t* coverage, int width, int height, int pitch);
+
+    // Add the characters of chars from the built-in bitmap font (AsciiFont.h).
+    // Returns the number of glyphs added.
+    int AddBuiltinGlyphs(const char* chars);
+
+    void Clear();
+
+    int GetGlyphCount() const { return static_cast<int>(m_chars.size()); }
+    wchar_t GetGlyph(int index) const { return m_chars[index]; }
+    const uint8_t* GetMask(int index) const { return m_masks.data() + static_cast<size_t>(index) * ASCII_GLYPH_MASK_SIZE; }
+
+    // Sum of the mask, i.e. how much ink the glyph puts into a cell
+    int GetCoverage(int index) const { return m_coverage[index]; }
+
+    // Glyph whose mask is closest to target (ASCII_GLYPH_MASK_SIZE bytes,
+    // row major). Ties go to the glyph added first.
+    wchar_t Match(const uint8_t* target) const;
+
+private:
+    std::vector<wchar_t> m_chars;
+    std::vector<uint8_t> m_masks; // ASCII_GLYPH_MASK_SIZE bytes per glyph
+    std::vector<int> m_coverage;
+};
+
+// Glyphs used by the conversion. The default set holds the palette
+// characters from the built-in font; a front end can replace it with
+// masks rasterized from its output font. The intensity palette is
+// rebuilt from the new set, ordered by ink coverage.
+void SetAsciiGlyphSet(const AsciiGlyphSet& glyphs);
+const AsciiGlyphSet& GetAsciiGlyphSet();
@@ -0,0 +1,543 @@
+﻿#include "AsciiImageIO.h"
+#include "AsciiKernels.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+// stdin and stdout carry binary data, which Windows would otherwise
+// translate as text
+static FILE* StandardStream(FILE* stream)
+{
+#ifdef _WIN32
+	_setmode(_fileno(stream), _O_BINARY);
+#endif
+	return stream;
+}
+
+static FILE* OpenOutput(const char* path, bool& ownsFile)
+{
+	ownsFile = strcmp(path, "-") != 0;
+	return ownsFile ? fopen(path, "wb") : StandardStream(stdout);
+}
+
+//------------------------------------------------------------
+// Readers. Every format parses its header into an AsciiImageHeader, and
+// the pixels are only read when asked for.
+//------------------------------------------------------------
+struct AsciiImageHeader
+{
+	int width = 0;
+	int height = 0;
+	int depth = 0;        // Samples per pixel: 1 gray, 2 gray + alpha, 3 RGB, 4 RGBA
+	int maxval = 255;     // PNM samples, 2 bytes big endian above 255
+	int bmpBits = 0;      // BMP only: 24 or 32
+	bool bmpTopDown = false;
+	long dataOffset = 0;  // BMP only: start of the pixel array
+};
+
+// Largest image the readers accept, so a corrupt header cannot ask for
+// gigabytes of memory
+static const long long ASCII_MAX_IMAGE_PIXELS = 1ll << 28;
+
+static bool ValidSize(int width, int height)
+{
+	return width > 0 && height > 0 && static_cast<long long>(width) * height <= ASCII_MAX_IMAGE_PIXELS;
+}
+
+// Next whitespace separated token of a PNM header, skipping # comments
+static bool ReadPnmToken(FILE* file, char* token, int size)
+{
+	int c = fgetc(file);
+	for (;;) {
+		while (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+			c = fgetc(file);
+		if (c != '#')
+			break;
+		while (c != '\n' && c != EOF)
+			c = fgetc(file);
+	}
+	int length = 0;
+	while (c != EOF && c != ' ' && c != '\t' && c != '\r' && c != '\n') {
+		if (length + 1 < size)
+			token[length++] = static_cast<char>(c);
+		c = fgetc(file);
+	}
+	token[length] = 0;
+	// The single whitespace character after the last header token has
+	// been consumed, so the file is at the first sample
+	return length > 0;
+}
+
+static bool ReadPnmNumber(FILE* file, int& value)
+{
+	char token[32];
+	if (!ReadPnmToken(file, token, sizeof(token)))
+		return false;
+	char* end = nullptr;
+	long number = strtol(token, &end, 10);
+	if (*end || number < 0 || number > 0x7FFFFFFF)
+		return false;
+	value = static_cast<int>(number);
+	return true;
+}
+
+static bool ReadPnmHeader(FILE* file, char kind, AsciiImageHeader& header)
+{
+	if (kind == '5' || kind == '6') {
+		header.depth = kind == '5' ? 1 : 3;
+		return ReadPnmNumber(file, header.width) && ReadPnmNumber(file, header.height) &&
+			ReadPnmNumber(file, header.maxval);
+	}
+
+	// PAM: KEY value lines up to ENDHDR
+	char key[32], value[32];
+	header.depth = 0;
+	header.maxval = 0;
+	while (ReadPnmToken(file, key, sizeof(key))) {
+		if (!strcmp(key, "ENDHDR"))
+			return true;
+		if (!ReadPnmToken(file, value, sizeof(value)))
+			return false;
+		if (!strcmp(key, "WIDTH"))
+			header.width = atoi(value);
+		else if (!strcmp(key, "HEIGHT"))
+			header.height = atoi(value);
+		else if (!strcmp(key, "DEPTH"))
+			header.depth = atoi(value);
+		else if (!strcmp(key, "MAXVAL"))
+			header.maxval = atoi(value);
+		// TUPLTYPE only names what DEPTH already says
+	}
+	return false;
+}
+
+static uint32_t ReadLE(const uint8_t* p, int bytes)
+{
+	uint32_t value = 0;
+	for (int i = bytes - 1; i >= 0; --i)
+		value = (value << 8) | p[i];
+	return value;
+}
+
+static bool ReadBmpHeader(FILE* file, AsciiImageHeader& header)
+{
+	// The "BM" signature has been read already
+	uint8_t fileHeader[12], info[40];
+	if (fread(fileHeader, 1, sizeof(fileHeader), file) != sizeof(fileHeader) ||
+		fread(info, 1, sizeof(info), file) != sizeof(info))
+		return false;
+
+	uint32_t infoSize = ReadLE(info, 4);
+	int32_t width = static_cast<int32_t>(ReadLE(info + 4, 4));
+	int32_t height = static_cast<int32_t>(ReadLE(info + 8, 4));
+	uint32_t bits = ReadLE(info + 14, 2);
+	uint32_t compression = ReadLE(info + 16, 4);
+	if (infoSize < 40 || (bits != 24 && bits != 32) || height == INT32_MIN)
+		return false;
+
+	// BI_RGB, or BI_BITFIELDS with the usual BGRA masks. The masks follow
+	// the 40 byte header, both after a BITMAPINFOHEADER and inside V4/V5.
+	if (compression == 3 && bits == 32) {
+		uint8_t masks[12];
+		if (fread(masks, 1, sizeof(masks), file) != sizeof(masks))
+			return false;
+		if (ReadLE(masks, 4) != 0x00FF0000u || ReadLE(masks + 4, 4) != 0x0000FF00u || ReadLE(masks + 8, 4) != 0x000000FFu)
+			return false;
+	}
+	else if (compression != 0) {
+		return false;
+	}
+
+	header.width = width;
+	header.height = height < 0 ? -height : height;
+	header.bmpTopDown = height < 0;
+	header.bmpBits = static_cast<int>(bits);
+	header.depth = bits == 32 ? 4 : 3;
+	header.dataOffset = static_cast<long>(ReadLE(fileHeader + 8, 4));
+	return true;
+}
+
+static bool ReadImageHeader(FILE* file, AsciiImageHeader& header)
+{
+	int c0 = fgetc(file), c1 = fgetc(file);
+	bool ok = false;
+	if (c0 == 'P' && (c1 == '5' || c1 == '6' || c1 == '7'))
+		ok = ReadPnmHeader(file, static_cast<char>(c1), header) && header.depth >= 1 && header.depth <= 4 &&
+			header.maxval >= 1 && header.maxval <= 65535;
+	else if (c0 == 'B' && c1 == 'M')
+		ok = ReadBmpHeader(file, header);
+	return ok && ValidSize(header.width, header.height);
+}
+
+static bool ReadPnmPixels(FILE* file, const AsciiImageHeader& header, AsciiImage& image)
+{
+	const int sampleBytes = header.maxval > 255 ? 2 : 1;
+	const size_t rowBytes = static_cast<size_t>(header.width) * header.depth * sampleBytes;
+	std::vector<uint8_t> row(rowBytes);
+	const uint32_t maxval = static_cast<uint32_t>(header.maxval);
+
+	for (int y = 0; y < header.height; ++y) {
+		if (fread(row.data(), 1, rowBytes, file) != rowBytes)
+			return false;
+
+		uint8_t* out = image.pixels.GetData() + static_cast<size_t>(y) * header.width * 4;
+		const uint8_t* in = row.data();
+		for (int x = 0; x < header.width; ++x, out += 4) {
+			uint8_t samples[4];
+			for (int s = 0; s < header.depth; ++s, in += sampleBytes) {
+				uint32_t v = sampleBytes == 2 ? (static_cast<uint32_t>(in[0]) << 8) | in[1] : in[0];
+				v = v > maxval ? maxval : v;
+				samples[s] = static_cast<uint8_t>(maxval == 255 ? v : (v * 255 + maxval / 2) / maxval);
+			}
+			bool color = header.depth >= 3;
+			bool alpha = header.depth == 2 || header.depth == 4;
+			out[0] = samples[color ? 2 : 0];
+			out[1] = samples[color ? 1 : 0];
+			out[2] = samples[0];
+			out[3] = alpha ? samples[header.depth - 1] : 255;
+		}
+	}
+	return true;
+}
+
+static bool ReadBmpPixels(FILE* file, const AsciiImageHeader& header, AsciiImage& image)
+{
+	if (fseek(file, header.dataOffset, SEEK_SET) != 0)
+		return false;
+
+	const int pixelBytes = header.bmpBits / 8;
+	const size_t rowBytes = (static_cast<size_t>(header.width) * pixelBytes + 3) & ~static_cast<size_t>(3);
+	std::vector<uint8_t> row(rowBytes);
+	for (int i = 0; i < header.height; ++i) {
+		if (fread(row.data(), 1, rowBytes, file) != rowBytes)
+			return false;
+
+		int y = header.bmpTopDown ? i : header.height - 1 - i;
+		uint8_t* out = image.pixels.GetData() + static_cast<size_t>(y) * header.width * 4;
+		const uint8_t* in = row.data();
+		for (int x = 0; x < header.width; ++x, out += 4, in += pixelBytes) {
+			out[0] = in[0];
+			out[1] = in[1];
+			out[2] = in[2];
+			out[3] = 255; // BMP alpha is unreliable, most writers leave it 0
+		}
+	}
+	return true;
+}
+
+bool ReadAsciiImage(const char* path, AsciiImage& image)
+{
+	FILE* file = path ? fopen(path, "rb") : nullptr;
+	if (!file)
+		return false;
+
+	AsciiImageHeader header;
+	bool ok = ReadImageHeader(file, header);
+	if (ok) {
+		image.width = header.width;
+		image.height = header.height;
+		image.format = AsciiPixelFormat::BGRA8;
+		image.pixels.Resize(static_cast<size_t>(header.width) * header.height * 4);
+		ok = header.bmpBits ? ReadBmpPixels(file, header, image) : ReadPnmPixels(file, header, image);
+	}
+	fclose(file);
+
+	if (!ok) {
+		image.pixels.Clear();
+		image.width = image.height = 0;
+	}
+	return ok;
+}
+
+bool ReadAsciiImageSize(const char* path, int& width, int& height)
+{
+	FILE* file = path ? fopen(path, "rb") : nullptr;
+	if (!file)
+		return false;
+
+	AsciiImageHeader header;
+	bool ok = ReadImageHeader(file, header);
+	fclose(file);
+	width = ok ? header.width : 0;
+	height = ok ? header.height : 0;
+	return ok;
+}
+
+//------------------------------------------------------------
+// PPM
+//------------------------------------------------------------
+bool WriteAsciiPpm(const char* path, const AsciiImageView& image)
+{
+	if (!path || !image.data || image.width <= 0 || image.height <= 0)
+		return false;
+
+	bool ownsFile = false;
+	FILE* file = OpenOutput(path, ownsFile);
+	if (!file)
+		return false;
+
+	bool ok = fprintf(file, "P6\n%d %d\n255\n", image.width, image.height) > 0;
+	std::vector<uint8_t> line(static_cast<size_t>(image.width) * 3);
+	for (int y = 0; ok && y < image.height; ++y) {
+		const uint8_t* pixel = image.data + static_cast<size_t>(y) * image.stride;
+		for (int x = 0; x < image.width; ++x, pixel += 4) {
+			line[x * 3] = pixel[2];
+			line[x * 3 + 1] = pixel[1];
+			line[x * 3 + 2] = pixel[0];
+		}
+		ok = fwrite(line.data(), 1, line.size(), file) == line.size();
+	}
+
+	if (ownsFile)
+		ok = fclose(file) == 0 && ok;
+	else
+		ok = fflush(file) == 0 && ok;
+	return ok;
+}
+
+//------------------------------------------------------------
+// YUV4MPEG2
+//------------------------------------------------------------
+bool AsciiY4mWriter::Open(const char* path, int width, int height, int fps)
+{
+	Close();
+	if (!path || width <= 0 || height <= 0 || fps <= 0)
+		return false;
+
+	m_file = OpenOutput(path, m_ownsFile);
+	if (!m_file)
+		return false;
+	m_width = width;
+	m_height = height;
+
+	if (fprintf(m_file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n", width, height, fps) < 0) {
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void AsciiY4mWriter::Close()
+{
+	if (m_file && m_ownsFile)
+		fclose(m_file);
+	else if (m_file)
+		fflush(m_file);
+	m_file = nullptr;
+	m_ownsFile = false;
+}
+
+// Fixed-point BT.601 limited range, scaled by 256
+static inline uint8_t Bt601Y(int r, int g, int b)
+{
+	return static_cast<uint8_t>((66 * r + 129 * g + 25 * b + 128 + (16 << 8)) >> 8);
+}
+
+static inline uint8_t Bt601U(int r, int g, int b)
+{
+	return static_cast<uint8_t>((-38 * r - 74 * g + 112 * b + 128 + (128 << 8)) >> 8);
+}
+
+static inline uint8_t Bt601V(int r, int g, int b)
+{
+	return static_cast<uint8_t>((112 * r - 94 * g - 18 * b + 128 + (128 << 8)) >> 8);
+}
+
+bool AsciiY4mWriter::WriteFrame(const AsciiImageView& frame)
+{
+	if (!m_file || !frame.data || frame.format != AsciiPixelFormat::BGRA8 || frame.width != m_width || frame.height != m_height)
+		return false;
+
+	const int chromaWidth = (m_width + 1) / 2;
+	const int chromaHeight = (m_height + 1) / 2;
+	const size_t lumaSize = static_cast<size_t>(m_width) * m_height;
+	const size_t chromaSize = static_cast<size_t>(chromaWidth) * chromaHeight;
+	m_planes.resize(lumaSize + chromaSize * 2);
+	uint8_t* planeY = m_planes.data();
+	uint8_t* planeU = planeY + lumaSize;
+	uint8_t* planeV = planeU + chromaSize;
+
+	for (int y = 0; y < m_height; ++y) {
+		const uint8_t* pixel = frame.data + static_cast<size_t>(y) * frame.stride;
+		uint8_t* outY = planeY + static_cast<size_t>(y) * m_width;
+		for (int x = 0; x < m_width; ++x, pixel += 4)
+			outY[x] = Bt601Y(pixel[2], pixel[1], pixel[0]);
+	}
+
+	// Chroma of the average of every 2x2 block
+	for (int cy = 0; cy < chromaHeight; ++cy) {
+		const uint8_t* row0 = frame.data + static_cast<size_t>(cy * 2) * frame.stride;
+		const uint8_t* row1 = cy * 2 + 1 < m_height ? row0 + frame.stride : row0;
+		for (int cx = 0; cx < chromaWidth; ++cx) {
+			int x0 = cx * 2 * 4;
+			int x1 = cx * 2 + 1 < m_width ? x0 + 4 : x0;
+			int b = (row0[x0] + row0[x1] + row1[x0] + row1[x1] + 2) >> 2;
+			int g = (row0[x0 + 1] + row0[x1 + 1] + row1[x0 + 1] + row1[x1 + 1] + 2) >> 2;
+			int r = (row0[x0 + 2] + row0[x1 + 2] + row1[x0 + 2] + row1[x1 + 2] + 2) >> 2;
+			planeU[cy * chromaWidth + cx] = Bt601U(r, g, b);
+			planeV[cy * chromaWidth + cx] = Bt601V(r, g, b);
+		}
+	}
+
+	return fputs("FRAME\n", m_file) >= 0 &&
+		fwrite(m_planes.data(), 1, m_planes.size(), m_file) == m_planes.size();
+}
+
+//------------------------------------------------------------
+// Frame sequences
+//------------------------------------------------------------
+// Inverse of Bt601Y/U/V
+static inline void Bt601ToBgra(int y, int u, int v, uint8_t* out)
+{
+	AsciiYuvToRgb(y, u, v, out[2], out[1], out[0]);
+	out[3] = 255;
+}
+
+bool AsciiFrameReader::OpenInput(const char* path)
+{
+	Close();
+	if (!path)
+		return false;
+	m_ownsFile = strcmp(path, "-") != 0;
+	m_file = m_ownsFile ? fopen(path, "rb") : StandardStream(stdin);
+	return m_file != nullptr;
+}
+
+bool AsciiFrameReader::OpenY4m(const char* path)
+{
+	if (!OpenInput(path))
+		return false;
+
+	char line[1024];
+	if (!fgets(line, sizeof(line), m_file) || strncmp(line, "YUV4MPEG2 ", 10) != 0) {
+		Close();
+		return false;
+	}
+
+	// Space separated parameters, each a letter and its value
+	m_layout = Layout::Y4m420;
+	m_width = m_height = 0;
+	m_frameRate = 0.0;
+	for (char* token = strtok(line + 10, " \r\n"); token; token = strtok(nullptr, " \r\n")) {
+		switch (token[0]) {
+		case 'W': m_width = atoi(token + 1); break;
+		case 'H': m_height = atoi(token + 1); break;
+		case 'F': {
+			int num = 0, den = 0;
+			if (sscanf(token + 1, "%d:%d", &num, &den) == 2 && num > 0 && den > 0)
+				m_frameRate = static_cast<double>(num) / den;
+			break;
+		}
+		case 'C':
+			if (!strcmp(token + 1, "420") || !strcmp(token + 1, "420jpeg") ||
+				!strcmp(token + 1, "420paldv") || !strcmp(token + 1, "420mpeg2"))
+				m_layout = Layout::Y4m420;
+			else if (!strcmp(token + 1, "444"))
+				m_layout = Layout::Y4m444;
+			else if (!strcmp(token + 1, "mono"))
+				m_layout = Layout::Y4mMono;
+			else
+				m_width = 0; // 4:2:2, 4:1:1, high bit depths and alpha are not supported
+			break;
+		}
+	}
+	if (!ValidSize(m_width, m_height)) {
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool AsciiFrameReader::OpenRaw(const char* path, AsciiPixelFormat format, int width, int height)
+{
+	if (!ValidSize(width, height) || !OpenInput(path))
+		return false;
+
+	m_width = width;
+	m_height = height;
+	m_frameRate = 0.0;
+	m_layout = Layout::Raw;
+	m_format = format;
+	return true;
+}
+
+void AsciiFrameReader::Close()
+{
+	if (m_file && m_ownsFile)
+		fclose(m_file);
+	m_file = nullptr;
+	m_ownsFile = false;
+	m_error = false;
+}
+
+bool AsciiFrameReader::ReadFrame(AsciiImage& frame)
+{
+	if (!m_file || m_error)
+		return false;
+
+	// Nothing at all left is the end of the stream, anything short of a
+	// whole frame an error
+	int first = fgetc(m_file);
+	if (first == EOF) {
+		m_error = ferror(m_file) != 0;
+		return false;
+	}
+	ungetc(first, m_file);
+	m_error = true;
+
+	if (m_layout != Layout::Raw) {
+		// "FRAME" and optional parameters up to the end of the line
+		char tag[6] = {};
+		if (fread(tag, 1, 5, m_file) != 5 || strcmp(tag, "FRAME") != 0)
+			return false;
+		int c;
+		while ((c = fgetc(m_file)) != '\n') {
+			if (c == EOF)
+				return false;
+		}
+	}
+
+	frame.width = m_width;
+	frame.height = m_height;
+
+	// Formats the conversion reads natively go straight into the image
+	if (m_layout == Layout::Raw || m_layout == Layout::Y4m420) {
+		frame.format = m_layout == Layout::Raw ? m_format : AsciiPixelFormat::I420;
+		size_t frameBytes = GetAsciiFrameSize(frame.format, m_width, m_height);
+		frame.pixels.Resize(frameBytes);
+		if (fread(frame.pixels.GetData(), 1, frameBytes, m_file) != frameBytes)
+			return false;
+		m_error = false;
+		return true;
+	}
+
+	const size_t pixels = static_cast<size_t>(m_width) * m_height;
+	size_t frameBytes = m_layout == Layout::Y4m444 ? pixels * 3 : pixels;
+	m_data.Resize(frameBytes);
+	if (fread(m_data.GetData(), 1, frameBytes, m_file) != frameBytes)
+		return false;
+
+	frame.format = AsciiPixelFormat::BGRA8;
+	frame.pixels.Resize(pixels * 4);
+	for (int y = 0; y < m_height; ++y) {
+		uint8_t* out = frame.pixels.GetData() + static_cast<size_t>(y) * m_width * 4;
+		const uint8_t* row = m_data.GetData() + static_cast<size_t>(y) * m_width;
+		if (m_layout == Layout::Y4m444) {
+			const uint8_t* u = row + pixels;
+			const uint8_t* v = u + pixels;
+			for (int x = 0; x < m_width; ++x, out += 4)
+				Bt601ToBgra(row[x], u[x], v[x], out);
+		}
+		else {
+			for (int x = 0; x < m_width; ++x, out += 4)
+				Bt601ToBgra(row[x], 128, 128, out);
+		}
+	}
+	m_error = false;
+	return true;
+}
@@ -0,0 +1,109 @@
+﻿// AsciiImageIO.h : Reads and writes BGRA frames as image and video files.
+//
+// Reads PPM/PGM, PAM and uncompressed BMP; writes plain PPM for single
+// frames and YUV4MPEG2 (.y4m) for sequences, which ffmpeg, mpv and most
+// video tools read directly. Everything needs nothing but stdio, so the
+// core can be fed and inspected headless. A path of "-" reads from stdin or writes to stdout.
+
+#pragma once
+#include "AsciiBuffer.h"
+
+#include <cstdio>
+
+// Tightly packed image, planes back to back (see GetAsciiFrameSize).
+// Reading into the same image again reuses its buffer, so a stream of
+// frames allocates nothing once it has started.
+struct AsciiImage
+{
+    AsciiPixelBuffer pixels;
+    int width = 0;
+    int height = 0;
+    AsciiPixelFormat format = AsciiPixelFormat::BGRA8;
+
+    AsciiImageView View() const { return MakeAsciiImageView(pixels, width, height, format); }
+};
+
+// Reads a binary PPM (P6) or PGM (P5), a PAM (P7: GRAYSCALE, RGB and their
+// _ALPHA variants) or an uncompressed 24/32-bit BMP, picked by content.
+// Samples with a maxval other than 255 are rescaled. Returns false for a
+// missing, truncated or unsupported file.
+bool ReadAsciiImage(const char* path, AsciiImage& image);
+
+// Size of an image ReadAsciiImage accepts, from its header only
+bool ReadAsciiImageSize(const char* path, int& width, int& height);
+
+// Binary PPM (P6), alpha is dropped. Returns false on any I/O error.
+bool WriteAsciiPpm(const char* path, const AsciiImageView& image);
+
+// 4:2:0 YUV4MPEG2 stream with BT.601 limited range colors. Odd sizes get
+// their last chroma column / row from a single pixel column / row.
+class AsciiY4mWriter
+{
+public:
+    AsciiY4mWriter() {}
+    ~AsciiY4mWriter() { Close(); }
+
+    AsciiY4mWriter(const AsciiY4mWriter&) = delete;
+    AsciiY4mWriter& operator=(const AsciiY4mWriter&) = delete;
+
+    bool Open(const char* path, int width, int height, int fps);
+    void Close();
+    bool IsOpen() const { return m_file != nullptr; }
+
+    // frame must be BGRA8 and have the size passed to Open
+    bool WriteFrame(const AsciiImageView& frame);
+
+private:
+    FILE* m_file = nullptr;
+    bool m_ownsFile = false;
+    int m_width = 0;
+    int m_height = 0;
+    std::vector<uint8_t> m_planes; // Y, U and V of one frame
+};
+
+// Reads consecutive frames from a YUV4MPEG2 stream (8-bit 4:2:0, 4:4:4 and
+// mono, BT.601 limited range like AsciiY4mWriter) or from headerless raw
+// video of a known size (ffmpeg -f rawvideo, any AsciiPixelFormat; see
+// GetAsciiPixelFormatName for the -pix_fmt names). Frames keep their
+// format where the conversion can read it: raw video and 4:2:0 Y4M (as
+// I420) are read straight into the image, 4:4:4 and mono Y4M become BGRA.
+class AsciiFrameReader
+{
+public:
+    AsciiFrameReader() {}
+    ~AsciiFrameReader() { Close(); }
+
+    AsciiFrameReader(const AsciiFrameReader&) = delete;
+    AsciiFrameReader& operator=(const AsciiFrameReader&) = delete;
+
+    bool OpenY4m(const char* path);
+    bool OpenRaw(const char* path, AsciiPixelFormat format, int width, int height);
+    void Close();
+    bool IsOpen() const { return m_file != nullptr; }
+
+    int GetWidth() const { return m_width; }
+    int GetHeight() const { return m_height; }
+    // Frames per second from the Y4M header, 0 when unknown
+    double GetFrameRate() const { return m_frameRate; }
+
+    // False at the end of the stream, on a truncated frame or a read error
+    bool ReadFrame(AsciiImage& frame);
+    // Whether the last ReadFrame failed on a truncated frame or a read
+    // error rather than at the end of the stream
+    bool HasError() const { return m_error; }
+
+private:
+    enum class Layout { Y4m420, Y4m444, Y4mMono, Raw };
+
+    bool OpenInput(const char* path);
+
+    FILE* m_file = nullptr;
+    bool m_ownsFile = false;
+    Layout m_layout = Layout::Raw;
+    AsciiPixelFormat m_format = AsciiPixelFormat::BGRA8; // Of Raw
+    int m_width = 0;
+    int m_height = 0;
+    double m_frameRate = 0.0;
+    bool m_error = false;
+    AsciiPixelBuffer m_data; // Y4M planes that are converted to BGRA
+};
@@ -0,0 +1,159 @@
+﻿#include "AsciiIntegral.h"
+#include "AsciiKernels.h"
+
+#include <cmath>
+
+//------------------------------------------------------------
+// Build the summed-area table: each entry holds the sums of all
+// pixels above and to the left of it
+//------------------------------------------------------------
+void AsciiIntegralImage::Build(const uint8_t* frame, int width, int height, int rowPitch)
+{
+	if (!frame || width <= 0 || height <= 0) {
+		m_width = 0;
+		m_height = 0;
+		m_sums.clear();
+		return;
+	}
+
+	m_width = width;
+	m_height = height;
+	size_t stride = static_cast<size_t>(width + 1) * 3;
+	m_sums.resize(stride * (height + 1));
+
+	// Zero first row; the first column is written per row below
+	for (size_t i = 0; i < stride; ++i)
+		m_sums[i] = 0;
+
+	for (int y = 0; y < height; ++y) {
+		const uint8_t* pixel = frame + static_cast<size_t>(y) * rowPitch;
+		const uint32_t* above = m_sums.data() + static_cast<size_t>(y) * stride;
+		uint32_t* out = m_sums.data() + static_cast<size_t>(y + 1) * stride;
+		out[0] = out[1] = out[2] = 0;
+
+		// Running row sums plus the entry directly above. Unsigned
+		// wraparound is intended, see SumRect.
+		uint32_t rowB = 0, rowG = 0, rowR = 0;
+		for (int x = 0; x < width; ++x, pixel += 4) {
+			rowB += pixel[0];
+			rowG += pixel[1];
+			rowR += pixel[2];
+			size_t i = static_cast<size_t>(x + 1) * 3;
+			out[i + 0] = above[i + 0] + rowB;
+			out[i + 1] = above[i + 1] + rowG;
+			out[i + 2] = above[i + 2] + rowR;
+		}
+	}
+}
+
+void AsciiIntegralImage::Build(const std::vector<uint8_t>& frameData, int width, int height)
+{
+	Build(MakeAsciiImageView(frameData, width, height));
+}
+
+void AsciiIntegralImage::Build(const AsciiImageView& image)
+{
+	bool bgra = image.format == AsciiPixelFormat::BGRA8;
+	Build(bgra ? image.data : nullptr, image.width, image.height, image.stride);
+}
+
+void AsciiIntegralImage::SumRect(int x0, int y0, int x1, int y1,
+	uint32_t& sumR, uint32_t& sumG, uint32_t& sumB) const
+{
+	size_t stride = static_cast<size_t>(m_width + 1) * 3;
+	const uint32_t* top = m_sums.data() + static_cast<size_t>(y0) * stride;
+	const uint32_t* bottom = m_sums.data() + static_cast<size_t>(y1) * stride;
+	size_t l = static_cast<size_t>(x0) * 3;
+	size_t r = static_cast<size_t>(x1) * 3;
+
+	sumB = bottom[r + 0] - bottom[l + 0] - top[r + 0] + top[l + 0];
+	sumG = bottom[r + 1] - bottom[l + 1] - top[r + 1] + top[l + 1];
+	sumR = bottom[r + 2] - bottom[l + 2] - top[r + 2] + top[l + 2];
+}
+
+//------------------------------------------------------------
+// Convert a region using four lookups per cell
+//------------------------------------------------------------
+void ConvertIntegralToAscii(const AsciiIntegralImage& integral,
+	const AsciiRect& region, double blockWidth, double blockHeight,
+	std::vector<AsciiCell>& asciiOut,
+	int& outCols, int& outRows)
+{
+	// Clamp the region to the frame
+	AsciiRect clipped = region;
+	clipped.left = clipped.left < 0 ? 0 : clipped.left;
+	clipped.top = clipped.top < 0 ? 0 : clipped.top;
+	clipped.right = clipped.right > integral.GetWidth() ? integral.GetWidth() : clipped.right;
+	clipped.bottom = clipped.bottom > integral.GetHeight() ? integral.GetHeight() : clipped.bottom;
+
+	int regionW = clipped.right - clipped.left;
+	int regionH = clipped.bottom - clipped.top;
+	if (integral.IsEmpty() || blockWidth <= 0.0 || blockHeight <= 0.0 || regionW <= 0 || regionH <= 0) {
+		outCols = 0;
+		outRows = 0;
+		asciiOut.clear();
+		return;
+	}
+
+	outCols = static_cast<int>(std::ceil(regionW / blockWidth));
+	outRows = static_cast<int>(std::ceil(regionH / blockHeight));
+	asciiOut.resize(static_cast<size_t>(outCols) * outRows);
+
+	const wchar_t* palette = GetAsciiPalette();
+	// Edge mode falls back to intensity glyphs, see the header
+	const AsciiGlyphSet* glyphs = GetAsciiGlyphMode() == AsciiGlyphMode::Shape ? &GetAsciiGlyphSet() : nullptr;
+	AsciiSubCellSums subSums;
+
+	// Column edges are the same for every row
+	std::vector<int> colEdges(outCols + 1);
+	for (int col = 0; col <= outCols; ++col) {
+		int x = clipped.left + static_cast<int>(std::floor(col * blockWidth));
+		colEdges[col] = x < clipped.right ? x : clipped.right;
+	}
+
+	for (int row = 0; row < outRows; ++row) {
+		int y0 = clipped.top + static_cast<int>(std::floor(row * blockHeight));
+		int y1 = clipped.top + static_cast<int>(std::floor((row + 1) * blockHeight));
+		y0 = y0 < clipped.bottom - 1 ? y0 : clipped.bottom - 1;
+		y1 = y1 > y0 ? (y1 < clipped.bottom ? y1 : clipped.bottom) : y0 + 1;
+
+		AsciiCell* outRow = asciiOut.data() + static_cast<size_t>(row) * outCols;
+		for (int col = 0; col < outCols; ++col) {
+			// Zoomed in past one pixel per cell: sample at least one pixel
+			int x0 = colEdges[col] < clipped.right - 1 ? colEdges[col] : clipped.right - 1;
+			int x1 = colEdges[col + 1] > x0 ? colEdges[col + 1] : x0 + 1;
+
+			// Shape matching: same sub-cell edges as the row kernels
+			if (glyphs) {
+				for (int sy = 0; sy < ASCII_GLYPH_MASK_ROWS; ++sy) {
+					int subY0 = y0 + sy * (y1 - y0) / ASCII_GLYPH_MASK_ROWS;
+					int subY1 = y0 + (sy + 1) * (y1 - y0) / ASCII_GLYPH_MASK_ROWS;
+					for (int sx = 0; sx < ASCII_GLYPH_MASK_COLS; ++sx) {
+						int subX0 = x0 + sx * (x1 - x0) / ASCII_GLYPH_MASK_COLS;
+						int subX1 = x0 + (sx + 1) * (x1 - x0) / ASCII_GLYPH_MASK_COLS;
+						int i = sy * ASCII_GLYPH_MASK_COLS + sx;
+						integral.SumRect(subX0, subY0, subX1, subY1, subSums.r[i], subSums.g[i], subSums.b[i]);
+						subSums.count[i] = static_cast<uint32_t>((subX1 - subX0) * (subY1 - subY0));
+						subSums.scale[i] = AsciiSubCellScale(subSums.count[i]);
+					}
+				}
+				outRow[col] = MakeAsciiShapeCell(subSums, *glyphs, palette);
+				continue;
+			}
+
+			uint32_t sumR, sumG, sumB;
+			integral.SumRect(x0, y0, x1, y1, sumR, sumG, sumB);
+			uint32_t count = static_cast<uint32_t>((x1 - x0) * (y1 - y0));
+			outRow[col] = MakeAsciiCell(sumR, sumG, sumB, count, palette);
+		}
+	}
+}
+
+void ConvertIntegralToAscii(const AsciiIntegralImage& integral,
+	const AsciiRect& region, const AsciiGeometry& geometry,
+	std::vector<AsciiCell>& asciiOut,
+	int& outCols, int& outRows)
+{
+	ConvertIntegralToAscii(integral, region, static_cast<double>(geometry.blockWidth),
+		static_cast<double>(geometry.blockHeight), asciiOut, outCols, outRows);
+}
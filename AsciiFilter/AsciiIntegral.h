@@ -0,0 +1,59 @@
+﻿// AsciiIntegral.h : Summed-area table (integral image) over a BGRA frame.
+//
+// Built once per captured frame, after which the average color of any
+// rectangle costs four lookups per channel. That makes block size, offset
+// and zoom changes free: several output resolutions can be produced from
+// one frame without walking the pixels again.
+
+#pragma once
+#include "AsciiCore.h"
+
+// Largest rectangle (in pixels) whose channel sums cannot exceed 32 bits
+const uint32_t ASCII_INTEGRAL_MAX_AREA = 0xFFFFFFFFu / 255u;
+
+class AsciiIntegralImage
+{
+public:
+    // Build the table from a BGRA frame. rowPitch is in bytes.
+    void Build(const uint8_t* frame, int width, int height, int rowPitch);
+    void Build(const std::vector<uint8_t>& frameData, int width, int height);
+    // BGRA8 only; other formats leave the table empty
+    void Build(const AsciiImageView& image);
+
+    int GetWidth() const { return m_width; }
+    int GetHeight() const { return m_height; }
+    bool IsEmpty() const { return m_width == 0 || m_height == 0; }
+
+    // Channel sums over [x0, x1) x [y0, y1). The rectangle must lie inside
+    // the frame.
+    //
+    // Entries are 32-bit and wrap on large frames; the four-corner
+    // difference is still exact modulo 2^32, so any rectangle up to
+    // ASCII_INTEGRAL_MAX_AREA pixels returns the true sum at any frame size.
+    void SumRect(int x0, int y0, int x1, int y1,
+        uint32_t& sumR, uint32_t& sumG, uint32_t& sumB) const;
+
+private:
+    int m_width = 0;
+    int m_height = 0;
+    // (width + 1) x (height + 1) entries of { B, G, R }, with a zero
+    // first row and column so lookups need no edge checks
+    std::vector<uint32_t> m_sums;
+};
+
+// Same output as ConvertRegionToAscii for the same frame and geometry,
+// but reading from the integral image. Intensity and shape glyphs only:
+// edge directions need pixel differences that the sums don't keep, so in
+// AsciiGlyphMode::Edge the cells get intensity glyphs.
+void ConvertIntegralToAscii(const AsciiIntegralImage& integral,
+    const AsciiRect& region, const AsciiGeometry& geometry,
+    std::vector<AsciiCell>& asciiOut,
+    int& outCols, int& outRows);
+
+// Fractional block sizes for interactive zoom. Cell edges are placed at
+// region.left + floor(col * blockWidth), so neighbouring cells never
+// overlap or leave gaps.
+void ConvertIntegralToAscii(const AsciiIntegralImage& integral,
+    const AsciiRect& region, double blockWidth, double blockHeight,
+    std::vector<AsciiCell>& asciiOut,
+    int& outCols, int& outRows);
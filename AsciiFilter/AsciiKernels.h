@@ -0,0 +1,558 @@
+﻿// AsciiKernels.h : Internal interface between ConvertRegionToAscii and
+// the per-instruction-set block averaging kernels.
+//
+// The SIMD kernels live in their own translation units that are compiled
+// with -msse4.1 / -mavx2. Helpers in this header are static so every TU
+// gets its own copy and no AVX2 code can leak into the scalar path through
+// a shared inline definition.
+
+#pragma once
+#include "AsciiCore.h"
+#include "AsciiGlyphs.h"
+
+#include <type_traits>
+#include <utility>
+
+// Everything a kernel needs to convert one row of cells
+struct AsciiBlockJob
+{
+    const uint8_t* frame;      // Pixels, the Y plane for YUV formats
+    int rowPitch;              // Bytes per frame row
+    AsciiPixelFormat format;
+    const uint8_t* chroma[2];  // Chroma planes of the YUV formats, see AsciiImageView
+    int chromaPitch;
+    AsciiRect region;          // Region being converted, in frame pixels
+    int blockWidth;
+    int blockHeight;
+    int outCols;
+    const wchar_t* palette;    // 256 entry intensity -> character table
+    const AsciiGlyphSet* glyphs; // Glyphs to match in AsciiGlyphMode::Shape, else null
+};
+
+typedef void (*AsciiRowKernel)(const AsciiBlockJob& job, int row, AsciiCell* outRow);
+
+// Channel sums of one block. The sums of neighbouring blocks add up to the
+// sums of their union, which is how AsciiPyramid builds coarse levels.
+struct AsciiBlockSums
+{
+    uint32_t r, g, b;
+    uint32_t count;
+};
+
+// Same as a row kernel, but writes the raw sums of every block of the row
+// instead of finished cells (BGRA8 only)
+typedef void (*AsciiSumKernel)(const AsciiBlockJob& job, int row, AsciiBlockSums* outRow);
+
+// Block sizes that get their own template instantiation in every kernel
+// file. Keep in sync with the comment on IsAsciiGeometrySpecialized.
+#define ASCII_FOR_EACH_FIXED_GEOMETRY(X) \
+    X(4, 8)                              \
+    X(6, 12)                             \
+    X(8, 16)                             \
+    X(10, 20)
+
+// Each kernel file returns its specialized row kernel for the geometry,
+// or its generic one when there is none.
+AsciiRowKernel GetRowKernelScalar(int blockWidth, int blockHeight);
+#ifdef ASCII_HAVE_X86_KERNELS
+AsciiRowKernel GetRowKernelSSE41(int blockWidth, int blockHeight);
+AsciiRowKernel GetRowKernelAVX2(int blockWidth, int blockHeight);
+#endif
+
+AsciiSumKernel GetSumKernelScalar(int blockWidth, int blockHeight);
+#ifdef ASCII_HAVE_X86_KERNELS
+AsciiSumKernel GetSumKernelSSE41(int blockWidth, int blockHeight);
+AsciiSumKernel GetSumKernelAVX2(int blockWidth, int blockHeight);
+#endif
+
+// Sum kernel for the active instruction set and geometry
+AsciiSumKernel GetAsciiSumKernel(const AsciiGeometry& geometry);
+
+// 64-bit hash of a block of BGRA pixels, see AsciiTileCache. Every kernel
+// file has one and they all return the same value for the same pixels.
+typedef uint64_t (*AsciiBlockHasher)(const uint8_t* pixel, int rowPitch, int width, int height);
+
+uint64_t HashBlockScalar(const uint8_t* pixel, int rowPitch, int width, int height);
+#ifdef ASCII_HAVE_X86_KERNELS
+uint64_t HashBlockSSE41(const uint8_t* pixel, int rowPitch, int width, int height);
+uint64_t HashBlockAVX2(const uint8_t* pixel, int rowPitch, int width, int height);
+#endif
+
+// Block hasher for the active instruction set
+AsciiBlockHasher GetAsciiBlockHasher();
+
+// Index of the mask (ASCII_GLYPH_MASK_SIZE bytes each) with the smallest
+// sum of absolute differences to target; the first one wins ties. Every
+// kernel file has one and they all return the same index.
+typedef int (*AsciiGlyphSearch)(const uint8_t* masks, int glyphCount, const uint8_t* target);
+
+int SearchGlyphsScalar(const uint8_t* masks, int glyphCount, const uint8_t* target);
+#ifdef ASCII_HAVE_X86_KERNELS
+int SearchGlyphsSSE41(const uint8_t* masks, int glyphCount, const uint8_t* target);
+int SearchGlyphsAVX2(const uint8_t* masks, int glyphCount, const uint8_t* target);
+#endif
+
+// Glyph search for the active instruction set
+AsciiGlyphSearch GetAsciiGlyphSearch();
+
+// Row kernels for AsciiGlyphMode::Shape, see AsciiGlyphs.cpp
+AsciiRowKernel GetShapeRowKernel(int blockWidth, int blockHeight);
+
+// Row kernels for AsciiGlyphMode::Edge: block averaging with the gradient
+// sums of SumEdgesScalar taken from the same loads
+AsciiRowKernel GetEdgeRowKernelScalar(int blockWidth, int blockHeight);
+#ifdef ASCII_HAVE_X86_KERNELS
+AsciiRowKernel GetEdgeRowKernelSSE41(int blockWidth, int blockHeight);
+AsciiRowKernel GetEdgeRowKernelAVX2(int blockWidth, int blockHeight);
+#endif
+
+// Row kernels for the pixel formats other than BGRA8, see AsciiFormats.cpp
+AsciiRowKernel GetFormatRowKernel(AsciiPixelFormat format, AsciiGlyphMode mode);
+
+// Hash of the pixels of one block in any format, for the formats the
+// block hashers above (BGRA only) don't cover
+uint64_t HashFormatBlock(const AsciiBlockJob& job, int startX, int startY, int endX, int endY);
+
+// Writes count BGRA pixels of one glyph row: every channel is
+// (bg * (256 - a) + fg * a) >> 8 with a = coverage + (coverage >> 7), which
+// is exact at coverage 0 and 255. fg and bg are packed BGRA pixels. Every
+// kernel file has one and they all write the same pixels.
+typedef void (*AsciiGlyphBlender)(uint8_t* dst, const uint8_t* coverage, int count, uint32_t fg, uint32_t bg);
+
+void BlendGlyphRowScalar(uint8_t* dst, const uint8_t* coverage, int count, uint32_t fg, uint32_t bg);
+#ifdef ASCII_HAVE_X86_KERNELS
+void BlendGlyphRowSSE41(uint8_t* dst, const uint8_t* coverage, int count, uint32_t fg, uint32_t bg);
+void BlendGlyphRowAVX2(uint8_t* dst, const uint8_t* coverage, int count, uint32_t fg, uint32_t bg);
+#endif
+
+// Glyph blender for the active instruction set
+AsciiGlyphBlender GetAsciiGlyphBlender();
+
+// Sets changed[i] to 1 where previous[i] != next[i], else 0, and returns
+// the number of changed cells. Padding bytes of AsciiCell are ignored.
+// Every kernel file has one and they all return the same flags.
+typedef int (*AsciiCellComparer)(const AsciiCell* previous, const AsciiCell* next, int count, uint8_t* changed);
+
+int CompareCellsScalar(const AsciiCell* previous, const AsciiCell* next, int count, uint8_t* changed);
+#ifdef ASCII_HAVE_X86_KERNELS
+int CompareCellsSSE41(const AsciiCell* previous, const AsciiCell* next, int count, uint8_t* changed);
+int CompareCellsAVX2(const AsciiCell* previous, const AsciiCell* next, int count, uint8_t* changed);
+#endif
+
+// Cell comparer for the active instruction set
+AsciiCellComparer GetAsciiCellComparer();
+
+// Calls f(0), f(1), ... f(N - 1) with the loop fully unrolled
+template<typename F, int... Is>
+static inline void AsciiUnrollImpl(F& f, std::integer_sequence<int, Is...>)
+{
+    (f(Is), ...);
+}
+
+template<int N, typename F>
+static inline void AsciiUnroll(F f)
+{
+    AsciiUnrollImpl(f, std::make_integer_sequence<int, N>{});
+}
+
+// Keeps the next loop rolled, for bodies whose full unroll makes GCC
+// spill the accumulators
+#if defined(__GNUC__)
+#define ASCII_NO_UNROLL _Pragma("GCC unroll 1")
+#else
+#define ASCII_NO_UNROLL
+#endif
+
+// Clamps the region to the frame and fills in a job for it. Returns false
+// (with outCols = outRows = 0) when there is nothing to convert.
+bool PrepareAsciiBlockJob(const AsciiImageView& image,
+    const AsciiRect& region, const AsciiGeometry& geometry,
+    AsciiBlockJob& job, int& outCols, int& outRows);
+
+// Row kernel for the active instruction set, glyph mode, geometry and
+// pixel format
+AsciiRowKernel GetAsciiRowKernel(const AsciiGeometry& geometry, AsciiPixelFormat format);
+
+// Per cell flags for partial updates
+static const uint8_t ASCII_CELL_CLEAN = 0;     // Not converted this frame
+static const uint8_t ASCII_CELL_CONVERTED = 1; // Converted, same cell as before
+static const uint8_t ASCII_CELL_CHANGED = 2;   // Converted, new cell
+
+// Converts every run of cells in one row whose flag is not CLEAN, with the
+// row kernel on a job shifted to the start of the run. Converted cells are
+// compared with the old ones in cells and their flag becomes CONVERTED or
+// CHANGED; forceChanged marks every converted cell as CHANGED.
+void ConvertDirtyCells(const AsciiBlockJob& job, AsciiRowKernel rowKernel, int row,
+    uint8_t* flags, AsciiCell* cells, bool forceChanged);
+
+// Sets the flag of every cell overlapping one of the damage rectangles
+// (frame coordinates) to mark. flags holds job.outCols x rows cells.
+void MarkAsciiDamage(const AsciiBlockJob& job, int rows, const std::vector<AsciiRect>& damage,
+    uint8_t* flags, uint8_t mark);
+
+// The intensity -> character table, initialized on first use
+const wchar_t* GetAsciiPalette();
+
+// Worker pool configured by SetAsciiThreadCount, or null when single threaded
+class AsciiThreadPool;
+AsciiThreadPool* GetAsciiThreadPool();
+
+// Fixed-point Rec.601 weights, scaled by 65536 (they add up to exactly 65536)
+static const uint32_t ASCII_LUMA_R = 19595;
+static const uint32_t ASCII_LUMA_G = 38470;
+static const uint32_t ASCII_LUMA_B = 7471;
+
+static inline uint8_t AsciiLuminance(uint32_t r, uint32_t g, uint32_t b)
+{
+    return static_cast<uint8_t>((ASCII_LUMA_R * r + ASCII_LUMA_G * g + ASCII_LUMA_B * b) >> 16);
+}
+
+static inline uint8_t AsciiClampByte(int v)
+{
+    return static_cast<uint8_t>(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+// BT.601 limited range YUV to full range RGB, in fixed point scaled by 256
+static inline void AsciiYuvToRgb(int y, int u, int v, uint8_t& r, uint8_t& g, uint8_t& b)
+{
+    int c = 298 * (y - 16) + 128;
+    int d = u - 128, e = v - 128;
+    r = AsciiClampByte((c + 409 * e) >> 8);
+    g = AsciiClampByte((c - 100 * d - 208 * e) >> 8);
+    b = AsciiClampByte((c + 516 * d) >> 8);
+}
+
+// Full range luminance of a limited range Y sample, i.e. the gray that
+// AsciiYuvToRgb gives it without chroma
+static inline uint8_t AsciiYToLuminance(int y)
+{
+    return AsciiClampByte((298 * (y - 16) + 128) >> 8);
+}
+
+// Turns the channel sums of one block into the final cell. Shared by every
+// kernel so they all produce bit-identical output.
+static inline AsciiCell MakeAsciiCell(uint32_t sumR, uint32_t sumG, uint32_t sumB, uint32_t count,
+    const wchar_t* palette)
+{
+    uint8_t avgR = static_cast<uint8_t>(sumR / count);
+    uint8_t avgG = static_cast<uint8_t>(sumG / count);
+    uint8_t avgB = static_cast<uint8_t>(sumB / count);
+
+    uint8_t luminance = AsciiLuminance(avgR, avgG, avgB);
+
+    // Text color as a dynamic grayscale based on luminance
+    uint8_t textGray = (luminance > 128) ? luminance - 80 : luminance + 80; // Ensure contrast
+
+    return {
+        palette[luminance],                      // Character
+        AsciiRgb(textGray, textGray, textGray),  // Dynamic grayscale text color
+        AsciiRgb(avgR, avgG, avgB)               // Background color
+    };
+}
+
+// The BGRA kernels are templates on what they write per block: a finished
+// cell for the row kernels, the raw sums for the sum kernels
+static inline void AsciiStoreBlock(AsciiCell& out, uint32_t sumR, uint32_t sumG, uint32_t sumB, uint32_t count,
+    const wchar_t* palette)
+{
+    out = MakeAsciiCell(sumR, sumG, sumB, count, palette);
+}
+
+static inline void AsciiStoreBlock(AsciiBlockSums& out, uint32_t sumR, uint32_t sumG, uint32_t sumB, uint32_t count,
+    const wchar_t*)
+{
+    out = { sumR, sumG, sumB, count };
+}
+
+// Cell of a YUV block from its average samples. The luminance comes from
+// Y directly; the colors match MakeAsciiCell on the converted pixels.
+static inline AsciiCell MakeAsciiYuvCell(uint32_t avgY, uint32_t avgU, uint32_t avgV, const wchar_t* palette)
+{
+    uint8_t luminance = AsciiYToLuminance(static_cast<int>(avgY));
+    uint8_t textGray = (luminance > 128) ? luminance - 80 : luminance + 80;
+    uint8_t r, g, b;
+    AsciiYuvToRgb(static_cast<int>(avgY), static_cast<int>(avgU), static_cast<int>(avgV), r, g, b);
+    return { palette[luminance], AsciiRgb(textGray, textGray, textGray), AsciiRgb(r, g, b) };
+}
+
+// Channel sums of the 4x8 sub-cells of one block, row major. Sub-cell
+// (sx, sy) of a width x height block covers [sx * width / 4,
+// (sx + 1) * width / 4) x [sy * height / 8, (sy + 1) * height / 8), so
+// blocks smaller than the mask leave some sub-cells empty.
+struct AsciiSubCellSums
+{
+    uint32_t r[ASCII_GLYPH_MASK_SIZE];
+    uint32_t g[ASCII_GLYPH_MASK_SIZE];
+    uint32_t b[ASCII_GLYPH_MASK_SIZE];
+    uint32_t count[ASCII_GLYPH_MASK_SIZE];
+    uint32_t scale[ASCII_GLYPH_MASK_SIZE]; // AsciiSubCellScale(count)
+};
+
+// 2^24 / count rounded up, so (77 r + 150 g + 29 b) * scale >> 32 is the
+// average luminance of a sub-cell without a division. 0 for empty
+// sub-cells. Sub-cells of up to 65793 pixels stay within 32 bits.
+static inline constexpr uint32_t AsciiSubCellScale(uint32_t count)
+{
+    return count ? ((1u << 24) + count - 1) / count : 0;
+}
+
+// Same colors as MakeAsciiCell, with the character matched by shape. The
+// target is the ink the cell should show: text is drawn lighter than the
+// background in dark blocks and darker in bright ones, so bright sub-cells
+// want ink in the first case and dark sub-cells in the second.
+static inline AsciiCell MakeAsciiShapeCell(const AsciiSubCellSums& sums, const AsciiGlyphSet& glyphs,
+    const wchar_t* palette)
+{
+    uint32_t sumR = 0, sumG = 0, sumB = 0, count = 0;
+    bool hasEmpty = false;
+    for (int i = 0; i < ASCII_GLYPH_MASK_SIZE; ++i) {
+        sumR += sums.r[i];
+        sumG += sums.g[i];
+        sumB += sums.b[i];
+        count += sums.count[i];
+        hasEmpty |= sums.count[i] == 0;
+    }
+    AsciiCell cell = MakeAsciiCell(sumR, sumG, sumB, count, palette);
+
+    uint8_t blockLuma = AsciiLuminance(sumR / count, sumG / count, sumB / count);
+    uint8_t inkFlip = blockLuma > 128 ? 255 : 0;
+
+    uint8_t target[ASCII_GLYPH_MASK_SIZE];
+    for (int i = 0; i < ASCII_GLYPH_MASK_SIZE; ++i) {
+        uint32_t lumaSum = 77 * sums.r[i] + 150 * sums.g[i] + 29 * sums.b[i];
+        uint32_t luma = static_cast<uint32_t>((static_cast<uint64_t>(lumaSum) * sums.scale[i]) >> 32);
+        target[i] = static_cast<uint8_t>(luma < 255 ? luma : 255) ^ inkFlip;
+    }
+    if (hasEmpty) {
+        for (int i = 0; i < ASCII_GLYPH_MASK_SIZE; ++i) {
+            if (sums.count[i] == 0)
+                target[i] = blockLuma ^ inkFlip;
+        }
+    }
+    cell.ch = glyphs.Match(target);
+    return cell;
+}
+
+// Gradient activity of one block for AsciiGlyphMode::Edge: the
+// |difference| over B, G and R of neighbour pairs inside the block, summed
+// by direction. Across pairs are high across vertical edges, down pairs
+// across horizontal ones; in a 2x2 window a b / c d the diagonals are a d
+// (downRight) and b c (downLeft).
+//
+// Only half of the pairs are taken. Every row is cut into groups of two
+// pixels, and the groups alternate like a checkerboard between
+// horizontal (across and downRight pairs starting in the group) and
+// vertical (down and downLeft pairs ending in it, from the row above). A
+// line or edge still meets both kinds, and the SIMD kernels get every
+// direction out of two PSADBW per row.
+struct AsciiEdgeSums
+{
+    uint64_t across;
+    uint64_t down;
+    uint64_t downRight;
+    uint64_t downLeft;
+    uint64_t downBottom; // The part of down from the bottom quarter of rows
+};
+
+// Pixel x of row y is in a vertical group
+static inline bool IsAsciiEdgeVertical(int x, int y)
+{
+    return (((x >> 1) + y) & 1) != 0;
+}
+
+// Number of pairs of each direction in a width x height block
+static inline void CountAsciiEdgePairs(int width, int height, int64_t& across, int64_t& down,
+    int64_t& downRight, int64_t& downLeft)
+{
+    // Horizontal pixels among the first n of an even row
+    auto horizontal = [](int64_t n) { return (n >> 2) * 2 + ((n & 3) < 2 ? (n & 3) : 2); };
+    int64_t evenRows = (height + 1) / 2, oddRows = height / 2;
+    int64_t pairStarts = width - 1;
+    across = evenRows * horizontal(pairStarts) + oddRows * (pairStarts - horizontal(pairStarts));
+    down = (evenRows - 1) * (width - horizontal(width)) + oddRows * horizontal(width);
+    downRight = (evenRows - 1) * horizontal(pairStarts) + oddRows * (pairStarts - horizontal(pairStarts));
+    downLeft = (evenRows - 1) * (pairStarts - horizontal(pairStarts)) + oddRows * horizontal(pairStarts);
+}
+
+// Per-pair weights of the four direction sums for one block size. A sum
+// times its weight, shifted down by ASCII_EDGE_WEIGHT_SHIFT, is the mean
+// activity of its pairs with 12 fraction bits, times 181 / 256 for the
+// diagonals, which are sqrt(2) pixels apart. All zero when a direction
+// has no pairs in the block.
+struct AsciiEdgeWeights
+{
+    int64_t across;
+    int64_t down;
+    int64_t downRight;
+    int64_t downLeft;
+};
+
+static const int ASCII_EDGE_WEIGHT_SHIFT = 16;
+
+static inline void GetAsciiEdgeWeights(int width, int height, AsciiEdgeWeights& weights)
+{
+    int64_t across, down, downRight, downLeft;
+    CountAsciiEdgePairs(width, height, across, down, downRight, downLeft);
+    weights = {};
+    if (across <= 0 || down <= 0 || downRight <= 0 || downLeft <= 0)
+        return;
+    const int64_t straight = int64_t(256 * 16) << ASCII_EDGE_WEIGHT_SHIFT;
+    const int64_t diagonal = int64_t(181 * 16) << ASCII_EDGE_WEIGHT_SHIFT;
+    weights.across = straight / across;
+    weights.down = straight / down;
+    weights.downRight = diagonal / downRight;
+    weights.downLeft = diagonal / downLeft;
+}
+
+static inline uint32_t AsciiPixelDistance(const uint8_t* a, const uint8_t* b)
+{
+    int db = a[0] - b[0], dg = a[1] - b[1], dr = a[2] - b[2];
+    return static_cast<uint32_t>((db < 0 ? -db : db) + (dg < 0 ? -dg : dg) + (dr < 0 ? -dr : dr));
+}
+
+// Reference gradient sums of a block of BGRA pixels
+static inline void SumEdgesScalar(const uint8_t* pixel, int rowPitch, int width, int height,
+    AsciiEdgeSums& edges)
+{
+    edges = {};
+    int bottom = height - height / 4;
+    for (int y = 0; y < height; ++y) {
+        const uint8_t* p = pixel + static_cast<size_t>(y) * rowPitch;
+        const uint8_t* above = p - rowPitch;
+        uint64_t down = 0;
+        for (int x = 0; x < width; ++x) {
+            bool last = x + 1 == width;
+            if (!IsAsciiEdgeVertical(x, y)) {
+                if (!last)
+                    edges.across += AsciiPixelDistance(p + x * 4, p + x * 4 + 4);
+                if (!last && y > 0)
+                    edges.downRight += AsciiPixelDistance(above + x * 4, p + x * 4 + 4);
+            }
+            else if (y > 0) {
+                down += AsciiPixelDistance(above + x * 4, p + x * 4);
+                if (!last)
+                    edges.downLeft += AsciiPixelDistance(above + x * 4 + 4, p + x * 4);
+            }
+        }
+        edges.down += down;
+        edges.downBottom += y >= bottom ? down : 0;
+    }
+}
+
+// Weakest edge that gets a directional glyph: 2r below, in average
+// |difference| per pixel pair summed over B, G and R
+static const int ASCII_EDGE_MIN_STRENGTH = 24;
+
+// Same cell as MakeAsciiCell, with a directional glyph when the block is
+// crossed by one strong edge.
+//
+// The mean activity of the pairs in direction d behaves like
+// m - r cos(2 (d - theta)): it is lowest along an edge at angle theta.
+// The four directions give 2r cos(2 theta) and 2r sin(2 theta). Blocks
+// with r >= m / 4 count as a single edge; texture and noise are active in
+// every direction and keep the intensity glyph. The glyph is the one
+// whose stroke is closest to theta when drawn in a 1:2 cell, where the
+// slashes run corner to corner at atan(2) from the horizontal.
+static inline AsciiCell MakeAsciiEdgeCell(uint32_t sumR, uint32_t sumG, uint32_t sumB, uint32_t count,
+    const AsciiEdgeSums& edges, const AsciiEdgeWeights& weights, const wchar_t* palette)
+{
+    AsciiCell cell = MakeAsciiCell(sumR, sumG, sumB, count, palette);
+
+    // Means below 765 << 12 whatever the block size, so the squares
+    // below fit in 64 bits
+    int64_t across = static_cast<int64_t>(edges.across) * weights.across >> ASCII_EDGE_WEIGHT_SHIFT;
+    int64_t down = static_cast<int64_t>(edges.down) * weights.down >> ASCII_EDGE_WEIGHT_SHIFT;
+    int64_t downRight = static_cast<int64_t>(edges.downRight) * weights.downRight >> ASCII_EDGE_WEIGHT_SHIFT;
+    int64_t downLeft = static_cast<int64_t>(edges.downLeft) * weights.downLeft >> ASCII_EDGE_WEIGHT_SHIFT;
+
+    int64_t x = down - across;        // 2r cos(2 theta)
+    int64_t y = downLeft - downRight; // 2r sin(2 theta)
+    int64_t strength = x * x + y * y; // (2r)^2
+    int64_t total = across + down + downRight + downLeft; // 4m
+    const int64_t minStrength = int64_t(ASCII_EDGE_MIN_STRENGTH) << 12;
+    if (strength < minStrength * minStrength || strength * 64 < total * total)
+        return cell;
+
+    // Bin edges halfway between the strokes: '-' up to |2 theta| = atan(2),
+    // '|' from |2 theta| = 180 - atan(1 / 2)
+    int64_t ay = y < 0 ? -y : y;
+    if (x > 0 && ay < 2 * x)
+        cell.ch = edges.downBottom * 2 > edges.down ? L'_' : L'-';
+    else if (x < 0 && 2 * ay < -x)
+        cell.ch = L'|';
+    else
+        cell.ch = y > 0 ? L'\\' : L'/';
+    return cell;
+}
+
+// Channel sums of a span of BGRA pixels, one byte at a time
+static inline void SumBlockScalar(const uint8_t* pixel, int rowPitch, int width, int height,
+    uint32_t& sumR, uint32_t& sumG, uint32_t& sumB)
+{
+    for (int y = 0; y < height; ++y) {
+        const uint8_t* p = pixel + static_cast<size_t>(y) * rowPitch;
+        for (int x = 0; x < width; ++x) {
+            sumB += p[0];
+            sumG += p[1];
+            sumR += p[2];
+            p += 4;
+        }
+    }
+}
+
+// Block hash layout: every block row is split into 32 byte stripes (the
+// last one zero padded), each stripe feeds one 64-bit word to each of four
+// lanes. A lane computes acc += word + lo32(word ^ key) * hi32(word ^ key)
+// where the key advances by HASH_KEY_STEP per stripe, so moving pixels
+// around changes the hash. Everything maps onto PMULUDQ.
+static const uint64_t ASCII_HASH_KEYS[4] = {
+    0xBE4BA423396CFEB8ull, 0x1CAD21F72C81017Cull, 0xDB979083E96DD4DEull, 0x1F67B3B7A4A44072ull
+};
+static const uint64_t ASCII_HASH_KEY_STEP = 0x9E3779B185EBCA87ull;
+
+static inline uint64_t AsciiHashRotate(uint64_t v, int bits)
+{
+    return (v << bits) | (v >> (64 - bits));
+}
+
+// Folds the four lanes and the block size into the final hash
+static inline uint64_t FinishBlockHash(const uint64_t acc[4], int width, int height)
+{
+    uint64_t h = acc[0] ^ AsciiHashRotate(acc[1], 17) ^ AsciiHashRotate(acc[2], 31) ^ AsciiHashRotate(acc[3], 47);
+    h ^= (static_cast<uint64_t>(width) << 32) | static_cast<uint32_t>(height);
+    h ^= h >> 33;
+    h *= 0xC2B2AE3D27D4EB4Full;
+    h ^= h >> 29;
+    return h;
+}
+
+// Pixel extent of one cell, clipped to the region
+static inline void GetBlockBounds(const AsciiBlockJob& job, int row, int col,
+    int& startX, int& startY, int& endX, int& endY)
+{
+    startX = job.region.left + col * job.blockWidth;
+    startY = job.region.top + row * job.blockHeight;
+    endX = startX + job.blockWidth < job.region.right ? startX + job.blockWidth : job.region.right;
+    endY = startY + job.blockHeight < job.region.bottom ? startY + job.blockHeight : job.region.bottom;
+}
+
+// One pixel of a glyph row, see AsciiGlyphBlender
+static inline void AsciiBlendPixel(uint8_t* dst, uint8_t coverage, uint32_t fg, uint32_t bg)
+{
+    uint32_t a = coverage + (coverage >> 7);
+    for (int c = 0; c < 4; ++c) {
+        uint32_t f = (fg >> (c * 8)) & 0xFF;
+        uint32_t b = (bg >> (c * 8)) & 0xFF;
+        dst[c] = static_cast<uint8_t>((b * (256 - a) + f * a) >> 8);
+    }
+}
+
+// The SIMD cell comparers treat cells as 12 raw bytes. Where wchar_t is
+// 16-bit, bytes 2 and 3 are padding and must not count as a change.
+static_assert(sizeof(AsciiCell) == 12 && offsetof(AsciiCell, textColor) == 4, "unexpected AsciiCell layout");
+
+static inline bool IsAsciiCellPadding(int byteOffset)
+{
+    int b = byteOffset % static_cast<int>(sizeof(AsciiCell));
+    return b >= static_cast<int>(sizeof(wchar_t)) && b < 4;
+}
@@ -0,0 +1,666 @@
+﻿#include "AsciiKernels.h"
+
+#include <immintrin.h>
+#include <cstring>
+
+// AVX2 block averaging, eight BGRA pixels per step.
+//
+// Same shuffle + PSADBW scheme as the SSE4.1 kernel, applied to both 128-bit
+// lanes at once. An 8 pixel wide block row is a single load. Leftover pixels
+// go through one 4 or 2 pixel step (the unused shuffle indices read zeros)
+// and then the scalar tail.
+
+struct SumsAVX2
+{
+	__m256i bg;
+	__m256i r;
+	uint32_t tailR, tailG, tailB;
+};
+
+static inline void AccumulateAVX2(SumsAVX2& acc, __m256i v)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i shufBG = _mm256_setr_epi8(
+		0, 4, 8, 12, -1, -1, -1, -1, 1, 5, 9, 13, -1, -1, -1, -1,
+		0, 4, 8, 12, -1, -1, -1, -1, 1, 5, 9, 13, -1, -1, -1, -1);
+	const __m256i shufR = _mm256_setr_epi8(
+		2, 6, 10, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		2, 6, 10, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	acc.bg = _mm256_add_epi64(acc.bg, _mm256_sad_epu8(_mm256_shuffle_epi8(v, shufBG), zero));
+	acc.r = _mm256_add_epi64(acc.r, _mm256_sad_epu8(_mm256_shuffle_epi8(v, shufR), zero));
+}
+
+static inline __m256i Load8(const uint8_t* pixel)
+{
+	return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pixel));
+}
+
+static inline __m256i Load4(const uint8_t* pixel)
+{
+	return _mm256_zextsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pixel)));
+}
+
+static inline __m256i Load2(const uint8_t* pixel)
+{
+	return _mm256_zextsi128_si256(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pixel)));
+}
+
+static inline void AccumulatePixel(SumsAVX2& acc, const uint8_t* pixel)
+{
+	acc.tailB += pixel[0];
+	acc.tailG += pixel[1];
+	acc.tailR += pixel[2];
+}
+
+static inline void InitSums(SumsAVX2& acc)
+{
+	acc.bg = _mm256_setzero_si256();
+	acc.r = _mm256_setzero_si256();
+	acc.tailR = acc.tailG = acc.tailB = 0;
+}
+
+template<typename Out>
+static inline void FinishBlock(const SumsAVX2& acc, uint32_t count, const wchar_t* palette, Out& out)
+{
+	// Fold the upper lane onto the lower one
+	__m128i bg = _mm_add_epi64(_mm256_castsi256_si128(acc.bg), _mm256_extracti128_si256(acc.bg, 1));
+	__m128i r = _mm_add_epi64(_mm256_castsi256_si128(acc.r), _mm256_extracti128_si256(acc.r, 1));
+	uint32_t sumB = acc.tailB + static_cast<uint32_t>(_mm_cvtsi128_si32(bg));
+	uint32_t sumG = acc.tailG + static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_unpackhi_epi64(bg, bg)));
+	uint32_t sumR = acc.tailR + static_cast<uint32_t>(_mm_cvtsi128_si32(r));
+	AsciiStoreBlock(out, sumR, sumG, sumB, count, palette);
+}
+
+// Any number of pixels in one block row
+static inline void AccumulateSpanAVX2(SumsAVX2& acc, const uint8_t* pixel, int width)
+{
+	int x = 0;
+	for (; x + 8 <= width; x += 8, pixel += 32)
+		AccumulateAVX2(acc, Load8(pixel));
+	if (x + 4 <= width) {
+		AccumulateAVX2(acc, Load4(pixel));
+		x += 4;
+		pixel += 16;
+	}
+	for (; x < width; ++x, pixel += 4)
+		AccumulatePixel(acc, pixel);
+}
+
+template<typename Out>
+static void ConvertRowAVX2(const AsciiBlockJob& job, int row, Out* outRow)
+{
+	for (int col = 0; col < job.outCols; ++col) {
+		int startX, startY, endX, endY;
+		GetBlockBounds(job, row, col, startX, startY, endX, endY);
+
+		SumsAVX2 acc;
+		InitSums(acc);
+		const uint8_t* pixel = job.frame + static_cast<size_t>(startY) * job.rowPitch + startX * 4;
+		for (int y = startY; y < endY; ++y, pixel += job.rowPitch)
+			AccumulateSpanAVX2(acc, pixel, endX - startX);
+
+		uint32_t count = static_cast<uint32_t>((endX - startX) * (endY - startY));
+		if (count > 0)
+			FinishBlock(acc, count, job.palette, outRow[col]);
+	}
+}
+
+// One block row of exactly W pixels, fully unrolled
+template<int W>
+static inline void AccumulateRowAVX2(SumsAVX2& acc, const uint8_t* pixel)
+{
+	AsciiUnroll<W / 8>([&](int i) {
+		AccumulateAVX2(acc, Load8(pixel + i * 32));
+	});
+	const uint8_t* tail = pixel + (W / 8) * 32;
+	if constexpr (W % 8 >= 4) {
+		AccumulateAVX2(acc, Load4(tail));
+		tail += 16;
+	}
+	if constexpr (W % 4 >= 2) {
+		AccumulateAVX2(acc, Load2(tail));
+		tail += 8;
+	}
+	if constexpr (W % 2 == 1)
+		AccumulatePixel(acc, tail);
+}
+
+template<int W, int H, typename Out>
+static void ConvertRowAVX2Fixed(const AsciiBlockJob& job, int row, Out* outRow)
+{
+	for (int col = 0; col < job.outCols; ++col) {
+		int startX, startY, endX, endY;
+		GetBlockBounds(job, row, col, startX, startY, endX, endY);
+
+		SumsAVX2 acc;
+		InitSums(acc);
+		const uint8_t* pixel = job.frame + static_cast<size_t>(startY) * job.rowPitch + startX * 4;
+		if (endX - startX == W && endY - startY == H) {
+			AsciiUnroll<H>([&](int y) {
+				AccumulateRowAVX2<W>(acc, pixel + static_cast<size_t>(y) * job.rowPitch);
+			});
+			FinishBlock(acc, W * H, job.palette, outRow[col]);
+			continue;
+		}
+
+		// Clipped block on the right or bottom edge
+		for (int y = startY; y < endY; ++y, pixel += job.rowPitch)
+			AccumulateSpanAVX2(acc, pixel, endX - startX);
+		uint32_t count = static_cast<uint32_t>((endX - startX) * (endY - startY));
+		if (count > 0)
+			FinishBlock(acc, count, job.palette, outRow[col]);
+	}
+}
+
+AsciiRowKernel GetRowKernelAVX2(int blockWidth, int blockHeight)
+{
+#define X(W, H) if (blockWidth == W && blockHeight == H) return ConvertRowAVX2Fixed<W, H, AsciiCell>;
+	ASCII_FOR_EACH_FIXED_GEOMETRY(X)
+#undef X
+	return ConvertRowAVX2<AsciiCell>;
+}
+
+AsciiSumKernel GetSumKernelAVX2(int blockWidth, int blockHeight)
+{
+#define X(W, H) if (blockWidth == W && blockHeight == H) return ConvertRowAVX2Fixed<W, H, AsciiBlockSums>;
+	ASCII_FOR_EACH_FIXED_GEOMETRY(X)
+#undef X
+	return ConvertRowAVX2<AsciiBlockSums>;
+}
+
+//------------------------------------------------------------
+// Edge kernels. Every block row is loaded once, in chunks of up
+// to eight pixels with the alpha bytes cleared, next to a copy
+// moved over by one pixel: an unaligned load inside the block,
+// a permute in its last chunk that repeats the last pixel, whose
+// pairs to the right do not count. One dword blend puts the pair
+// groups of SumEdgesScalar side by side for a PSADBW that sums
+// across and down, told apart by the 64-bit lane. The same blend
+// with the last pixel cleared is the second operand of the
+// diagonal PSADBW and the first one of the next row's, so the
+// previous row is carried in two registers. The channel sums
+// take two rows at a time: their bytes interleaved, one
+// PMADDUBSW adds each channel of both.
+//------------------------------------------------------------
+struct EdgeSumsAVX2
+{
+	__m256i channels; // 16-bit B G R A sums of four pixel columns
+	__m256i straight[2], diagonal[2], bottom[2]; // By row parity
+};
+
+// N (even) pixels, zero padded
+template<int N>
+static inline __m256i LoadChunkAVX2(const uint8_t* pixel)
+{
+	static_assert(N % 2 == 0 && N > 0 && N <= 8, "unsupported chunk width");
+	if constexpr (N == 8)
+		return Load8(pixel);
+	else if constexpr (N == 6)
+		return _mm256_inserti128_si256(Load4(pixel), _mm_loadl_epi64(reinterpret_cast<const __m128i*>(pixel + 16)), 1);
+	else if constexpr (N == 4)
+		return Load4(pixel);
+	else
+		return Load2(pixel);
+}
+
+// Gradient sums of one chunk of one row. right is v moved over by one
+// pixel and pairs clears the pixels without a pair to the right.
+template<bool Odd>
+static inline void SumEdgeChunkAVX2(__m256i v, __m256i right, __m256i pairs, bool first,
+	__m256i& above, __m256i& aboveDiagonal, __m256i& straight, __m256i& diagonal)
+{
+	// Vertical groups (down, downLeft) are the odd 64-bit lanes on
+	// even rows and the even ones on odd rows
+	constexpr int Vertical = Odd ? 0x33 : 0xCC;
+	__m256i operand = _mm256_blend_epi32(right, v, Vertical);
+	straight = _mm256_add_epi64(straight, _mm256_sad_epu8(_mm256_blend_epi32(v, first ? v : above, Vertical), operand));
+	operand = _mm256_and_si256(operand, pairs);
+	if (!first)
+		diagonal = _mm256_add_epi64(diagonal, _mm256_sad_epu8(aboveDiagonal, operand));
+	above = v;
+	aboveDiagonal = operand;
+}
+
+// Channel sums of two rows (or one and zero) into 16-bit lanes
+static inline __m256i SumRowPairAVX2(__m256i channels, __m256i top, __m256i next)
+{
+	const __m256i ones = _mm256_set1_epi8(1);
+	channels = _mm256_add_epi16(channels, _mm256_maddubs_epi16(_mm256_unpacklo_epi8(top, next), ones));
+	return _mm256_add_epi16(channels, _mm256_maddubs_epi16(_mm256_unpackhi_epi8(top, next), ones));
+}
+
+template<int W, int H>
+static inline void SumBlockEdgesAVX2(const uint8_t* pixel, int rowPitch, EdgeSumsAVX2& sums)
+{
+	static_assert(H % 2 == 0 && H >= 4 && W * H * 255 <= 0xFFFF, "unsupported block size");
+	constexpr int Chunks = (W + 7) / 8;
+	constexpr int Last = W - (Chunks - 1) * 8;
+	constexpr int Bottom = H - H / 4;
+	const __m256i alpha = _mm256_set1_epi32(0x00FFFFFF);
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i lastPairs = _mm256_cmpgt_epi32(_mm256_set1_epi32(Last - 1), lanes);
+	const __m256i next = _mm256_sub_epi32(lanes, lastPairs);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i channels = zero;
+	__m256i straight[2] = { zero, zero }, diagonal[2] = { zero, zero };
+
+	__m256i above[Chunks], aboveDiagonal[Chunks];
+	auto sumRow = [&](int y, auto odd, __m256i* rowPixels) {
+		constexpr int Parity = decltype(odd)::value ? 1 : 0;
+		const uint8_t* row = pixel + static_cast<size_t>(y) * rowPitch;
+		AsciiUnroll<Chunks>([&](int i) {
+			__m256i v, right, pairs;
+			if (i + 1 < Chunks) {
+				v = _mm256_and_si256(Load8(row + i * 32), alpha);
+				right = _mm256_and_si256(Load8(row + i * 32 + 4), alpha);
+				pairs = _mm256_cmpeq_epi32(zero, zero);
+			}
+			else {
+				v = _mm256_and_si256(LoadChunkAVX2<Last>(row + i * 32), alpha);
+				right = _mm256_permutevar8x32_epi32(v, next);
+				pairs = lastPairs;
+			}
+			rowPixels[i] = v;
+			SumEdgeChunkAVX2<decltype(odd)::value>(v, right, pairs, y == 0, above[i], aboveDiagonal[i],
+				straight[Parity], diagonal[Parity]);
+		});
+	};
+
+	// Rows in pairs, in a loop rather than a full unroll, which only
+	// makes the compiler spill the partial sums. The bottom quarter's
+	// sums are the difference of two snapshots, taken in the pair that
+	// holds its first row.
+	const std::integral_constant<bool, false> even;
+	const std::integral_constant<bool, true> odd;
+	constexpr int Split = Bottom & ~1;
+	auto sumPair = [&](int y) {
+		__m256i top[Chunks], bottom[Chunks];
+		if (Bottom % 2 == 0 && y == Split) {
+			sums.bottom[0] = straight[0];
+			sums.bottom[1] = straight[1];
+		}
+		sumRow(y, even, top);
+		if (Bottom % 2 == 1 && y == Split) {
+			sums.bottom[0] = straight[0];
+			sums.bottom[1] = straight[1];
+		}
+		sumRow(y + 1, odd, bottom);
+		AsciiUnroll<Chunks>([&](int i) {
+			channels = SumRowPairAVX2(channels, top[i], bottom[i]);
+		});
+	};
+	ASCII_NO_UNROLL
+	for (int y = 0; y < H; y += 2)
+		sumPair(y);
+
+	sums.channels = channels;
+	for (int parity = 0; parity < 2; ++parity) {
+		sums.straight[parity] = straight[parity];
+		sums.diagonal[parity] = diagonal[parity];
+		sums.bottom[parity] = _mm256_sub_epi64(straight[parity], sums.bottom[parity]);
+	}
+}
+
+// Even row sums + odd row sums with their 64-bit lanes swapped, so the
+// even lanes hold the horizontal groups' sums and the odd ones the
+// vertical groups'
+static inline __m256i AddParityLanesAVX2(const __m256i* sums)
+{
+	return _mm256_add_epi64(sums[0], _mm256_shuffle_epi32(sums[1], _MM_SHUFFLE(1, 0, 3, 2)));
+}
+
+static inline __m128i FoldLanesAVX2(__m256i v)
+{
+	return _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+}
+
+// The fixed sizes are small enough for 16-bit channel totals and 32-bit
+// gradient totals, so everything folds into two vectors
+static inline void FinishEdgeSumsAVX2(const EdgeSumsAVX2& sums, uint32_t& sumR, uint32_t& sumG, uint32_t& sumB,
+	AsciiEdgeSums& edges)
+{
+	__m256i channels = _mm256_add_epi16(sums.channels, _mm256_shuffle_epi32(sums.channels, _MM_SHUFFLE(1, 0, 3, 2)));
+	__m256i straight = AddParityLanesAVX2(sums.straight);
+	__m256i diagonal = AddParityLanesAVX2(sums.diagonal);
+	__m256i bottom = AddParityLanesAVX2(sums.bottom);
+	// across, downRight, down, downLeft; B G R A words, downBottom
+	__m256i gradients = _mm256_blend_epi32(straight, _mm256_shuffle_epi32(diagonal, _MM_SHUFFLE(2, 3, 0, 1)), 0xAA);
+	__m256i rest = _mm256_blend_epi32(channels, bottom, 0xCC);
+	alignas(16) uint32_t totals[8];
+	_mm_store_si128(reinterpret_cast<__m128i*>(totals), FoldLanesAVX2(gradients));
+	_mm_store_si128(reinterpret_cast<__m128i*>(totals + 4), FoldLanesAVX2(rest));
+	edges.across = totals[0];
+	edges.downRight = totals[1];
+	edges.down = totals[2];
+	edges.downLeft = totals[3];
+	edges.downBottom = totals[6];
+	sumB = totals[4] & 0xFFFF;
+	sumG = totals[4] >> 16;
+	sumR = totals[5] & 0xFFFF;
+}
+
+// Even and odd 64-bit lanes of the parity sums
+static inline void SumParityLanesAVX2(const __m256i* sums, uint64_t& even, uint64_t& odd)
+{
+	__m256i v = AddParityLanesAVX2(sums);
+	__m128i s = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+	even = static_cast<uint64_t>(_mm_cvtsi128_si64(s));
+	odd = static_cast<uint64_t>(_mm_extract_epi64(s, 1));
+}
+
+// Any block size, in strips of up to eight pixel columns summed from top
+// to bottom. The last strip is a masked load, so nothing outside the
+// block is read. The 16-bit channel sums move to 32-bit lanes after
+// every 64 rows and at the end of each strip.
+static inline void SumEdgeStripsAVX2(const uint8_t* pixel, int rowPitch, int width, int height,
+	uint32_t& sumR, uint32_t& sumG, uint32_t& sumB, AsciiEdgeSums& edges)
+{
+	const __m256i alpha = _mm256_set1_epi32(0x00FFFFFF);
+	const __m256i low = _mm256_set1_epi32(0x00000001);
+	const __m256i high = _mm256_set1_epi32(0x00010000);
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i zero = _mm256_setzero_si256();
+	const int bottom = height - height / 4;
+	__m256i blueRed = zero, greenAlpha = zero;
+	__m256i straight[2] = { zero, zero }, lower[2] = { zero, zero }, diagonal[2] = { zero, zero };
+
+	for (int x = 0; x < width; x += 8) {
+		const uint8_t* strip = pixel + x * 4;
+		const bool last = x + 8 >= width;
+		const __m256i loaded = _mm256_cmpgt_epi32(_mm256_set1_epi32(width - x), lanes);
+		const __m256i pairs = _mm256_cmpgt_epi32(_mm256_set1_epi32(width - x - 1), lanes);
+		const __m256i next = _mm256_sub_epi32(lanes, pairs);
+		__m256i channels = zero, above = zero, aboveDiagonal = zero;
+		__m256i mark[2] = { straight[0], straight[1] };
+		auto sumRow = [&](int y, auto odd, bool first) {
+			constexpr int Parity = decltype(odd)::value ? 1 : 0;
+			const uint8_t* row = strip + static_cast<size_t>(y) * rowPitch;
+			__m256i v, right;
+			if (last) {
+				v = _mm256_and_si256(_mm256_maskload_epi32(reinterpret_cast<const int*>(row), loaded), alpha);
+				right = _mm256_permutevar8x32_epi32(v, next);
+			}
+			else {
+				v = _mm256_and_si256(Load8(row), alpha);
+				right = _mm256_and_si256(Load8(row + 4), alpha);
+			}
+			if (y == bottom) {
+				mark[0] = straight[0];
+				mark[1] = straight[1];
+			}
+			SumEdgeChunkAVX2<decltype(odd)::value>(v, right, pairs, first, above, aboveDiagonal,
+				straight[Parity], diagonal[Parity]);
+			return v;
+		};
+		const std::integral_constant<bool, false> even;
+		const std::integral_constant<bool, true> odd;
+		auto flush = [&]() {
+			blueRed = _mm256_add_epi32(blueRed, _mm256_madd_epi16(channels, low));
+			greenAlpha = _mm256_add_epi32(greenAlpha, _mm256_madd_epi16(channels, high));
+			channels = zero;
+		};
+		auto sumPair = [&](int y, bool first) {
+			__m256i top = sumRow(y, even, first);
+			channels = SumRowPairAVX2(channels, top, y + 1 < height ? sumRow(y + 1, odd, false) : zero);
+			if ((y & 63) == 62)
+				flush();
+		};
+		sumPair(0, true);
+		for (int y = 2; y < height; y += 2)
+			sumPair(y, false);
+		flush();
+		if (bottom < height) {
+			lower[0] = _mm256_add_epi64(lower[0], _mm256_sub_epi64(straight[0], mark[0]));
+			lower[1] = _mm256_add_epi64(lower[1], _mm256_sub_epi64(straight[1], mark[1]));
+		}
+	}
+
+	// Even dwords hold B and G, odd ones R and A
+	__m128i blueRedTotal = FoldLanesAVX2(blueRed);
+	__m128i greenTotal = FoldLanesAVX2(greenAlpha);
+	blueRedTotal = _mm_add_epi32(blueRedTotal, _mm_unpackhi_epi64(blueRedTotal, blueRedTotal));
+	greenTotal = _mm_add_epi32(greenTotal, _mm_unpackhi_epi64(greenTotal, greenTotal));
+	sumB = static_cast<uint32_t>(_mm_cvtsi128_si32(blueRedTotal));
+	sumR = static_cast<uint32_t>(_mm_extract_epi32(blueRedTotal, 1));
+	sumG = static_cast<uint32_t>(_mm_cvtsi128_si32(greenTotal));
+	uint64_t unused;
+	SumParityLanesAVX2(straight, edges.across, edges.down);
+	SumParityLanesAVX2(diagonal, edges.downRight, edges.downLeft);
+	SumParityLanesAVX2(lower, unused, edges.downBottom);
+}
+
+// Clipped blocks at the right and bottom of the region take the strips
+template<int W, int H>
+static void ConvertRowEdgeAVX2Fixed(const AsciiBlockJob& job, int row, AsciiCell* outRow)
+{
+	AsciiEdgeWeights weights;
+	GetAsciiEdgeWeights(W, H, weights);
+	for (int col = 0; col < job.outCols; ++col) {
+		int startX, startY, endX, endY;
+		GetBlockBounds(job, row, col, startX, startY, endX, endY);
+
+		const uint8_t* pixel = job.frame + static_cast<size_t>(startY) * job.rowPitch + startX * 4;
+		uint32_t sumR, sumG, sumB;
+		AsciiEdgeSums edges;
+		if (endX - startX == W && endY - startY == H) {
+			EdgeSumsAVX2 sums;
+			SumBlockEdgesAVX2<W, H>(pixel, job.rowPitch, sums);
+			FinishEdgeSumsAVX2(sums, sumR, sumG, sumB, edges);
+			outRow[col] = MakeAsciiEdgeCell(sumR, sumG, sumB, W * H, edges, weights, job.palette);
+			continue;
+		}
+
+		uint32_t count = static_cast<uint32_t>((endX - startX) * (endY - startY));
+		if (count > 0) {
+			AsciiEdgeWeights clipped;
+			GetAsciiEdgeWeights(endX - startX, endY - startY, clipped);
+			SumEdgeStripsAVX2(pixel, job.rowPitch, endX - startX, endY - startY, sumR, sumG, sumB, edges);
+			outRow[col] = MakeAsciiEdgeCell(sumR, sumG, sumB, count, edges, clipped, job.palette);
+		}
+	}
+}
+
+static void ConvertRowEdgeAVX2(const AsciiBlockJob& job, int row, AsciiCell* outRow)
+{
+	AsciiEdgeWeights weights;
+	GetAsciiEdgeWeights(job.blockWidth, job.blockHeight, weights);
+	for (int col = 0; col < job.outCols; ++col) {
+		int startX, startY, endX, endY;
+		GetBlockBounds(job, row, col, startX, startY, endX, endY);
+
+		uint32_t count = static_cast<uint32_t>((endX - startX) * (endY - startY));
+		if (count == 0)
+			continue;
+		const uint8_t* pixel = job.frame + static_cast<size_t>(startY) * job.rowPitch + startX * 4;
+		uint32_t sumR, sumG, sumB;
+		AsciiEdgeSums edges;
+		SumEdgeStripsAVX2(pixel, job.rowPitch, endX - startX, endY - startY, sumR, sumG, sumB, edges);
+		if (endX - startX == job.blockWidth && endY - startY == job.blockHeight)
+			outRow[col] = MakeAsciiEdgeCell(sumR, sumG, sumB, count, edges, weights, job.palette);
+		else {
+			AsciiEdgeWeights clipped;
+			GetAsciiEdgeWeights(endX - startX, endY - startY, clipped);
+			outRow[col] = MakeAsciiEdgeCell(sumR, sumG, sumB, count, edges, clipped, job.palette);
+		}
+	}
+}
+
+AsciiRowKernel GetEdgeRowKernelAVX2(int blockWidth, int blockHeight)
+{
+#define X(W, H) if (blockWidth == W && blockHeight == H) return ConvertRowEdgeAVX2Fixed<W, H>;
+	ASCII_FOR_EACH_FIXED_GEOMETRY(X)
+#undef X
+	return ConvertRowEdgeAVX2;
+}
+
+//------------------------------------------------------------
+// Block hash, one 32 byte stripe (all four lanes) per step. The
+// zero padded last stripe of a row comes from a masked load.
+//------------------------------------------------------------
+static inline void HashStripeAVX2(__m256i& acc, __m256i& key, __m256i words)
+{
+	const __m256i step = _mm256_set1_epi64x(static_cast<long long>(ASCII_HASH_KEY_STEP));
+	key = _mm256_add_epi64(key, step);
+	__m256i x = _mm256_xor_si256(words, key);
+	__m256i product = _mm256_mul_epu32(x, _mm256_srli_epi64(x, 32));
+	acc = _mm256_add_epi64(acc, _mm256_add_epi64(words, product));
+}
+
+uint64_t HashBlockAVX2(const uint8_t* pixel, int rowPitch, int width, int height)
+{
+	__m256i acc = _mm256_setzero_si256();
+	__m256i key = _mm256_setr_epi64x(
+		static_cast<long long>(ASCII_HASH_KEYS[0]), static_cast<long long>(ASCII_HASH_KEYS[1]),
+		static_cast<long long>(ASCII_HASH_KEYS[2]), static_cast<long long>(ASCII_HASH_KEYS[3]));
+
+	int stripes = width / 8;
+	int rest = width % 8;
+	__m256i restMask = _mm256_cmpgt_epi32(_mm256_set1_epi32(rest), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+
+	for (int y = 0; y < height; ++y) {
+		const uint8_t* row = pixel + static_cast<size_t>(y) * rowPitch;
+		for (int s = 0; s < stripes; ++s, row += 32)
+			HashStripeAVX2(acc, key, Load8(row));
+		if (rest)
+			HashStripeAVX2(acc, key, _mm256_maskload_epi32(reinterpret_cast<const int*>(row), restMask));
+	}
+
+	alignas(32) uint64_t lanes[4];
+	_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc);
+	return FinishBlockHash(lanes, width, height);
+}
+
+//------------------------------------------------------------
+// Glyph search: one PSADBW per 32 byte mask, four glyphs per step, with
+// the same distance << 16 | index packing as the SSE4.1 search
+//------------------------------------------------------------
+static inline __m256i SadAVX2(const uint8_t* mask, __m256i target)
+{
+	return _mm256_sad_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(mask)), target);
+}
+
+// Four 64-bit partial sums per glyph -> { d0 lo, d1 lo, d0 lo, d1 lo | d0 hi, d1 hi, ... }
+static inline __m256i FoldPairAVX2(__m256i sad0, __m256i sad1)
+{
+	__m256i both = _mm256_or_si256(sad0, _mm256_slli_epi64(sad1, 32));
+	return _mm256_add_epi32(both, _mm256_shuffle_epi32(both, _MM_SHUFFLE(1, 0, 3, 2)));
+}
+
+int SearchGlyphsAVX2(const uint8_t* masks, int glyphCount, const uint8_t* target)
+{
+	__m256i t = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(target));
+
+	__m128i best = _mm_set1_epi32(-1);
+	__m128i index = _mm_setr_epi32(0, 1, 2, 3);
+	const __m128i four = _mm_set1_epi32(4);
+	int i = 0;
+	for (; i + 4 <= glyphCount; i += 4, masks += 4 * ASCII_GLYPH_MASK_SIZE) {
+		__m256i d01 = FoldPairAVX2(SadAVX2(masks, t), SadAVX2(masks + ASCII_GLYPH_MASK_SIZE, t));
+		__m256i d23 = FoldPairAVX2(SadAVX2(masks + 2 * ASCII_GLYPH_MASK_SIZE, t), SadAVX2(masks + 3 * ASCII_GLYPH_MASK_SIZE, t));
+		__m256i halves = _mm256_unpacklo_epi64(d01, d23);
+		__m128i distance = _mm_add_epi32(_mm256_castsi256_si128(halves), _mm256_extracti128_si256(halves, 1));
+		best = _mm_min_epu32(best, _mm_or_si128(_mm_slli_epi32(distance, 16), index));
+		index = _mm_add_epi32(index, four);
+	}
+	best = _mm_min_epu32(best, _mm_shuffle_epi32(best, _MM_SHUFFLE(1, 0, 3, 2)));
+	best = _mm_min_epu32(best, _mm_shuffle_epi32(best, _MM_SHUFFLE(2, 3, 0, 1)));
+	uint32_t packed = static_cast<uint32_t>(_mm_cvtsi128_si32(best));
+
+	for (; i < glyphCount; ++i, masks += ASCII_GLYPH_MASK_SIZE) {
+		__m256i sad = SadAVX2(masks, t);
+		__m128i sum = _mm_add_epi64(_mm256_castsi256_si128(sad), _mm256_extracti128_si256(sad, 1));
+		uint32_t distance = static_cast<uint32_t>(_mm_cvtsi128_si32(sum) + _mm_extract_epi32(sum, 2));
+		uint32_t candidate = (distance << 16) | static_cast<uint32_t>(i);
+		packed = candidate < packed ? candidate : packed;
+	}
+	return static_cast<int>(packed & 0xFFFF);
+}
+
+//------------------------------------------------------------
+// Glyph blending, eight pixels per step. Each 256-bit vector holds four
+// pixels widened to 16 bits; PACKUSWB works per lane, so the packed
+// quarters are put back in order with VPERMQ.
+//------------------------------------------------------------
+void BlendGlyphRowAVX2(uint8_t* dst, const uint8_t* coverage, int count, uint32_t fg, uint32_t bg)
+{
+	const __m256i fg16 = _mm256_cvtepu8_epi16(_mm_set1_epi32(static_cast<int>(fg))); // Four pixels
+	const __m256i bg16 = _mm256_cvtepu8_epi16(_mm_set1_epi32(static_cast<int>(bg)));
+	const __m256i full = _mm256_set1_epi16(256);
+	const __m256i spread0123 = _mm256_setr_epi8(0, 1, 0, 1, 0, 1, 0, 1, 2, 3, 2, 3, 2, 3, 2, 3,
+		4, 5, 4, 5, 4, 5, 4, 5, 6, 7, 6, 7, 6, 7, 6, 7);
+	const __m256i spread4567 = _mm256_setr_epi8(8, 9, 8, 9, 8, 9, 8, 9, 10, 11, 10, 11, 10, 11, 10, 11,
+		12, 13, 12, 13, 12, 13, 12, 13, 14, 15, 14, 15, 14, 15, 14, 15);
+
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128i a = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(coverage + i)));
+		a = _mm_add_epi16(a, _mm_srli_epi16(a, 7));
+		__m256i a8 = _mm256_broadcastsi128_si256(a);
+
+		__m256i a0123 = _mm256_shuffle_epi8(a8, spread0123);
+		__m256i a4567 = _mm256_shuffle_epi8(a8, spread4567);
+		__m256i p0123 = _mm256_add_epi16(_mm256_mullo_epi16(bg16, _mm256_sub_epi16(full, a0123)), _mm256_mullo_epi16(fg16, a0123));
+		__m256i p4567 = _mm256_add_epi16(_mm256_mullo_epi16(bg16, _mm256_sub_epi16(full, a4567)), _mm256_mullo_epi16(fg16, a4567));
+		__m256i pixels = _mm256_packus_epi16(_mm256_srli_epi16(p0123, 8), _mm256_srli_epi16(p4567, 8));
+		pixels = _mm256_permute4x64_epi64(pixels, _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4), pixels);
+	}
+	for (; i < count; ++i)
+		AsciiBlendPixel(dst + i * 4, coverage[i], fg, bg);
+}
+
+//------------------------------------------------------------
+// Cell comparison, eight cells (three vectors) per step, with the same
+// padding masks as the SSE4.1 comparer. Unchanged groups of eight, the
+// common case, cost three compares and one test.
+//------------------------------------------------------------
+int CompareCellsAVX2(const AsciiCell* previous, const AsciiCell* next, int count, uint8_t* changed)
+{
+	alignas(32) int8_t padding[96];
+	for (int i = 0; i < 96; ++i)
+		padding[i] = IsAsciiCellPadding(i) ? -1 : 0;
+	const __m256i pad0 = _mm256_load_si256(reinterpret_cast<const __m256i*>(padding));
+	const __m256i pad1 = _mm256_load_si256(reinterpret_cast<const __m256i*>(padding + 32));
+	const __m256i pad2 = _mm256_load_si256(reinterpret_cast<const __m256i*>(padding + 64));
+
+	const uint8_t* a = reinterpret_cast<const uint8_t*>(previous);
+	const uint8_t* b = reinterpret_cast<const uint8_t*>(next);
+	int total = 0;
+	int i = 0;
+	for (; i + 8 <= count; i += 8, a += 96, b += 96) {
+		__m256i eq0 = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a)),
+			_mm256_loadu_si256(reinterpret_cast<const __m256i*>(b))), pad0);
+		__m256i eq1 = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + 32)),
+			_mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + 32))), pad1);
+		__m256i eq2 = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + 64)),
+			_mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + 64))), pad2);
+
+		__m256i all = _mm256_and_si256(_mm256_and_si256(eq0, eq1), eq2);
+		if (_mm256_movemask_epi8(all) == -1) {
+			memset(changed + i, 0, 8);
+			continue;
+		}
+
+		// 96 mask bits, 12 per cell; cells 2 and 5 straddle two words
+		uint32_t mask[3] = {
+			static_cast<uint32_t>(_mm256_movemask_epi8(eq0)),
+			static_cast<uint32_t>(_mm256_movemask_epi8(eq1)),
+			static_cast<uint32_t>(_mm256_movemask_epi8(eq2)),
+		};
+		for (int c = 0; c < 8; ++c) {
+			int bit = c * 12;
+			int word = bit >> 5, shift = bit & 31;
+			uint32_t bits = mask[word] >> shift;
+			if (shift > 20)
+				bits |= mask[word + 1] << (32 - shift);
+			uint8_t differs = (bits & 0xFFF) != 0xFFF;
+			changed[i + c] = differs;
+			total += differs;
+		}
+	}
+	for (; i < count; ++i) {
+		changed[i] = previous[i] != next[i];
+		total += changed[i];
+	}
+	return total;
+}
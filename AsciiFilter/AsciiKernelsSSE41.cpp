@@ -0,0 +1,627 @@
+﻿#include "AsciiKernels.h"
+
+#include <smmintrin.h>
+#include <cstring>
+
+// SSE4.1 block averaging, four BGRA pixels per step.
+//
+// Each step shuffles the B and G bytes of four pixels into separate 64-bit
+// halves and sums them with PSADBW against zero; a second shuffle does the
+// same for R. The partial sums live in 64-bit lanes, so any block size is
+// safe from overflow. Shuffle indices that point past a partial load pick
+// up zero bytes, so two pixel tails can reuse the same masks.
+
+struct SumsSSE41
+{
+	__m128i bg;
+	__m128i r;
+	uint32_t tailR, tailG, tailB;
+};
+
+static inline void AccumulateSSE41(SumsSSE41& acc, __m128i v)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i shufBG = _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, 1, 5, 9, 13, -1, -1, -1, -1);
+	const __m128i shufR = _mm_setr_epi8(2, 6, 10, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	acc.bg = _mm_add_epi64(acc.bg, _mm_sad_epu8(_mm_shuffle_epi8(v, shufBG), zero));
+	acc.r = _mm_add_epi64(acc.r, _mm_sad_epu8(_mm_shuffle_epi8(v, shufR), zero));
+}
+
+static inline void AccumulatePixel(SumsSSE41& acc, const uint8_t* pixel)
+{
+	acc.tailB += pixel[0];
+	acc.tailG += pixel[1];
+	acc.tailR += pixel[2];
+}
+
+static inline void InitSums(SumsSSE41& acc)
+{
+	acc.bg = _mm_setzero_si128();
+	acc.r = _mm_setzero_si128();
+	acc.tailR = acc.tailG = acc.tailB = 0;
+}
+
+template<typename Out>
+static inline void FinishBlock(const SumsSSE41& acc, uint32_t count, const wchar_t* palette, Out& out)
+{
+	uint32_t sumB = acc.tailB + static_cast<uint32_t>(_mm_cvtsi128_si32(acc.bg));
+	uint32_t sumG = acc.tailG + static_cast<uint32_t>(_mm_extract_epi32(acc.bg, 2));
+	uint32_t sumR = acc.tailR + static_cast<uint32_t>(_mm_cvtsi128_si32(acc.r));
+	AsciiStoreBlock(out, sumR, sumG, sumB, count, palette);
+}
+
+// Any block size, four pixels at a time and a scalar tail
+static inline void AccumulateBlockSSE41(SumsSSE41& acc, const uint8_t* pixel, int rowPitch, int width, int height)
+{
+	for (int y = 0; y < height; ++y, pixel += rowPitch) {
+		const uint8_t* p = pixel;
+		int x = 0;
+		for (; x + 4 <= width; x += 4, p += 16)
+			AccumulateSSE41(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+		for (; x < width; ++x, p += 4)
+			AccumulatePixel(acc, p);
+	}
+}
+
+template<typename Out>
+static void ConvertRowSSE41(const AsciiBlockJob& job, int row, Out* outRow)
+{
+	for (int col = 0; col < job.outCols; ++col) {
+		int startX, startY, endX, endY;
+		GetBlockBounds(job, row, col, startX, startY, endX, endY);
+
+		SumsSSE41 acc;
+		InitSums(acc);
+		const uint8_t* pixel = job.frame + static_cast<size_t>(startY) * job.rowPitch + startX * 4;
+		AccumulateBlockSSE41(acc, pixel, job.rowPitch, endX - startX, endY - startY);
+
+		uint32_t count = static_cast<uint32_t>((endX - startX) * (endY - startY));
+		if (count > 0)
+			FinishBlock(acc, count, job.palette, outRow[col]);
+	}
+}
+
+// One block row of exactly W pixels, fully unrolled
+template<int W>
+static inline void AccumulateRowSSE41(SumsSSE41& acc, const uint8_t* pixel)
+{
+	AsciiUnroll<W / 4>([&](int i) {
+		AccumulateSSE41(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixel + i * 16)));
+	});
+	const uint8_t* tail = pixel + (W / 4) * 16;
+	if constexpr (W % 4 >= 2)
+		AccumulateSSE41(acc, _mm_loadl_epi64(reinterpret_cast<const __m128i*>(tail)));
+	if constexpr (W % 2 == 1)
+		AccumulatePixel(acc, tail + (W % 4 - 1) * 4);
+}
+
+template<int W, int H, typename Out>
+static void ConvertRowSSE41Fixed(const AsciiBlockJob& job, int row, Out* outRow)
+{
+	for (int col = 0; col < job.outCols; ++col) {
+		int startX, startY, endX, endY;
+		GetBlockBounds(job, row, col, startX, startY, endX, endY);
+
+		SumsSSE41 acc;
+		InitSums(acc);
+		const uint8_t* pixel = job.frame + static_cast<size_t>(startY) * job.rowPitch + startX * 4;
+		if (endX - startX == W && endY - startY == H) {
+			AsciiUnroll<H>([&](int y) {
+				AccumulateRowSSE41<W>(acc, pixel + static_cast<size_t>(y) * job.rowPitch);
+			});
+			FinishBlock(acc, W * H, job.palette, outRow[col]);
+			continue;
+		}
+
+		// Clipped block on the right or bottom edge
+		AccumulateBlockSSE41(acc, pixel, job.rowPitch, endX - startX, endY - startY);
+		uint32_t count = static_cast<uint32_t>((endX - startX) * (endY - startY));
+		if (count > 0)
+			FinishBlock(acc, count, job.palette, outRow[col]);
+	}
+}
+
+AsciiRowKernel GetRowKernelSSE41(int blockWidth, int blockHeight)
+{
+#define X(W, H) if (blockWidth == W && blockHeight == H) return ConvertRowSSE41Fixed<W, H, AsciiCell>;
+	ASCII_FOR_EACH_FIXED_GEOMETRY(X)
+#undef X
+	return ConvertRowSSE41<AsciiCell>;
+}
+
+AsciiSumKernel GetSumKernelSSE41(int blockWidth, int blockHeight)
+{
+#define X(W, H) if (blockWidth == W && blockHeight == H) return ConvertRowSSE41Fixed<W, H, AsciiBlockSums>;
+	ASCII_FOR_EACH_FIXED_GEOMETRY(X)
+#undef X
+	return ConvertRowSSE41<AsciiBlockSums>;
+}
+
+//------------------------------------------------------------
+// Edge kernels, same scheme as the AVX2 ones with chunks of four
+// pixels
+//------------------------------------------------------------
+struct EdgeSumsSSE41
+{
+	__m128i channels; // 16-bit B G R A sums of two pixel columns
+	__m128i straight[2], diagonal[2], bottom[2]; // By row parity
+};
+
+// Gradient sums of one chunk of one row. right is v moved over by one
+// pixel and pairs clears the pixels without a pair to the right.
+template<bool Odd>
+static inline void SumEdgeChunkSSE41(__m128i v, __m128i right, __m128i pairs, bool first,
+	__m128i& above, __m128i& aboveDiagonal, __m128i& straight, __m128i& diagonal)
+{
+	constexpr int Vertical = Odd ? 0x0F : 0xF0;
+	__m128i operand = _mm_blend_epi16(right, v, Vertical);
+	straight = _mm_add_epi64(straight, _mm_sad_epu8(_mm_blend_epi16(v, first ? v : above, Vertical), operand));
+	operand = _mm_and_si128(operand, pairs);
+	if (!first)
+		diagonal = _mm_add_epi64(diagonal, _mm_sad_epu8(aboveDiagonal, operand));
+	above = v;
+	aboveDiagonal = operand;
+}
+
+// Channel sums of two rows (or one and zero) into 16-bit lanes
+static inline __m128i SumRowPairSSE41(__m128i channels, __m128i top, __m128i next)
+{
+	const __m128i ones = _mm_set1_epi8(1);
+	channels = _mm_add_epi16(channels, _mm_maddubs_epi16(_mm_unpacklo_epi8(top, next), ones));
+	return _mm_add_epi16(channels, _mm_maddubs_epi16(_mm_unpackhi_epi8(top, next), ones));
+}
+
+template<int W, int H>
+static inline void SumBlockEdgesSSE41(const uint8_t* pixel, int rowPitch, EdgeSumsSSE41& sums)
+{
+	static_assert(W % 2 == 0 && H % 2 == 0 && H >= 4 && W * H * 255 <= 0xFFFF, "unsupported block size");
+	constexpr int Chunks = (W + 3) / 4;
+	constexpr int Last = W - (Chunks - 1) * 4;
+	constexpr int Bottom = H - H / 4;
+	const __m128i alpha = _mm_set1_epi32(0x00FFFFFF);
+	const __m128i lastPairs = _mm_cmpgt_epi32(_mm_set1_epi32(Last - 1), _mm_setr_epi32(0, 1, 2, 3));
+	const __m128i zero = _mm_setzero_si128();
+	__m128i channels = zero;
+	__m128i straight[2] = { zero, zero }, diagonal[2] = { zero, zero };
+
+	__m128i above[Chunks], aboveDiagonal[Chunks];
+	auto sumRow = [&](int y, auto odd, __m128i* rowPixels) {
+		constexpr int Parity = decltype(odd)::value ? 1 : 0;
+		const uint8_t* row = pixel + static_cast<size_t>(y) * rowPitch;
+		AsciiUnroll<Chunks>([&](int i) {
+			const __m128i* chunk = reinterpret_cast<const __m128i*>(row + i * 16);
+			__m128i v, right, pairs;
+			if (i + 1 < Chunks) {
+				v = _mm_and_si128(_mm_loadu_si128(chunk), alpha);
+				right = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i * 16 + 4)), alpha);
+				pairs = _mm_cmpeq_epi32(zero, zero);
+			}
+			else if constexpr (Last == 4) {
+				v = _mm_and_si128(_mm_loadu_si128(chunk), alpha);
+				right = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 2, 1));
+				pairs = lastPairs;
+			}
+			else {
+				v = _mm_and_si128(_mm_loadl_epi64(chunk), alpha);
+				right = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 2, 1, 1));
+				pairs = lastPairs;
+			}
+			rowPixels[i] = v;
+			SumEdgeChunkSSE41<decltype(odd)::value>(v, right, pairs, y == 0, above[i], aboveDiagonal[i],
+				straight[Parity], diagonal[Parity]);
+		});
+	};
+
+	// Rows in pairs, in a loop rather than a full unroll, which only
+	// makes the compiler spill the partial sums. The bottom quarter's
+	// sums are the difference of two snapshots, taken in the pair that
+	// holds its first row.
+	const std::integral_constant<bool, false> even;
+	const std::integral_constant<bool, true> odd;
+	constexpr int Split = Bottom & ~1;
+	auto sumPair = [&](int y) {
+		__m128i top[Chunks], bottom[Chunks];
+		if (Bottom % 2 == 0 && y == Split) {
+			sums.bottom[0] = straight[0];
+			sums.bottom[1] = straight[1];
+		}
+		sumRow(y, even, top);
+		if (Bottom % 2 == 1 && y == Split) {
+			sums.bottom[0] = straight[0];
+			sums.bottom[1] = straight[1];
+		}
+		sumRow(y + 1, odd, bottom);
+		AsciiUnroll<Chunks>([&](int i) {
+			channels = SumRowPairSSE41(channels, top[i], bottom[i]);
+		});
+	};
+	ASCII_NO_UNROLL
+	for (int y = 0; y < H; y += 2)
+		sumPair(y);
+
+	sums.channels = channels;
+	for (int parity = 0; parity < 2; ++parity) {
+		sums.straight[parity] = straight[parity];
+		sums.diagonal[parity] = diagonal[parity];
+		sums.bottom[parity] = _mm_sub_epi64(straight[parity], sums.bottom[parity]);
+	}
+}
+
+// Even row sums + odd row sums with their 64-bit lanes swapped
+static inline __m128i AddParityLanesSSE41(const __m128i* sums)
+{
+	return _mm_add_epi64(sums[0], _mm_shuffle_epi32(sums[1], _MM_SHUFFLE(1, 0, 3, 2)));
+}
+
+// Even and odd 64-bit lanes of the parity sums
+static inline void SumParityLanesSSE41(const __m128i* sums, uint64_t& even, uint64_t& odd)
+{
+	__m128i v = AddParityLanesSSE41(sums);
+	even = static_cast<uint64_t>(_mm_cvtsi128_si64(v));
+	odd = static_cast<uint64_t>(_mm_extract_epi64(v, 1));
+}
+
+static inline void FinishEdgeSumsSSE41(const EdgeSumsSSE41& sums, uint32_t& sumR, uint32_t& sumG, uint32_t& sumB,
+	AsciiEdgeSums& edges)
+{
+	__m128i channels = _mm_add_epi16(sums.channels, _mm_shuffle_epi32(sums.channels, _MM_SHUFFLE(1, 0, 3, 2)));
+	__m128i straight = AddParityLanesSSE41(sums.straight);
+	__m128i diagonal = AddParityLanesSSE41(sums.diagonal);
+	__m128i bottom = AddParityLanesSSE41(sums.bottom);
+	// across, downRight, down, downLeft; B G R A words, downBottom
+	alignas(16) uint32_t totals[8];
+	_mm_store_si128(reinterpret_cast<__m128i*>(totals),
+		_mm_blend_epi16(straight, _mm_shuffle_epi32(diagonal, _MM_SHUFFLE(2, 3, 0, 1)), 0xCC));
+	_mm_store_si128(reinterpret_cast<__m128i*>(totals + 4), _mm_blend_epi16(channels, bottom, 0xF0));
+	edges.across = totals[0];
+	edges.downRight = totals[1];
+	edges.down = totals[2];
+	edges.downLeft = totals[3];
+	edges.downBottom = totals[6];
+	sumB = totals[4] & 0xFFFF;
+	sumG = totals[4] >> 16;
+	sumR = totals[5] & 0xFFFF;
+}
+
+// 1 to 4 pixels, zero padded
+static inline __m128i LoadPixelsSSE41(const uint8_t* pixel, int count)
+{
+	int last;
+	switch (count) {
+	case 1:
+		std::memcpy(&last, pixel, 4);
+		return _mm_cvtsi32_si128(last);
+	case 2:
+		return _mm_loadl_epi64(reinterpret_cast<const __m128i*>(pixel));
+	case 3:
+		std::memcpy(&last, pixel + 8, 4);
+		return _mm_insert_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pixel)), last, 2);
+	default:
+		return _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixel));
+	}
+}
+
+// Any block size, in strips of up to four pixel columns summed from top
+// to bottom. The last strip is a partial load, so nothing outside the
+// block is read. The 16-bit channel sums move to 32-bit lanes after
+// every 64 rows and at the end of each strip.
+static inline void SumEdgeStripsSSE41(const uint8_t* pixel, int rowPitch, int width, int height,
+	uint32_t& sumR, uint32_t& sumG, uint32_t& sumB, AsciiEdgeSums& edges)
+{
+	const __m128i alpha = _mm_set1_epi32(0x00FFFFFF);
+	const __m128i low = _mm_set1_epi32(0x00000001);
+	const __m128i high = _mm_set1_epi32(0x00010000);
+	const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+	const __m128i zero = _mm_setzero_si128();
+	const int bottom = height - height / 4;
+	__m128i blueRed = zero, greenAlpha = zero;
+	__m128i straight[2] = { zero, zero }, lower[2] = { zero, zero }, diagonal[2] = { zero, zero };
+
+	for (int x = 0; x < width; x += 4) {
+		const uint8_t* strip = pixel + x * 4;
+		const int count = width - x < 4 ? width - x : 4;
+		const bool last = x + 4 >= width;
+		const __m128i pairs = _mm_cmpgt_epi32(_mm_set1_epi32(width - x - 1), lanes);
+		// Byte indices of the next pixel, or of the same one without a pair
+		const __m128i next = _mm_add_epi32(_mm_mullo_epi32(_mm_sub_epi32(lanes, pairs), _mm_set1_epi32(0x04040404)),
+			_mm_set1_epi32(0x03020100));
+		__m128i channels = zero, above = zero, aboveDiagonal = zero;
+		__m128i mark[2] = { straight[0], straight[1] };
+		auto sumRow = [&](int y, auto odd, bool first) {
+			constexpr int Parity = decltype(odd)::value ? 1 : 0;
+			const uint8_t* row = strip + static_cast<size_t>(y) * rowPitch;
+			__m128i v, right;
+			if (last) {
+				v = _mm_and_si128(LoadPixelsSSE41(row, count), alpha);
+				right = _mm_shuffle_epi8(v, next);
+			}
+			else {
+				v = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row)), alpha);
+				right = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + 4)), alpha);
+			}
+			if (y == bottom) {
+				mark[0] = straight[0];
+				mark[1] = straight[1];
+			}
+			SumEdgeChunkSSE41<decltype(odd)::value>(v, right, pairs, first, above, aboveDiagonal,
+				straight[Parity], diagonal[Parity]);
+			return v;
+		};
+		const std::integral_constant<bool, false> even;
+		const std::integral_constant<bool, true> odd;
+		auto flush = [&]() {
+			blueRed = _mm_add_epi32(blueRed, _mm_madd_epi16(channels, low));
+			greenAlpha = _mm_add_epi32(greenAlpha, _mm_madd_epi16(channels, high));
+			channels = zero;
+		};
+		auto sumPair = [&](int y, bool first) {
+			__m128i top = sumRow(y, even, first);
+			channels = SumRowPairSSE41(channels, top, y + 1 < height ? sumRow(y + 1, odd, false) : zero);
+			if ((y & 63) == 62)
+				flush();
+		};
+		sumPair(0, true);
+		for (int y = 2; y < height; y += 2)
+			sumPair(y, false);
+		flush();
+		if (bottom < height) {
+			lower[0] = _mm_add_epi64(lower[0], _mm_sub_epi64(straight[0], mark[0]));
+			lower[1] = _mm_add_epi64(lower[1], _mm_sub_epi64(straight[1], mark[1]));
+		}
+	}
+
+	// Even dwords hold B and G, odd ones R and A
+	blueRed = _mm_add_epi32(blueRed, _mm_unpackhi_epi64(blueRed, blueRed));
+	greenAlpha = _mm_add_epi32(greenAlpha, _mm_unpackhi_epi64(greenAlpha, greenAlpha));
+	sumB = static_cast<uint32_t>(_mm_cvtsi128_si32(blueRed));
+	sumR = static_cast<uint32_t>(_mm_extract_epi32(blueRed, 1));
+	sumG = static_cast<uint32_t>(_mm_cvtsi128_si32(greenAlpha));
+	uint64_t unused;
+	SumParityLanesSSE41(straight, edges.across, edges.down);
+	SumParityLanesSSE41(diagonal, edges.downRight, edges.downLeft);
+	SumParityLanesSSE41(lower, unused, edges.downBottom);
+}
+
+// Clipped blocks at the right and bottom of the region take the strips
+template<int W, int H>
+static void ConvertRowEdgeSSE41Fixed(const AsciiBlockJob& job, int row, AsciiCell* outRow)
+{
+	AsciiEdgeWeights weights;
+	GetAsciiEdgeWeights(W, H, weights);
+	for (int col = 0; col < job.outCols; ++col) {
+		int startX, startY, endX, endY;
+		GetBlockBounds(job, row, col, startX, startY, endX, endY);
+
+		const uint8_t* pixel = job.frame + static_cast<size_t>(startY) * job.rowPitch + startX * 4;
+		uint32_t sumR, sumG, sumB;
+		AsciiEdgeSums edges;
+		if (endX - startX == W && endY - startY == H) {
+			EdgeSumsSSE41 sums;
+			SumBlockEdgesSSE41<W, H>(pixel, job.rowPitch, sums);
+			FinishEdgeSumsSSE41(sums, sumR, sumG, sumB, edges);
+			outRow[col] = MakeAsciiEdgeCell(sumR, sumG, sumB, W * H, edges, weights, job.palette);
+			continue;
+		}
+
+		uint32_t count = static_cast<uint32_t>((endX - startX) * (endY - startY));
+		if (count > 0) {
+			AsciiEdgeWeights clipped;
+			GetAsciiEdgeWeights(endX - startX, endY - startY, clipped);
+			SumEdgeStripsSSE41(pixel, job.rowPitch, endX - startX, endY - startY, sumR, sumG, sumB, edges);
+			outRow[col] = MakeAsciiEdgeCell(sumR, sumG, sumB, count, edges, clipped, job.palette);
+		}
+	}
+}
+
+static void ConvertRowEdgeSSE41(const AsciiBlockJob& job, int row, AsciiCell* outRow)
+{
+	AsciiEdgeWeights weights;
+	GetAsciiEdgeWeights(job.blockWidth, job.blockHeight, weights);
+	for (int col = 0; col < job.outCols; ++col) {
+		int startX, startY, endX, endY;
+		GetBlockBounds(job, row, col, startX, startY, endX, endY);
+
+		uint32_t count = static_cast<uint32_t>((endX - startX) * (endY - startY));
+		if (count == 0)
+			continue;
+		const uint8_t* pixel = job.frame + static_cast<size_t>(startY) * job.rowPitch + startX * 4;
+		uint32_t sumR, sumG, sumB;
+		AsciiEdgeSums edges;
+		SumEdgeStripsSSE41(pixel, job.rowPitch, endX - startX, endY - startY, sumR, sumG, sumB, edges);
+		if (endX - startX == job.blockWidth && endY - startY == job.blockHeight)
+			outRow[col] = MakeAsciiEdgeCell(sumR, sumG, sumB, count, edges, weights, job.palette);
+		else {
+			AsciiEdgeWeights clipped;
+			GetAsciiEdgeWeights(endX - startX, endY - startY, clipped);
+			outRow[col] = MakeAsciiEdgeCell(sumR, sumG, sumB, count, edges, clipped, job.palette);
+		}
+	}
+}
+
+AsciiRowKernel GetEdgeRowKernelSSE41(int blockWidth, int blockHeight)
+{
+#define X(W, H) if (blockWidth == W && blockHeight == H) return ConvertRowEdgeSSE41Fixed<W, H>;
+	ASCII_FOR_EACH_FIXED_GEOMETRY(X)
+#undef X
+	return ConvertRowEdgeSSE41;
+}
+
+//------------------------------------------------------------
+// Block hash, lanes 0-1 and 2-3 of a stripe in two registers
+//------------------------------------------------------------
+static inline void HashHalfSSE41(__m128i& acc, __m128i& key, __m128i words)
+{
+	const __m128i step = _mm_set1_epi64x(static_cast<long long>(ASCII_HASH_KEY_STEP));
+	key = _mm_add_epi64(key, step);
+	__m128i x = _mm_xor_si128(words, key);
+	__m128i product = _mm_mul_epu32(x, _mm_srli_epi64(x, 32));
+	acc = _mm_add_epi64(acc, _mm_add_epi64(words, product));
+}
+
+// Up to three pixels, zero padded to 16 bytes
+static inline __m128i LoadPartialSSE41(const uint8_t* pixel, int count)
+{
+	alignas(16) uint8_t buffer[16] = {};
+	for (int i = 0; i < count * 4; ++i)
+		buffer[i] = pixel[i];
+	return _mm_load_si128(reinterpret_cast<const __m128i*>(buffer));
+}
+
+uint64_t HashBlockSSE41(const uint8_t* pixel, int rowPitch, int width, int height)
+{
+	__m128i accLo = _mm_setzero_si128();
+	__m128i accHi = _mm_setzero_si128();
+	__m128i keyLo = _mm_set_epi64x(static_cast<long long>(ASCII_HASH_KEYS[1]), static_cast<long long>(ASCII_HASH_KEYS[0]));
+	__m128i keyHi = _mm_set_epi64x(static_cast<long long>(ASCII_HASH_KEYS[3]), static_cast<long long>(ASCII_HASH_KEYS[2]));
+
+	int stripes = width / 8;
+	int rest = width % 8;
+
+	for (int y = 0; y < height; ++y) {
+		const uint8_t* row = pixel + static_cast<size_t>(y) * rowPitch;
+		for (int s = 0; s < stripes; ++s, row += 32) {
+			HashHalfSSE41(accLo, keyLo, _mm_loadu_si128(reinterpret_cast<const __m128i*>(row)));
+			HashHalfSSE41(accHi, keyHi, _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + 16)));
+		}
+		if (rest >= 4) {
+			HashHalfSSE41(accLo, keyLo, _mm_loadu_si128(reinterpret_cast<const __m128i*>(row)));
+			HashHalfSSE41(accHi, keyHi, LoadPartialSSE41(row + 16, rest - 4));
+		}
+		else if (rest) {
+			HashHalfSSE41(accLo, keyLo, LoadPartialSSE41(row, rest));
+			HashHalfSSE41(accHi, keyHi, _mm_setzero_si128());
+		}
+	}
+
+	alignas(16) uint64_t lanes[4];
+	_mm_store_si128(reinterpret_cast<__m128i*>(lanes), accLo);
+	_mm_store_si128(reinterpret_cast<__m128i*>(lanes + 2), accHi);
+	return FinishBlockHash(lanes, width, height);
+}
+
+//------------------------------------------------------------
+// Glyph search: two PSADBW per 32 byte mask, four glyphs per step.
+// Distances are packed as distance << 16 | index so a single unsigned
+// min keeps the closest glyph and, on ties, the first one.
+//------------------------------------------------------------
+static inline __m128i SadSSE41(const uint8_t* mask, __m128i targetLo, __m128i targetHi)
+{
+	__m128i lo = _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(mask)), targetLo);
+	__m128i hi = _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(mask + 16)), targetHi);
+	return _mm_add_epi64(lo, hi);
+}
+
+// Two 64-bit partial sums per glyph -> { d0, d1, d0, d1 }
+static inline __m128i FoldPairSSE41(__m128i sad0, __m128i sad1)
+{
+	__m128i both = _mm_or_si128(sad0, _mm_slli_epi64(sad1, 32));
+	return _mm_add_epi32(both, _mm_shuffle_epi32(both, _MM_SHUFFLE(1, 0, 3, 2)));
+}
+
+int SearchGlyphsSSE41(const uint8_t* masks, int glyphCount, const uint8_t* target)
+{
+	__m128i targetLo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(target));
+	__m128i targetHi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(target + 16));
+
+	__m128i best = _mm_set1_epi32(-1);
+	__m128i index = _mm_setr_epi32(0, 1, 2, 3);
+	const __m128i four = _mm_set1_epi32(4);
+	int i = 0;
+	for (; i + 4 <= glyphCount; i += 4, masks += 4 * ASCII_GLYPH_MASK_SIZE) {
+		__m128i d01 = FoldPairSSE41(SadSSE41(masks, targetLo, targetHi),
+			SadSSE41(masks + ASCII_GLYPH_MASK_SIZE, targetLo, targetHi));
+		__m128i d23 = FoldPairSSE41(SadSSE41(masks + 2 * ASCII_GLYPH_MASK_SIZE, targetLo, targetHi),
+			SadSSE41(masks + 3 * ASCII_GLYPH_MASK_SIZE, targetLo, targetHi));
+		__m128i distance = _mm_unpacklo_epi64(d01, d23);
+		best = _mm_min_epu32(best, _mm_or_si128(_mm_slli_epi32(distance, 16), index));
+		index = _mm_add_epi32(index, four);
+	}
+	best = _mm_min_epu32(best, _mm_shuffle_epi32(best, _MM_SHUFFLE(1, 0, 3, 2)));
+	best = _mm_min_epu32(best, _mm_shuffle_epi32(best, _MM_SHUFFLE(2, 3, 0, 1)));
+	uint32_t packed = static_cast<uint32_t>(_mm_cvtsi128_si32(best));
+
+	for (; i < glyphCount; ++i, masks += ASCII_GLYPH_MASK_SIZE) {
+		__m128i sad = SadSSE41(masks, targetLo, targetHi);
+		uint32_t distance = static_cast<uint32_t>(_mm_cvtsi128_si32(sad) + _mm_extract_epi32(sad, 2));
+		uint32_t candidate = (distance << 16) | static_cast<uint32_t>(i);
+		packed = candidate < packed ? candidate : packed;
+	}
+	return static_cast<int>(packed & 0xFFFF);
+}
+
+//------------------------------------------------------------
+// Glyph blending, four pixels per step: channels are widened to 16 bits,
+// where bg * (256 - a) + fg * a still fits, and packed back with PACKUSWB.
+//------------------------------------------------------------
+void BlendGlyphRowSSE41(uint8_t* dst, const uint8_t* coverage, int count, uint32_t fg, uint32_t bg)
+{
+	const __m128i fg16 = _mm_cvtepu8_epi16(_mm_set1_epi32(static_cast<int>(fg))); // Two pixels
+	const __m128i bg16 = _mm_cvtepu8_epi16(_mm_set1_epi32(static_cast<int>(bg)));
+	const __m128i full = _mm_set1_epi16(256);
+	const __m128i spread01 = _mm_setr_epi8(0, 1, 0, 1, 0, 1, 0, 1, 2, 3, 2, 3, 2, 3, 2, 3);
+	const __m128i spread23 = _mm_setr_epi8(4, 5, 4, 5, 4, 5, 4, 5, 6, 7, 6, 7, 6, 7, 6, 7);
+
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		int packed;
+		memcpy(&packed, coverage + i, 4);
+		__m128i a = _mm_cvtepu8_epi16(_mm_cvtsi32_si128(packed));
+		a = _mm_add_epi16(a, _mm_srli_epi16(a, 7));
+
+		__m128i a01 = _mm_shuffle_epi8(a, spread01);
+		__m128i a23 = _mm_shuffle_epi8(a, spread23);
+		__m128i p01 = _mm_add_epi16(_mm_mullo_epi16(bg16, _mm_sub_epi16(full, a01)), _mm_mullo_epi16(fg16, a01));
+		__m128i p23 = _mm_add_epi16(_mm_mullo_epi16(bg16, _mm_sub_epi16(full, a23)), _mm_mullo_epi16(fg16, a23));
+		__m128i pixels = _mm_packus_epi16(_mm_srli_epi16(p01, 8), _mm_srli_epi16(p23, 8));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), pixels);
+	}
+	for (; i < count; ++i)
+		AsciiBlendPixel(dst + i * 4, coverage[i], fg, bg);
+}
+
+//------------------------------------------------------------
+// Cell comparison, four cells (three vectors) per step. Byte equality
+// masks are ORed with the padding bytes; a cell is unchanged when all 12
+// of its mask bits are set.
+//------------------------------------------------------------
+int CompareCellsSSE41(const AsciiCell* previous, const AsciiCell* next, int count, uint8_t* changed)
+{
+	alignas(16) int8_t padding[48];
+	for (int i = 0; i < 48; ++i)
+		padding[i] = IsAsciiCellPadding(i) ? -1 : 0;
+	const __m128i pad0 = _mm_load_si128(reinterpret_cast<const __m128i*>(padding));
+	const __m128i pad1 = _mm_load_si128(reinterpret_cast<const __m128i*>(padding + 16));
+	const __m128i pad2 = _mm_load_si128(reinterpret_cast<const __m128i*>(padding + 32));
+	const uint64_t allEqual = 0xFFFFFFFFFFFFull;
+
+	const uint8_t* a = reinterpret_cast<const uint8_t*>(previous);
+	const uint8_t* b = reinterpret_cast<const uint8_t*>(next);
+	int total = 0;
+	int i = 0;
+	for (; i + 4 <= count; i += 4, a += 48, b += 48) {
+		__m128i eq0 = _mm_or_si128(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a)),
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(b))), pad0);
+		__m128i eq1 = _mm_or_si128(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + 16)),
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + 16))), pad1);
+		__m128i eq2 = _mm_or_si128(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + 32)),
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + 32))), pad2);
+		uint64_t mask = static_cast<uint64_t>(_mm_movemask_epi8(eq0)) |
+			(static_cast<uint64_t>(_mm_movemask_epi8(eq1)) << 16) |
+			(static_cast<uint64_t>(_mm_movemask_epi8(eq2)) << 32);
+
+		if (mask == allEqual) {
+			memset(changed + i, 0, 4);
+			continue;
+		}
+		for (int c = 0; c < 4; ++c) {
+			uint8_t differs = ((mask >> (c * 12)) & 0xFFF) != 0xFFF;
+			changed[i + c] = differs;
+			total += differs;
+		}
+	}
+	for (; i < count; ++i) {
+		changed[i] = previous[i] != next[i];
+		total += changed[i];
+	}
+	return total;
+}
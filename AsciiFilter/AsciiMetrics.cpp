@@ -0,0 +1,229 @@
+﻿#include "AsciiMetrics.h"
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+//------------------------------------------------------------
+// Histogram
+//------------------------------------------------------------
+static int HighestBit(uint64_t value)
+{
+	int bit = 0;
+	for (int shift = 32; shift > 0; shift >>= 1) {
+		if (value >> shift) {
+			value >>= shift;
+			bit += shift;
+		}
+	}
+	return bit;
+}
+
+AsciiHistogram::AsciiHistogram()
+	: m_counts(new std::atomic<uint64_t>[BUCKET_COUNT])
+{
+	for (int i = 0; i < BUCKET_COUNT; ++i)
+		m_counts[i].store(0, std::memory_order_relaxed);
+}
+
+int AsciiHistogram::GetBucket(uint64_t value)
+{
+	if (value < SUB_BUCKETS)
+		return static_cast<int>(value);
+	int exponent = HighestBit(value);
+	int sub = static_cast<int>(value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+	return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+uint64_t AsciiHistogram::GetBucketValue(int bucket)
+{
+	if (bucket < SUB_BUCKETS)
+		return static_cast<uint64_t>(bucket);
+	int shift = bucket / SUB_BUCKETS - 1;
+	uint64_t low = static_cast<uint64_t>(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+	return low + ((uint64_t(1) << shift) >> 1);
+}
+
+void AsciiHistogram::Record(uint64_t value)
+{
+	m_counts[GetBucket(value)].fetch_add(1, std::memory_order_relaxed);
+	m_sum.fetch_add(value, std::memory_order_relaxed);
+	uint64_t max = m_max.load(std::memory_order_relaxed);
+	while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {}
+}
+
+AsciiHistogram::Summary AsciiHistogram::Drain()
+{
+	Summary summary;
+	std::vector<uint64_t> counts(BUCKET_COUNT);
+	for (int i = 0; i < BUCKET_COUNT; ++i) {
+		counts[i] = m_counts[i].exchange(0, std::memory_order_relaxed);
+		summary.count += counts[i];
+	}
+	uint64_t sum = m_sum.exchange(0, std::memory_order_relaxed);
+	summary.max = m_max.exchange(0, std::memory_order_relaxed);
+	if (summary.count == 0)
+		return summary;
+	summary.mean = static_cast<double>(sum) / summary.count;
+
+	// Smallest bucket that holds at least the given share of the values
+	const double shares[3] = { 0.50, 0.95, 0.99 };
+	uint64_t* results[3] = { &summary.p50, &summary.p95, &summary.p99 };
+	uint64_t seen = 0;
+	int next = 0;
+	for (int i = 0; i < BUCKET_COUNT && next < 3; ++i) {
+		seen += counts[i];
+		while (next < 3 && static_cast<double>(seen) >= shares[next] * summary.count) {
+			uint64_t value = GetBucketValue(i);
+			*results[next++] = value < summary.max ? value : summary.max;
+		}
+	}
+	return summary;
+}
+
+//------------------------------------------------------------
+// Metrics
+//------------------------------------------------------------
+AsciiMetrics::AsciiMetrics()
+{
+	m_lastSnapshot = Now();
+}
+
+uint64_t AsciiMetrics::Now()
+{
+	using namespace std::chrono;
+	return static_cast<uint64_t>(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+}
+
+int AsciiMetrics::AddStage(const char* name)
+{
+	m_names.push_back(name);
+	m_stages.emplace_back(new AsciiHistogram());
+	return static_cast<int>(m_stages.size()) - 1;
+}
+
+void AsciiMetrics::Record(int stage, uint64_t nanoseconds)
+{
+	if (stage >= 0 && stage < static_cast<int>(m_stages.size()))
+		m_stages[stage]->Record(nanoseconds);
+}
+
+void AsciiMetrics::EndFrame(uint64_t nanoseconds)
+{
+	m_frameTime.Record(nanoseconds);
+	m_frames.fetch_add(1, std::memory_order_relaxed);
+	uint64_t budget = m_budget.load(std::memory_order_relaxed);
+	if (budget && nanoseconds > budget)
+		m_late.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AsciiMetrics::AddDropped(uint64_t frames)
+{
+	m_dropped.fetch_add(frames, std::memory_order_relaxed);
+}
+
+void AsciiMetrics::SetFrameBudget(double seconds)
+{
+	m_budget.store(seconds > 0.0 ? static_cast<uint64_t>(seconds * 1e9) : 0, std::memory_order_relaxed);
+}
+
+void AsciiMetrics::Snapshot(AsciiMetricsSnapshot& snapshot)
+{
+	using namespace std::chrono;
+	uint64_t now = Now();
+	snapshot.timestamp = duration<double>(system_clock::now().time_since_epoch()).count();
+	snapshot.intervalSeconds = (now - m_lastSnapshot) / 1e9;
+	m_lastSnapshot = now;
+
+	snapshot.frames = m_frames.exchange(0, std::memory_order_relaxed);
+	snapshot.dropped = m_dropped.exchange(0, std::memory_order_relaxed);
+	snapshot.late = m_late.exchange(0, std::memory_order_relaxed);
+	snapshot.frameTime = m_frameTime.Drain();
+	snapshot.stages.resize(m_stages.size());
+	for (size_t i = 0; i < m_stages.size(); ++i) {
+		snapshot.stages[i].name = m_names[i];
+		snapshot.stages[i].time = m_stages[i]->Drain();
+	}
+}
+
+//------------------------------------------------------------
+// Output
+//------------------------------------------------------------
+static void AppendFormat(std::string& out, const char* format, ...)
+{
+	char buffer[256];
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+	if (length > 0)
+		out.append(buffer, length < static_cast<int>(sizeof(buffer)) ? length : sizeof(buffer) - 1);
+}
+
+static void AppendSummaryJson(std::string& out, const AsciiHistogram::Summary& s)
+{
+	AppendFormat(out, "{\"count\":%llu,\"p50_us\":%.3f,\"p95_us\":%.3f,\"p99_us\":%.3f,\"max_us\":%.3f,\"mean_us\":%.3f}",
+		static_cast<unsigned long long>(s.count), s.p50 / 1e3, s.p95 / 1e3, s.p99 / 1e3, s.max / 1e3, s.mean / 1e3);
+}
+
+void FormatAsciiMetricsJson(const AsciiMetricsSnapshot& snapshot, std::string& out)
+{
+	double fps = snapshot.intervalSeconds > 0.0 ? snapshot.frames / snapshot.intervalSeconds : 0.0;
+	AppendFormat(out, "{\"time\":%.3f,\"interval_s\":%.3f,\"frames\":%llu,\"fps\":%.2f,\"dropped\":%llu,\"late\":%llu,\"frame\":",
+		snapshot.timestamp, snapshot.intervalSeconds, static_cast<unsigned long long>(snapshot.frames), fps,
+		static_cast<unsigned long long>(snapshot.dropped), static_cast<unsigned long long>(snapshot.late));
+	AppendSummaryJson(out, snapshot.frameTime);
+	out += ",\"stages\":{";
+	for (size_t i = 0; i < snapshot.stages.size(); ++i) {
+		// Stage names are identifiers chosen by the program, no escaping needed
+		AppendFormat(out, "%s\"%s\":", i ? "," : "", snapshot.stages[i].name.c_str());
+		AppendSummaryJson(out, snapshot.stages[i].time);
+	}
+	out += "}}";
+}
+
+static void AppendSummaryCsv(std::string& out, const AsciiMetricsSnapshot& snapshot, const char* name,
+	const AsciiHistogram::Summary& s)
+{
+	AppendFormat(out, "%.3f,%.3f,%s,%llu,%.3f,%.3f,%.3f,%.3f,%.3f,%llu,%llu,%llu\n",
+		snapshot.timestamp, snapshot.intervalSeconds, name, static_cast<unsigned long long>(s.count),
+		s.p50 / 1e3, s.p95 / 1e3, s.p99 / 1e3, s.max / 1e3, s.mean / 1e3,
+		static_cast<unsigned long long>(snapshot.frames), static_cast<unsigned long long>(snapshot.dropped),
+		static_cast<unsigned long long>(snapshot.late));
+}
+
+void FormatAsciiMetricsCsv(const AsciiMetricsSnapshot& snapshot, bool header, std::string& out)
+{
+	if (header)
+		out += "time,interval_s,stage,count,p50_us,p95_us,p99_us,max_us,mean_us,frames,dropped,late\n";
+	AppendSummaryCsv(out, snapshot, "frame", snapshot.frameTime);
+	for (const AsciiStageSummary& stage : snapshot.stages)
+		AppendSummaryCsv(out, snapshot, stage.name.c_str(), stage.time);
+}
+
+bool AppendAsciiMetricsFile(const char* path, const AsciiMetricsSnapshot& snapshot)
+{
+	if (!path)
+		return false;
+	size_t length = strlen(path);
+	bool json = (length >= 5 && !strcmp(path + length - 5, ".json")) || (length >= 6 && !strcmp(path + length - 6, ".jsonl"));
+
+	FILE* file = fopen(path, "ab");
+	if (!file)
+		return false;
+	// Appending starts at the end, so an empty file is a new one
+	fseek(file, 0, SEEK_END);
+	bool isNew = ftell(file) == 0;
+
+	std::string text;
+	if (json) {
+		FormatAsciiMetricsJson(snapshot, text);
+		text += '\n';
+	}
+	else {
+		FormatAsciiMetricsCsv(snapshot, isNew, text);
+	}
+	bool ok = fwrite(text.data(), 1, text.size(), file) == text.size();
+	return fclose(file) == 0 && ok;
+}
@@ -0,0 +1,126 @@
+﻿// AsciiMetrics.h : Frame-time histograms per pipeline stage.
+//
+// Every stage (capture, convert, draw ...) records its duration into an
+// HDR-style histogram: 16 linear sub-buckets per power of two, so any
+// value from 1 ns to hours lands in a bucket within ~6% of it, in fixed
+// memory. Recording is a relaxed atomic add, safe and cheap from any
+// number of threads. Snapshot() turns the counts since the last snapshot
+// into p50/p95/p99/max per stage, which can be written as JSON or CSV.
+
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class AsciiHistogram
+{
+public:
+    static const int SUB_BUCKET_BITS = 4;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const int BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    AsciiHistogram();
+
+    void Record(uint64_t value);
+
+    // Summary of everything recorded since the last Drain, which starts
+    // over. Values recorded while draining go to one side or the other.
+    struct Summary
+    {
+        uint64_t count = 0;
+        uint64_t p50 = 0;
+        uint64_t p95 = 0;
+        uint64_t p99 = 0;
+        uint64_t max = 0;
+        double mean = 0.0;
+    };
+    Summary Drain();
+
+    static int GetBucket(uint64_t value);
+    // Middle of the values that share a bucket
+    static uint64_t GetBucketValue(int bucket);
+
+private:
+    std::unique_ptr<std::atomic<uint64_t>[]> m_counts;
+    std::atomic<uint64_t> m_sum{ 0 };
+    std::atomic<uint64_t> m_max{ 0 };
+};
+
+// Durations are in nanoseconds
+struct AsciiStageSummary
+{
+    std::string name;
+    AsciiHistogram::Summary time;
+};
+
+struct AsciiMetricsSnapshot
+{
+    double timestamp = 0.0;       // Unix time in seconds
+    double intervalSeconds = 0.0; // Since the previous snapshot
+    uint64_t frames = 0;
+    uint64_t dropped = 0;         // Source frames that were never converted
+    uint64_t late = 0;            // Frames over the frame budget
+    std::vector<AsciiStageSummary> stages;
+    AsciiHistogram::Summary frameTime; // Whole frames, EndFrame to EndFrame work
+};
+
+class AsciiMetrics
+{
+public:
+    AsciiMetrics();
+
+    // Stages are added up front, before any thread records into them.
+    // Returns the index Record takes.
+    int AddStage(const char* name);
+
+    void Record(int stage, uint64_t nanoseconds);
+
+    // Ends a frame that took nanoseconds of work in total; frames over
+    // the budget (0 = none) count as late
+    void EndFrame(uint64_t nanoseconds);
+    void AddDropped(uint64_t frames);
+    void SetFrameBudget(double seconds);
+
+    // Everything since the previous snapshot; the counters start over
+    void Snapshot(AsciiMetricsSnapshot& snapshot);
+
+    static uint64_t Now(); // Steady clock in nanoseconds
+
+private:
+    std::vector<std::string> m_names;
+    std::vector<std::unique_ptr<AsciiHistogram>> m_stages;
+    AsciiHistogram m_frameTime;
+    std::atomic<uint64_t> m_frames{ 0 };
+    std::atomic<uint64_t> m_dropped{ 0 };
+    std::atomic<uint64_t> m_late{ 0 };
+    std::atomic<uint64_t> m_budget{ 0 };
+    uint64_t m_lastSnapshot = 0;
+};
+
+// Times a scope into one stage
+class AsciiStageTimer
+{
+public:
+    AsciiStageTimer(AsciiMetrics& metrics, int stage) : m_metrics(metrics), m_stage(stage), m_start(AsciiMetrics::Now()) {}
+    ~AsciiStageTimer() { m_metrics.Record(m_stage, AsciiMetrics::Now() - m_start); }
+
+    AsciiStageTimer(const AsciiStageTimer&) = delete;
+    AsciiStageTimer& operator=(const AsciiStageTimer&) = delete;
+
+private:
+    AsciiMetrics& m_metrics;
+    int m_stage;
+    uint64_t m_start;
+};
+
+// One JSON object per snapshot, times in microseconds, no trailing newline
+void FormatAsciiMetricsJson(const AsciiMetricsSnapshot& snapshot, std::string& out);
+
+// One CSV row per stage plus a "frame" row; header adds the column names first
+void FormatAsciiMetricsCsv(const AsciiMetricsSnapshot& snapshot, bool header, std::string& out);
+
+// Appends the snapshot to path: JSON lines for .json/.jsonl, CSV
+// otherwise, with the header when the file is new. False on I/O errors.
+bool AppendAsciiMetricsFile(const char* path, const AsciiMetricsSnapshot& snapshot);
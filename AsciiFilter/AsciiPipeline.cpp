@@ -0,0 +1,216 @@
+﻿#include "AsciiPipeline.h"
+#include "AsciiSpscQueue.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+static double NowSeconds()
+{
+	using namespace std::chrono;
+	return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Spins briefly, then yields, then sleeps, so an idle stage neither adds
+// latency nor burns a core
+static void Backoff(int& attempts)
+{
+	if (attempts < 64)
+		std::this_thread::yield();
+	else
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+	++attempts;
+}
+
+//------------------------------------------------------------
+// Queue with depth statistics, updated by its producer only
+//------------------------------------------------------------
+struct AsciiPipelineQueue
+{
+	explicit AsciiPipelineQueue(size_t capacity) : queue(capacity) {}
+
+	AsciiSpscQueue<AsciiStreamFrame*> queue;
+	uint64_t pushes = 0;
+	uint64_t depthSum = 0;
+	size_t maxDepth = 0;
+};
+
+// Blocking push; returns the seconds spent waiting for room
+static double Push(AsciiPipelineQueue& q, AsciiStreamFrame* frame)
+{
+	size_t depth = q.queue.GetSize();
+	q.pushes++;
+	q.depthSum += depth;
+	q.maxDepth = depth > q.maxDepth ? depth : q.maxDepth;
+
+	if (q.queue.TryPush(frame))
+		return 0.0;
+	double start = NowSeconds();
+	for (int attempts = 0; !q.queue.TryPush(frame);)
+		Backoff(attempts);
+	return NowSeconds() - start;
+}
+
+// Blocking pop; returns the seconds spent waiting for a frame
+static double Pop(AsciiPipelineQueue& q, AsciiStreamFrame*& frame)
+{
+	if (q.queue.TryPop(frame))
+		return 0.0;
+	double start = NowSeconds();
+	for (int attempts = 0; !q.queue.TryPop(frame);)
+		Backoff(attempts);
+	return NowSeconds() - start;
+}
+
+static AsciiQueueStats GetQueueStats(const char* name, const AsciiPipelineQueue& q)
+{
+	AsciiQueueStats stats;
+	stats.name = name;
+	stats.capacity = static_cast<int>(q.queue.GetCapacity());
+	stats.maxDepth = static_cast<int>(q.maxDepth);
+	stats.averageDepth = q.pushes ? static_cast<double>(q.depthSum) / q.pushes : 0.0;
+	return stats;
+}
+
+//------------------------------------------------------------
+// Pipeline. A null frame marks the end of the stream.
+//------------------------------------------------------------
+bool RunAsciiPipeline(const AsciiPipelineOptions& options,
+	const AsciiFrameSource& source, const AsciiFrameSink& sink,
+	AsciiPipelineStats& stats)
+{
+	const int workers = options.convertWorkers > 1 ? options.convertWorkers : 1;
+	const size_t depth = options.queueDepth > 1 ? static_cast<size_t>(options.queueDepth) : 2;
+
+	// Enough frames to fill every queue, plus one in each stage
+	const size_t frameCount = depth * (workers * 2) + workers + 2;
+	std::vector<std::unique_ptr<AsciiStreamFrame>> frames;
+	AsciiPipelineQueue freeFrames(frameCount);
+	for (size_t i = 0; i < frameCount; ++i) {
+		frames.emplace_back(new AsciiStreamFrame());
+		freeFrames.queue.TryPush(frames.back().get());
+	}
+
+	std::vector<std::unique_ptr<AsciiPipelineQueue>> decoded, converted;
+	for (int i = 0; i < workers; ++i) {
+		decoded.emplace_back(new AsciiPipelineQueue(depth));
+		converted.emplace_back(new AsciiPipelineQueue(depth));
+	}
+
+	// Workers converting side by side must not share the thread pool
+	int poolThreads = GetAsciiThreadCount();
+	if (workers > 1)
+		SetAsciiThreadCount(1);
+	PrepareAsciiConversion();
+
+	std::vector<AsciiStageStats> stageStats(workers + 2);
+	stageStats[0].name = "decode";
+	for (int i = 0; i < workers; ++i)
+		stageStats[i + 1].name = workers > 1 ? "convert " + std::to_string(i) : "convert";
+	stageStats[workers + 1].name = "encode";
+
+	AsciiMetrics* metrics = options.metrics;
+	int decodeStage = metrics ? metrics->AddStage("decode") : -1;
+	int convertStage = metrics ? metrics->AddStage("convert") : -1;
+	int encodeStage = metrics ? metrics->AddStage("encode") : -1;
+
+	std::atomic<bool> stopped(false);
+	double start = NowSeconds();
+
+	std::thread decoder([&]() {
+		AsciiStageStats& s = stageStats[0];
+		for (uint64_t index = 0; !stopped.load(std::memory_order_relaxed); ++index) {
+			AsciiStreamFrame* frame = nullptr;
+			s.outputStallSeconds += Pop(freeFrames, frame);
+
+			double busy = NowSeconds();
+			frame->index = index;
+			bool ok = source(*frame);
+			double elapsed = NowSeconds() - busy;
+			s.busySeconds += elapsed;
+			frame->workTime = static_cast<uint64_t>(elapsed * 1e9);
+			if (metrics && ok)
+				metrics->Record(decodeStage, frame->workTime);
+			if (!ok)
+				break; // The frame stays out of circulation, frames owns it
+			s.frames++;
+			s.outputStallSeconds += Push(*decoded[index % workers], frame);
+		}
+		for (int i = 0; i < workers; ++i)
+			s.outputStallSeconds += Push(*decoded[i], nullptr);
+	});
+
+	std::vector<std::thread> converters;
+	for (int w = 0; w < workers; ++w) {
+		converters.emplace_back([&, w]() {
+			AsciiStageStats& s = stageStats[w + 1];
+			for (;;) {
+				AsciiStreamFrame* frame = nullptr;
+				s.inputStallSeconds += Pop(*decoded[w], frame);
+				if (frame) {
+					double busy = NowSeconds();
+					const AsciiImage& image = frame->image;
+					AsciiRect region = { 0, 0, image.width, image.height };
+					ConvertRegionToAscii(image.View(), region, options.geometry, frame->cells, frame->cols, frame->rows);
+					double elapsed = NowSeconds() - busy;
+					s.busySeconds += elapsed;
+					frame->workTime += static_cast<uint64_t>(elapsed * 1e9);
+					if (metrics)
+						metrics->Record(convertStage, static_cast<uint64_t>(elapsed * 1e9));
+					s.frames++;
+				}
+				s.outputStallSeconds += Push(*converted[w], frame);
+				if (!frame)
+					break;
+			}
+		});
+	}
+
+	// The encoder runs on the calling thread; after a stop it keeps
+	// draining so no stage is left blocked on a full queue
+	AsciiStageStats& encodeStats = stageStats[workers + 1];
+	for (uint64_t index = 0;; ++index) {
+		AsciiStreamFrame* frame = nullptr;
+		encodeStats.inputStallSeconds += Pop(*converted[index % workers], frame);
+		if (!frame)
+			break;
+
+		if (!stopped.load(std::memory_order_relaxed)) {
+			double busy = NowSeconds();
+			if (!sink(*frame))
+				stopped.store(true, std::memory_order_relaxed);
+			double elapsed = NowSeconds() - busy;
+			encodeStats.busySeconds += elapsed;
+			if (metrics) {
+				metrics->Record(encodeStage, static_cast<uint64_t>(elapsed * 1e9));
+				metrics->EndFrame(frame->workTime + static_cast<uint64_t>(elapsed * 1e9));
+			}
+			encodeStats.frames++;
+		}
+		encodeStats.outputStallSeconds += Push(freeFrames, frame);
+	}
+
+	decoder.join();
+	for (std::thread& converter : converters)
+		converter.join();
+	// Worker i ends on its own null, collect the ones after the first
+	for (int i = 0; i < workers; ++i) {
+		AsciiStreamFrame* frame = nullptr;
+		while (converted[i]->queue.TryPop(frame)) {}
+	}
+	if (workers > 1)
+		SetAsciiThreadCount(poolThreads);
+
+	stats.frames = encodeStats.frames;
+	stats.seconds = NowSeconds() - start;
+	stats.stages = stageStats;
+	stats.queues.clear();
+	stats.queues.push_back(GetQueueStats("free", freeFrames));
+	for (int i = 0; i < workers; ++i) {
+		std::string suffix = workers > 1 ? " " + std::to_string(i) : "";
+		stats.queues.push_back(GetQueueStats(("decoded" + suffix).c_str(), *decoded[i]));
+		stats.queues.push_back(GetQueueStats(("converted" + suffix).c_str(), *converted[i]));
+	}
+	return !stopped.load();
+}
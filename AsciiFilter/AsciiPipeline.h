@@ -0,0 +1,81 @@
+﻿// AsciiPipeline.h : Streaming decode -> convert -> encode chain.
+//
+// Each stage runs on its own thread and hands frames to the next through
+// bounded lock-free SPSC queues (AsciiSpscQueue.h), so reading, converting
+// and writing a video overlap. Frames come from a fixed pool and travel
+// back to the decoder once written, so the steady state allocates nothing.
+//
+// With several convert workers, frame i goes to worker i % N and the
+// encoder collects from the workers in the same order: frames are
+// converted in parallel but written in their original order.
+
+#pragma once
+#include "AsciiCore.h"
+#include "AsciiImageIO.h"
+#include "AsciiMetrics.h"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+struct AsciiStreamFrame
+{
+    uint64_t index = 0;             // Position in the stream
+    AsciiImage image;               // Filled by the source
+    std::vector<AsciiCell> cells;   // Filled by the convert stage
+    int cols = 0;
+    int rows = 0;
+    uint64_t workTime = 0;          // Nanoseconds spent on the frame so far
+};
+
+struct AsciiPipelineOptions
+{
+    AsciiGeometry geometry;
+    int queueDepth = 4;     // Frames each queue holds
+    int convertWorkers = 1; // Above 1: frame-parallel conversion, ordered output
+    // Optional per-frame times. RunAsciiPipeline adds "decode", "convert"
+    // and "encode" stages to it and ends a frame once it is written.
+    AsciiMetrics* metrics = nullptr;
+};
+
+// Time a stage spent working and waiting. A stage that mostly waits for
+// input is starved by the one before it, a stage that mostly waits for
+// output is held back by the one after it.
+struct AsciiStageStats
+{
+    std::string name;
+    uint64_t frames = 0;
+    double busySeconds = 0.0;
+    double inputStallSeconds = 0.0;   // Waiting for a frame to work on
+    double outputStallSeconds = 0.0;  // Waiting for room in the next queue
+};
+
+// Depth of a queue, sampled every time a frame is pushed
+struct AsciiQueueStats
+{
+    std::string name;
+    int capacity = 0;
+    int maxDepth = 0;
+    double averageDepth = 0.0;
+};
+
+struct AsciiPipelineStats
+{
+    uint64_t frames = 0;
+    double seconds = 0.0;
+    std::vector<AsciiStageStats> stages;
+    std::vector<AsciiQueueStats> queues;
+};
+
+// Fills frame.image with the next frame, false at the end of the stream
+typedef std::function<bool(AsciiStreamFrame& frame)> AsciiFrameSource;
+// Writes a converted frame, false to stop the stream early
+typedef std::function<bool(const AsciiStreamFrame& frame)> AsciiFrameSink;
+
+// Runs the pipeline until the source ends or the sink stops it, and
+// returns false if the sink stopped it. The conversion uses the thread
+// count set with SetAsciiThreadCount when there is a single convert
+// worker; frame-parallel workers convert on their own thread each.
+bool RunAsciiPipeline(const AsciiPipelineOptions& options,
+    const AsciiFrameSource& source, const AsciiFrameSink& sink,
+    AsciiPipelineStats& stats);
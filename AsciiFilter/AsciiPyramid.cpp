@@ -0,0 +1,119 @@
+﻿#include "AsciiPyramid.h"
+#include "AsciiKernels.h"
+#include "AsciiThreadPool.h"
+
+// Blocks up to this size keep their channel sums within 32 bits
+static const int64_t ASCII_PYRAMID_MAX_BLOCK_PIXELS = int64_t(1) << 24;
+
+static void RunRows(int rows, AsciiTaskRef task)
+{
+	if (AsciiThreadPool* pool = GetAsciiThreadPool()) {
+		pool->ParallelFor(rows, task);
+		return;
+	}
+	for (int row = 0; row < rows; ++row)
+		task(row);
+}
+
+//------------------------------------------------------------
+// Multi-resolution conversion
+//------------------------------------------------------------
+void ConvertRegionToAsciiPyramid(const AsciiImageView& image,
+	const AsciiRect& region, const AsciiGeometry& geometry, int levelCount,
+	std::vector<AsciiPyramidLevel>& levels)
+{
+	levelCount = levelCount < 1 ? 1 : (levelCount > ASCII_PYRAMID_MAX_LEVELS ? ASCII_PYRAMID_MAX_LEVELS : levelCount);
+	for (int level = 1; level < levelCount; ++level) {
+		int64_t pixels = (static_cast<int64_t>(geometry.blockWidth) << level) * (static_cast<int64_t>(geometry.blockHeight) << level);
+		if (pixels > ASCII_PYRAMID_MAX_BLOCK_PIXELS) {
+			levelCount = level;
+			break;
+		}
+	}
+
+	levels.resize(levelCount);
+	for (int level = 0; level < levelCount; ++level) {
+		levels[level].geometry.blockWidth = geometry.blockWidth << level;
+		levels[level].geometry.blockHeight = geometry.blockHeight << level;
+	}
+
+	AsciiBlockJob job;
+	int cols = 0, rows = 0;
+	if (image.format != AsciiPixelFormat::BGRA8 || GetAsciiGlyphMode() != AsciiGlyphMode::Intensity ||
+		!PrepareAsciiBlockJob(image, region, geometry, job, cols, rows)) {
+		for (AsciiPyramidLevel& level : levels)
+			ConvertRegionToAscii(image, region, level.geometry, level.cells, level.cols, level.rows);
+		return;
+	}
+
+	// Level k + 1 cell (c, r) covers cells 2c, 2c + 1 of rows 2r, 2r + 1
+	// of level k, clipped to the region just like the pixels are
+	size_t sumCount = 0;
+	for (int level = 0; level < levelCount; ++level) {
+		AsciiPyramidLevel& out = levels[level];
+		out.cols = level ? (levels[level - 1].cols + 1) / 2 : cols;
+		out.rows = level ? (levels[level - 1].rows + 1) / 2 : rows;
+		out.cells.resize(static_cast<size_t>(out.cols) * out.rows);
+		sumCount += out.cells.size();
+	}
+
+	// Workers have their own thread_local buffers, hand them ours
+	static thread_local std::vector<AsciiBlockSums> sums;
+	sums.resize(sumCount);
+	AsciiBlockSums* levelSums = sums.data();
+	const wchar_t* palette = job.palette;
+
+	// The only pass over the pixels
+	AsciiSumKernel sumKernel = GetAsciiSumKernel(geometry);
+	AsciiCell* cells = levels[0].cells.data();
+	RunRows(rows, [&](int row) {
+		AsciiBlockSums* rowSums = levelSums + static_cast<size_t>(row) * cols;
+		AsciiCell* rowCells = cells + static_cast<size_t>(row) * cols;
+		sumKernel(job, row, rowSums);
+		for (int col = 0; col < cols; ++col) {
+			const AsciiBlockSums& s = rowSums[col];
+			rowCells[col] = MakeAsciiCell(s.r, s.g, s.b, s.count, palette);
+		}
+	});
+
+	for (int level = 1; level < levelCount; ++level) {
+		const AsciiPyramidLevel& fine = levels[level - 1];
+		AsciiPyramidLevel& coarse = levels[level];
+		const AsciiBlockSums* fineSums = levelSums;
+		AsciiBlockSums* coarseSums = levelSums + fine.cells.size();
+		AsciiCell* coarseCells = coarse.cells.data();
+
+		RunRows(coarse.rows, [&](int row) {
+			const AsciiBlockSums* top = fineSums + static_cast<size_t>(row * 2) * fine.cols;
+			const AsciiBlockSums* bottom = row * 2 + 1 < fine.rows ? top + fine.cols : nullptr;
+			AsciiBlockSums* rowSums = coarseSums + static_cast<size_t>(row) * coarse.cols;
+			AsciiCell* rowCells = coarseCells + static_cast<size_t>(row) * coarse.cols;
+			for (int col = 0; col < coarse.cols; ++col) {
+				int left = col * 2;
+				int right = left + 1 < fine.cols ? left + 1 : left;
+				AsciiBlockSums s = top[left];
+				if (right != left) {
+					s.r += top[right].r;
+					s.g += top[right].g;
+					s.b += top[right].b;
+					s.count += top[right].count;
+				}
+				if (bottom) {
+					s.r += bottom[left].r;
+					s.g += bottom[left].g;
+					s.b += bottom[left].b;
+					s.count += bottom[left].count;
+					if (right != left) {
+						s.r += bottom[right].r;
+						s.g += bottom[right].g;
+						s.b += bottom[right].b;
+						s.count += bottom[right].count;
+					}
+				}
+				rowSums[col] = s;
+				rowCells[col] = MakeAsciiCell(s.r, s.g, s.b, s.count, palette);
+			}
+		});
+		levelSums = coarseSums;
+	}
+}
@@ -0,0 +1,34 @@
+﻿// AsciiPyramid.h : Several output densities from one pass over the pixels.
+//
+// Level 0 uses the given block size and every further level doubles both
+// block dimensions. Only level 0 reads pixels: its blocks are summed by
+// the active SIMD kernel, and each coarser level adds up 2x2 sums of the
+// level below. Another level costs a quarter of the cells of the one
+// before it and no pixel bandwidth.
+
+#pragma once
+#include "AsciiCore.h"
+
+// Most levels one call produces
+static const int ASCII_PYRAMID_MAX_LEVELS = 8;
+
+// One output grid of the pyramid
+struct AsciiPyramidLevel
+{
+    AsciiGeometry geometry; // Block size of this level
+    std::vector<AsciiCell> cells;
+    int cols = 0;
+    int rows = 0;
+};
+
+// Converts the region at levelCount block sizes: geometry, then twice its
+// width and height per level. levels gets one entry per level; levels
+// whose blocks would exceed 2^24 pixels (where channel sums stop fitting
+// in 32 bits) are dropped, and at least one is always produced. Every
+// level holds the same cells as ConvertRegionToAscii with its geometry.
+// BGRA8 in intensity mode takes the single pass. Shape and edge glyphs need
+// detail that the sums don't keep, and the other formats have no sum
+// kernels, so those convert each level separately.
+void ConvertRegionToAsciiPyramid(const AsciiImageView& image,
+    const AsciiRect& region, const AsciiGeometry& geometry, int levelCount,
+    std::vector<AsciiPyramidLevel>& levels);
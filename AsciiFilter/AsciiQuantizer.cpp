@@ -0,0 +1,255 @@
+﻿#include "AsciiQuantizer.h"
+
+#include <algorithm>
+
+static const int ASCII_LUT_BITS = 5;
+static const int ASCII_LUT_SIZE = 1 << (3 * ASCII_LUT_BITS);
+
+static inline int LutIndex(AsciiColor color)
+{
+	return ((AsciiRValue(color) >> 3) << 10) | ((AsciiGValue(color) >> 3) << 5) | (AsciiBValue(color) >> 3);
+}
+
+// Center of the colors that share a table entry
+static inline uint8_t LutChannel(int index, int shift)
+{
+	return static_cast<uint8_t>((((index >> shift) & 31) << 3) | 4);
+}
+
+const char* GetAsciiColorModeName(AsciiColorMode mode)
+{
+	switch (mode) {
+	case AsciiColorMode::TrueColor: return "truecolor";
+	case AsciiColorMode::Ansi16:    return "16";
+	case AsciiColorMode::Xterm256:  return "256";
+	case AsciiColorMode::Adaptive:  return "adaptive";
+	}
+	return "unknown";
+}
+
+//------------------------------------------------------------
+// Fixed palettes
+//------------------------------------------------------------
+static void GetAnsi16Palette(std::vector<AsciiColor>& palette)
+{
+	static const uint8_t colors[16][3] = {
+		{ 0, 0, 0 },       { 128, 0, 0 },     { 0, 128, 0 },     { 128, 128, 0 },
+		{ 0, 0, 128 },     { 128, 0, 128 },   { 0, 128, 128 },   { 192, 192, 192 },
+		{ 128, 128, 128 }, { 255, 0, 0 },     { 0, 255, 0 },     { 255, 255, 0 },
+		{ 0, 0, 255 },     { 255, 0, 255 },   { 0, 255, 255 },   { 255, 255, 255 },
+	};
+	palette.clear();
+	for (const uint8_t* c : colors)
+		palette.push_back(AsciiRgb(c[0], c[1], c[2]));
+}
+
+static void GetXterm256Palette(std::vector<AsciiColor>& palette)
+{
+	GetAnsi16Palette(palette);
+
+	static const uint8_t levels[6] = { 0, 95, 135, 175, 215, 255 };
+	for (int r = 0; r < 6; ++r) {
+		for (int g = 0; g < 6; ++g) {
+			for (int b = 0; b < 6; ++b)
+				palette.push_back(AsciiRgb(levels[r], levels[g], levels[b]));
+		}
+	}
+	for (int i = 0; i < 24; ++i) {
+		uint8_t gray = static_cast<uint8_t>(8 + i * 10);
+		palette.push_back(AsciiRgb(gray, gray, gray));
+	}
+}
+
+//------------------------------------------------------------
+// Quantizer
+//------------------------------------------------------------
+AsciiColorQuantizer::AsciiColorQuantizer()
+{
+	m_lut.assign(ASCII_LUT_SIZE, 0);
+}
+
+void AsciiColorQuantizer::SetMode(AsciiColorMode mode, int adaptiveColors)
+{
+	m_mode = mode;
+	m_adaptiveColors = adaptiveColors < 2 ? 2 : (adaptiveColors > 256 ? 256 : adaptiveColors);
+
+	std::vector<AsciiColor> palette;
+	switch (mode) {
+	case AsciiColorMode::Ansi16:   GetAnsi16Palette(palette); break;
+	case AsciiColorMode::Xterm256: GetXterm256Palette(palette); break;
+	default:                       break; // Adaptive starts empty, TrueColor needs none
+	}
+	SetPalette(palette);
+}
+
+void AsciiColorQuantizer::SetPalette(const std::vector<AsciiColor>& palette)
+{
+	m_palette = palette;
+	std::fill(m_lut.begin(), m_lut.end(), static_cast<uint16_t>(0));
+}
+
+int AsciiColorQuantizer::MapIndex(AsciiColor color)
+{
+	if (m_mode == AsciiColorMode::TrueColor || m_palette.empty())
+		return -1;
+
+	int index = LutIndex(color);
+	uint16_t entry = m_lut[index];
+	if (entry == 0) {
+		// Nearest palette color to the center of the table cell
+		int r = LutChannel(index, 10), g = LutChannel(index, 5), b = LutChannel(index, 0);
+		uint32_t bestDistance = 0xFFFFFFFFu;
+		for (size_t i = 0; i < m_palette.size(); ++i) {
+			int dr = r - AsciiRValue(m_palette[i]);
+			int dg = g - AsciiGValue(m_palette[i]);
+			int db = b - AsciiBValue(m_palette[i]);
+			uint32_t distance = static_cast<uint32_t>(dr * dr + dg * dg + db * db);
+			if (distance < bestDistance) {
+				bestDistance = distance;
+				entry = static_cast<uint16_t>(i + 1);
+			}
+		}
+		m_lut[index] = entry;
+	}
+	return entry - 1;
+}
+
+AsciiColor AsciiColorQuantizer::Map(AsciiColor color)
+{
+	int index = MapIndex(color);
+	return index < 0 ? color : m_palette[index];
+}
+
+void AsciiColorQuantizer::Quantize(const std::vector<AsciiCell>& in, std::vector<AsciiCell>& out)
+{
+	out.resize(in.size());
+	if (m_mode == AsciiColorMode::TrueColor) {
+		std::copy(in.begin(), in.end(), out.begin());
+		return;
+	}
+	if (m_mode == AsciiColorMode::Adaptive)
+		BuildPalette(in);
+
+	for (size_t i = 0; i < in.size(); ++i) {
+		out[i].ch = in[i].ch;
+		out[i].textColor = Map(in[i].textColor);
+		out[i].bgColor = Map(in[i].bgColor);
+	}
+}
+
+//------------------------------------------------------------
+// Median cut: split the box with the widest channel range at its
+// weighted median until there are enough boxes, then average each box
+//------------------------------------------------------------
+struct AsciiColorBin
+{
+	uint16_t index;
+	uint32_t count;
+};
+
+struct AsciiColorBox
+{
+	int begin;
+	int end;
+	int axis;  // Shift of the widest channel: 10 = R, 5 = G, 0 = B
+	int range; // Extent along that channel
+};
+
+static void MeasureBox(const std::vector<AsciiColorBin>& bins, AsciiColorBox& box)
+{
+	int lo[3] = { 31, 31, 31 }, hi[3] = { 0, 0, 0 };
+	for (int i = box.begin; i < box.end; ++i) {
+		for (int c = 0; c < 3; ++c) {
+			int v = (bins[i].index >> (10 - c * 5)) & 31;
+			lo[c] = v < lo[c] ? v : lo[c];
+			hi[c] = v > hi[c] ? v : hi[c];
+		}
+	}
+	box.axis = 10;
+	box.range = hi[0] - lo[0];
+	for (int c = 1; c < 3; ++c) {
+		if (hi[c] - lo[c] > box.range) {
+			box.axis = 10 - c * 5;
+			box.range = hi[c] - lo[c];
+		}
+	}
+}
+
+void AsciiColorQuantizer::BuildPalette(const std::vector<AsciiCell>& cells)
+{
+	if (m_mode != AsciiColorMode::Adaptive)
+		return;
+
+	m_histogram.assign(ASCII_LUT_SIZE, 0);
+	for (const AsciiCell& cell : cells) {
+		m_histogram[LutIndex(cell.textColor)]++;
+		m_histogram[LutIndex(cell.bgColor)]++;
+	}
+
+	// Scratch kept across frames so a warmed up quantizer does not allocate
+	static thread_local std::vector<AsciiColorBin> bins;
+	static thread_local std::vector<AsciiColorBox> boxes;
+	static thread_local std::vector<AsciiColor> palette;
+	bins.clear();
+	boxes.clear();
+	palette.clear();
+	for (int i = 0; i < ASCII_LUT_SIZE; ++i) {
+		if (m_histogram[i])
+			bins.push_back({ static_cast<uint16_t>(i), m_histogram[i] });
+	}
+
+	if (!bins.empty()) {
+		AsciiColorBox all = { 0, static_cast<int>(bins.size()), 10, 0 };
+		MeasureBox(bins, all);
+		boxes.push_back(all);
+	}
+
+	while (static_cast<int>(boxes.size()) < m_adaptiveColors) {
+		// Widest box that still holds more than one color
+		int widest = -1;
+		for (size_t i = 0; i < boxes.size(); ++i) {
+			if (boxes[i].end - boxes[i].begin > 1 && (widest < 0 || boxes[i].range > boxes[widest].range))
+				widest = static_cast<int>(i);
+		}
+		if (widest < 0)
+			break;
+
+		AsciiColorBox box = boxes[widest];
+		int axis = box.axis;
+		std::sort(bins.begin() + box.begin, bins.begin() + box.end, [axis](const AsciiColorBin& a, const AsciiColorBin& b) {
+			return ((a.index >> axis) & 31) < ((b.index >> axis) & 31);
+		});
+
+		uint64_t total = 0;
+		for (int i = box.begin; i < box.end; ++i)
+			total += bins[i].count;
+		uint64_t half = 0;
+		int split = box.begin + 1;
+		for (int i = box.begin; i < box.end - 1; ++i) {
+			half += bins[i].count;
+			split = i + 1;
+			if (half * 2 >= total)
+				break;
+		}
+
+		AsciiColorBox lower = { box.begin, split, 10, 0 };
+		AsciiColorBox upper = { split, box.end, 10, 0 };
+		MeasureBox(bins, lower);
+		MeasureBox(bins, upper);
+		boxes[widest] = lower;
+		boxes.push_back(upper);
+	}
+
+	for (const AsciiColorBox& box : boxes) {
+		uint64_t sumR = 0, sumG = 0, sumB = 0, count = 0;
+		for (int i = box.begin; i < box.end; ++i) {
+			sumR += static_cast<uint64_t>(LutChannel(bins[i].index, 10)) * bins[i].count;
+			sumG += static_cast<uint64_t>(LutChannel(bins[i].index, 5)) * bins[i].count;
+			sumB += static_cast<uint64_t>(LutChannel(bins[i].index, 0)) * bins[i].count;
+			count += bins[i].count;
+		}
+		palette.push_back(AsciiRgb(static_cast<uint8_t>(sumR / count), static_cast<uint8_t>(sumG / count),
+			static_cast<uint8_t>(sumB / count)));
+	}
+	SetPalette(palette);
+}
@@ -0,0 +1,58 @@
+﻿// AsciiQuantizer.h : Reduces cell colors to a small palette.
+//
+// Averaged background colors differ in nearly every cell, which splits
+// every row into one draw call per character. Snapping text and background
+// colors to a palette makes neighbouring cells share colors again so they
+// can be drawn as one run (see AsciiRuns.h).
+//
+// Colors are looked up in a 32x32x32 table indexed by the top five bits of
+// each channel. Entries are filled on first use and reset whenever the
+// palette changes, so even the adaptive per-frame palette only pays for
+// the colors that actually occur.
+
+#pragma once
+#include "AsciiCore.h"
+
+enum class AsciiColorMode
+{
+    TrueColor,  // No quantization
+    Ansi16,     // The 16 standard console colors
+    Xterm256,   // xterm 256 colors: the 16 above, a 6x6x6 cube and 24 grays
+    Adaptive,   // Median cut palette built from every frame
+};
+
+const char* GetAsciiColorModeName(AsciiColorMode mode);
+
+class AsciiColorQuantizer
+{
+public:
+    AsciiColorQuantizer();
+
+    // adaptiveColors is the palette size in Adaptive mode (2..256)
+    void SetMode(AsciiColorMode mode, int adaptiveColors = 16);
+    AsciiColorMode GetMode() const { return m_mode; }
+
+    // Median cut over the text and background colors of cells. Only does
+    // something in Adaptive mode; Quantize calls it for every frame.
+    void BuildPalette(const std::vector<AsciiCell>& cells);
+
+    // Copy of in with both colors of every cell replaced by the nearest
+    // palette entry. In TrueColor mode out is a plain copy.
+    void Quantize(const std::vector<AsciiCell>& in, std::vector<AsciiCell>& out);
+
+    // Nearest palette entry, and its index for front ends that emit
+    // palette indices (e.g. ANSI escape codes). Index is -1 in TrueColor.
+    AsciiColor Map(AsciiColor color);
+    int MapIndex(AsciiColor color);
+
+    const std::vector<AsciiColor>& GetPalette() const { return m_palette; }
+
+private:
+    void SetPalette(const std::vector<AsciiColor>& palette);
+
+    AsciiColorMode m_mode = AsciiColorMode::TrueColor;
+    int m_adaptiveColors = 16;
+    std::vector<AsciiColor> m_palette;
+    std::vector<uint16_t> m_lut;       // 32^3 entries of palette index + 1, 0 = not looked up yet
+    std::vector<uint32_t> m_histogram; // Scratch for BuildPalette, 32^3 bins
+};
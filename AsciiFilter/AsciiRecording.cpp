@@ -0,0 +1,309 @@
+﻿#include "AsciiRecording.h"
+#include "AsciiMetrics.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char ASCII_RECORDING_MAGIC[8] = { 'A', 'S', 'C', 'I', 'I', 'R', 'E', 'C' };
+static const char ASCII_RECORDING_INDEX_MAGIC[8] = { 'A', 'S', 'C', 'I', 'I', 'I', 'D', 'X' };
+
+static void PutU32(std::string& out, uint32_t value)
+{
+	for (int i = 0; i < 4; ++i)
+		out += static_cast<char>(value >> (i * 8));
+}
+
+static void PutU64(std::string& out, uint64_t value)
+{
+	for (int i = 0; i < 8; ++i)
+		out += static_cast<char>(value >> (i * 8));
+}
+
+static uint32_t GetU32(const uint8_t* p)
+{
+	return p[0] | (static_cast<uint32_t>(p[1]) << 8) | (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static uint64_t GetU64(const uint8_t* p)
+{
+	return GetU32(p) | (static_cast<uint64_t>(GetU32(p + 4)) << 32);
+}
+
+static void PutEntry(std::string& out, uint64_t timestamp, uint64_t offset, uint32_t keyframe, uint32_t size)
+{
+	PutU64(out, timestamp);
+	PutU64(out, offset);
+	PutU32(out, keyframe);
+	PutU32(out, size);
+}
+
+//------------------------------------------------------------
+// Writer
+//------------------------------------------------------------
+bool AsciiRecordingWriter::Open(const char* path, const AsciiRecordingOptions& options)
+{
+	Close();
+	m_file = fopen(path, "wb");
+	if (!m_file)
+		return false;
+	// Records are small and many; hand them to the OS in large writes
+	setvbuf(m_file, nullptr, _IOFBF, 1 << 20);
+
+	m_options = options;
+	m_stats = AsciiRecordingStats();
+	m_encoder.Reset();
+	m_encoder.SetRunLength(options.runLength);
+	m_index.clear();
+	m_keyframe = 0;
+
+	std::string header(ASCII_RECORDING_MAGIC, sizeof(ASCII_RECORDING_MAGIC));
+	PutU32(header, ASCII_RECORDING_VERSION);
+	PutU32(header, 0);
+	m_ok = fwrite(header.data(), 1, header.size(), m_file) == header.size();
+	m_stats.bytes = header.size();
+	return m_ok;
+}
+
+bool AsciiRecordingWriter::WriteFrame(const std::vector<AsciiCell>& cells, int cols, int rows, uint64_t timestamp)
+{
+	if (!m_file)
+		return false;
+	uint64_t start = AsciiMetrics::Now();
+
+	if (m_stats.frames == 0)
+		m_start = timestamp;
+	uint64_t time = timestamp > m_start ? timestamp - m_start : 0;
+	time = time > m_lastTime ? time : m_lastTime;
+	m_lastTime = time;
+
+	uint32_t frame = static_cast<uint32_t>(m_stats.frames);
+	bool keyframeDue = m_options.keyframeInterval > 0 && frame - m_keyframe >= static_cast<uint32_t>(m_options.keyframeInterval);
+	m_record.clear();
+	PutU64(m_record, time);
+	if (m_encoder.Encode(cells, cols, rows, keyframeDue || frame == 0, m_record) == AsciiPacketType::Keyframe) {
+		m_keyframe = frame;
+		++m_stats.keyframes;
+	}
+
+	PutEntry(m_index, time, m_stats.bytes, m_keyframe, static_cast<uint32_t>(m_record.size()));
+	m_ok &= fwrite(m_record.data(), 1, m_record.size(), m_file) == m_record.size();
+	m_stats.bytes += m_record.size();
+	++m_stats.frames;
+	m_stats.encodeTime += AsciiMetrics::Now() - start;
+	return m_ok;
+}
+
+bool AsciiRecordingWriter::Close()
+{
+	if (!m_file)
+		return false;
+
+	// The index starts 8 byte aligned, so it could be read in place
+	std::string tail((8 - m_stats.bytes % 8) % 8, '\0');
+	uint64_t indexOffset = m_stats.bytes + tail.size();
+	tail += m_index;
+	PutU64(tail, indexOffset);
+	PutU64(tail, m_stats.frames);
+	tail.append(ASCII_RECORDING_INDEX_MAGIC, sizeof(ASCII_RECORDING_INDEX_MAGIC));
+	m_ok &= fwrite(tail.data(), 1, tail.size(), m_file) == tail.size();
+	m_stats.bytes += tail.size();
+
+	m_ok &= fclose(m_file) == 0;
+	m_file = nullptr;
+	return m_ok;
+}
+
+//------------------------------------------------------------
+// Reader
+//------------------------------------------------------------
+#ifdef _WIN32
+static const uint8_t* MapFile(const char* path, size_t& size, void*& mapping)
+{
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return nullptr;
+	LARGE_INTEGER fileSize = {};
+	const uint8_t* data = nullptr;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+		HANDLE map = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (map) {
+			data = static_cast<const uint8_t*>(MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0));
+			if (data) {
+				size = static_cast<size_t>(fileSize.QuadPart);
+				mapping = map;
+			}
+			else {
+				CloseHandle(map);
+			}
+		}
+	}
+	CloseHandle(file);
+	return data;
+}
+
+static void UnmapFile(const uint8_t* data, size_t, void* mapping)
+{
+	UnmapViewOfFile(data);
+	CloseHandle(static_cast<HANDLE>(mapping));
+}
+#else
+static const uint8_t* MapFile(const char* path, size_t& size, void*& mapping)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return nullptr;
+	struct stat info;
+	void* data = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && info.st_size > 0)
+		data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return nullptr;
+	size = static_cast<size_t>(info.st_size);
+	mapping = nullptr;
+	return static_cast<const uint8_t*>(data);
+}
+
+static void UnmapFile(const uint8_t* data, size_t size, void*)
+{
+	munmap(const_cast<uint8_t*>(data), size);
+}
+#endif
+
+bool AsciiRecordingReader::Open(const char* path)
+{
+	Close();
+	m_data = MapFile(path, m_size, m_mapping);
+	if (!m_data)
+		return false;
+	if (m_size < ASCII_RECORDING_HEADER_SIZE || memcmp(m_data, ASCII_RECORDING_MAGIC, sizeof(ASCII_RECORDING_MAGIC)) != 0 ||
+		GetU32(m_data + 8) != ASCII_RECORDING_VERSION) {
+		Close();
+		return false;
+	}
+
+	// Use the trailer's index when it is consistent, else scan the records
+	const uint8_t* trailer = nullptr;
+	if (m_size >= ASCII_RECORDING_HEADER_SIZE + ASCII_RECORDING_TRAILER_SIZE)
+		trailer = m_data + m_size - ASCII_RECORDING_TRAILER_SIZE;
+	if (trailer && memcmp(trailer + 16, ASCII_RECORDING_INDEX_MAGIC, sizeof(ASCII_RECORDING_INDEX_MAGIC)) == 0) {
+		uint64_t offset = GetU64(trailer);
+		uint64_t frames = GetU64(trailer + 8);
+		uint64_t end = static_cast<uint64_t>(trailer - m_data);
+		if (offset >= ASCII_RECORDING_HEADER_SIZE && offset <= end && (end - offset) / ASCII_RECORDING_ENTRY_SIZE == frames &&
+			(end - offset) % ASCII_RECORDING_ENTRY_SIZE == 0) {
+			m_index = m_data + offset;
+			m_frames = static_cast<size_t>(frames);
+		}
+	}
+	if (!m_index)
+		RebuildIndex();
+	return true;
+}
+
+void AsciiRecordingReader::Close()
+{
+	if (m_data)
+		UnmapFile(m_data, m_size, m_mapping);
+	m_data = nullptr;
+	m_size = 0;
+	m_mapping = nullptr;
+	m_index = nullptr;
+	m_rebuilt.clear();
+	m_frames = 0;
+	m_frame = SIZE_MAX;
+	m_decoder.Reset();
+}
+
+void AsciiRecordingReader::RebuildIndex()
+{
+	size_t offset = ASCII_RECORDING_HEADER_SIZE;
+	uint32_t keyframe = 0;
+	bool haveKeyframe = false;
+	for (;;) {
+		if (m_size - offset < 8 + ASCII_PACKET_HEADER_SIZE)
+			break;
+		const uint8_t* packet = m_data + offset + 8;
+		size_t size = AsciiDeltaDecoder::GetPacketSize(packet, m_size - offset - 8);
+		if (size == 0 || size > m_size - offset - 8)
+			break;
+		uint32_t frame = static_cast<uint32_t>(m_frames);
+		if ((packet[3] & ~ASCII_PACKET_RUN_LENGTH) == static_cast<uint8_t>(AsciiPacketType::Keyframe)) {
+			keyframe = frame;
+			haveKeyframe = true;
+		}
+		if (haveKeyframe) {
+			PutEntry(m_rebuilt, GetU64(m_data + offset), offset, keyframe, static_cast<uint32_t>(8 + size));
+			++m_frames;
+		}
+		offset += 8 + size;
+	}
+	m_index = reinterpret_cast<const uint8_t*>(m_rebuilt.data());
+}
+
+uint64_t AsciiRecordingReader::GetTimestamp(size_t frame) const
+{
+	return frame < m_frames ? GetU64(GetEntry(frame)) : 0;
+}
+
+size_t AsciiRecordingReader::FindFrame(uint64_t timestamp) const
+{
+	// First frame after timestamp, then one back
+	size_t low = 0, high = m_frames;
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		if (GetTimestamp(middle) <= timestamp)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low > 0 ? low - 1 : 0;
+}
+
+bool AsciiRecordingReader::ApplyRecord(size_t frame)
+{
+	const uint8_t* entry = GetEntry(frame);
+	uint64_t offset = GetU64(entry + 8);
+	uint32_t size = GetU32(entry + 20);
+	if (size < 8 || offset > m_size || size > m_size - offset)
+		return false;
+	return m_decoder.Decode(m_data + offset + 8, size - 8);
+}
+
+bool AsciiRecordingReader::ReadFrame(size_t frame)
+{
+	if (frame >= m_frames)
+		return false;
+	if (frame == m_frame)
+		return true;
+
+	// Continue from the current frame when it is on the way, else start
+	// at the keyframe. A keyframe after the frame can only come from a
+	// damaged index, and decoding nothing would leave stale cells.
+	size_t keyframe = GetU32(GetEntry(frame) + 16);
+	if (keyframe > frame) {
+		m_frame = SIZE_MAX;
+		return false;
+	}
+	size_t next = m_frame != SIZE_MAX && m_frame < frame && m_frame >= keyframe ? m_frame + 1 : keyframe;
+	for (; next <= frame; ++next) {
+		if (!ApplyRecord(next)) {
+			m_frame = SIZE_MAX;
+			return false;
+		}
+	}
+	m_frame = frame;
+	return true;
+}
@@ -0,0 +1,125 @@
+﻿// AsciiRecording.h : Append-only recordings of cell grids with a seek index.
+//
+// A recording is a header followed by one record per frame: a timestamp
+// and a run-length coded AsciiDelta packet, a keyframe every
+// keyframeInterval frames (and whenever the grid changes size) and deltas
+// in between. Close() appends an index of every frame's timestamp, offset
+// and keyframe and a trailer that points at it. The player maps the file,
+// finds the frame for any time with a binary search over the mapped index
+// and decodes forward from that frame's keyframe. A recording that was
+// never closed has no trailer; the player then rebuilds the index with one
+// pass over the records and drops a torn last record.
+//
+// All integers are little endian.
+//   header   "ASCIIREC", u32 version, u32 reserved
+//   record   u64 timestamp in ns from the first frame, then the packet
+//   index    8 byte aligned; per frame u64 timestamp, u64 record offset,
+//            u32 frame of its keyframe, u32 record size
+//   trailer  u64 index offset, u64 frame count, "ASCIIIDX"
+
+#pragma once
+#include "AsciiCore.h"
+#include "AsciiDelta.h"
+
+#include <cstdio>
+#include <string>
+
+const uint32_t ASCII_RECORDING_VERSION = 1;
+const size_t ASCII_RECORDING_HEADER_SIZE = 16;
+const size_t ASCII_RECORDING_ENTRY_SIZE = 24;
+const size_t ASCII_RECORDING_TRAILER_SIZE = 24;
+
+struct AsciiRecordingOptions
+{
+    int keyframeInterval = 600; // Frames between keyframes, 10 s at 60 fps; bounds the decoding per seek
+    bool runLength = true;
+};
+
+struct AsciiRecordingStats
+{
+    uint64_t frames = 0;
+    uint64_t keyframes = 0;
+    uint64_t bytes = 0;         // Written so far, header and index included
+    uint64_t encodeTime = 0;    // Nanoseconds encoding and writing, all frames
+};
+
+class AsciiRecordingWriter
+{
+public:
+    AsciiRecordingWriter() {}
+    ~AsciiRecordingWriter() { Close(); }
+
+    AsciiRecordingWriter(const AsciiRecordingWriter&) = delete;
+    AsciiRecordingWriter& operator=(const AsciiRecordingWriter&) = delete;
+
+    bool Open(const char* path, const AsciiRecordingOptions& options = AsciiRecordingOptions());
+
+    // Appends a frame shown at timestamp (nanoseconds, any clock that does
+    // not go backwards; the first frame becomes 0)
+    bool WriteFrame(const std::vector<AsciiCell>& cells, int cols, int rows, uint64_t timestamp);
+
+    // Writes the index and closes the file. Returns false when anything
+    // failed to write since Open.
+    bool Close();
+
+    bool IsOpen() const { return m_file != nullptr; }
+    const AsciiRecordingStats& GetStats() const { return m_stats; }
+
+private:
+    FILE* m_file = nullptr;
+    bool m_ok = false;
+    AsciiRecordingOptions m_options;
+    AsciiRecordingStats m_stats;
+    AsciiDeltaEncoder m_encoder;
+    std::string m_record;
+    std::string m_index;       // Entries in file format, written by Close
+    uint64_t m_start = 0;      // Timestamp of the first frame
+    uint64_t m_lastTime = 0;
+    uint32_t m_keyframe = 0;   // Frame of the last keyframe
+};
+
+class AsciiRecordingReader
+{
+public:
+    AsciiRecordingReader() {}
+    ~AsciiRecordingReader() { Close(); }
+
+    AsciiRecordingReader(const AsciiRecordingReader&) = delete;
+    AsciiRecordingReader& operator=(const AsciiRecordingReader&) = delete;
+
+    // Maps the file and its index, rebuilding the index when the
+    // recording was not closed
+    bool Open(const char* path);
+    void Close();
+
+    size_t GetFrameCount() const { return m_frames; }
+    bool HasIndex() const { return m_rebuilt.empty(); }   // False when it was rebuilt
+    uint64_t GetTimestamp(size_t frame) const;
+    uint64_t GetDuration() const { return m_frames ? GetTimestamp(m_frames - 1) : 0; }
+
+    // Last frame shown at or before timestamp, 0 for earlier times
+    size_t FindFrame(uint64_t timestamp) const;
+
+    // Decodes frame into GetCells. The frame after the current one costs
+    // one delta, any other frame decodes forward from its keyframe.
+    bool ReadFrame(size_t frame);
+
+    size_t GetFrame() const { return m_frame; }
+    const std::vector<AsciiCell>& GetCells() const { return m_decoder.GetCells(); }
+    int GetCols() const { return m_decoder.GetCols(); }
+    int GetRows() const { return m_decoder.GetRows(); }
+
+private:
+    const uint8_t* GetEntry(size_t frame) const { return m_index + frame * ASCII_RECORDING_ENTRY_SIZE; }
+    bool ApplyRecord(size_t frame);
+    void RebuildIndex();
+
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+    void* m_mapping = nullptr;         // Platform handle of the mapping
+    const uint8_t* m_index = nullptr;  // In the mapping, or m_rebuilt
+    std::string m_rebuilt;
+    size_t m_frames = 0;
+    size_t m_frame = SIZE_MAX;         // Frame in the decoder
+    AsciiDeltaDecoder m_decoder;
+};
@@ -0,0 +1,81 @@
+﻿#include "AsciiRegions.h"
+#include "AsciiKernels.h"
+#include "AsciiThreadPool.h"
+
+#include <algorithm>
+#include <cwchar>
+
+void BuildAsciiPalette(const wchar_t* ramp, wchar_t* palette)
+{
+	size_t length = ramp ? wcslen(ramp) : 0;
+	for (int i = 0; i < 256; ++i) {
+		if (length == 0) {
+			palette[i] = L' ';
+			continue;
+		}
+		long index = static_cast<long>(i * (length - 1) / 255.0f);
+		palette[i] = ramp[index];
+	}
+}
+
+//------------------------------------------------------------
+// Convert all regions as one batch of cell rows
+//------------------------------------------------------------
+void ConvertRegionsToAscii(const AsciiImageView& image,
+	const std::vector<AsciiCaptureRegion>& regions,
+	std::vector<AsciiCellGrid>& grids)
+{
+	grids.resize(regions.size());
+
+	// Workers have their own thread_local buffers, hand them ours
+	static thread_local std::vector<AsciiBlockJob> jobs;
+	static thread_local std::vector<AsciiRowKernel> kernels;
+	static thread_local std::vector<int> firstRows; // Batch row of each region's row 0, plus the total
+	jobs.resize(regions.size());
+	kernels.resize(regions.size());
+	firstRows.resize(regions.size() + 1);
+
+	int totalRows = 0;
+	for (size_t i = 0; i < regions.size(); ++i) {
+		const AsciiCaptureRegion& request = regions[i];
+		AsciiCellGrid& grid = grids[i];
+		firstRows[i] = totalRows;
+		if (!PrepareAsciiBlockJob(image, request.region, request.geometry, jobs[i], grid.cols, grid.rows)) {
+			grid.cells.clear();
+			continue;
+		}
+		if (request.palette)
+			jobs[i].palette = request.palette;
+		kernels[i] = GetAsciiRowKernel(request.geometry, image.format);
+
+		grid.cells.resize(static_cast<size_t>(grid.cols) * grid.rows);
+		grid.region = jobs[i].region;
+		grid.geometry = request.geometry;
+		grid.format = image.format;
+		grid.glyphVersion = GetAsciiGlyphVersion();
+		totalRows += grid.rows;
+	}
+	firstRows[regions.size()] = totalRows;
+
+	const AsciiBlockJob* jobData = jobs.data();
+	const AsciiRowKernel* kernelData = kernels.data();
+	const int* firstRowData = firstRows.data();
+	AsciiCellGrid* gridData = grids.data();
+	int regionCount = static_cast<int>(regions.size());
+	auto convertRow = [&](int index) {
+		// Last region starting at or before index; empty regions start
+		// where the next one does and are skipped
+		int region = static_cast<int>(std::upper_bound(firstRowData, firstRowData + regionCount, index) - firstRowData) - 1;
+		int row = index - firstRowData[region];
+		AsciiCellGrid& grid = gridData[region];
+		kernelData[region](jobData[region], row, grid.cells.data() + static_cast<size_t>(row) * grid.cols);
+	};
+
+	if (AsciiThreadPool* pool = GetAsciiThreadPool()) {
+		pool->ParallelFor(totalRows, convertRow);
+	}
+	else {
+		for (int index = 0; index < totalRows; ++index)
+			convertRow(index);
+	}
+}
@@ -0,0 +1,33 @@
+﻿// AsciiRegions.h : Several capture regions converted from one frame.
+//
+// Each region has its own rectangle, block size and palette. They are
+// read in place from the shared image view, and the rows of all regions
+// go to the worker pool as one batch, so a small region doesn't leave
+// threads idle while a large one finishes.
+
+#pragma once
+#include "AsciiCore.h"
+
+// One region to convert
+struct AsciiCaptureRegion
+{
+    AsciiRect region = { 0, 0, 0, 0 }; // In image coordinates, clamped to the image
+    AsciiGeometry geometry;
+    // 256 entry intensity -> character table (see BuildAsciiPalette), or
+    // null for the global one. Shape glyph mode picks characters from the
+    // glyph set and ignores it.
+    const wchar_t* palette = nullptr;
+};
+
+// Fills a 256 entry intensity -> character table from a ramp ordered from
+// least to most ink, spread the same way as the global palette. An empty
+// ramp gives all spaces.
+void BuildAsciiPalette(const wchar_t* ramp, wchar_t* palette);
+
+// Converts every region of the image. grids gets one entry per region with
+// the same cells ConvertRegionToAscii would produce for it; an empty
+// region gives an empty grid. Grids reused across frames keep their
+// buffers.
+void ConvertRegionsToAscii(const AsciiImageView& image,
+    const std::vector<AsciiCaptureRegion>& regions,
+    std::vector<AsciiCellGrid>& grids);
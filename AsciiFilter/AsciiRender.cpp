@@ -0,0 +1,188 @@
+﻿#include "AsciiRender.h"
+#include "AsciiFont.h"
+#include "AsciiKernels.h"
+
+#include <cstring>
+
+//------------------------------------------------------------
+// Glyph atlas
+//------------------------------------------------------------
+void AsciiGlyphAtlas::Reset(int cellWidth, int cellHeight)
+{
+	m_cellWidth = cellWidth > 0 ? cellWidth : 0;
+	m_cellHeight = cellHeight > 0 ? cellHeight : 0;
+	m_coverage.assign(static_cast<size_t>(m_cellWidth) * m_cellHeight, 0);
+	memset(m_latin, 0, sizeof(m_latin));
+	m_other.clear();
+}
+
+int AsciiGlyphAtlas::FindGlyph(wchar_t ch) const
+{
+	if (static_cast<uint32_t>(ch) < 256)
+		return m_latin[static_cast<uint32_t>(ch)];
+	auto it = m_other.find(ch);
+	return it != m_other.end() ? it->second : 0;
+}
+
+bool AsciiGlyphAtlas::AddGlyph(wchar_t ch, const uint8_t* coverage, int width, int height, int pitch)
+{
+	if (!coverage || width <= 0 || height <= 0 || m_cellWidth <= 0 || m_cellHeight <= 0)
+		return false;
+
+	int index = FindGlyph(ch);
+	if (index == 0) {
+		index = static_cast<int>(m_coverage.size() / (static_cast<size_t>(m_cellWidth) * m_cellHeight));
+		m_coverage.resize(m_coverage.size() + static_cast<size_t>(m_cellWidth) * m_cellHeight);
+		if (static_cast<uint32_t>(ch) < 256)
+			m_latin[static_cast<uint32_t>(ch)] = index;
+		else
+			m_other[ch] = index;
+	}
+	uint8_t* glyph = m_coverage.data() + static_cast<size_t>(index) * m_cellWidth * m_cellHeight;
+
+	if (width == m_cellWidth && height == m_cellHeight) {
+		for (int y = 0; y < height; ++y)
+			memcpy(glyph + y * width, coverage + static_cast<size_t>(y) * pitch, width);
+		return true;
+	}
+
+	// Resample with 4x4 samples per cell pixel, so scaled glyphs keep
+	// antialiased edges instead of dropping thin strokes
+	for (int y = 0; y < m_cellHeight; ++y) {
+		for (int x = 0; x < m_cellWidth; ++x) {
+			uint32_t sum = 0;
+			for (int sy = 0; sy < 4; ++sy) {
+				int srcY = ((y * 4 + sy) * 2 + 1) * height / (m_cellHeight * 8);
+				const uint8_t* row = coverage + static_cast<size_t>(srcY) * pitch;
+				for (int sx = 0; sx < 4; ++sx)
+					sum += row[((x * 4 + sx) * 2 + 1) * width / (m_cellWidth * 8)];
+			}
+			glyph[y * m_cellWidth + x] = static_cast<uint8_t>((sum + 8) / 16);
+		}
+	}
+	return true;
+}
+
+int AsciiGlyphAtlas::AddBuiltinGlyphs(const char* chars)
+{
+	int added = 0;
+	for (int c = 32; c < 127; ++c) {
+		if (chars && !strchr(chars, c))
+			continue;
+		const uint8_t* rows = GetAsciiFontGlyph(static_cast<wchar_t>(c));
+		if (!rows)
+			continue;
+
+		uint8_t raster[ASCII_FONT_WIDTH * ASCII_FONT_HEIGHT];
+		for (int y = 0; y < ASCII_FONT_HEIGHT; ++y) {
+			for (int x = 0; x < ASCII_FONT_WIDTH; ++x)
+				raster[y * ASCII_FONT_WIDTH + x] = (rows[y] & (0x80 >> x)) ? 255 : 0;
+		}
+		if (AddGlyph(static_cast<wchar_t>(c), raster, ASCII_FONT_WIDTH, ASCII_FONT_HEIGHT, ASCII_FONT_WIDTH))
+			++added;
+	}
+	return added;
+}
+
+const uint8_t* AsciiGlyphAtlas::GetCoverage(wchar_t ch) const
+{
+	return m_coverage.data() + static_cast<size_t>(FindGlyph(ch)) * m_cellWidth * m_cellHeight;
+}
+
+//------------------------------------------------------------
+// Reference glyph blending
+//------------------------------------------------------------
+void BlendGlyphRowScalar(uint8_t* dst, const uint8_t* coverage, int count, uint32_t fg, uint32_t bg)
+{
+	// Bitmap fonts are almost all solid pixels, which need no blending
+	for (int i = 0; i < count; ++i) {
+		if (coverage[i] == 0)
+			memcpy(dst + i * 4, &bg, 4);
+		else if (coverage[i] == 255)
+			memcpy(dst + i * 4, &fg, 4);
+		else
+			AsciiBlendPixel(dst + i * 4, coverage[i], fg, bg);
+	}
+}
+
+//------------------------------------------------------------
+// Cell rendering
+//------------------------------------------------------------
+
+// Draws cells [col0, col1) of one row, already clipped to the buffer width
+static void RenderCellRange(const AsciiCell* rowCells, int row, int col0, int col1,
+	const AsciiGlyphAtlas& atlas, AsciiGlyphBlender blend, uint8_t* pixels, int width, int height, int stride)
+{
+	const int cellWidth = atlas.GetCellWidth();
+	const int cellHeight = atlas.GetCellHeight();
+
+	// Look glyphs and colors up once per cell, not per pixel row
+	thread_local std::vector<const uint8_t*> glyphs;
+	thread_local std::vector<uint32_t> colors;
+	glyphs.resize(col1 - col0);
+	colors.resize(static_cast<size_t>(col1 - col0) * 2);
+	for (int col = col0; col < col1; ++col) {
+		glyphs[col - col0] = atlas.GetCoverage(rowCells[col].ch);
+		colors[(col - col0) * 2] = AsciiBgraPixel(rowCells[col].textColor);
+		colors[(col - col0) * 2 + 1] = AsciiBgraPixel(rowCells[col].bgColor);
+	}
+
+	int y0 = row * cellHeight;
+	int yEnd = y0 + cellHeight < height ? y0 + cellHeight : height;
+	for (int y = y0; y < yEnd; ++y) {
+		uint8_t* line = pixels + static_cast<size_t>(y) * stride;
+		int glyphRow = (y - y0) * cellWidth;
+		for (int col = col0; col < col1; ++col) {
+			int x = col * cellWidth;
+			int count = x + cellWidth < width ? cellWidth : width - x;
+			int i = col - col0;
+			blend(line + x * 4, glyphs[i] + glyphRow, count, colors[i * 2], colors[i * 2 + 1]);
+		}
+	}
+}
+
+void RenderAsciiCells(const std::vector<AsciiCell>& cells, int cols, int rows,
+	const AsciiGlyphAtlas& atlas, uint8_t* pixels, int width, int height, int stride)
+{
+	const int cellWidth = atlas.GetCellWidth();
+	const int cellHeight = atlas.GetCellHeight();
+	if (!pixels || cellWidth <= 0 || cellHeight <= 0 || cols <= 0 || rows <= 0 ||
+		cells.size() < static_cast<size_t>(cols) * rows)
+		return;
+
+	// Clip the grid to the buffer
+	int drawCols = (width + cellWidth - 1) / cellWidth;
+	int drawRows = (height + cellHeight - 1) / cellHeight;
+	drawCols = drawCols < cols ? drawCols : cols;
+	drawRows = drawRows < rows ? drawRows : rows;
+
+	AsciiGlyphBlender blend = GetAsciiGlyphBlender();
+	for (int row = 0; row < drawRows; ++row)
+		RenderCellRange(cells.data() + static_cast<size_t>(row) * cols, row, 0, drawCols, atlas, blend, pixels, width, height, stride);
+}
+
+void RenderAsciiSpans(const std::vector<AsciiCell>& cells, int cols, int rows,
+	const std::vector<AsciiCellSpan>& spans, const AsciiGlyphAtlas& atlas,
+	uint8_t* pixels, int width, int height, int stride)
+{
+	const int cellWidth = atlas.GetCellWidth();
+	const int cellHeight = atlas.GetCellHeight();
+	if (!pixels || cellWidth <= 0 || cellHeight <= 0 || cols <= 0 || rows <= 0 ||
+		cells.size() < static_cast<size_t>(cols) * rows)
+		return;
+
+	int drawCols = (width + cellWidth - 1) / cellWidth;
+	int drawRows = (height + cellHeight - 1) / cellHeight;
+	drawCols = drawCols < cols ? drawCols : cols;
+	drawRows = drawRows < rows ? drawRows : rows;
+
+	AsciiGlyphBlender blend = GetAsciiGlyphBlender();
+	for (const AsciiCellSpan& span : spans) {
+		int col0 = span.col > 0 ? span.col : 0;
+		int col1 = span.col + span.length < drawCols ? span.col + span.length : drawCols;
+		if (span.row < 0 || span.row >= drawRows || col0 >= col1)
+			continue;
+		RenderCellRange(cells.data() + static_cast<size_t>(span.row) * cols, span.row, col0, col1,
+			atlas, blend, pixels, width, height, stride);
+	}
+}
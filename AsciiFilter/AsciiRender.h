@@ -0,0 +1,65 @@
+﻿// AsciiRender.h : Software renderer for cell grids.
+//
+// An AsciiGlyphAtlas holds the coverage of every glyph rasterized once at
+// the cell size. RenderAsciiCells blends the cells straight into a 32-bit
+// BGRA buffer (a DIB section, a frame for AsciiImageIO ...) with the active
+// SIMD kernel, one glyph row at a time, so it needs no platform text API
+// and runs headless.
+
+#pragma once
+#include "AsciiCellDiff.h"
+#include "AsciiCore.h"
+
+#include <unordered_map>
+
+class AsciiGlyphAtlas
+{
+public:
+    // Drops every glyph and sets the cell size the glyphs are stored at
+    void Reset(int cellWidth, int cellHeight);
+
+    // Add a glyph from an 8-bit coverage raster (0 = background, 255 =
+    // ink) of any size; pitch is in bytes. Rasters that do not match the
+    // cell size are resampled. Replaces an existing glyph for ch.
+    bool AddGlyph(wchar_t ch, const uint8_t* coverage, int width, int height, int pitch);
+
+    // Add the characters of chars (every printable ASCII character when
+    // null) from the built-in bitmap font, scaled to the cell size.
+    // Returns the number of glyphs added.
+    int AddBuiltinGlyphs(const char* chars = nullptr);
+
+    int GetCellWidth() const { return m_cellWidth; }
+    int GetCellHeight() const { return m_cellHeight; }
+
+    // cellWidth x cellHeight coverage bytes of ch; characters without a
+    // glyph get the blank one
+    const uint8_t* GetCoverage(wchar_t ch) const;
+
+private:
+    int FindGlyph(wchar_t ch) const;
+
+    int m_cellWidth = 0;
+    int m_cellHeight = 0;
+    std::vector<uint8_t> m_coverage;      // Glyph 0 is blank
+    int m_latin[256] = {};                // Glyph index for ch < 256, 0 = none
+    std::unordered_map<wchar_t, int> m_other;
+};
+
+// Packed BGRA pixel (alpha 255) for a cell color, as the blenders take them
+inline uint32_t AsciiBgraPixel(AsciiColor color)
+{
+    return static_cast<uint32_t>(AsciiBValue(color)) | (static_cast<uint32_t>(AsciiGValue(color)) << 8) |
+        (static_cast<uint32_t>(AsciiRValue(color)) << 16) | 0xFF000000u;
+}
+
+// Draws a cols x rows grid into a width x height BGRA buffer (stride in
+// bytes), cell (col, row) at (col * cellWidth, row * cellHeight) of the
+// atlas. Cells are clipped to the buffer; pixels outside the grid are left
+// alone.
+void RenderAsciiCells(const std::vector<AsciiCell>& cells, int cols, int rows,
+    const AsciiGlyphAtlas& atlas, uint8_t* pixels, int width, int height, int stride);
+
+// Same, but only the cells of spans (see AsciiCellDiff.h)
+void RenderAsciiSpans(const std::vector<AsciiCell>& cells, int cols, int rows,
+    const std::vector<AsciiCellSpan>& spans, const AsciiGlyphAtlas& atlas,
+    uint8_t* pixels, int width, int height, int stride);
@@ -0,0 +1,61 @@
+﻿#include "AsciiRuns.h"
+
+// Appends the runs of cells [col0, col1) of one row
+static void AppendRowRuns(const AsciiCell* rowCells, int row, int col0, int col1, std::vector<AsciiRun>& runs)
+{
+	AsciiRun run = { row, col0, 0, 0, 0 };
+	bool hasText = false;
+
+	for (int col = col0; col < col1; ++col) {
+		const AsciiCell& cell = rowCells[col];
+		bool blank = cell.ch == L' ';
+
+		if (run.length > 0 && cell.bgColor == run.bgColor &&
+			(blank || !hasText || cell.textColor == run.textColor)) {
+			// Same colors, or a blank that only needs the background
+			run.length++;
+		}
+		else {
+			if (run.length > 0)
+				runs.push_back(run);
+			run.col = col;
+			run.length = 1;
+			run.bgColor = cell.bgColor;
+			run.textColor = cell.textColor;
+			hasText = false;
+		}
+
+		if (!blank && !hasText) {
+			run.textColor = cell.textColor;
+			hasText = true;
+		}
+	}
+	if (run.length > 0)
+		runs.push_back(run);
+}
+
+void BuildAsciiRuns(const std::vector<AsciiCell>& cells, int cols, int rows,
+	std::vector<AsciiRun>& runs)
+{
+	runs.clear();
+	if (cells.size() < static_cast<size_t>(cols) * rows)
+		return;
+
+	for (int row = 0; row < rows; ++row)
+		AppendRowRuns(cells.data() + static_cast<size_t>(row) * cols, row, 0, cols, runs);
+}
+
+void BuildAsciiRuns(const std::vector<AsciiCell>& cells, int cols, int rows,
+	const std::vector<AsciiCellSpan>& spans, std::vector<AsciiRun>& runs)
+{
+	runs.clear();
+	if (cells.size() < static_cast<size_t>(cols) * rows)
+		return;
+
+	for (const AsciiCellSpan& span : spans) {
+		int col0 = span.col > 0 ? span.col : 0;
+		int col1 = span.col + span.length < cols ? span.col + span.length : cols;
+		if (span.row >= 0 && span.row < rows && col0 < col1)
+			AppendRowRuns(cells.data() + static_cast<size_t>(span.row) * cols, span.row, col0, col1, runs);
+	}
+}
@@ -0,0 +1,27 @@
+﻿// AsciiRuns.h : Splits cell rows into runs that share their colors.
+//
+// Each run can be drawn with a single text call (one TextOut, one escape
+// sequence ...). A blank cell shows no text color, so it joins any run
+// with the same background; the run takes the text color of its first
+// non-blank cell.
+
+#pragma once
+#include "AsciiCellDiff.h"
+#include "AsciiCore.h"
+
+struct AsciiRun
+{
+    int row;
+    int col;            // First cell of the run
+    int length;         // Number of cells
+    AsciiColor textColor;
+    AsciiColor bgColor;
+};
+
+// Replaces runs with the runs of every row of a cols x rows grid
+void BuildAsciiRuns(const std::vector<AsciiCell>& cells, int cols, int rows,
+    std::vector<AsciiRun>& runs);
+
+// Same, but only for the cells of spans (see AsciiCellDiff.h)
+void BuildAsciiRuns(const std::vector<AsciiCell>& cells, int cols, int rows,
+    const std::vector<AsciiCellSpan>& spans, std::vector<AsciiRun>& runs);
@@ -0,0 +1,80 @@
+﻿#include "AsciiScheduler.h"
+
+#include <chrono>
+
+uint64_t AsciiSteadyClock::Now() const
+{
+	using namespace std::chrono;
+	return static_cast<uint64_t>(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+}
+
+AsciiFrameScheduler::AsciiFrameScheduler(const AsciiClock& clock, const AsciiSchedulerOptions& options)
+	: m_clock(clock)
+{
+	SetOptions(options);
+	m_deadline = m_clock.Now();
+}
+
+void AsciiFrameScheduler::SetOptions(const AsciiSchedulerOptions& options)
+{
+	m_options = options;
+	double fps = options.targetFps > 0.0 ? options.targetFps : 60.0;
+	m_targetInterval = static_cast<uint64_t>(1e9 / fps + 0.5);
+	m_maxInterval = static_cast<uint64_t>(options.maxIdleInterval * 1e9);
+	if (m_maxInterval < m_targetInterval)
+		m_maxInterval = m_targetInterval;
+	m_interval = m_targetInterval;
+	m_unchanged = 0;
+}
+
+uint64_t AsciiFrameScheduler::GetWaitTime() const
+{
+	uint64_t now = m_clock.Now();
+	return m_deadline > now ? m_deadline - now : 0;
+}
+
+int AsciiFrameScheduler::BeginFrame()
+{
+	uint64_t now = m_clock.Now();
+
+	// Deadlines that passed before this one started are dropped, not queued
+	uint64_t missed = now > m_deadline ? (now - m_deadline) / m_interval : 0;
+	m_deadline += (missed + 1) * m_interval;
+
+	m_stats.frames++;
+	m_stats.dropped += missed;
+	if (IsIdle())
+		m_stats.idleFrames++;
+	return static_cast<int>(missed);
+}
+
+void AsciiFrameScheduler::EndFrame(bool changed)
+{
+	if (changed) {
+		if (IsIdle()) {
+			// Back to the target rate from the next deadline on
+			uint64_t now = m_clock.Now();
+			m_deadline = now + m_targetInterval;
+		}
+		m_interval = m_targetInterval;
+		m_unchanged = 0;
+		return;
+	}
+
+	// Double the interval with every unchanged frame past the threshold
+	if (++m_unchanged >= m_options.idleFrames && m_interval < m_maxInterval) {
+		uint64_t next = m_interval * 2;
+		uint64_t grown = (next < m_maxInterval ? next : m_maxInterval) - m_interval;
+		m_interval += grown;
+		m_deadline += grown;
+	}
+}
+
+void AsciiFrameScheduler::Wake()
+{
+	uint64_t now = m_clock.Now();
+	m_interval = m_targetInterval;
+	m_unchanged = 0;
+	if (m_deadline > now)
+		m_deadline = now;
+}
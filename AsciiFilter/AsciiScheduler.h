@@ -0,0 +1,94 @@
+﻿// AsciiScheduler.h : Deadline based frame pacing with idle backoff.
+//
+// Frames are due on a fixed grid of deadlines at the target rate. A frame
+// that starts late does not make the ones it missed run back to back: the
+// missed deadlines are dropped and counted, and the next one is the first
+// still in the future. Once the source has shown nothing new for a while
+// the interval doubles with every unchanged frame, up to a cap, so a static
+// screen costs next to no CPU; Wake() or a changed frame brings the target
+// rate back at once.
+//
+// Time comes from an AsciiClock, so a manual clock can drive the
+// scheduler deterministically (see the scheduler mode of asciifilter_bench).
+
+#pragma once
+#include <cstdint>
+
+// Monotonic time in nanoseconds
+class AsciiClock
+{
+public:
+    virtual ~AsciiClock() {}
+    virtual uint64_t Now() const = 0;
+};
+
+class AsciiSteadyClock : public AsciiClock
+{
+public:
+    uint64_t Now() const override;
+};
+
+// Only moves when told to
+class AsciiManualClock : public AsciiClock
+{
+public:
+    uint64_t Now() const override { return m_now; }
+    void Set(uint64_t now) { m_now = now; }
+    void Advance(uint64_t nanoseconds) { m_now += nanoseconds; }
+
+private:
+    uint64_t m_now = 0;
+};
+
+struct AsciiSchedulerOptions
+{
+    double targetFps = 60.0;
+    int idleFrames = 30;           // Unchanged frames in a row before backing off
+    double maxIdleInterval = 0.5;  // Longest gap between frames while idle, in seconds
+};
+
+struct AsciiSchedulerStats
+{
+    uint64_t frames = 0;
+    uint64_t dropped = 0;      // Deadlines missed because a frame started late
+    uint64_t idleFrames = 0;   // Frames run at the backed off rate
+};
+
+class AsciiFrameScheduler
+{
+public:
+    // The clock has to outlive the scheduler
+    explicit AsciiFrameScheduler(const AsciiClock& clock, const AsciiSchedulerOptions& options = AsciiSchedulerOptions());
+
+    void SetOptions(const AsciiSchedulerOptions& options);
+    const AsciiSchedulerOptions& GetOptions() const { return m_options; }
+
+    // Nanoseconds until the next frame is due, 0 when it is due now
+    uint64_t GetWaitTime() const;
+    bool IsFrameDue() const { return GetWaitTime() == 0; }
+
+    // Starts a due frame and moves the deadline on. Returns the number of
+    // deadlines dropped since the previous frame.
+    int BeginFrame();
+
+    // Ends the frame; changed tells whether it showed anything new
+    void EndFrame(bool changed);
+
+    // Something happened (input, resize, new content): leave the idle
+    // backoff and make a frame due now
+    void Wake();
+
+    bool IsIdle() const { return m_interval > m_targetInterval; }
+    uint64_t GetInterval() const { return m_interval; }
+    const AsciiSchedulerStats& GetStats() const { return m_stats; }
+
+private:
+    const AsciiClock& m_clock;
+    AsciiSchedulerOptions m_options;
+    uint64_t m_targetInterval = 0;
+    uint64_t m_maxInterval = 0;
+    uint64_t m_interval = 0;    // Current interval, above the target while idle
+    uint64_t m_deadline = 0;    // When the next frame is due
+    int m_unchanged = 0;        // Unchanged frames in a row
+    AsciiSchedulerStats m_stats;
+};
@@ -0,0 +1,939 @@
+﻿#include "AsciiServer.h"
+#include "AsciiDelta.h"
+#include "AsciiMetrics.h"
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+// A connection that sends nothing for this long is a plain TCP viewer;
+// WebSocket clients send their upgrade request right away
+static const int ASCII_SERVER_PROBE_MS = 100;
+static const size_t ASCII_SERVER_MAX_REQUEST = 8192;
+// Room in front of every packet for the largest WebSocket frame header
+static const size_t ASCII_WS_HEADER_SPACE = 10;
+static const char* ASCII_WS_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+//------------------------------------------------------------
+// Sockets
+//------------------------------------------------------------
+#ifdef _WIN32
+typedef SOCKET AsciiSocket;
+static const AsciiSocket ASCII_NO_SOCKET = INVALID_SOCKET;
+static const int ASCII_SEND_FLAGS = 0;
+
+// Winsock counts the calls, every start needs its stop
+static bool StartSockets()
+{
+	WSADATA data;
+	return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+}
+
+static void StopSockets()
+{
+	WSACleanup();
+}
+
+static void CloseSocket(AsciiSocket s)
+{
+	closesocket(s);
+}
+
+static bool SetNonBlocking(AsciiSocket s)
+{
+	u_long on = 1;
+	return ioctlsocket(s, FIONBIO, &on) == 0;
+}
+
+static bool WouldBlock()
+{
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+}
+
+static int PollSockets(pollfd* fds, size_t count, int timeout)
+{
+	return WSAPoll(fds, static_cast<ULONG>(count), timeout);
+}
+#else
+typedef int AsciiSocket;
+static const AsciiSocket ASCII_NO_SOCKET = -1;
+#ifdef MSG_NOSIGNAL
+static const int ASCII_SEND_FLAGS = MSG_NOSIGNAL; // A viewer that went away must not kill the process
+#else
+static const int ASCII_SEND_FLAGS = 0;
+#endif
+
+static bool StartSockets()
+{
+	return true;
+}
+
+static void StopSockets()
+{
+}
+
+static void CloseSocket(AsciiSocket s)
+{
+	close(s);
+}
+
+static bool SetNonBlocking(AsciiSocket s)
+{
+	int flags = fcntl(s, F_GETFL, 0);
+	return flags >= 0 && fcntl(s, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static bool WouldBlock()
+{
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+static int PollSockets(pollfd* fds, size_t count, int timeout)
+{
+	return poll(fds, static_cast<nfds_t>(count), timeout);
+}
+#endif
+
+static long SendSome(AsciiSocket s, const char* data, size_t size)
+{
+	return static_cast<long>(send(s, data, static_cast<int>(std::min<size_t>(size, 1u << 30)), ASCII_SEND_FLAGS));
+}
+
+static long ReceiveSome(AsciiSocket s, char* data, size_t size)
+{
+	return static_cast<long>(recv(s, data, static_cast<int>(size), 0));
+}
+
+static void SetNoDelay(AsciiSocket s)
+{
+	int on = 1;
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&on), sizeof(on));
+}
+
+static void SetBufferSize(AsciiSocket s, int option, int bytes)
+{
+	if (bytes > 0)
+		setsockopt(s, SOL_SOCKET, option, reinterpret_cast<const char*>(&bytes), sizeof(bytes));
+}
+
+//------------------------------------------------------------
+// WebSocket handshake: base64(SHA-1(key + GUID))
+//------------------------------------------------------------
+static void Sha1(const uint8_t* data, size_t size, uint8_t digest[20])
+{
+	uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+	auto rotl = [](uint32_t x, int n) { return (x << n) | (x >> (32 - n)); };
+
+	// The message, a 0x80 byte, zeros and the bit length, in 64 byte blocks
+	size_t total = (size + 9 + 63) / 64 * 64;
+	for (size_t block = 0; block < total; block += 64) {
+		uint8_t chunk[64];
+		for (size_t i = 0; i < 64; ++i) {
+			size_t at = block + i;
+			if (at < size)
+				chunk[i] = data[at];
+			else if (at == size)
+				chunk[i] = 0x80;
+			else if (at >= total - 8)
+				chunk[i] = static_cast<uint8_t>(static_cast<uint64_t>(size) * 8 >> ((total - 1 - at) * 8));
+			else
+				chunk[i] = 0;
+		}
+
+		uint32_t w[80];
+		for (int i = 0; i < 16; ++i)
+			w[i] = (uint32_t(chunk[i * 4]) << 24) | (uint32_t(chunk[i * 4 + 1]) << 16) | (uint32_t(chunk[i * 4 + 2]) << 8) | chunk[i * 4 + 3];
+		for (int i = 16; i < 80; ++i)
+			w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+		uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+		for (int i = 0; i < 80; ++i) {
+			uint32_t f, k;
+			if (i < 20) { f = (b & c) | (~b & d); k = 0x5A827999; }
+			else if (i < 40) { f = b ^ c ^ d; k = 0x6ED9EBA1; }
+			else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+			else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+			uint32_t t = rotl(a, 5) + f + e + k + w[i];
+			e = d;
+			d = c;
+			c = rotl(b, 30);
+			b = a;
+			a = t;
+		}
+		h[0] += a;
+		h[1] += b;
+		h[2] += c;
+		h[3] += d;
+		h[4] += e;
+	}
+	for (int i = 0; i < 20; ++i)
+		digest[i] = static_cast<uint8_t>(h[i / 4] >> (24 - (i % 4) * 8));
+}
+
+static std::string Base64(const uint8_t* data, size_t size)
+{
+	static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	std::string out;
+	for (size_t i = 0; i < size; i += 3) {
+		uint32_t v = uint32_t(data[i]) << 16;
+		if (i + 1 < size)
+			v |= uint32_t(data[i + 1]) << 8;
+		if (i + 2 < size)
+			v |= data[i + 2];
+		out += digits[(v >> 18) & 63];
+		out += digits[(v >> 12) & 63];
+		out += i + 1 < size ? digits[(v >> 6) & 63] : '=';
+		out += i + 2 < size ? digits[v & 63] : '=';
+	}
+	return out;
+}
+
+static std::string GetWebSocketAccept(const std::string& key)
+{
+	std::string text = key + ASCII_WS_GUID;
+	uint8_t digest[20];
+	Sha1(reinterpret_cast<const uint8_t*>(text.data()), text.size(), digest);
+	return Base64(digest, sizeof(digest));
+}
+
+// Value of an HTTP header, matched case-insensitively; empty when missing
+static std::string GetHeader(const std::string& request, const char* name)
+{
+	size_t length = strlen(name);
+	for (size_t line = request.find("\r\n"); line != std::string::npos; line = request.find("\r\n", line + 2)) {
+		size_t start = line + 2;
+		if (request.size() - start <= length || request[start + length] != ':')
+			continue;
+		bool match = true;
+		for (size_t i = 0; i < length && match; ++i)
+			match = tolower(static_cast<unsigned char>(request[start + i])) == tolower(static_cast<unsigned char>(name[i]));
+		if (!match)
+			continue;
+		size_t begin = request.find_first_not_of(" \t", start + length + 1);
+		size_t end = request.find("\r\n", start);
+		if (begin == std::string::npos || begin >= end)
+			return std::string();
+		end = request.find_last_not_of(" \t", end - 1) + 1;
+		return request.substr(begin, end - begin);
+	}
+	return std::string();
+}
+
+//------------------------------------------------------------
+// Server state
+//------------------------------------------------------------
+namespace
+{
+	// One encoded packet, shared by every viewer it is queued for
+	struct ServerPacket
+	{
+		std::string bytes;  // ASCII_WS_HEADER_SPACE spare bytes, then the packet
+		size_t wsStart = 0; // Where the WebSocket frame header starts
+		uint32_t frame = 0;
+		uint64_t time = 0;  // When it was published
+	};
+	typedef std::shared_ptr<ServerPacket> ServerPacketRef;
+
+	struct QueuedPacket
+	{
+		ServerPacketRef packet;
+		size_t offset = 0;  // Next byte to send
+	};
+
+	enum class ClientPhase { Probing, Handshake, Streaming };
+
+	struct ServerClient
+	{
+		uint64_t id = 0;
+		AsciiSocket socket = ASCII_NO_SOCKET;
+		ClientPhase phase = ClientPhase::Probing;
+		bool websocket = false;
+		bool needKeyframe = true;
+		// Written under the mutex; the network thread, their only other
+		// writer, may read them without it
+		bool blocked = false;   // The socket buffer is full, wait for POLLOUT
+		bool closed = false;
+		uint64_t connected = 0;
+		std::string request;    // HTTP request read so far
+		std::string reply;      // Handshake answer, sent before any packet
+		size_t replyOffset = 0;
+		// Packets [head, end) are queued. The head one may be in the middle
+		// of a send and is never dropped.
+		std::vector<QueuedPacket> queue;
+		size_t head = 0;
+		size_t backlog = 0;
+		uint32_t lastSent = 0;  // Frame of the last packet sent completely
+		uint64_t frames = 0;
+		uint64_t skipped = 0;
+		uint64_t bytesSent = 0;
+
+		bool HasOutput() const { return replyOffset < reply.size() || head < queue.size(); }
+	};
+}
+
+struct AsciiFanoutServer::State
+{
+	AsciiServerOptions options;
+	AsciiSocket listener = ASCII_NO_SOCKET;
+	AsciiSocket wake = ASCII_NO_SOCKET;  // UDP socket connected to itself
+	std::atomic<bool> stop{ false };
+
+	// Everything below the mutex is shared by Publish and the network thread
+	std::mutex mutex;
+	std::vector<std::unique_ptr<ServerClient>> clients;
+	AsciiServerStats stats;
+	uint32_t frame = 0;
+	uint64_t nextId = 1;
+
+	// Publish only
+	AsciiDeltaEncoder encoder;
+	std::vector<ServerPacketRef> pool;
+	uint32_t lastKeyframe = 0;
+
+	// A packet no viewer holds any more, or a new one. Viewers drop their
+	// references under the mutex, which orders the last send from a packet
+	// before its reuse.
+	ServerPacketRef AcquirePacket()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (const ServerPacketRef& packet : pool) {
+			if (packet.use_count() == 1) {
+				packet->bytes.assign(ASCII_WS_HEADER_SPACE, '\0');
+				return packet;
+			}
+		}
+		pool.push_back(std::make_shared<ServerPacket>());
+		pool.back()->bytes.assign(ASCII_WS_HEADER_SPACE, '\0');
+		return pool.back();
+	}
+
+	// Writes the WebSocket header of a binary message in front of the packet
+	static void FinishPacket(ServerPacket& packet, uint32_t frame, uint64_t time)
+	{
+		uint64_t size = packet.bytes.size() - ASCII_WS_HEADER_SPACE;
+		uint8_t header[ASCII_WS_HEADER_SPACE];
+		size_t length = 0;
+		header[length++] = 0x82; // FIN, binary
+		if (size < 126) {
+			header[length++] = static_cast<uint8_t>(size);
+		}
+		else if (size < 65536) {
+			header[length++] = 126;
+			header[length++] = static_cast<uint8_t>(size >> 8);
+			header[length++] = static_cast<uint8_t>(size);
+		}
+		else {
+			header[length++] = 127;
+			for (int shift = 56; shift >= 0; shift -= 8)
+				header[length++] = static_cast<uint8_t>(size >> shift);
+		}
+		packet.wsStart = ASCII_WS_HEADER_SPACE - length;
+		memcpy(&packet.bytes[packet.wsStart], header, length);
+		packet.frame = frame;
+		packet.time = time;
+	}
+
+	void Enqueue(ServerClient& client, const ServerPacketRef& packet)
+	{
+		QueuedPacket queued;
+		queued.packet = packet;
+		queued.offset = client.websocket ? packet->wsStart : ASCII_WS_HEADER_SPACE;
+		client.backlog += packet->bytes.size() - queued.offset;
+		client.queue.push_back(queued);
+		++client.frames;
+	}
+
+	// Drops everything queued behind the head packet
+	void DropBacklog(ServerClient& client)
+	{
+		size_t keep = std::min(client.head + 1, client.queue.size());
+		for (size_t i = keep; i < client.queue.size(); ++i) {
+			const QueuedPacket& queued = client.queue[i];
+			client.backlog -= queued.packet->bytes.size() - queued.offset;
+			++client.skipped;
+			++stats.skipped;
+		}
+		client.queue.resize(keep);
+	}
+
+	void Wake()
+	{
+		char byte = 0;
+		send(wake, &byte, 1, 0);
+	}
+
+	// Sends what the socket takes without blocking
+	void Flush(ServerClient& client)
+	{
+		for (;;) {
+			// The head packet stays queued while it is sent, so it is safe to
+			// send from it without the lock
+			const char* data = nullptr;
+			size_t size = 0;
+			bool reply = false;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (client.replyOffset < client.reply.size()) {
+					data = client.reply.data() + client.replyOffset;
+					size = client.reply.size() - client.replyOffset;
+					reply = true;
+				}
+				else if (client.head < client.queue.size()) {
+					const QueuedPacket& queued = client.queue[client.head];
+					data = queued.packet->bytes.data() + queued.offset;
+					size = queued.packet->bytes.size() - queued.offset;
+				}
+				else {
+					return;
+				}
+			}
+
+			long sent = SendSome(client.socket, data, size);
+			std::lock_guard<std::mutex> lock(mutex);
+			if (sent <= 0) {
+				if (sent < 0 && WouldBlock())
+					client.blocked = true;
+				else
+					client.closed = true;
+				return;
+			}
+			client.bytesSent += sent;
+			stats.bytesSent += sent;
+			if (reply) {
+				client.replyOffset += sent;
+				continue;
+			}
+			QueuedPacket& queued = client.queue[client.head];
+			queued.offset += sent;
+			client.backlog -= sent;
+			if (queued.offset == queued.packet->bytes.size()) {
+				client.lastSent = queued.packet->frame;
+				queued.packet.reset();
+				if (++client.head == client.queue.size()) {
+					client.queue.clear();
+					client.head = 0;
+				}
+				else if (client.head >= 64) {
+					// Never drained: drop the sent entries now and then
+					client.queue.erase(client.queue.begin(), client.queue.begin() + client.head);
+					client.head = 0;
+				}
+			}
+		}
+	}
+};
+
+//------------------------------------------------------------
+// Server
+//------------------------------------------------------------
+AsciiFanoutServer::AsciiFanoutServer()
+{
+}
+
+AsciiFanoutServer::~AsciiFanoutServer()
+{
+	Stop();
+}
+
+bool AsciiFanoutServer::Start(const AsciiServerOptions& options)
+{
+	Stop();
+	if (!StartSockets()) {
+		m_error = "cannot initialize sockets";
+		return false;
+	}
+	m_state.reset(new State());
+	State& state = *m_state;
+	state.options = options;
+	state.options.maxClients = std::max(options.maxClients, 1);
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(static_cast<uint16_t>(options.port));
+	socklen_t addressSize = sizeof(address);
+	state.listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	int on = 1;
+	bool ok = state.listener != ASCII_NO_SOCKET &&
+		inet_pton(AF_INET, options.bindAddress.c_str(), &address.sin_addr) == 1 &&
+		setsockopt(state.listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&on), sizeof(on)) == 0 &&
+		bind(state.listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0 &&
+		listen(state.listener, 16) == 0 &&
+		getsockname(state.listener, reinterpret_cast<sockaddr*>(&address), &addressSize) == 0 &&
+		SetNonBlocking(state.listener);
+	if (!ok) {
+		m_error = "cannot listen on " + options.bindAddress + ":" + std::to_string(options.port);
+		Stop();
+		return false;
+	}
+	m_port = ntohs(address.sin_port);
+
+	// Publish wakes the network thread by sending itself a datagram
+	sockaddr_in loopback = {};
+	loopback.sin_family = AF_INET;
+	loopback.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t loopbackSize = sizeof(loopback);
+	state.wake = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	ok = state.wake != ASCII_NO_SOCKET &&
+		bind(state.wake, reinterpret_cast<sockaddr*>(&loopback), sizeof(loopback)) == 0 &&
+		getsockname(state.wake, reinterpret_cast<sockaddr*>(&loopback), &loopbackSize) == 0 &&
+		connect(state.wake, reinterpret_cast<sockaddr*>(&loopback), sizeof(loopback)) == 0 &&
+		SetNonBlocking(state.wake);
+	if (!ok) {
+		m_error = "cannot create the wake socket";
+		Stop();
+		return false;
+	}
+
+	m_error.clear();
+	m_running = true;
+	m_thread = std::thread(&AsciiFanoutServer::Run, this);
+	return true;
+}
+
+void AsciiFanoutServer::Stop()
+{
+	if (!m_state)
+		return;
+	State& state = *m_state;
+	state.stop = true;
+	if (m_thread.joinable()) {
+		state.Wake();
+		m_thread.join();
+	}
+	for (const std::unique_ptr<ServerClient>& client : state.clients)
+		CloseSocket(client->socket);
+	if (state.listener != ASCII_NO_SOCKET)
+		CloseSocket(state.listener);
+	if (state.wake != ASCII_NO_SOCKET)
+		CloseSocket(state.wake);
+	m_state.reset();
+	m_running = false;
+	m_port = 0;
+	StopSockets();
+}
+
+void AsciiFanoutServer::Publish(const std::vector<AsciiCell>& cells, int cols, int rows)
+{
+	if (!m_state)
+		return;
+	State& state = *m_state;
+	uint64_t start = AsciiMetrics::Now();
+
+	uint32_t frame = state.encoder.GetFrame() + 1;
+	bool keyframeDue = state.options.keyframeInterval > 0 &&
+		frame - state.lastKeyframe >= static_cast<uint32_t>(state.options.keyframeInterval);
+	ServerPacketRef packet = state.AcquirePacket();
+	AsciiPacketType type = state.encoder.Encode(cells, cols, rows, keyframeDue, packet->bytes);
+	State::FinishPacket(*packet, frame, start);
+	ServerPacketRef keyframe;
+	if (type == AsciiPacketType::Keyframe) {
+		keyframe = packet;
+		state.lastKeyframe = frame;
+	}
+
+	// A viewer waiting for a keyframe gets one once its backlog drained;
+	// however many wait, it is encoded once. A limit below two keyframes
+	// would have a viewer skip again right after every keyframe.
+	size_t keyframeSize = ASCII_PACKET_HEADER_SIZE + static_cast<size_t>(cols) * rows * ASCII_PACKET_CELL_SIZE;
+	size_t maxBacklog = std::max(state.options.maxBacklogBytes, 2 * keyframeSize);
+	bool wanted = false;
+	{
+		std::lock_guard<std::mutex> lock(state.mutex);
+		for (const std::unique_ptr<ServerClient>& client : state.clients)
+			wanted |= client->phase == ClientPhase::Streaming && client->needKeyframe && client->backlog <= maxBacklog / 2;
+	}
+	if (wanted && !keyframe) {
+		keyframe = state.AcquirePacket();
+		state.encoder.EncodeKeyframe(keyframe->bytes);
+		State::FinishPacket(*keyframe, frame, start);
+	}
+	uint64_t encodeTime = AsciiMetrics::Now() - start;
+
+	std::lock_guard<std::mutex> lock(state.mutex);
+	state.frame = frame;
+	++state.stats.frames;
+	state.stats.encodeTime += encodeTime;
+	state.stats.maxEncodeTime = std::max(state.stats.maxEncodeTime, encodeTime);
+	size_t packetSize = packet->bytes.size() - ASCII_WS_HEADER_SPACE;
+	if (type == AsciiPacketType::Keyframe) {
+		++state.stats.keyframes;
+		state.stats.keyframeBytes += packetSize;
+	}
+	else {
+		++state.stats.deltas;
+		state.stats.deltaBytes += packetSize;
+		if (keyframe) {
+			++state.stats.keyframes;
+			state.stats.keyframeBytes += keyframe->bytes.size() - ASCII_WS_HEADER_SPACE;
+		}
+	}
+
+	for (const std::unique_ptr<ServerClient>& client : state.clients) {
+		if (client->phase != ClientPhase::Streaming || client->closed)
+			continue;
+		if (!client->needKeyframe && client->backlog + packetSize > maxBacklog) {
+			// Too far behind: whatever is queued is stale, skip to a keyframe
+			state.DropBacklog(*client);
+			client->needKeyframe = true;
+		}
+		if (!client->needKeyframe) {
+			state.Enqueue(*client, packet);
+		}
+		else if (keyframe && client->backlog <= maxBacklog / 2) {
+			state.Enqueue(*client, keyframe);
+			client->needKeyframe = false;
+		}
+		else {
+			++client->skipped;
+			++state.stats.skipped;
+		}
+	}
+	state.Wake();
+}
+
+AsciiServerStats AsciiFanoutServer::GetStats() const
+{
+	if (!m_state)
+		return AsciiServerStats();
+	std::lock_guard<std::mutex> lock(m_state->mutex);
+	AsciiServerStats stats = m_state->stats;
+	stats.clients = static_cast<int>(m_state->clients.size());
+	return stats;
+}
+
+void AsciiFanoutServer::GetClientStats(std::vector<AsciiClientStats>& clients) const
+{
+	clients.clear();
+	if (!m_state)
+		return;
+	std::lock_guard<std::mutex> lock(m_state->mutex);
+	uint64_t now = AsciiMetrics::Now();
+	for (const std::unique_ptr<ServerClient>& client : m_state->clients) {
+		AsciiClientStats stats;
+		stats.id = client->id;
+		stats.websocket = client->websocket;
+		stats.streaming = client->phase == ClientPhase::Streaming && !client->needKeyframe;
+		stats.frames = client->frames;
+		stats.skipped = client->skipped;
+		stats.bytesSent = client->bytesSent;
+		stats.backlogBytes = client->backlog;
+		if (client->phase == ClientPhase::Streaming)
+			stats.lagFrames = m_state->frame - client->lastSent;
+		if (client->head < client->queue.size())
+			stats.lagSeconds = (now - client->queue[client->head].packet->time) / 1e9;
+		clients.push_back(stats);
+	}
+}
+
+//------------------------------------------------------------
+// Network thread
+//------------------------------------------------------------
+void AsciiFanoutServer::Run()
+{
+	State& state = *m_state;
+	std::vector<pollfd> fds;
+	std::vector<ServerClient*> polled;
+	std::vector<ServerClient*> flushed;
+	char buffer[4096];
+
+	while (!state.stop) {
+		fds.clear();
+		polled.clear();
+		fds.push_back({ state.listener, POLLIN, 0 });
+		fds.push_back({ state.wake, POLLIN, 0 });
+		bool probing = false;
+		{
+			std::lock_guard<std::mutex> lock(state.mutex);
+			for (const std::unique_ptr<ServerClient>& client : state.clients) {
+				short events = POLLIN;
+				if (client->blocked)
+					events |= POLLOUT;
+				fds.push_back({ client->socket, events, 0 });
+				polled.push_back(client.get());
+				probing |= client->phase != ClientPhase::Streaming;
+			}
+		}
+		PollSockets(fds.data(), fds.size(), probing ? ASCII_SERVER_PROBE_MS / 4 : 1000);
+		if (state.stop)
+			break;
+
+		if (fds[1].revents & POLLIN) {
+			while (ReceiveSome(state.wake, buffer, sizeof(buffer)) > 0) {
+			}
+		}
+
+		uint64_t now = AsciiMetrics::Now();
+		if (fds[0].revents & POLLIN) {
+			for (;;) {
+				AsciiSocket s = accept(state.listener, nullptr, nullptr);
+				if (s == ASCII_NO_SOCKET)
+					break;
+				std::lock_guard<std::mutex> lock(state.mutex);
+				if (static_cast<int>(state.clients.size()) >= state.options.maxClients || !SetNonBlocking(s)) {
+					CloseSocket(s);
+					continue;
+				}
+				SetNoDelay(s);
+				SetBufferSize(s, SO_SNDBUF, state.options.sendBufferBytes);
+				std::unique_ptr<ServerClient> client(new ServerClient());
+				client->id = state.nextId++;
+				client->socket = s;
+				client->connected = now;
+				client->lastSent = state.frame;
+				state.clients.push_back(std::move(client));
+				++state.stats.connections;
+			}
+		}
+
+		for (size_t i = 0; i < polled.size(); ++i) {
+			ServerClient& client = *polled[i];
+			short revents = fds[i + 2].revents;
+			if (revents & (POLLOUT | POLLERR | POLLNVAL)) {
+				// Publish reads the flags under the lock
+				std::lock_guard<std::mutex> lock(state.mutex);
+				if (revents & POLLOUT)
+					client.blocked = false;
+				if (revents & (POLLERR | POLLNVAL))
+					client.closed = true;
+			}
+			if (!(revents & (POLLIN | POLLHUP)) || client.closed)
+				continue;
+
+			// Viewers have nothing to say after the handshake; their data
+			// is read and dropped, end of stream closes the connection
+			for (;;) {
+				long received = ReceiveSome(client.socket, buffer, sizeof(buffer));
+				if (received == 0 || (received < 0 && !WouldBlock())) {
+					std::lock_guard<std::mutex> lock(state.mutex);
+					client.closed = true;
+					break;
+				}
+				if (received < 0)
+					break;
+				std::lock_guard<std::mutex> lock(state.mutex);
+				if (client.phase == ClientPhase::Streaming)
+					continue;
+				client.request.append(buffer, received);
+				if (client.request.compare(0, std::min<size_t>(client.request.size(), 4), "GET ", 0,
+					std::min<size_t>(client.request.size(), 4)) != 0) {
+					client.phase = ClientPhase::Streaming;
+					continue;
+				}
+				client.phase = ClientPhase::Handshake;
+				if (client.request.find("\r\n\r\n") == std::string::npos) {
+					client.closed = client.request.size() > ASCII_SERVER_MAX_REQUEST;
+					continue;
+				}
+				std::string key = GetHeader(client.request, "Sec-WebSocket-Key");
+				if (key.empty()) {
+					static const char refused[] = "HTTP/1.1 426 Upgrade Required\r\nUpgrade: websocket\r\nContent-Length: 0\r\n\r\n";
+					SendSome(client.socket, refused, sizeof(refused) - 1);
+					client.closed = true;
+				}
+				else {
+					client.reply = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+						"Sec-WebSocket-Accept: " + GetWebSocketAccept(key) + "\r\n\r\n";
+					client.websocket = true;
+					client.phase = ClientPhase::Streaming;
+				}
+				client.request.clear();
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(state.mutex);
+			for (const std::unique_ptr<ServerClient>& client : state.clients) {
+				if (client->phase == ClientPhase::Probing && now - client->connected >= ASCII_SERVER_PROBE_MS * 1000000ull)
+					client->phase = ClientPhase::Streaming;
+			}
+		}
+
+		// Publish queues packets meanwhile, so the queues are looked at
+		// under the lock; Flush takes it itself
+		flushed.clear();
+		{
+			std::lock_guard<std::mutex> lock(state.mutex);
+			for (ServerClient* client : polled) {
+				if (!client->blocked && !client->closed && client->HasOutput())
+					flushed.push_back(client);
+			}
+		}
+		for (ServerClient* client : flushed)
+			state.Flush(*client);
+
+		std::lock_guard<std::mutex> lock(state.mutex);
+		auto end = std::remove_if(state.clients.begin(), state.clients.end(), [](const std::unique_ptr<ServerClient>& client) {
+			if (!client->closed)
+				return false;
+			CloseSocket(client->socket);
+			return true;
+		});
+		state.clients.erase(end, state.clients.end());
+	}
+}
+
+//------------------------------------------------------------
+// Viewer
+//------------------------------------------------------------
+AsciiStreamClient::AsciiStreamClient()
+	: m_socket(static_cast<intptr_t>(ASCII_NO_SOCKET))
+{
+}
+
+AsciiStreamClient::~AsciiStreamClient()
+{
+	Close();
+}
+
+bool AsciiStreamClient::Connect(const char* host, int port, bool websocket)
+{
+	Close();
+	if (!StartSockets())
+		return false;
+
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo* found = nullptr;
+	std::string service = std::to_string(port);
+	AsciiSocket s = ASCII_NO_SOCKET;
+	if (getaddrinfo(host, service.c_str(), &hints, &found) == 0) {
+		for (addrinfo* a = found; a && s == ASCII_NO_SOCKET; a = a->ai_next) {
+			s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+			if (s != ASCII_NO_SOCKET)
+				SetBufferSize(s, SO_RCVBUF, m_receiveBuffer);
+			if (s != ASCII_NO_SOCKET && connect(s, a->ai_addr, static_cast<int>(a->ai_addrlen)) != 0) {
+				CloseSocket(s);
+				s = ASCII_NO_SOCKET;
+			}
+		}
+		freeaddrinfo(found);
+	}
+	m_socket = static_cast<intptr_t>(s);
+	if (s == ASCII_NO_SOCKET) {
+		StopSockets();
+		return false;
+	}
+	SetNoDelay(s);
+	m_buffer.clear();
+	m_offset = 0;
+	m_websocket = websocket;
+	if (!websocket) {
+		// Anything but an upgrade request ends the server's wait for one
+		bool ok = SendSome(s, "\n", 1) == 1;
+		if (!ok)
+			Close();
+		return ok;
+	}
+
+	uint8_t nonce[16];
+	std::random_device random;
+	for (uint8_t& byte : nonce)
+		byte = static_cast<uint8_t>(random());
+	std::string key = Base64(nonce, sizeof(nonce));
+	std::string request = "GET / HTTP/1.1\r\nHost: " + std::string(host) + ":" + service + "\r\n"
+		"Upgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: " + key + "\r\n"
+		"Sec-WebSocket-Version: 13\r\n\r\n";
+	bool ok = SendSome(s, request.data(), request.size()) == static_cast<long>(request.size());
+
+	// The answer ends with an empty line; packets may follow right behind it
+	size_t end = std::string::npos;
+	while (ok && (end = m_buffer.find("\r\n\r\n")) == std::string::npos)
+		ok = m_buffer.size() < ASCII_SERVER_MAX_REQUEST && Fill(m_buffer.size() + 1);
+	ok = ok && m_buffer.compare(0, 12, "HTTP/1.1 101") == 0 &&
+		GetHeader(m_buffer.substr(0, end + 2), "Sec-WebSocket-Accept") == GetWebSocketAccept(key);
+	if (!ok) {
+		Close();
+		return false;
+	}
+	m_offset = end + 4;
+	return true;
+}
+
+void AsciiStreamClient::Close()
+{
+	AsciiSocket s = static_cast<AsciiSocket>(m_socket);
+	if (s == ASCII_NO_SOCKET)
+		return;
+	CloseSocket(s);
+	m_socket = static_cast<intptr_t>(ASCII_NO_SOCKET);
+	StopSockets();
+}
+
+bool AsciiStreamClient::Fill(size_t bytes)
+{
+	AsciiSocket s = static_cast<AsciiSocket>(m_socket);
+	if (s == ASCII_NO_SOCKET)
+		return false;
+	char chunk[65536];
+	while (m_buffer.size() - m_offset < bytes) {
+		// Keep only what was not returned yet before reading more
+		m_buffer.erase(0, m_offset);
+		m_offset = 0;
+		long received = ReceiveSome(s, chunk, sizeof(chunk));
+		if (received <= 0)
+			return false;
+		m_buffer.append(chunk, received);
+	}
+	return true;
+}
+
+bool AsciiStreamClient::ReadPacket(std::string& packet)
+{
+	if (!m_websocket) {
+		if (!Fill(ASCII_PACKET_HEADER_SIZE))
+			return false;
+		size_t size = AsciiDeltaDecoder::GetPacketSize(reinterpret_cast<const uint8_t*>(&m_buffer[m_offset]), ASCII_PACKET_HEADER_SIZE);
+		if (size == 0 || !Fill(size))
+			return false;
+		packet.assign(m_buffer, m_offset, size);
+		m_offset += size;
+		return true;
+	}
+
+	// Server messages are unmasked and, from this server, never fragmented
+	for (;;) {
+		if (!Fill(2))
+			return false;
+		const uint8_t* p = reinterpret_cast<const uint8_t*>(&m_buffer[m_offset]);
+		int opcode = p[0] & 0x0F;
+		uint64_t size = p[1] & 0x7F;
+		size_t header = 2;
+		if (size >= 126) {
+			header = size == 126 ? 4 : 10;
+			if (!Fill(header))
+				return false;
+			p = reinterpret_cast<const uint8_t*>(&m_buffer[m_offset]);
+			size = 0;
+			for (size_t i = 2; i < header; ++i)
+				size = (size << 8) | p[i];
+		}
+		// Longer messages cannot hold a packet; do not buffer them
+		if ((p[1] & 0x80) || opcode == 0x8 || size > ASCII_PACKET_MAX_SIZE || !Fill(header + static_cast<size_t>(size)))
+			return false;
+		size_t start = m_offset + header;
+		m_offset = start + size;
+		if (opcode == 0x2) {
+			packet.assign(m_buffer, start, size);
+			return true;
+		}
+	}
+}
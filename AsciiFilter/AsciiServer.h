@@ -0,0 +1,135 @@
+﻿// AsciiServer.h : Fans one stream of cell grids out to many viewers.
+//
+// Publish() encodes a frame once (AsciiDelta.h) and queues the same bytes
+// for every connected viewer; a network thread does all socket work, so
+// the converting thread never waits for a viewer. A connection that sends
+// an HTTP upgrade request right after connecting gets the WebSocket
+// handshake and one binary message per packet; any other connection is a
+// plain TCP stream of packets. A plain viewer that sends a byte first
+// (AsciiStreamClient sends a newline) starts at once, a silent one after
+// a short wait for an upgrade request that does not come.
+//
+// Viewers that fall behind are not waited for: once more than
+// maxBacklogBytes are queued for one, its queued deltas are dropped and it
+// skips ahead to the next keyframe. Keyframes for joining and recovering
+// viewers are encoded once per frame, however many of them wait.
+
+#pragma once
+#include "AsciiCore.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+struct AsciiServerOptions
+{
+    std::string bindAddress = "127.0.0.1"; // "0.0.0.0" serves other machines too
+    int port = 8765;                       // 0 picks a free port, see GetPort
+    int keyframeInterval = 300;            // Frames between keyframes for everyone, 0 = only on demand
+    size_t maxBacklogBytes = 4u << 20;     // Queued bytes after which a viewer skips to a keyframe;
+                                           // never less than two keyframes
+    int sendBufferBytes = 256 << 10;       // Socket send buffer per viewer, 0 = system default. A
+                                           // large one hides a slow viewer's lag from the backlog.
+    int maxClients = 64;
+};
+
+struct AsciiServerStats
+{
+    uint64_t frames = 0;
+    uint64_t keyframes = 0;      // Packets, including the ones for single viewers
+    uint64_t keyframeBytes = 0;
+    uint64_t deltas = 0;
+    uint64_t deltaBytes = 0;
+    uint64_t encodeTime = 0;     // Nanoseconds spent encoding, all frames
+    uint64_t maxEncodeTime = 0;
+    uint64_t bytesSent = 0;      // To all viewers
+    uint64_t skipped = 0;        // Frames viewers skipped to catch up
+    uint64_t connections = 0;    // Since Start
+    int clients = 0;             // Connected now
+};
+
+struct AsciiClientStats
+{
+    uint64_t id = 0;
+    bool websocket = false;
+    bool streaming = false;      // False while connecting or waiting for a keyframe
+    uint64_t frames = 0;         // Packets queued for it
+    uint64_t skipped = 0;
+    uint64_t bytesSent = 0;
+    size_t backlogBytes = 0;     // Queued, not yet taken by the socket
+    uint32_t lagFrames = 0;      // Published frames it has not been sent completely
+    double lagSeconds = 0.0;     // Age of the oldest packet still queued for it
+};
+
+class AsciiFanoutServer
+{
+public:
+    AsciiFanoutServer();
+    ~AsciiFanoutServer();
+
+    AsciiFanoutServer(const AsciiFanoutServer&) = delete;
+    AsciiFanoutServer& operator=(const AsciiFanoutServer&) = delete;
+
+    // Starts listening and the network thread. Returns false, with a
+    // message in GetError, when the address cannot be bound.
+    bool Start(const AsciiServerOptions& options);
+    // Closes every connection and joins the network thread
+    void Stop();
+
+    bool IsRunning() const { return m_running; }
+    int GetPort() const { return m_port; }
+    const std::string& GetError() const { return m_error; }
+
+    // Encodes cells (cols x rows) and queues them for every viewer.
+    // Never blocks on a viewer; call from one thread at a time.
+    void Publish(const std::vector<AsciiCell>& cells, int cols, int rows);
+
+    AsciiServerStats GetStats() const;
+    void GetClientStats(std::vector<AsciiClientStats>& clients) const;
+
+private:
+    struct State;
+
+    void Run();
+
+    std::unique_ptr<State> m_state;
+    std::thread m_thread;
+    std::atomic<bool> m_running{ false };
+    int m_port = 0;
+    std::string m_error;
+};
+
+// Blocking viewer side of the protocol, for tests and terminal viewers
+class AsciiStreamClient
+{
+public:
+    AsciiStreamClient();
+    ~AsciiStreamClient();
+
+    AsciiStreamClient(const AsciiStreamClient&) = delete;
+    AsciiStreamClient& operator=(const AsciiStreamClient&) = delete;
+
+    // Connects to host:port, as a WebSocket client when websocket is set
+    // (which checks the server's handshake answer)
+    bool Connect(const char* host, int port, bool websocket);
+    void Close();
+
+    // Waits for the next whole packet and replaces packet with it.
+    // Returns false when the connection closed or broke.
+    bool ReadPacket(std::string& packet);
+
+    // Socket receive buffer for the next Connect, e.g. small to play a
+    // slow viewer; 0 = system default
+    void SetReceiveBuffer(int bytes) { m_receiveBuffer = bytes; }
+
+private:
+    bool Fill(size_t bytes);
+
+    intptr_t m_socket;
+    int m_receiveBuffer = 0;
+    bool m_websocket = false;
+    std::string m_buffer;   // Received, not yet returned
+    size_t m_offset = 0;
+};
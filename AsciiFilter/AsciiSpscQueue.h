@@ -0,0 +1,65 @@
+﻿// AsciiSpscQueue.h : Bounded lock-free single-producer/single-consumer queue.
+//
+// A ring of a power of two slots with one atomic index per side. The
+// producer only writes m_tail and the consumer only writes m_head, each on
+// its own cache line, so neither side ever waits on a lock. Exactly one
+// thread may push and exactly one (other) thread may pop.
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+template <typename T>
+class AsciiSpscQueue
+{
+public:
+    // capacity is rounded up to a power of two
+    explicit AsciiSpscQueue(size_t capacity = 16)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        m_mask = size - 1;
+        m_slots.reset(new T[size]);
+    }
+
+    AsciiSpscQueue(const AsciiSpscQueue&) = delete;
+    AsciiSpscQueue& operator=(const AsciiSpscQueue&) = delete;
+
+    size_t GetCapacity() const { return m_mask + 1; }
+
+    // Producer side. False when the queue is full.
+    bool TryPush(const T& value)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) > m_mask)
+            return false;
+        m_slots[tail & m_mask] = value;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. False when the queue is empty.
+    bool TryPop(T& value)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+            return false;
+        value = m_slots[head & m_mask];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Number of queued items; only a snapshot when called from outside
+    size_t GetSize() const
+    {
+        return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+    }
+
+private:
+    alignas(64) std::atomic<size_t> m_head{ 0 };
+    alignas(64) std::atomic<size_t> m_tail{ 0 };
+    alignas(64) size_t m_mask = 0;
+    std::unique_ptr<T[]> m_slots;
+};
@@ -0,0 +1,134 @@
+﻿#include "AsciiStabilizer.h"
+#include "AsciiKernels.h"
+
+static inline uint8_t CellLuminance(const AsciiCell& cell)
+{
+	// The background is the block's average color, the luminance the
+	// intensity ramp was indexed with
+	return AsciiLuminance(AsciiRValue(cell.bgColor), AsciiGValue(cell.bgColor), AsciiBValue(cell.bgColor));
+}
+
+static inline int ColorDistance(AsciiColor a, AsciiColor b)
+{
+	int distance = 0;
+	for (int shift = 0; shift < 24; shift += 8) {
+		int d = static_cast<int>((a >> shift) & 0xFF) - static_cast<int>((b >> shift) & 0xFF);
+		d = d < 0 ? -d : d;
+		distance = d > distance ? d : distance;
+	}
+	return distance;
+}
+
+void AsciiTemporalStabilizer::Reset()
+{
+	m_shown.clear();
+	m_luma.clear();
+	m_cols = m_rows = 0;
+}
+
+void AsciiTemporalStabilizer::Restart(const std::vector<AsciiCell>& cells, int cols, int rows)
+{
+	size_t count = static_cast<size_t>(cols) * rows;
+	m_shown.assign(cells.begin(), cells.begin() + count);
+	m_luma.resize(count);
+	for (size_t i = 0; i < count; ++i)
+		m_luma[i] = CellLuminance(m_shown[i]);
+	m_cols = cols;
+	m_rows = rows;
+	m_stats.changed += count;
+}
+
+void AsciiTemporalStabilizer::SelectRamp()
+{
+	if (GetAsciiGlyphMode() == AsciiGlyphMode::Intensity)
+		m_ramp = nullptr;
+	else
+		m_ramp = m_options.palette ? m_options.palette : GetAsciiPalette();
+}
+
+bool AsciiTemporalStabilizer::Filter(AsciiCell& cell, size_t index)
+{
+	AsciiCell& shown = m_shown[index];
+	if (cell == shown)
+		return false;
+
+	AsciiCell out = shown;
+	uint8_t luma = CellLuminance(cell);
+	int lumaDelta = static_cast<int>(luma) - m_luma[index];
+	lumaDelta = lumaDelta < 0 ? -lumaDelta : lumaDelta;
+	if (cell.ch == shown.ch) {
+		// Same character at the new luminance: the margin is measured
+		// from here on
+		m_luma[index] = luma;
+	}
+	else if (m_options.glyphMargin == 0 || lumaDelta > m_options.glyphMargin ||
+		(m_ramp && (m_ramp[luma] != cell.ch || m_ramp[m_luma[index]] != shown.ch))) {
+		// Off, moved past the margin, or a structural character in or out
+		out.ch = cell.ch;
+		out.textColor = cell.textColor;
+		m_luma[index] = luma;
+	}
+	if (ColorDistance(cell.textColor, out.textColor) > m_options.colorMargin)
+		out.textColor = cell.textColor;
+	if (ColorDistance(cell.bgColor, out.bgColor) > m_options.colorMargin)
+		out.bgColor = cell.bgColor;
+
+	bool held = out == shown;
+	if (held) {
+		m_stats.suppressed++;
+	}
+	else {
+		m_stats.changed++;
+		shown = out;
+	}
+	cell = out;
+	return held;
+}
+
+int AsciiTemporalStabilizer::Apply(std::vector<AsciiCell>& cells, int cols, int rows)
+{
+	size_t count = static_cast<size_t>(cols) * rows;
+	if (cols <= 0 || rows <= 0 || cells.size() < count)
+		return 0;
+
+	m_stats.frames++;
+	SelectRamp();
+	if (cols != m_cols || rows != m_rows || m_shown.size() != count) {
+		Restart(cells, cols, rows);
+		return 0;
+	}
+
+	int held = 0;
+	for (size_t i = 0; i < count; ++i)
+		held += Filter(cells[i], i) ? 1 : 0;
+	return held;
+}
+
+int AsciiTemporalStabilizer::Apply(AsciiCellGrid& grid, std::vector<int>& changedCells)
+{
+	size_t count = static_cast<size_t>(grid.cols) * grid.rows;
+	if (grid.cols <= 0 || grid.rows <= 0 || grid.cells.size() < count)
+		return 0;
+
+	m_stats.frames++;
+	SelectRamp();
+	if (grid.cols != m_cols || grid.rows != m_rows || m_shown.size() != count ||
+		grid.geometry.blockWidth != m_geometry.blockWidth || grid.geometry.blockHeight != m_geometry.blockHeight ||
+		grid.glyphVersion != m_glyphVersion) {
+		m_geometry = grid.geometry;
+		m_glyphVersion = grid.glyphVersion;
+		Restart(grid.cells, grid.cols, grid.rows);
+		return 0;
+	}
+
+	int held = 0;
+	size_t kept = 0;
+	for (int index : changedCells) {
+		if (Filter(grid.cells[index], static_cast<size_t>(index)))
+			++held;
+		else
+			changedCells[kept++] = index;
+	}
+	changedCells.resize(kept);
+	return held;
+}
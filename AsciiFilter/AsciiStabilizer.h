@@ -0,0 +1,72 @@
+﻿// AsciiStabilizer.h : Temporal hysteresis for converted cells.
+//
+// Sensor and compression noise moves the luminance of a block by a level
+// or two from frame to frame. Near an edge of the intensity ramp that is
+// enough to flip the character back and forth, and every flip is a cell
+// that has to be redrawn, re-encoded or sent. The stabilizer remembers
+// what it let through last and only passes a new character once the
+// block's luminance moved more than a margin since that character was
+// chosen, and a new color once one of its channels moved more than
+// another margin.
+//
+// In AsciiGlyphMode::Shape and Edge the character also depends on
+// structure. A change to or from a character that is not the intensity
+// ramp's for its luminance is structural and passes whatever the margin;
+// only steps along the ramp are held.
+
+#pragma once
+#include "AsciiCore.h"
+
+struct AsciiStabilizerOptions
+{
+    int glyphMargin = 4; // Luminance levels (0-255) before the character may change, 0 = off
+    int colorMargin = 8; // Largest per-channel color change that is held back, 0 = off
+    const wchar_t* palette = nullptr; // Ramp the cells were converted with, null for the global one
+};
+
+struct AsciiStabilizerStats
+{
+    uint64_t frames = 0;
+    uint64_t changed = 0;    // Cells that changed on the output
+    uint64_t suppressed = 0; // Cells that changed on the input but were held entirely
+};
+
+class AsciiTemporalStabilizer
+{
+public:
+    void SetOptions(const AsciiStabilizerOptions& options) { m_options = options; }
+    const AsciiStabilizerOptions& GetOptions() const { return m_options; }
+
+    // Forgets the shown cells; the next frame passes unchanged
+    void Reset();
+
+    // Stabilizes a full cols x rows grid in place. Returns the number of
+    // cells held back in this frame.
+    int Apply(std::vector<AsciiCell>& cells, int cols, int rows);
+
+    // Same for a grid maintained by the damage based ConvertRegionToAscii:
+    // only the cells in changedCells are looked at, held cells get their
+    // shown value back in the grid and are removed from changedCells, so
+    // the grid keeps matching what was shown. A grid of another size,
+    // geometry or glyph version starts over.
+    int Apply(AsciiCellGrid& grid, std::vector<int>& changedCells);
+
+    const AsciiStabilizerStats& GetStats() const { return m_stats; }
+    void ResetStats() { m_stats = AsciiStabilizerStats(); }
+
+private:
+    // Filters one cell against what is shown; true when it was held
+    bool Filter(AsciiCell& cell, size_t index);
+    void SelectRamp();
+    void Restart(const std::vector<AsciiCell>& cells, int cols, int rows);
+
+    AsciiStabilizerOptions m_options;
+    AsciiStabilizerStats m_stats;
+    std::vector<AsciiCell> m_shown;
+    std::vector<uint8_t> m_luma;    // Luminance when the shown character was chosen
+    const wchar_t* m_ramp = nullptr; // Ramp of a Shape or Edge frame, null in Intensity mode
+    int m_cols = 0;
+    int m_rows = 0;
+    AsciiGeometry m_geometry;
+    uint32_t m_glyphVersion = 0;
+};
@@ -0,0 +1,253 @@
+﻿#include "AsciiTerminal.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <cerrno>
+#include <unistd.h>
+#endif
+
+// Unchanged cells a span may bridge; rewriting a cell costs about as many
+// bytes as the cursor move that would skip it
+static const int ASCII_TERMINAL_MERGE_GAP = 3;
+
+// Worst case output: two true color SGRs and a 4-byte character per cell,
+// and a cursor move per span. Encode reserves this much so a reused output
+// string stops growing after the first frame.
+static const size_t ASCII_TERMINAL_MAX_CELL_BYTES = 40;
+static const size_t ASCII_TERMINAL_MAX_SPAN_BYTES = 24;
+
+static void AppendNumber(std::string& out, int value)
+{
+	char digits[12];
+	int length = 0;
+	do {
+		digits[length++] = static_cast<char>('0' + value % 10);
+		value /= 10;
+	} while (value > 0);
+	while (length > 0)
+		out += digits[--length];
+}
+
+static void AppendUtf8(std::string& out, uint32_t ch)
+{
+	if (ch < 0x20 || (ch >= 0xD800 && ch < 0xE000) || ch > 0x10FFFF)
+		ch = '?'; // Control characters would move the cursor
+	if (ch < 0x80) {
+		out += static_cast<char>(ch);
+	}
+	else if (ch < 0x800) {
+		out += static_cast<char>(0xC0 | (ch >> 6));
+		out += static_cast<char>(0x80 | (ch & 0x3F));
+	}
+	else if (ch < 0x10000) {
+		out += static_cast<char>(0xE0 | (ch >> 12));
+		out += static_cast<char>(0x80 | ((ch >> 6) & 0x3F));
+		out += static_cast<char>(0x80 | (ch & 0x3F));
+	}
+	else {
+		out += static_cast<char>(0xF0 | (ch >> 18));
+		out += static_cast<char>(0x80 | ((ch >> 12) & 0x3F));
+		out += static_cast<char>(0x80 | ((ch >> 6) & 0x3F));
+		out += static_cast<char>(0x80 | (ch & 0x3F));
+	}
+}
+
+//------------------------------------------------------------
+// Encoder
+//------------------------------------------------------------
+void AsciiTerminalEncoder::SetColorMode(AsciiColorMode mode)
+{
+	m_quantizer.SetMode(mode);
+	Reset();
+}
+
+void AsciiTerminalEncoder::Reset()
+{
+	m_valid = false;
+	m_cursorRow = m_cursorCol = -1;
+	m_textKnown = m_bgKnown = false;
+}
+
+const char* AsciiTerminalEncoder::GetRestoreSequence()
+{
+	return "\x1b[0m\x1b[?25h";
+}
+
+void AsciiTerminalEncoder::AppendColor(std::string& out, AsciiColor color, bool background)
+{
+	// In the palette modes color is a palette index, see Encode
+	AsciiColorMode mode = m_quantizer.GetMode();
+	if (mode == AsciiColorMode::Ansi16) {
+		int index = static_cast<int>(color);
+		AppendNumber(out, (index < 8 ? 30 + index : 90 + index - 8) + (background ? 10 : 0));
+	}
+	else if (mode == AsciiColorMode::Xterm256) {
+		out += background ? "48;5;" : "38;5;";
+		AppendNumber(out, static_cast<int>(color));
+	}
+	else {
+		out += background ? "48;2;" : "38;2;";
+		AppendNumber(out, AsciiRValue(color));
+		out += ';';
+		AppendNumber(out, AsciiGValue(color));
+		out += ';';
+		AppendNumber(out, AsciiBValue(color));
+	}
+}
+
+void AsciiTerminalEncoder::AppendColors(std::string& out, AsciiColor textColor, AsciiColor bgColor, bool needText)
+{
+	// Blank cells show no text color, so they keep whatever is set
+	bool text = needText && (!m_textKnown || textColor != m_textColor);
+	bool bg = !m_bgKnown || bgColor != m_bgColor;
+	if (!text && !bg)
+		return;
+
+	// One SGR for both colors
+	out += "\x1b[";
+	if (text) {
+		AppendColor(out, textColor, false);
+		m_textColor = textColor;
+		m_textKnown = true;
+	}
+	if (bg) {
+		if (text)
+			out += ';';
+		AppendColor(out, bgColor, true);
+		m_bgColor = bgColor;
+		m_bgKnown = true;
+	}
+	out += 'm';
+}
+
+void AsciiTerminalEncoder::PrepareCells(const std::vector<AsciiCell>& cells, int cols, int rows)
+{
+	// Palette modes keep the palette index in place of the color, so the
+	// escape codes come straight from the cells
+	AsciiColorMode mode = m_quantizer.GetMode();
+	if (mode == AsciiColorMode::Ansi16 || mode == AsciiColorMode::Xterm256) {
+		m_cells.resize(static_cast<size_t>(cols) * rows);
+		for (size_t i = 0; i < m_cells.size(); ++i) {
+			m_cells[i].ch = cells[i].ch;
+			m_cells[i].textColor = static_cast<AsciiColor>(m_quantizer.MapIndex(cells[i].textColor));
+			m_cells[i].bgColor = static_cast<AsciiColor>(m_quantizer.MapIndex(cells[i].bgColor));
+		}
+	}
+	else {
+		m_quantizer.Quantize(cells, m_cells);
+		m_cells.resize(static_cast<size_t>(cols) * rows);
+	}
+}
+
+size_t AsciiTerminalEncoder::Encode(const std::vector<AsciiCell>& cells, int cols, int rows, std::string& out)
+{
+	size_t start = out.size();
+	if (cols <= 0 || rows <= 0 || cells.size() < static_cast<size_t>(cols) * rows) {
+		m_lastFrameBytes = 0;
+		return 0;
+	}
+
+	PrepareCells(cells, cols, rows);
+	out.reserve(start + 16 + static_cast<size_t>(cols) * rows * ASCII_TERMINAL_MAX_CELL_BYTES +
+		GetAsciiMaxSpanCount(cols, rows) * ASCII_TERMINAL_MAX_SPAN_BYTES);
+
+	m_spans.clear();
+	if (!m_valid || cols != m_cols || rows != m_rows) {
+		// Unknown screen: hide the cursor, reset colors, clear and redraw all
+		out += "\x1b[?25l\x1b[0m\x1b[2J";
+		m_cursorRow = m_cursorCol = -1;
+		m_textKnown = m_bgKnown = false;
+		for (int row = 0; row < rows; ++row)
+			m_spans.push_back({ row, 0, cols });
+	}
+	else {
+		DiffAsciiCells(m_previous.data(), m_cells.data(), cols, rows, ASCII_TERMINAL_MERGE_GAP, m_spans);
+	}
+
+	for (const AsciiCellSpan& span : m_spans) {
+		if (span.row != m_cursorRow || span.col != m_cursorCol) {
+			// CUP is 1-based
+			out += "\x1b[";
+			AppendNumber(out, span.row + 1);
+			out += ';';
+			AppendNumber(out, span.col + 1);
+			out += 'H';
+		}
+
+		const AsciiCell* cell = m_cells.data() + static_cast<size_t>(span.row) * cols + span.col;
+		for (int i = 0; i < span.length; ++i, ++cell) {
+			AppendColors(out, cell->textColor, cell->bgColor, cell->ch != L' ');
+			AppendUtf8(out, static_cast<uint32_t>(cell->ch));
+		}
+
+		// After the last column the cursor waits to wrap, so its position
+		// depends on the terminal
+		m_cursorRow = span.row;
+		m_cursorCol = span.col + span.length < cols ? span.col + span.length : -1;
+	}
+
+	m_previous.swap(m_cells);
+	m_cols = cols;
+	m_rows = rows;
+	m_valid = true;
+	m_lastFrameBytes = out.size() - start;
+	return m_lastFrameBytes;
+}
+
+size_t AsciiTerminalEncoder::EncodeLines(const std::vector<AsciiCell>& cells, int cols, int rows, std::string& out)
+{
+	Reset();
+	size_t start = out.size();
+	if (cols <= 0 || rows <= 0 || cells.size() < static_cast<size_t>(cols) * rows)
+		return 0;
+
+	PrepareCells(cells, cols, rows);
+	for (int row = 0; row < rows; ++row) {
+		const AsciiCell* cell = m_cells.data() + static_cast<size_t>(row) * cols;
+		for (int col = 0; col < cols; ++col, ++cell) {
+			AppendColors(out, cell->textColor, cell->bgColor, cell->ch != L' ');
+			AppendUtf8(out, static_cast<uint32_t>(cell->ch));
+		}
+		out += "\x1b[0m\n";
+		m_textKnown = m_bgKnown = false;
+	}
+	return out.size() - start;
+}
+
+void EncodeAsciiText(const std::vector<AsciiCell>& cells, int cols, int rows, std::string& out)
+{
+	if (cols <= 0 || rows <= 0 || cells.size() < static_cast<size_t>(cols) * rows)
+		return;
+	for (int row = 0; row < rows; ++row) {
+		const AsciiCell* cell = cells.data() + static_cast<size_t>(row) * cols;
+		for (int col = 0; col < cols; ++col)
+			AppendUtf8(out, static_cast<uint32_t>(cell[col].ch));
+		out += '\n';
+	}
+}
+
+//------------------------------------------------------------
+// Output
+//------------------------------------------------------------
+bool WriteAsciiTerminal(int fd, const std::string& data)
+{
+	const char* p = data.data();
+	size_t left = data.size();
+	while (left > 0) {
+#ifdef _WIN32
+		int written = _write(fd, p, static_cast<unsigned int>(left));
+		if (written <= 0)
+			return false;
+#else
+		ssize_t written = write(fd, p, left);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return false;
+#endif
+		p += written;
+		left -= static_cast<size_t>(written);
+	}
+	return true;
+}
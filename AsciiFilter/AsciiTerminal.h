@@ -0,0 +1,73 @@
+﻿// AsciiTerminal.h : Encodes cell grids as ANSI escape sequences.
+//
+// Lets the filter run on a headless box and be watched in any terminal
+// that speaks 24-bit SGR (xterm, VTE, Windows Terminal, tmux ...), e.g.
+// over SSH. The encoder remembers what the terminal shows, so a frame only
+// moves the cursor to changed cells and only emits SGR when the colors
+// actually change. Every frame is one buffer, written with a single call.
+
+#pragma once
+#include "AsciiCellDiff.h"
+#include "AsciiCore.h"
+#include "AsciiQuantizer.h"
+
+#include <string>
+
+class AsciiTerminalEncoder
+{
+public:
+    // TrueColor emits 38;2 / 48;2 escapes, Xterm256 38;5 / 48;5, Ansi16
+    // the classic 30-37 / 90-97 codes. Adaptive quantizes like the other
+    // front ends and emits the palette colors as true color.
+    void SetColorMode(AsciiColorMode mode);
+    AsciiColorMode GetColorMode() const { return m_quantizer.GetMode(); }
+
+    // Forget the terminal state; the next frame clears the screen and
+    // redraws every cell
+    void Reset();
+
+    // Appends the bytes that turn the terminal from the previous frame
+    // into cells (cols x rows, drawn from the top left corner) to out.
+    // Returns the number of bytes appended.
+    size_t Encode(const std::vector<AsciiCell>& cells, int cols, int rows, std::string& out);
+
+    // Appends cells as a standalone ANSI document: one line per row, no
+    // cursor movement, colors reset at the end of every line. For files
+    // and pipes rather than a live screen; forgets the terminal state.
+    size_t EncodeLines(const std::vector<AsciiCell>& cells, int cols, int rows, std::string& out);
+
+    size_t GetLastFrameBytes() const { return m_lastFrameBytes; }
+
+    // Resets colors and shows the cursor again, for when output stops
+    static const char* GetRestoreSequence();
+
+private:
+    void PrepareCells(const std::vector<AsciiCell>& cells, int cols, int rows);
+    void AppendColors(std::string& out, AsciiColor textColor, AsciiColor bgColor, bool needText);
+    void AppendColor(std::string& out, AsciiColor color, bool background);
+
+    AsciiColorQuantizer m_quantizer;
+    std::vector<AsciiCell> m_cells;     // Quantized frame being encoded
+    std::vector<AsciiCell> m_previous;  // What the terminal shows
+    std::vector<AsciiCellSpan> m_spans;
+    int m_cols = 0;
+    int m_rows = 0;
+    bool m_valid = false;
+
+    // Terminal state after the last escape, -1 = unknown
+    int m_cursorRow = -1;
+    int m_cursorCol = -1;
+    AsciiColor m_textColor = 0;
+    AsciiColor m_bgColor = 0;
+    bool m_textKnown = false;
+    bool m_bgKnown = false;
+
+    size_t m_lastFrameBytes = 0;
+};
+
+// Appends the characters of cells as UTF-8 text, one line per row
+void EncodeAsciiText(const std::vector<AsciiCell>& cells, int cols, int rows, std::string& out);
+
+// Writes all of data to a file descriptor (1 = stdout), in one write
+// call unless the descriptor takes it in parts. Returns false on error.
+bool WriteAsciiTerminal(int fd, const std::string& data);
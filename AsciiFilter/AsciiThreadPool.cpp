@@ -0,0 +1,148 @@
+﻿#include "AsciiThreadPool.h"
+
+static inline uint64_t PackRange(uint32_t begin, uint32_t end)
+{
+	return static_cast<uint64_t>(begin) | (static_cast<uint64_t>(end) << 32);
+}
+
+static inline uint32_t RangeBegin(uint64_t range) { return static_cast<uint32_t>(range); }
+static inline uint32_t RangeEnd(uint64_t range) { return static_cast<uint32_t>(range >> 32); }
+
+AsciiThreadPool::AsciiThreadPool(int threadCount)
+{
+	if (threadCount <= 0)
+		threadCount = static_cast<int>(std::thread::hardware_concurrency());
+	if (threadCount <= 0)
+		threadCount = 1;
+
+	m_slots.reset(new Slot[threadCount]);
+
+	// Slot 0 belongs to the thread calling ParallelFor
+	m_workers.reserve(threadCount - 1);
+	for (int i = 1; i < threadCount; ++i)
+		m_workers.emplace_back(&AsciiThreadPool::WorkerMain, this, i);
+}
+
+AsciiThreadPool::~AsciiThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+	for (std::thread& worker : m_workers)
+		worker.join();
+}
+
+void AsciiThreadPool::ParallelFor(int taskCount, AsciiTaskRef task)
+{
+	if (taskCount <= 0)
+		return;
+
+	// Not worth waking anyone up
+	int participants = GetThreadCount();
+	if (participants == 1 || taskCount == 1) {
+		for (int i = 0; i < taskCount; ++i)
+			task(i);
+		return;
+	}
+
+	// Hand every participant an equal contiguous share
+	for (int i = 0; i < participants; ++i) {
+		uint32_t begin = static_cast<uint32_t>(static_cast<int64_t>(taskCount) * i / participants);
+		uint32_t end = static_cast<uint32_t>(static_cast<int64_t>(taskCount) * (i + 1) / participants);
+		m_slots[i].range.store(PackRange(begin, end), std::memory_order_relaxed);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_task = &task;
+		m_activeWorkers = static_cast<int>(m_workers.size());
+		++m_generation;
+	}
+	m_wake.notify_all();
+
+	RunTasks(0);
+
+	// Every task is done once all participants ran out of work, but the
+	// workers still have to leave RunTasks before the job can go away
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done.wait(lock, [this] { return m_activeWorkers == 0; });
+	m_task = nullptr;
+}
+
+void AsciiThreadPool::WorkerMain(int slot)
+{
+	uint64_t seenGeneration = 0;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wake.wait(lock, [&] { return m_stop || m_generation != seenGeneration; });
+			if (m_stop)
+				return;
+			seenGeneration = m_generation;
+		}
+
+		RunTasks(slot);
+
+		bool last;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			last = (--m_activeWorkers == 0);
+		}
+		if (last)
+			m_done.notify_one();
+	}
+}
+
+void AsciiThreadPool::RunTasks(int slot)
+{
+	const AsciiTaskRef& task = *m_task;
+	int index;
+	for (;;) {
+		while (PopTask(slot, index))
+			task(index);
+		if (!StealTasks(slot))
+			return;
+	}
+}
+
+// Take the next task from the front of our own range
+bool AsciiThreadPool::PopTask(int slot, int& task)
+{
+	std::atomic<uint64_t>& range = m_slots[slot].range;
+	uint64_t current = range.load(std::memory_order_acquire);
+	for (;;) {
+		uint32_t begin = RangeBegin(current);
+		uint32_t end = RangeEnd(current);
+		if (begin >= end)
+			return false;
+		if (range.compare_exchange_weak(current, PackRange(begin + 1, end), std::memory_order_acq_rel)) {
+			task = static_cast<int>(begin);
+			return true;
+		}
+	}
+}
+
+// Move the back half of another participant's range into our (empty) slot
+bool AsciiThreadPool::StealTasks(int slot)
+{
+	int participants = GetThreadCount();
+	for (int i = 1; i < participants; ++i) {
+		int victim = (slot + i) % participants;
+		std::atomic<uint64_t>& range = m_slots[victim].range;
+		uint64_t current = range.load(std::memory_order_acquire);
+		for (;;) {
+			uint32_t begin = RangeBegin(current);
+			uint32_t end = RangeEnd(current);
+			if (begin >= end)
+				break;
+			uint32_t take = (end - begin + 1) / 2;
+			if (range.compare_exchange_weak(current, PackRange(begin, end - take), std::memory_order_acq_rel)) {
+				m_slots[slot].range.store(PackRange(end - take, end), std::memory_order_release);
+				return true;
+			}
+		}
+	}
+	return false;
+}
@@ -0,0 +1,80 @@
+﻿// AsciiThreadPool.h : Persistent worker pool with work stealing.
+//
+// Workers are created once and sleep between jobs. A job is a range of
+// task indices that is split evenly over all participants (the workers
+// plus the calling thread). Each participant consumes its own share from
+// the front and, once empty, steals half of the remaining tasks from the
+// back of another participant, so uneven tasks still balance out.
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Non-owning reference to a void(int) callable. Unlike std::function it
+// never copies the callable, so handing a lambda with a big capture list
+// to ParallelFor does not allocate. The callable has to outlive the call.
+class AsciiTaskRef
+{
+public:
+    template <typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, AsciiTaskRef>::value>::type>
+    AsciiTaskRef(F&& task)
+        : m_object(const_cast<void*>(static_cast<const void*>(&task)))
+        , m_invoke([](void* object, int index) { (*static_cast<typename std::remove_reference<F>::type*>(object))(index); })
+    {
+    }
+
+    void operator()(int index) const { m_invoke(m_object, index); }
+
+private:
+    void* m_object;
+    void (*m_invoke)(void* object, int index);
+};
+
+class AsciiThreadPool
+{
+public:
+    // threadCount counts the calling thread too; 0 uses every hardware thread
+    explicit AsciiThreadPool(int threadCount = 0);
+    ~AsciiThreadPool();
+
+    AsciiThreadPool(const AsciiThreadPool&) = delete;
+    AsciiThreadPool& operator=(const AsciiThreadPool&) = delete;
+
+    int GetThreadCount() const { return static_cast<int>(m_workers.size()) + 1; }
+
+    // Runs task(i) for every i in [0, taskCount) and returns once all of
+    // them have finished. Not reentrant: call from one thread at a time.
+    void ParallelFor(int taskCount, AsciiTaskRef task);
+
+private:
+    // Remaining task range of one participant, packed as begin | end << 32
+    // so the owner and thieves can update it with a single CAS
+    struct alignas(64) Slot
+    {
+        std::atomic<uint64_t> range{ 0 };
+    };
+
+    void WorkerMain(int slot);
+    void RunTasks(int slot);
+    bool PopTask(int slot, int& task);
+    bool StealTasks(int slot);
+
+    std::vector<std::thread> m_workers;
+    std::unique_ptr<Slot[]> m_slots;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    uint64_t m_generation = 0;
+    int m_activeWorkers = 0;
+    bool m_stop = false;
+
+    const AsciiTaskRef* m_task = nullptr;
+};
@@ -0,0 +1,148 @@
+﻿#include "AsciiTileCache.h"
+#include "AsciiKernels.h"
+#include "AsciiThreadPool.h"
+
+uint64_t HashAsciiBlock(const uint8_t* pixel, int rowPitch, int width, int height)
+{
+	return GetAsciiBlockHasher()(pixel, rowPitch, width, height);
+}
+
+//------------------------------------------------------------
+// Incremental conversion
+//------------------------------------------------------------
+void AsciiTileCache::Reset()
+{
+	m_valid = false;
+}
+
+void AsciiTileCache::Update(const std::vector<uint8_t>& frameData,
+	int desktopWidth, int desktopHeight,
+	const AsciiRect& region, const AsciiGeometry& geometry,
+	std::vector<int>& changedCells)
+{
+	Update(MakeAsciiImageView(frameData, desktopWidth, desktopHeight), region, geometry, changedCells);
+}
+
+void AsciiTileCache::Update(const AsciiImageView& image,
+	const AsciiRect& region, const AsciiGeometry& geometry,
+	std::vector<int>& changedCells)
+{
+	Update(image, region, geometry, nullptr, changedCells);
+}
+
+void AsciiTileCache::Update(const AsciiImageView& image,
+	const AsciiRect& region, const AsciiGeometry& geometry,
+	const std::vector<AsciiRect>& damage,
+	std::vector<int>& changedCells)
+{
+	Update(image, region, geometry, &damage, changedCells);
+}
+
+void AsciiTileCache::Update(const AsciiImageView& image,
+	const AsciiRect& region, const AsciiGeometry& geometry,
+	const std::vector<AsciiRect>* damage,
+	std::vector<int>& changedCells)
+{
+	changedCells.clear();
+	m_stats = AsciiTileCacheStats();
+
+	AsciiBlockJob job;
+	int cols = 0, rows = 0;
+	if (!PrepareAsciiBlockJob(image, region, geometry, job, cols, rows)) {
+		m_cells.clear();
+		m_cols = 0;
+		m_rows = 0;
+		m_valid = false;
+		return;
+	}
+
+	// Hashes from another block layout can't be compared, and cells from
+	// other glyphs or another part of the frame can't be reused
+	const AsciiRect& clipped = job.region;
+	bool fullUpdate = !m_valid || cols != m_cols || rows != m_rows ||
+		clipped.left != m_region.left || clipped.top != m_region.top ||
+		clipped.right != m_region.right || clipped.bottom != m_region.bottom ||
+		geometry.blockWidth != m_geometry.blockWidth || geometry.blockHeight != m_geometry.blockHeight ||
+		image.format != m_format || m_glyphVersion != GetAsciiGlyphVersion();
+
+	size_t cellCount = static_cast<size_t>(cols) * rows;
+	m_hashes.resize(cellCount);
+	m_cells.resize(cellCount);
+
+	// With damage only the blocks under it are hashed: they start out
+	// CONVERTED and the hash pass clears the ones that did not change
+	bool damageOnly = damage && !fullUpdate;
+	m_changed.assign(cellCount, damageOnly ? ASCII_CELL_CLEAN : ASCII_CELL_CONVERTED);
+	if (damageOnly)
+		MarkAsciiDamage(job, rows, *damage, m_changed.data(), ASCII_CELL_CONVERTED);
+	m_dirtyRows.clear();
+	for (int row = 0; row < rows; ++row) {
+		const uint8_t* rowFlags = m_changed.data() + static_cast<size_t>(row) * cols;
+		int marked = 0;
+		for (int col = 0; col < cols; ++col)
+			marked += rowFlags[col] != ASCII_CELL_CLEAN;
+		if (marked)
+			m_dirtyRows.push_back(row);
+		m_stats.tilesHashed += marked;
+	}
+	m_cols = cols;
+	m_rows = rows;
+	m_region = clipped;
+	m_geometry = geometry;
+	m_format = image.format;
+	m_glyphVersion = GetAsciiGlyphVersion();
+	m_valid = true;
+
+	AsciiRowKernel rowKernel = GetAsciiRowKernel(geometry, image.format);
+	AsciiBlockHasher hashBlock = GetAsciiBlockHasher();
+	bool bgra = image.format == AsciiPixelFormat::BGRA8;
+
+	auto updateRow = [&](int index) {
+		int row = m_dirtyRows[index];
+		uint64_t* hashes = m_hashes.data() + static_cast<size_t>(row) * cols;
+		AsciiCell* cells = m_cells.data() + static_cast<size_t>(row) * cols;
+		uint8_t* changed = m_changed.data() + static_cast<size_t>(row) * cols;
+
+		// Hash the candidate blocks and flag the ones that need averaging
+		for (int col = 0; col < cols; ++col) {
+			if (changed[col] == ASCII_CELL_CLEAN)
+				continue;
+			int startX, startY, endX, endY;
+			GetBlockBounds(job, row, col, startX, startY, endX, endY);
+			uint64_t hash;
+			if (bgra) {
+				const uint8_t* pixel = job.frame + static_cast<size_t>(startY) * job.rowPitch + startX * 4;
+				hash = hashBlock(pixel, job.rowPitch, endX - startX, endY - startY);
+			}
+			else {
+				hash = HashFormatBlock(job, startX, startY, endX, endY);
+			}
+			changed[col] = (fullUpdate || hash != hashes[col]) ? ASCII_CELL_CONVERTED : ASCII_CELL_CLEAN;
+			hashes[col] = hash;
+		}
+
+		ConvertDirtyCells(job, rowKernel, row, changed, cells, fullUpdate);
+	};
+
+	int dirtyRows = static_cast<int>(m_dirtyRows.size());
+	if (AsciiThreadPool* pool = GetAsciiThreadPool()) {
+		pool->ParallelFor(dirtyRows, updateRow);
+	}
+	else {
+		for (int i = 0; i < dirtyRows; ++i)
+			updateRow(i);
+	}
+
+	m_stats.tiles = static_cast<int>(cellCount);
+	for (int row : m_dirtyRows) {
+		size_t offset = static_cast<size_t>(row) * cols;
+		for (int col = 0; col < cols; ++col) {
+			uint8_t flag = m_changed[offset + col];
+			if (flag != ASCII_CELL_CLEAN)
+				m_stats.tilesConverted++;
+			if (flag == ASCII_CELL_CHANGED)
+				changedCells.push_back(static_cast<int>(offset + col));
+		}
+	}
+	m_stats.cellsChanged = static_cast<int>(changedCells.size());
+}
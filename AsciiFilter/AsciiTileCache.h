@@ -0,0 +1,79 @@
+﻿// AsciiTileCache.h : Incremental conversion for mostly static sources.
+//
+// Keeps a 64-bit hash of the source pixels of every block together with
+// the cell produced for it. On the next frame only blocks whose hash
+// changed are averaged again, and the cells that actually changed are
+// reported so later stages can skip the rest too.
+//
+// Hashing a block reads as many bytes as averaging it, so without damage
+// information the cache only pays off for the expensive glyph modes. Given
+// the damage rectangles of the frame (Desktop Duplication dirty and move
+// rects, which are coarse and often repaint unchanged pixels), only the
+// blocks under them are hashed, and of those only the ones that really
+// changed are converted.
+
+#pragma once
+#include "AsciiCore.h"
+
+struct AsciiTileCacheStats
+{
+    int tiles = 0;          // Blocks in the grid
+    int tilesHashed = 0;    // Blocks whose pixels were hashed
+    int tilesConverted = 0; // Blocks whose pixels changed and were averaged again
+    int cellsChanged = 0;   // Cells whose output differs from the previous frame
+};
+
+class AsciiTileCache
+{
+public:
+    // Convert the region like ConvertRegionToAscii, reusing cells of
+    // unchanged blocks. changedCells receives the row * cols + col index
+    // of every cell that differs from the previous call. A new grid size,
+    // region, geometry or glyph version reconverts (and reports) every cell.
+    void Update(const AsciiImageView& image,
+        const AsciiRect& region, const AsciiGeometry& geometry,
+        std::vector<int>& changedCells);
+    void Update(const std::vector<uint8_t>& frameData,
+        int desktopWidth, int desktopHeight,
+        const AsciiRect& region, const AsciiGeometry& geometry,
+        std::vector<int>& changedCells);
+
+    // Same, but blocks outside the damage rectangles (frame coordinates)
+    // are neither hashed nor converted and keep their cells. The first
+    // call, and any call after a layout or glyph change, converts all.
+    void Update(const AsciiImageView& image,
+        const AsciiRect& region, const AsciiGeometry& geometry,
+        const std::vector<AsciiRect>& damage,
+        std::vector<int>& changedCells);
+
+    // Forget all cached blocks; the next Update converts everything
+    void Reset();
+
+    const std::vector<AsciiCell>& GetCells() const { return m_cells; }
+    int GetCols() const { return m_cols; }
+    int GetRows() const { return m_rows; }
+    const AsciiTileCacheStats& GetLastStats() const { return m_stats; }
+
+private:
+    void Update(const AsciiImageView& image,
+        const AsciiRect& region, const AsciiGeometry& geometry,
+        const std::vector<AsciiRect>* damage,
+        std::vector<int>& changedCells);
+
+    std::vector<uint64_t> m_hashes;
+    std::vector<AsciiCell> m_cells;
+    std::vector<uint8_t> m_changed; // Per cell flag, filled in parallel
+    std::vector<int> m_dirtyRows;   // Rows with damaged blocks
+    int m_cols = 0;
+    int m_rows = 0;
+    AsciiRect m_region = {};        // Clipped region of the cached cells
+    AsciiGeometry m_geometry;
+    AsciiPixelFormat m_format = AsciiPixelFormat::BGRA8;
+    uint32_t m_glyphVersion = 0;
+    bool m_valid = false;
+    AsciiTileCacheStats m_stats;
+};
+
+// Hash of a block of BGRA pixels. Four independent 64-bit multiply-
+// accumulate lanes, computed with the active SIMD kernel.
+uint64_t HashAsciiBlock(const uint8_t* pixel, int rowPitch, int width, int height);